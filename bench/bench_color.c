@@ -0,0 +1,84 @@
+/* bench/bench_color.c: Mpixel/s de la conversion --depth, por ruta
+   (escalar, SSE2, AVX2), profundidad y dither. "make bench-color" */
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#include "dat_color.h"
+
+#define W 2048
+#define H 2048
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+/* Mejor de varias pasadas de al menos 0.2 s */
+static double mpix_per_s(const DatBitmap *src, const u8 *pal, int depth, DatDither dither) {
+    double best = 0.0;
+    int rep;
+    for (rep = 0; rep < 3; rep++) {
+        double t0 = now(), t;
+        int n = 0;
+        do {
+            DatBitmap *o;
+            if (!dat_bitmap_convert(src, pal, depth, dither, &o)) return 0.0;
+            free_dat_bitmap(o);
+            n++;
+            t = now() - t0;
+        } while (t < 0.2);
+        if ((double)W * H * n / t / 1e6 > best) best = (double)W * H * n / t / 1e6;
+    }
+    return best;
+}
+
+int main(void) {
+    static const int depths[] = { 15, 16, 24, 32 };
+    static const int srcs[] = { 8, 24, 32 };
+    static const DatColorPath paths[] = { DAT_COLOR_SCALAR, DAT_COLOR_SSE2, DAT_COLOR_AVX2 };
+    u8 pal[256 * 3];
+    DatBitmap src[3];
+    u32 seed = 12345;
+    size_t i, s, d, p;
+
+#ifdef __GLIBC__
+    /* Que la salida de cada pasada reutilice memoria ya tocada: se mide la
+       conversion, no los fallos de pagina de un mmap nuevo */
+    mallopt(M_MMAP_THRESHOLD, 256 << 20);
+    mallopt(M_TRIM_THRESHOLD, 512 << 20);
+#endif
+    for (i = 0; i < sizeof(pal); i++) pal[i] = (u8)(i % 64);
+    for (s = 0; s < 3; s++) {
+        size_t n = (size_t)W * H * (size_t)(srcs[s] / 8);
+        src[s].bits_per_pixel = (s16)srcs[s];
+        src[s].width = W;
+        src[s].height = H;
+        src[s].image = (u8*)malloc(n);
+        if (!src[s].image) return 1;
+        for (i = 0; i < n; i++) { seed = seed * 1103515245u + 12345u; src[s].image[i] = (u8)(seed >> 16); }
+    }
+
+    printf("%-6s %-4s %-6s %-8s %10s\n", "path", "src", "depth", "dither", "Mpixel/s");
+    for (p = 0; p < 3; p++) {
+        if (!dat_color_set_path(paths[p])) {
+            printf("%-6s (not supported by this CPU)\n", dat_color_path_name(paths[p]));
+            continue;
+        }
+        for (s = 0; s < 3; s++)
+            for (d = 0; d < 4; d++) {
+                int dt, ndither = depths[d] <= 16 ? 3 : 1;
+                for (dt = 0; dt < ndither; dt++)
+                    printf("%-6s %-4d %-6d %-8s %10.1f\n", dat_color_path_name(paths[p]), srcs[s], depths[d],
+                           dat_dither_name((DatDither)dt), mpix_per_s(&src[s], pal, depths[d], (DatDither)dt));
+            }
+    }
+    for (s = 0; s < 3; s++) free(src[s].image);
+    return 0;
+}
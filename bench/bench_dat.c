@@ -0,0 +1,756 @@
+/* bench/bench_dat.c: "make bench". Genera un corpus sintetico y
+   reproducible (miles de sprites, fondos grandes, WAV largos, MIDI de
+   mas de 32 pistas y lo necesario para un DAT de 1 GB), mide cada
+   conversor dentro del proceso y cada orden de dat de punta a punta, y
+   compara con una linea base.
+
+   Cada medida corre en un proceso hijo, asi el pico de RSS es solo suyo.
+   Se queda la pasada mas rapida de --repeat. Salida TSV, una fila por
+   medida (el MB/s es de la entrada: ficheros leidos o bytes escritos):
+
+     # name  seconds  mb_s  objects_s  peak_rss_mb
+
+   Con --baseline, una medida es una regresion si su MB/s (u objetos/s)
+   baja, o su RSS sube, mas de --tolerance por ciento; el codigo de salida
+   es entonces 1. Si el fichero no existe es un error (2). --save-baseline guarda lo medido como nueva linea base. */
+#define _DEFAULT_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dat_loader_bmp.h"
+#include "dat_pool.h"
+#include "dat_writer.h"
+#include "midi_to_allegro.h"
+#include "wav_to_allegro.h"
+
+#define CORPUS_VERSION  2
+#define MAX_RESULTS     64
+#define BLOB_SIZE       (25u << 20)
+
+typedef struct {
+    char   name[48];
+    double seconds;
+    double mb_s;
+    double objects_s;
+    double rss_mb;
+} Result;
+
+/* Tamano del corpus para una escala: a 1, ~1 GB en big.dat */
+typedef struct {
+    int n_sprites, n_bg, n_wav, wav_seconds, n_midi, midi_events, n_blob;
+} CorpusSize;
+
+static const char *corpus_dir = "bench/corpus";
+static const char *dat_path = "./dat";
+static double      scale = 1.0;
+static CorpusSize  cs;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+/* xorshift32: el mismo corpus en cualquier maquina */
+static u32 rng_state = 2463534242u;
+static u32 rnd(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+static void cpath(char *dst, size_t cap, const char *fmt, int i) {
+    char rel[256];
+    snprintf(rel, sizeof(rel), fmt, i);
+    snprintf(dst, cap, "%s/%s", corpus_dir, rel);
+}
+
+static u64 file_size(const char *path) {
+    struct stat st;
+    return stat(path, &st) == 0 ? (u64)st.st_size : 0;
+}
+
+/* ------------------------------------------------------------------ */
+/* Corpus                                                              */
+/* ------------------------------------------------------------------ */
+
+static void put16(u8 *p, unsigned v) { p[0] = (u8)v; p[1] = (u8)(v >> 8); }
+static void put32(u8 *p, u32 v) { put16(p, v & 0xFFFF); put16(p + 2, v >> 16); }
+static void put_be32(u8 *p, u32 v) { p[0] = (u8)(v >> 24); p[1] = (u8)(v >> 16); p[2] = (u8)(v >> 8); p[3] = (u8)v; }
+
+/* BMP de 8 bpp (paleta, indice 0 = fondo magenta) o 24 bpp, de abajo
+   arriba. pixel(x, y) da el indice o 0xRRGGBB */
+typedef u32 (*PixelFn)(int x, int y, int w, int h, u32 seed);
+
+static int write_bmp(const char *path, int w, int h, int bpp, PixelFn px, u32 seed) {
+    u32 stride = (u32)((w * bpp / 8 + 3) & ~3), pal_bytes = bpp == 8 ? 1024u : 0u;
+    u32 off = 54 + pal_bytes, size = off + stride * (u32)h;
+    u8 hdr[54], *row;
+    FILE *f = fopen(path, "wb");
+    int x, y, ok = 1;
+
+    if (!f) return 0;
+    memset(hdr, 0, sizeof(hdr));
+    hdr[0] = 'B'; hdr[1] = 'M';
+    put32(hdr + 2, size); put32(hdr + 10, off); put32(hdr + 14, 40);
+    put32(hdr + 18, (u32)w); put32(hdr + 22, (u32)h); put16(hdr + 26, 1); put16(hdr + 28, (unsigned)bpp);
+    put32(hdr + 34, stride * (u32)h);
+    if (bpp == 8) put32(hdr + 46, 256);
+    fwrite(hdr, 1, sizeof(hdr), f);
+    if (bpp == 8) {
+        u8 pal[1024];
+        for (x = 0; x < 256; x++) {
+            pal[x * 4 + 0] = (u8)(x ? x * 7 : 255);
+            pal[x * 4 + 1] = (u8)(x ? x * 3 : 0);
+            pal[x * 4 + 2] = (u8)(x ? 255 - x : 255);
+            pal[x * 4 + 3] = 0;
+        }
+        fwrite(pal, 1, sizeof(pal), f);
+    }
+    row = (u8*)calloc(stride, 1);
+    if (!row) { fclose(f); return 0; }
+    for (y = h - 1; y >= 0; y--) {
+        for (x = 0; x < w; x++) {
+            u32 v = px(x, y, w, h, seed);
+            if (bpp == 8) row[x] = (u8)v;
+            else { row[x * 3] = (u8)v; row[x * 3 + 1] = (u8)(v >> 8); row[x * 3 + 2] = (u8)(v >> 16); }
+        }
+        if (fwrite(row, 1, stride, f) != stride) ok = 0;
+    }
+    free(row);
+    return fclose(f) == 0 && ok;
+}
+
+/* Sprite: elipse con rayas sobre fondo transparente */
+static u32 sprite_px(int x, int y, int w, int h, u32 seed) {
+    double dx = (x - w / 2.0) / (w / 2.0), dy = (y - h / 2.0) / (h / 2.0);
+    u32 c;
+    if (dx * dx + dy * dy > 1.0) return (seed & 1) ? 0xFF00FFu : 0u;
+    c = (u32)((x + y) / 4 + seed) & 0xFF;
+    return (seed & 1) ? (c << 16 | (255 - c) << 8 | (seed & 0xFF)) : (c ? c : 1);
+}
+
+/* Fondo: degradado con ruido, poco comprimible */
+static u32 bg_px(int x, int y, int w, int h, u32 seed) {
+    u32 n = rnd() & 0x1F;
+    (void)seed;
+    return ((u32)(x * 255 / w) ^ n) << 16 | ((u32)(y * 255 / h) ^ n) << 8 | ((u32)((x + y) & 0xFF) ^ n);
+}
+
+/* 16 bits estereo 44100 Hz: barrido con ruido, escrito por bloques */
+static int write_wav(const char *path, int seconds, u32 seed) {
+    const u32 rate = 44100, frames = rate * (u32)seconds;
+    u8 hdr[44], buf[4 * 4096];
+    double ph = 0.0;
+    u32 i = 0, k;
+    FILE *f = fopen(path, "wb");
+    int ok = 1;
+
+    if (!f) return 0;
+    memcpy(hdr, "RIFF", 4); put32(hdr + 4, 36 + frames * 4); memcpy(hdr + 8, "WAVEfmt ", 8);
+    put32(hdr + 16, 16); put16(hdr + 20, 1); put16(hdr + 22, 2); put32(hdr + 24, rate);
+    put32(hdr + 28, rate * 4); put16(hdr + 32, 4); put16(hdr + 34, 16);
+    memcpy(hdr + 36, "data", 4); put32(hdr + 40, frames * 4);
+    fwrite(hdr, 1, sizeof(hdr), f);
+    rng_state = seed | 1;
+    while (i < frames && ok) {
+        for (k = 0; k < 4096 && i < frames; k++, i++) {
+            double freq = 100.0 + 4000.0 * (double)(i % (rate * 8)) / (rate * 8);
+            int s = (int)(sin(ph) * 12000.0) + (int)(rnd() % 2001) - 1000;
+            ph += 2.0 * 3.14159265358979 * freq / rate;
+            put16(buf + k * 4, (unsigned)(s & 0xFFFF));
+            put16(buf + k * 4 + 2, (unsigned)((-s) & 0xFFFF));
+        }
+        if (fwrite(buf, 4, k, f) != k) ok = 0;
+    }
+    return fclose(f) == 0 && ok;
+}
+
+/* SMF formato 1 de 48 pistas (mas de las 32 de Allegro), sin running
+   status y con texto, como los exporta un secuenciador */
+static int write_midi(const char *path, int events, u32 seed) {
+    const int tracks = 48;
+    u8 *trk = (u8*)malloc((size_t)events * 12 + 64), hdr[14];
+    FILE *f = fopen(path, "wb");
+    int t, e, ok = 1;
+
+    if (!f || !trk) { free(trk); if (f) fclose(f); return 0; }
+    memcpy(hdr, "MThd", 4); put_be32(hdr + 4, 6);
+    hdr[8] = 0; hdr[9] = 1; hdr[10] = 0; hdr[11] = (u8)tracks; hdr[12] = 1; hdr[13] = 0xE0;
+    fwrite(hdr, 1, sizeof(hdr), f);
+    rng_state = seed | 1;
+    for (t = 0; t < tracks; t++) {
+        u32 n = 0;
+        u8 ch = (u8)(t % 16);
+        static const char text[] = "Synthetic benchmark track";
+        trk[n++] = 0; trk[n++] = 0xFF; trk[n++] = 0x03; trk[n++] = (u8)(sizeof(text) - 1);
+        memcpy(trk + n, text, sizeof(text) - 1); n += sizeof(text) - 1;
+        if (t == 0) { trk[n++] = 0; trk[n++] = 0xFF; trk[n++] = 0x51; trk[n++] = 3; trk[n++] = 0x07; trk[n++] = 0xA1; trk[n++] = 0x20; }
+        trk[n++] = 0; trk[n++] = (u8)(0xC0 | ch); trk[n++] = (u8)(t & 0x7F);
+        for (e = 0; e + 1 < events; e += 2) {
+            u8 key = (u8)(36 + rnd() % 48);
+            trk[n++] = (u8)(rnd() % 60); trk[n++] = (u8)(0x90 | ch); trk[n++] = key; trk[n++] = (u8)(40 + rnd() % 80);
+            trk[n++] = 0x60; trk[n++] = (u8)(0x80 | ch); trk[n++] = key; trk[n++] = 64;
+        }
+        trk[n++] = 0; trk[n++] = 0xFF; trk[n++] = 0x2F; trk[n++] = 0;
+        memcpy(hdr, "MTrk", 4); put_be32(hdr + 4, n);
+        if (fwrite(hdr, 1, 8, f) != 8 || fwrite(trk, 1, n, f) != n) ok = 0;
+    }
+    free(trk);
+    return fclose(f) == 0 && ok;
+}
+
+/* Datos sin estructura: mitad aleatorios, mitad repetidos */
+static int write_blob(const char *path, u32 size, u32 seed) {
+    u8 *buf = (u8*)malloc(1u << 20);
+    u32 done = 0, k;
+    FILE *f = fopen(path, "wb");
+    int ok = 1;
+
+    if (!f || !buf) { free(buf); if (f) fclose(f); return 0; }
+    rng_state = seed | 1;
+    while (done < size && ok) {
+        u32 n = size - done < (1u << 20) ? size - done : (1u << 20);
+        for (k = 0; k < n; k += 4) {
+            u32 v = (k & 0x1000) ? 0x01020304u : rnd();
+            memcpy(buf + k, &v, n - k < 4 ? n - k : 4);
+        }
+        if (fwrite(buf, 1, n, f) != n) ok = 0;
+        done += n;
+    }
+    free(buf);
+    return fclose(f) == 0 && ok;
+}
+
+static int scaled(int n, int min) {
+    int v = (int)(n * scale + 0.5);
+    return v < min ? min : v;
+}
+
+/* Manifiestos: sprites.dat, sprites_atlas.dat (los mismos sprites en un
+   atlas), audio.dat y big.dat (fondos, WAV y datos) */
+static int write_manifests(void) {
+    char path[512], p[512];
+    FILE *f;
+    int i;
+
+    cpath(path, sizeof(path), "sprites.txt", 0);
+    if (!(f = fopen(path, "w"))) return 0;
+    fprintf(f, "dat %s/out/sprites.dat\n", corpus_dir);
+    for (i = 0; i < cs.n_sprites; i++) { cpath(p, sizeof(p), "sprites/s%05d.bmp", i); fprintf(f, "bmp %s\n", p); }
+    fclose(f);
+
+    /* Los sprites mezclan profundidades: el atlas las pasa todas a 16 bpp */
+    cpath(path, sizeof(path), "sprites_atlas.txt", 0);
+    if (!(f = fopen(path, "w"))) return 0;
+    fprintf(f, "dat %s/out/sprites_atlas.dat\nbegin-atlas SPRITES depth=16\n", corpus_dir);
+    for (i = 0; i < cs.n_sprites; i++) { cpath(p, sizeof(p), "sprites/s%05d.bmp", i); fprintf(f, "bmp %s\n", p); }
+    fprintf(f, "end-atlas\n");
+    fclose(f);
+
+    cpath(path, sizeof(path), "audio.txt", 0);
+    if (!(f = fopen(path, "w"))) return 0;
+    fprintf(f, "dat %s/out/audio.dat\n", corpus_dir);
+    for (i = 0; i < cs.n_wav; i++) { cpath(p, sizeof(p), "wav/w%02d.wav", i); fprintf(f, "wav %s\n", p); }
+    for (i = 0; i < cs.n_midi; i++) { cpath(p, sizeof(p), "midi/m%03d.mid", i); fprintf(f, "midi %s\n", p); }
+    fclose(f);
+
+    cpath(path, sizeof(path), "big.txt", 0);
+    if (!(f = fopen(path, "w"))) return 0;
+    fprintf(f, "dat %s/out/big.dat\n", corpus_dir);
+    for (i = 0; i < cs.n_bg; i++) { cpath(p, sizeof(p), "bg/bg%02d.bmp", i); fprintf(f, "bmp %s\n", p); }
+    for (i = 0; i < cs.n_wav; i++) { cpath(p, sizeof(p), "wav/w%02d.wav", i); fprintf(f, "wav %s\n", p); }
+    for (i = 0; i < cs.n_blob; i++) { cpath(p, sizeof(p), "blob/b%02d.bin", i); fprintf(f, "data %s\n", p); }
+    fclose(f);
+    return 1;
+}
+
+static int ensure_corpus(void) {
+    static const char *dirs[] = { "", "/sprites", "/bg", "/wav", "/midi", "/blob", "/out" };
+    char path[512], stamp[128], have[128] = "";
+    FILE *f;
+    size_t d;
+    int i, ok = 1;
+    double t0 = now();
+
+    cs.n_sprites = scaled(4000, 20);
+    cs.n_bg = scaled(8, 1);
+    cs.n_wav = 4;
+    cs.wav_seconds = scaled(300, 2);
+    cs.n_midi = scaled(50, 2);
+    cs.midi_events = 1500;
+    cs.n_blob = scaled(28, 1);
+
+    snprintf(stamp, sizeof(stamp), "bench corpus v%d scale %g\n", CORPUS_VERSION, scale);
+    cpath(path, sizeof(path), "STAMP", 0);
+    if ((f = fopen(path, "r"))) {
+        if (!fgets(have, sizeof(have), f)) have[0] = '\0';
+        fclose(f);
+    }
+    if (strcmp(have, stamp) == 0) return 1;
+
+    fprintf(stderr, "Generating the benchmark corpus in %s (scale %g)...\n", corpus_dir, scale);
+    for (d = 0; d < sizeof(dirs) / sizeof(dirs[0]); d++) {
+        snprintf(path, sizeof(path), "%s%s", corpus_dir, dirs[d]);
+        if (mkdir(path, 0777) != 0 && errno != EEXIST) {
+            fprintf(stderr, "Error: cannot create '%s'\n", path);
+            return 0;
+        }
+    }
+    rng_state = 2463534242u;
+    for (i = 0; i < cs.n_sprites && ok; i++) {
+        u32 s = rnd();
+        int w = 16 + (int)(s % 49), h = 16 + (int)((s >> 8) % 49);
+        cpath(path, sizeof(path), "sprites/s%05d.bmp", i);
+        ok = write_bmp(path, w, h, (i & 1) ? 24 : 8, sprite_px, (u32)i);
+    }
+    for (i = 0; i < cs.n_bg && ok; i++) {
+        cpath(path, sizeof(path), "bg/bg%02d.bmp", i);
+        ok = write_bmp(path, 2048, 2048, 24, bg_px, (u32)i);
+    }
+    for (i = 0; i < cs.n_wav && ok; i++) {
+        cpath(path, sizeof(path), "wav/w%02d.wav", i);
+        ok = write_wav(path, cs.wav_seconds, 1000u + (u32)i);
+    }
+    for (i = 0; i < cs.n_midi && ok; i++) {
+        cpath(path, sizeof(path), "midi/m%03d.mid", i);
+        ok = write_midi(path, cs.midi_events, 2000u + (u32)i);
+    }
+    for (i = 0; i < cs.n_blob && ok; i++) {
+        cpath(path, sizeof(path), "blob/b%02d.bin", i);
+        ok = write_blob(path, BLOB_SIZE, 3000u + (u32)i);
+    }
+    if (!ok || !write_manifests()) {
+        fprintf(stderr, "Error: could not write the corpus\n");
+        return 0;
+    }
+    cpath(path, sizeof(path), "STAMP", 0);
+    if (!(f = fopen(path, "w"))) return 0;
+    fputs(stamp, f);
+    fclose(f);
+    fprintf(stderr, "Corpus ready in %.1f s\n", now() - t0);
+    return 1;
+}
+
+/* ------------------------------------------------------------------ */
+/* Medidas                                                             */
+/* ------------------------------------------------------------------ */
+
+/* Lo que devuelve una medida: bytes y objetos procesados en 'seconds' */
+typedef struct {
+    double seconds;
+    u64    bytes;
+    u64    objects;
+    int    ok;
+} Sample;
+
+typedef Sample (*BenchFn)(void);
+
+static Sample bench_bmp(const char *fmt, int n) {
+    Sample s = { 0, 0, 0, 1 };
+    char path[512];
+    double t0 = now();
+    int i;
+    for (i = 0; i < n && s.ok; i++) {
+        DatBitmap *b = NULL;
+        cpath(path, sizeof(path), fmt, i);
+        s.ok = load_bmp_to_dat_bitmap(path, &b);
+        s.bytes += file_size(path);
+        free_dat_bitmap(b);
+    }
+    s.seconds = now() - t0;
+    s.objects = (u64)n;
+    return s;
+}
+
+static Sample bench_bmp_sprites(void) { return bench_bmp("sprites/s%05d.bmp", cs.n_sprites); }
+static Sample bench_bmp_backgrounds(void) { return bench_bmp("bg/bg%02d.bmp", cs.n_bg); }
+
+static Sample bench_wav_opt(const WavConvertOptions *opt) {
+    Sample s = { 0, 0, 0, 1 };
+    char path[512];
+    double t0 = now();
+    int i;
+    for (i = 0; i < cs.n_wav && s.ok; i++) {
+        u8 *buf = NULL;
+        unsigned int sz;
+        cpath(path, sizeof(path), "wav/w%02d.wav", i);
+        s.ok = wav_to_allegro_samp_file(path, opt, &buf, &sz);
+        s.bytes += file_size(path);
+        free(buf);
+    }
+    s.seconds = now() - t0;
+    s.objects = (u64)cs.n_wav;
+    return s;
+}
+
+/* Sin opciones, como lo escribe dat create: por bloques de WAV_BLOCK_SIZE */
+static Sample bench_wav(void) {
+    Sample s = { 0, 0, 0, 1 };
+    unsigned char *block = (unsigned char *)malloc(WAV_BLOCK_SIZE);
+    char path[512];
+    double t0 = now();
+    int i;
+    if (!block) { s.ok = 0; return s; }
+    for (i = 0; i < cs.n_wav && s.ok; i++) {
+        WavStream ws;
+        FILE *f;
+        cpath(path, sizeof(path), "wav/w%02d.wav", i);
+        f = fopen(path, "rb");
+        s.ok = f && wav_stream_open(&ws, f) && wav_stream_is_plain(&ws, NULL);
+        while (s.ok && wav_stream_read(&ws, block, WAV_BLOCK_SIZE) > 0) {}
+        s.ok = s.ok && ws.data_left == 0;
+        if (f) fclose(f);
+        s.bytes += file_size(path);
+    }
+    free(block);
+    s.seconds = now() - t0;
+    s.objects = (u64)cs.n_wav;
+    return s;
+}
+
+static Sample bench_wav_22k_mono_8(void) {
+    WavConvertOptions opt = { 22050, 1, 8, 0 };
+    return bench_wav_opt(&opt);
+}
+
+/* Solo la conversion: los SMF se leen antes de empezar a medir */
+static Sample bench_midi(void) {
+    Sample s = { 0, 0, 0, 1 };
+    u8 **mid = (u8**)calloc((size_t)cs.n_midi, sizeof(u8*));
+    u32 *len = (u32*)calloc((size_t)cs.n_midi, sizeof(u32));
+    char path[512];
+    double t0;
+    int i;
+
+    if (!mid || !len) { free(mid); free(len); s.ok = 0; return s; }
+    for (i = 0; i < cs.n_midi && s.ok; i++) {
+        FILE *f;
+        cpath(path, sizeof(path), "midi/m%03d.mid", i);
+        len[i] = (u32)file_size(path);
+        mid[i] = (u8*)malloc(len[i] ? len[i] : 1);
+        f = fopen(path, "rb");
+        s.ok = f && mid[i] && fread(mid[i], 1, len[i], f) == len[i];
+        if (f) fclose(f);
+        s.bytes += len[i];
+    }
+    t0 = now();
+    for (i = 0; i < cs.n_midi && s.ok; i++) {
+        unsigned char *out = NULL;
+        unsigned int out_sz;
+        s.ok = mid_to_allegro_dat(mid[i], len[i], NULL, &out, &out_sz, NULL);
+        free(out);
+    }
+    s.seconds = now() - t0;
+    s.objects = (u64)cs.n_midi;
+    for (i = 0; i < cs.n_midi; i++) free(mid[i]);
+    free(mid);
+    free(len);
+    return s;
+}
+
+/* DatWriter con los bloques de datos (big.dat sin fondos ni WAV), sin
+   comprimir o comprimido entero; los cuerpos ya estan en memoria */
+static Sample bench_write(u32 pack_magic, int max_blobs) {
+    Sample s = { 0, 0, 0, 1 };
+    DatObject *objs;
+    DatWriter *w = NULL;
+    DatWriteOptions wopt;
+    DatWriteStats st;
+    char path[512], out[512];
+    int i, n = cs.n_blob < max_blobs ? cs.n_blob : max_blobs;
+
+    objs = (DatObject*)calloc((size_t)(n ? n : 1), sizeof(DatObject));
+    if (!objs) { s.ok = 0; return s; }
+    for (i = 0; i < n && s.ok; i++) {
+        DatObject *o = &objs[i];
+        FILE *f;
+        cpath(path, sizeof(path), "blob/b%02d.bin", i);
+        memcpy(o->type, "DATA", 4);
+        o->body.any = malloc(BLOB_SIZE);
+        f = fopen(path, "rb");
+        s.ok = f && o->body.any && fread(o->body.any, 1, BLOB_SIZE, f) == BLOB_SIZE;
+        if (f) fclose(f);
+        o->len_compressed = o->len_uncompressed = (s32)BLOB_SIZE;
+    }
+    wopt.pack_level = 6;
+    cpath(out, sizeof(out), "out/write.dat", 0);
+    if (s.ok) w = dat_writer_open(out, pack_magic, &wopt);
+    if (w) {
+        /* Cada objeto se libera al escribirlo */
+        for (i = 0; i < n; i++) dat_writer_add_object(w, &objs[i]);
+        s.ok = dat_writer_close(w, &st);
+        s.seconds = st.seconds;
+        s.bytes = st.raw_bytes;
+        s.objects = (u64)n;
+    } else {
+        s.ok = 0;
+    }
+    unlink(out);
+    for (i = 0; i < n; i++) free_dat_object(&objs[i]);
+    free(objs);
+    return s;
+}
+
+static Sample bench_write_plain(void) { return bench_write(DAT_F_NOPACK_MAGIC, 1 << 30); }
+static Sample bench_write_packed(void) { return bench_write(DAT_F_PACK_MAGIC, 2); }
+
+/* Corre fn en un hijo: el tiempo llega por una tuberia, el pico de RSS
+   por wait4 */
+static int run_child(BenchFn fn, Sample *s, double *rss_mb) {
+    int fds[2], status;
+    struct rusage ru;
+    pid_t pid;
+
+    if (pipe(fds) != 0) return 0;
+    fflush(NULL);
+    pid = fork();
+    if (pid < 0) { close(fds[0]); close(fds[1]); return 0; }
+    if (pid == 0) {
+        Sample r = fn();
+        close(fds[0]);
+        _exit(write(fds[1], &r, sizeof(r)) == (ssize_t)sizeof(r) ? 0 : 1);
+    }
+    close(fds[1]);
+    if (read(fds[0], s, sizeof(*s)) != (ssize_t)sizeof(*s)) s->ok = 0;
+    close(fds[0]);
+    if (wait4(pid, &status, 0, &ru) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0) return 0;
+    *rss_mb = (double)ru.ru_maxrss / 1024.0;
+    return s->ok;
+}
+
+/* Una orden de dat con la salida a /dev/null */
+static int run_dat(char *const *argv, Sample *s, double *rss_mb) {
+    int status;
+    struct rusage ru;
+    double t0 = now();
+    pid_t pid;
+
+    fflush(NULL);
+    pid = fork();
+    if (pid < 0) return 0;
+    if (pid == 0) {
+        int fd = open("/dev/null", O_WRONLY);
+        if (fd >= 0) dup2(fd, 1);
+        execv(dat_path, argv);
+        _exit(127);
+    }
+    if (wait4(pid, &status, 0, &ru) != pid) return 0;
+    s->seconds = now() - t0;
+    *rss_mb = (double)ru.ru_maxrss / 1024.0;
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static Result results[MAX_RESULTS];
+static int    num_results;
+static int    failures;
+static int    repeat = 3;
+
+/* Mejor tiempo de 'repeat' pasadas y el mayor pico de RSS */
+static void record(const char *name, BenchFn fn, char *const *argv, u64 bytes, u64 objects) {
+    Result *r = &results[num_results];
+    int k;
+
+    memset(r, 0, sizeof(*r));
+    snprintf(r->name, sizeof(r->name), "%s", name);
+    for (k = 0; k < repeat; k++) {
+        Sample s = { 0, bytes, objects, 1 };
+        double rss = 0.0;
+        int ok = fn ? run_child(fn, &s, &rss) : run_dat(argv, &s, &rss);
+        if (!ok) {
+            fprintf(stderr, "Error: benchmark '%s' failed\n", name);
+            failures++;
+            return;
+        }
+        if (k == 0 || s.seconds < r->seconds) {
+            r->seconds = s.seconds;
+            r->mb_s = s.seconds > 0 ? (double)s.bytes / 1e6 / s.seconds : 0.0;
+            r->objects_s = s.seconds > 0 ? (double)s.objects / s.seconds : 0.0;
+        }
+        if (rss > r->rss_mb) r->rss_mb = rss;
+    }
+    fprintf(stderr, "  %-28s %8.3f s %9.1f MB/s %10.1f obj/s %8.1f MB RSS\n",
+            r->name, r->seconds, r->mb_s, r->objects_s, r->rss_mb);
+    num_results++;
+}
+
+static u64 sum_sizes(const char *fmt, int n) {
+    char path[512];
+    u64 total = 0;
+    int i;
+    for (i = 0; i < n; i++) { cpath(path, sizeof(path), fmt, i); total += file_size(path); }
+    return total;
+}
+
+static void run_all(void) {
+    char sprites[512], atlas[512], audio[512], big[512], big_dat[512], big_dir[512];
+    u64 spr = sum_sizes("sprites/s%05d.bmp", cs.n_sprites);
+    u64 bg = sum_sizes("bg/bg%02d.bmp", cs.n_bg);
+    u64 wav = sum_sizes("wav/w%02d.wav", cs.n_wav);
+    u64 mid = sum_sizes("midi/m%03d.mid", cs.n_midi);
+    u64 blob = sum_sizes("blob/b%02d.bin", cs.n_blob);
+    u64 n_big = (u64)(cs.n_bg + cs.n_wav + cs.n_blob);
+
+    snprintf(sprites, sizeof(sprites), "@%s/sprites.txt", corpus_dir);
+    snprintf(atlas, sizeof(atlas), "@%s/sprites_atlas.txt", corpus_dir);
+    snprintf(audio, sizeof(audio), "@%s/audio.txt", corpus_dir);
+    snprintf(big, sizeof(big), "@%s/big.txt", corpus_dir);
+    cpath(big_dat, sizeof(big_dat), "out/big.dat", 0);
+    cpath(big_dir, sizeof(big_dir), "out/big", 0);
+
+    /* Conversores, dentro del proceso */
+    record("bmp_sprites", bench_bmp_sprites, NULL, 0, 0);
+    record("bmp_backgrounds", bench_bmp_backgrounds, NULL, 0, 0);
+    record("wav", bench_wav, NULL, 0, 0);
+    record("wav_22k_mono_8", bench_wav_22k_mono_8, NULL, 0, 0);
+    record("midi", bench_midi, NULL, 0, 0);
+    record("write_plain", bench_write_plain, NULL, 0, 0);
+    record("write_packed", bench_write_packed, NULL, 0, 0);
+
+    /* Ordenes completas */
+    {
+        char *create_sprites[] = { "dat", "create", sprites, NULL };
+        char *compress_sprites[] = { "dat", "create", sprites, "--compress", NULL };
+        char *pack_sprites[] = { "dat", "create", sprites, "--pack", NULL };
+        char *atlas_sprites[] = { "dat", "create", atlas, NULL };
+        char *create_audio[] = { "dat", "create", audio, NULL };
+        char *create_big[] = { "dat", "create", big, NULL };
+        char *update_big[] = { "dat", "update", big, NULL };
+        char *list_big[] = { "dat", "list", big_dat, NULL };
+        char *extract_big[] = { "dat", "extract", big_dat, big_dir, NULL };
+        char *checksum_big[] = { "dat", "create", big, "--checksum", NULL };
+        char *verify_big[] = { "dat", "verify", big_dat, NULL };
+        record("create_sprites", NULL, create_sprites, spr, (u64)cs.n_sprites);
+        record("create_sprites_compress", NULL, compress_sprites, spr, (u64)cs.n_sprites);
+        record("create_sprites_pack", NULL, pack_sprites, spr, (u64)cs.n_sprites);
+        record("create_sprites_atlas", NULL, atlas_sprites, spr, (u64)cs.n_sprites);
+        record("create_audio", NULL, create_audio, wav + mid, (u64)(cs.n_wav + cs.n_midi));
+        record("create_big", NULL, create_big, bg + wav + blob, n_big);
+        /* Nada ha cambiado: todo se reutiliza del DAT anterior. Lo que
+           escribe create no lleva HASH; un primer update sin medir lo pone */
+        {
+            Sample s = { 0, 0, 0, 1 };
+            double rss = 0.0;
+            run_dat(update_big, &s, &rss);
+        }
+        record("update_big_unchanged", NULL, update_big, file_size(big_dat), n_big);
+        record("list_big", NULL, list_big, file_size(big_dat), n_big);
+        record("extract_big", NULL, extract_big, file_size(big_dat), n_big);
+        /* Sobrescribe big.dat, ahora con CRC para que verify lo recorra entero */
+        record("create_big_checksum", NULL, checksum_big, bg + wav + blob, n_big);
+        record("verify_big", NULL, verify_big, file_size(big_dat), n_big);
+    }
+}
+
+/* ------------------------------------------------------------------ */
+/* Linea base                                                          */
+/* ------------------------------------------------------------------ */
+
+static int save_results(const char *path) {
+    FILE *f = path ? fopen(path, "w") : stdout;
+    int i;
+    if (!f) {
+        fprintf(stderr, "Error: cannot write '%s'\n", path);
+        return 0;
+    }
+    fprintf(f, "# name\tseconds\tmb_s\tobjects_s\tpeak_rss_mb\n");
+    fprintf(f, "# corpus v%d scale %g\n", CORPUS_VERSION, scale);
+    for (i = 0; i < num_results; i++)
+        fprintf(f, "%s\t%.4f\t%.2f\t%.2f\t%.1f\n", results[i].name, results[i].seconds,
+                results[i].mb_s, results[i].objects_s, results[i].rss_mb);
+    return path ? fclose(f) == 0 : 1;
+}
+
+/* 0 si alguna medida empeora mas de tolerance por ciento */
+static int compare(const char *path, double tolerance) {
+    char line[256], name[64], want[64];
+    double sec, mb, obj, rss;
+    FILE *f = fopen(path, "r");
+    int i, regressions = 0, same_corpus = 0;
+
+    if (!f) {
+        fprintf(stderr, "Error: no baseline in '%s' (make bench-baseline writes one)\n", path);
+        return 0;
+    }
+    snprintf(want, sizeof(want), "# corpus v%d scale %g", CORPUS_VERSION, scale);
+    fprintf(stderr, "\nAgainst %s (tolerance %g%%):\n", path, tolerance);
+    while (fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "\n")] = '\0';
+        if (strcmp(line, want) == 0) same_corpus = 1;
+        if (line[0] == '#' || sscanf(line, "%63s %lf %lf %lf %lf", name, &sec, &mb, &obj, &rss) != 5) continue;
+        for (i = 0; i < num_results; i++) {
+            const Result *r = &results[i];
+            double base, cur, speed, mem;
+            const char *verdict = "ok";
+            if (strcmp(r->name, name) != 0) continue;
+            /* La velocidad en MB/s, o en objetos/s si no hay bytes */
+            base = mb > 0 ? mb : obj;
+            cur = mb > 0 ? r->mb_s : r->objects_s;
+            speed = base > 0 ? 100.0 * (cur - base) / base : 0.0;
+            mem = rss > 0 ? 100.0 * (r->rss_mb - rss) / rss : 0.0;
+            if (speed < -tolerance) verdict = "SLOWER";
+            else if (mem > tolerance && r->rss_mb - rss > 4.0) verdict = "MORE MEMORY";
+            if (verdict[0] != 'o') regressions++;
+            fprintf(stderr, "  %-28s speed %+7.1f%%  rss %+7.1f%%  %s\n", r->name, speed, mem, verdict);
+        }
+    }
+    fclose(f);
+    if (!same_corpus) fprintf(stderr, "Warning: the baseline was measured on another corpus (scale)\n");
+    if (regressions) fprintf(stderr, "%d regression(s)\n", regressions);
+    return regressions == 0;
+}
+
+static void usage(void) {
+    fprintf(stderr,
+            "Usage: bench_dat [--dat ./dat] [--corpus dir] [--scale S] [--repeat N]\n"
+            "                 [--out results.tsv] [--baseline file [--tolerance PCT]]\n"
+            "                 [--save-baseline file]\n");
+}
+
+int main(int argc, char **argv) {
+    const char *out = NULL, *baseline = NULL, *save = NULL;
+    double tolerance = 10.0;
+    int i, ok = 1;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--dat") == 0 && i + 1 < argc) dat_path = argv[++i];
+        else if (strcmp(argv[i], "--corpus") == 0 && i + 1 < argc) corpus_dir = argv[++i];
+        else if (strcmp(argv[i], "--scale") == 0 && i + 1 < argc) scale = atof(argv[++i]);
+        else if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) repeat = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) out = argv[++i];
+        else if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc) baseline = argv[++i];
+        else if (strcmp(argv[i], "--tolerance") == 0 && i + 1 < argc) tolerance = atof(argv[++i]);
+        else if (strcmp(argv[i], "--save-baseline") == 0 && i + 1 < argc) save = argv[++i];
+        else { usage(); return 2; }
+    }
+    if (scale <= 0 || scale > 16 || repeat < 1) { usage(); return 2; }
+    if (access(dat_path, X_OK) != 0) {
+        fprintf(stderr, "Error: '%s' is not executable (run make first)\n", dat_path);
+        return 2;
+    }
+    /* Sin linea base no hay con que comparar: fallar antes de medir */
+    if (baseline && !save && access(baseline, R_OK) != 0) {
+        fprintf(stderr, "Error: no baseline in '%s' (make bench-baseline writes one)\n", baseline);
+        return 2;
+    }
+    if (!ensure_corpus()) return 2;
+
+    fprintf(stderr, "Benchmarks (best of %d):\n", repeat);
+    run_all();
+    if (!save_results(out)) return 2;
+    if (failures) return 2;
+    if (save && !save_results(save)) return 2;
+    if (baseline && !save) ok = compare(baseline, tolerance);
+    return ok ? 0 : 1;
+}
@@ -9,9 +9,15 @@
 typedef uint8_t  u8; 
 typedef uint16_t u16; 
 typedef uint32_t u32; 
+typedef uint64_t u64; 
 typedef int16_t  s16; 
 typedef int32_t  s32; 
 
+// File magics (big-endian on disk)
+#define DAT_F_NOPACK_MAGIC 0x736C682Eu // "slh." unpacked file
+#define DAT_F_PACK_MAGIC   0x736C6821u // "slh!" whole file LZSS-packed
+#define DAT_MAGIC          0x414C4C2Eu // "ALL."
+
 static inline u16 to_be16(u16 x){ return (u16)((x>>8) | (x<<8)); }
 static inline u32 to_be32(u32 x){ return ((x>>24)&0xFF) | ((x>>8)&0xFF00) | ((x<<8)&0xFF0000) | ((x<<24)&0xFF000000); }
 
@@ -28,9 +34,12 @@ typedef struct {
     s16 bits_per_pixel; // host endian
     u16 width;          // host endian
     u16 height;         // host endian (absolute)
-    u8 *image;          // width*height*(bpp/8) bytes, top-down, tightly packed
+    u8 *image;          // width*height*dat_bitmap_pixel_size(bpp) bytes, top-down, tightly packed
 } DatBitmap;
 
+// Bytes per pixel of a BMP body: 15 bpp uses 16-bit words, -32 is Allegro's RGBA
+static inline u32 dat_bitmap_pixel_size(s16 bpp){ return bpp == 15 ? 2u : (u32)(bpp < 0 ? -bpp : bpp) / 8u; }
+
 // Allegro DAT RLE body
 typedef struct {
     s16 bits_per_pixel; // host endian
@@ -53,15 +62,17 @@ typedef struct {
 typedef struct {
     Property *properties; // array
     int       num_properties;
-    s32       len_compressed;
-    s32       len_uncompressed;
+    s32       len_compressed;   // bytes on disk
+    s32       len_uncompressed; // negative = body is LZSS-packed ("individual" compression)
     char      type[4]; // "BMP ", "PAL ", "RLE ", "FONT"
     union { DatBitmap *bmp; DatRleSprite *rle; DatFont *font; u8 *pal; void *any; } body;
+    u8       *stored;  // if set, exact on-disk body (len_compressed bytes), written instead of body
+    int       stored_is_view; // stored points into a loaded/mapped file and is not freed
 } DatObject;
 
 // DAT file root
 typedef struct {
-    u32 pack_magic;   // 0x736C682E -> "slh." (unpacked), big-endian on disk
+    u32 pack_magic;   // DAT_F_NOPACK_MAGIC or DAT_F_PACK_MAGIC, big-endian on disk
     u32 dat_magic;    // 'ALL.'
     u32 num_objects;  // number of objects
     DatObject *objects; // array length num_objects
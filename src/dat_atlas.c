@@ -0,0 +1,253 @@
+/* src/dat_atlas.c */
+#include <stdlib.h>
+#include <string.h>
+
+#include "dat_atlas.h"
+
+#define NO_FIT 0xFFFFFFFFu
+
+/* Skyline: segmentos horizontales que cubren todo el ancho de la pagina,
+   de izquierda a derecha; y es la altura ya ocupada bajo cada uno */
+typedef struct {
+    u32 x, y, w;
+} SkyNode;
+
+typedef struct {
+    SkyNode *nodes;
+    u32      num, cap;
+} Skyline;
+
+typedef struct {
+    u16 w, h;
+    u32 index;
+} Item;
+
+static int cmp_items(const void *a, const void *b) {
+    const Item *p = (const Item*)a, *q = (const Item*)b;
+    if (p->h != q->h) return p->h > q->h ? -1 : 1;
+    if (p->w != q->w) return p->w > q->w ? -1 : 1;
+    return p->index < q->index ? -1 : 1;
+}
+
+/* Altura a la que cabe un w x h con el borde izquierdo en el nodo i */
+static u32 fit(const Skyline *s, u32 i, u32 w, u32 h, u32 max_w, u32 max_h) {
+    u32 y = 0, left = w;
+    if (s->nodes[i].x + w > max_w) return NO_FIT;
+    for (;;) {
+        if (s->nodes[i].y > y) y = s->nodes[i].y;
+        if (y + h > max_h) return NO_FIT;
+        if (s->nodes[i].w >= left) return y;
+        left -= s->nodes[i].w;
+        i++;
+    }
+}
+
+/* Nodo i: el mejor sitio de la pagina (borde superior mas bajo, luego mas
+   a la izquierda), o NO_FIT */
+static u32 best_node(const Skyline *s, u32 w, u32 h, u32 max_w, u32 max_h, u32 *best_y) {
+    u32 i, best = NO_FIT, best_top = NO_FIT;
+    for (i = 0; i < s->num; i++) {
+        u32 y = fit(s, i, w, h, max_w, max_h);
+        if (y != NO_FIT && y + h < best_top) {
+            best = i;
+            best_top = y + h;
+            *best_y = y;
+        }
+    }
+    return best;
+}
+
+static int place(Skyline *s, u32 i, u32 y, u32 w, u32 h) {
+    u32 x = s->nodes[i].x, j;
+    if (s->num == s->cap) {
+        u32 cap = s->cap * 2;
+        SkyNode *nn = (SkyNode*)realloc(s->nodes, sizeof(SkyNode) * cap);
+        if (!nn) return 0;
+        s->nodes = nn;
+        s->cap = cap;
+    }
+    memmove(s->nodes + i + 1, s->nodes + i, sizeof(SkyNode) * (s->num - i));
+    s->nodes[i].x = x;
+    s->nodes[i].y = y + h;
+    s->nodes[i].w = w;
+    s->num++;
+    /* Los segmentos que quedan debajo se recortan o desaparecen */
+    j = i + 1;
+    while (j < s->num && s->nodes[j].x < x + w) {
+        u32 over = x + w - s->nodes[j].x;
+        if (s->nodes[j].w <= over) {
+            memmove(s->nodes + j, s->nodes + j + 1, sizeof(SkyNode) * (s->num - j - 1));
+            s->num--;
+        } else {
+            s->nodes[j].x += over;
+            s->nodes[j].w -= over;
+            break;
+        }
+    }
+    /* Vecinos a la misma altura: un solo segmento */
+    for (j = 0; j + 1 < s->num;) {
+        if (s->nodes[j].y == s->nodes[j + 1].y) {
+            s->nodes[j].w += s->nodes[j + 1].w;
+            memmove(s->nodes + j + 1, s->nodes + j + 2, sizeof(SkyNode) * (s->num - j - 2));
+            s->num--;
+        } else {
+            j++;
+        }
+    }
+    return 1;
+}
+
+u32 dat_atlas_pack(const u16 *w, const u16 *h, u32 n, u32 max_w, u32 max_h, DatAtlasRect *rects,
+                   u16 *page_w, u16 *page_h) {
+    Item *items = (Item*)malloc(sizeof(Item) * (n ? n : 1));
+    Skyline *pages = (Skyline*)calloc(n ? n : 1, sizeof(Skyline));
+    u32 i, p, num_pages = 0;
+    int ok = items && pages;
+
+    for (i = 0; ok && i < n; i++) {
+        if (w[i] > max_w || h[i] > max_h) ok = 0;
+        items[i].w = w[i];
+        items[i].h = h[i];
+        items[i].index = i;
+    }
+    if (ok) qsort(items, n, sizeof(Item), cmp_items);
+
+    for (i = 0; ok && i < n; i++) {
+        const Item *it = &items[i];
+        DatAtlasRect *r = &rects[it->index];
+        u32 node = NO_FIT, y = 0;
+        r->w = it->w;
+        r->h = it->h;
+        if (!it->w || !it->h) {
+            /* No ocupa sitio */
+            r->page = r->x = r->y = 0;
+            continue;
+        }
+        for (p = 0; p < num_pages; p++)
+            if ((node = best_node(&pages[p], it->w, it->h, max_w, max_h, &y)) != NO_FIT) break;
+        if (p == num_pages) {
+            Skyline *s = &pages[num_pages++];
+            s->cap = 16;
+            s->nodes = (SkyNode*)malloc(sizeof(SkyNode) * s->cap);
+            if (!s->nodes) { ok = 0; break; }
+            s->nodes[0].x = s->nodes[0].y = 0;
+            s->nodes[0].w = max_w;
+            s->num = 1;
+            page_w[p] = page_h[p] = 0;
+            node = 0;
+            y = 0;
+        }
+        r->page = (u16)p;
+        r->x = (u16)pages[p].nodes[node].x;
+        r->y = (u16)y;
+        if (!place(&pages[p], node, y, it->w, it->h)) { ok = 0; break; }
+        if (r->x + it->w > page_w[p]) page_w[p] = (u16)(r->x + it->w);
+        if (r->y + it->h > page_h[p]) page_h[p] = (u16)(r->y + it->h);
+    }
+    /* Solo sprites vacios: una pagina de 1 x 1 */
+    if (ok && n && !num_pages) {
+        page_w[0] = page_h[0] = 1;
+        num_pages = 1;
+    }
+
+    for (p = 0; pages && p < num_pages; p++) free(pages[p].nodes);
+    free(pages);
+    free(items);
+    return ok ? num_pages : 0;
+}
+
+/* Color mascara de Allegro en el formato de cada profundidad */
+void dat_fill_mask(u8 *px, size_t count, s16 bpp) {
+    size_t i;
+    switch (bpp) {
+    case 15:
+    case 16: {
+        /* 15 y 16 bpp se guardan igual: palabras 5.6.5 */
+        for (i = 0; i < count; i++) {
+            px[2 * i] = 0x1F;
+            px[2 * i + 1] = 0xF8;
+        }
+        break;
+    }
+    case 24:
+        for (i = 0; i < count; i++) {
+            px[3 * i] = 0xFF;
+            px[3 * i + 1] = 0;
+            px[3 * i + 2] = 0xFF;
+        }
+        break;
+    case 32:
+        for (i = 0; i < count; i++) {
+            px[4 * i] = 0xFF;
+            px[4 * i + 1] = 0;
+            px[4 * i + 2] = 0xFF;
+            px[4 * i + 3] = 0;
+        }
+        break;
+    default:
+        /* 8 bpp: indice 0; RGBA: alfa 0 */
+        memset(px, 0, count * dat_bitmap_pixel_size(bpp));
+    }
+}
+
+DatBitmap *dat_atlas_page(const DatBitmap *const *sprites, const DatAtlasRect *rects, u32 n, u16 page,
+                          u16 w, u16 h) {
+    s16 bpp = sprites[0]->bits_per_pixel;
+    u32 ps = dat_bitmap_pixel_size(bpp), i, y;
+    size_t bytes = (size_t)w * h * ps;
+    DatBitmap *b = (DatBitmap*)calloc(1, sizeof(DatBitmap));
+
+    if (!b) return NULL;
+    b->bits_per_pixel = bpp;
+    b->width = w;
+    b->height = h;
+    b->image = (u8*)malloc(bytes ? bytes : 1);
+    if (!b->image) {
+        free(b);
+        return NULL;
+    }
+    dat_fill_mask(b->image, (size_t)w * h, bpp);
+    for (i = 0; i < n; i++) {
+        const DatAtlasRect *r = &rects[i];
+        if (r->page != page || !r->w || !r->h) continue;
+        for (y = 0; y < r->h; y++)
+            memcpy(b->image + ((size_t)(r->y + y) * w + r->x) * ps,
+                   sprites[i]->image + (size_t)y * r->w * ps, (size_t)r->w * ps);
+    }
+    return b;
+}
+
+static u8 *put_be16(u8 *p, u32 v) {
+    p[0] = (u8)(v >> 8);
+    p[1] = (u8)v;
+    return p + 2;
+}
+
+u8 *dat_atlas_table(const DatAtlasRect *rects, const char *const *names, u32 n, u32 pages, u32 *size) {
+    size_t total = 4, len;
+    u32 i;
+    u8 *buf, *p;
+
+    for (i = 0; i < n; i++) {
+        len = strlen(names[i]);
+        total += 11 + (len > 255 ? 255 : len);
+    }
+    buf = (u8*)malloc(total);
+    if (!buf) return NULL;
+    p = put_be16(buf, pages);
+    p = put_be16(p, n);
+    for (i = 0; i < n; i++) {
+        len = strlen(names[i]);
+        if (len > 255) len = 255;
+        p = put_be16(p, rects[i].page);
+        p = put_be16(p, rects[i].x);
+        p = put_be16(p, rects[i].y);
+        p = put_be16(p, rects[i].w);
+        p = put_be16(p, rects[i].h);
+        *p++ = (u8)len;
+        memcpy(p, names[i], len);
+        p += len;
+    }
+    *size = (u32)total;
+    return buf;
+}
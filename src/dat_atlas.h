@@ -0,0 +1,60 @@
+/* src/dat_atlas.h
+ *
+ * Sprite atlases (--atlas): many small bitmaps packed into a few large
+ * ones, so a game loads one BITMAP per page instead of one per sprite.
+ *
+ * Packing is a skyline bottom-left packer: sprites go tallest first, each
+ * into the first page where it fits, at the position that keeps its top
+ * edge lowest. The result only depends on the sizes and their order. A
+ * page is cropped to what it uses, and the space between sprites is the
+ * mask colour of its depth (0 at 8 bpp, bright pink at 15 to 32 bpp,
+ * alpha 0 for RGBA).
+ *
+ * The table is a DATA body, big-endian like the rest of the datafile:
+ *
+ *   be16 pages, be16 sprites
+ *   per sprite, in command-line order:
+ *     be16 page, be16 x, be16 y, be16 w, be16 h, u8 name length, name
+ *
+ * Page k is the BMP object NAME_PAGEk, where NAME is the table's; these
+ * names are reserved when the DAT's names are assigned.
+ */
+#ifndef DAT_ATLAS_H
+#define DAT_ATLAS_H
+
+#include "allegro_dat_structs.h"
+
+#define DAT_ATLAS_DEFAULT_SIZE 1024  /* --atlas-size default, both sides */
+#define DAT_ATLAS_MAX_SPRITES  65535 /* be16 in the table */
+
+typedef struct {
+    u16 page, x, y, w, h;
+} DatAtlasRect;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Places n sprites of w[i] x h[i] on pages of at most max_w x max_h.
+   rects[i] receives its page and position, and page_w/page_h (n entries
+   each) the cropped size of every page. Returns the number of pages; 0 if
+   a sprite is larger than a page or memory runs out. */
+u32 dat_atlas_pack(const u16 *w, const u16 *h, u32 n, u32 max_w, u32 max_h, DatAtlasRect *rects,
+                   u16 *page_w, u16 *page_h);
+
+/* Page 'page' (w x h) with every sprite whose rect is on it copied in.
+   All sprites have the depth of sprites[0]. NULL if out of memory. */
+DatBitmap *dat_atlas_page(const DatBitmap *const *sprites, const DatAtlasRect *rects, u32 n, u16 page,
+                          u16 w, u16 h);
+
+/* Sets count pixels of depth bpp to the mask colour (also for tilesets). */
+void dat_fill_mask(u8 *px, size_t count, s16 bpp);
+
+/* Table body (malloc'd, *size bytes); names longer than 255 are cut. */
+u8 *dat_atlas_table(const DatAtlasRect *rects, const char *const *names, u32 n, u32 pages, u32 *size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DAT_ATLAS_H */
@@ -0,0 +1,1127 @@
+/* src/dat_build.c */
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <sys/stat.h>
+
+#include "dat_build.h"
+#include "dat_atlas.h"
+#include "dat_color.h"
+#include "dat_hash.h"
+#include "dat_loader_bmp.h"
+#include "dat_loader_data.h"
+#include "dat_loader_font.h"
+#include "dat_loader_pal.h"
+#include "dat_names.h"
+#include "dat_pool.h"
+#include "dat_quantize.h"
+#include "dat_rle.h"
+#include "dat_stats.h"
+#include "dat_tiles.h"
+#include "dat_writer.h"
+#include "lzss.h"
+#include "midi_to_allegro.h"
+#include "wav_to_allegro.h"
+
+static const struct { const char *opt; AssetKind kind; const char *type; } asset_options[] = {
+    { "--bmp",          ASSET_BMP,       "BMP " },
+    { "--pal",          ASSET_PAL,       "PAL " },
+    { "--pal-bmp",      ASSET_PAL_BMP,   "PAL " },
+    { "--rle",          ASSET_RLE,       "RLE " },
+    { "--rle-bmp",      ASSET_RLE_BMP,   "RLE " },
+    { "--font8-bmp",    ASSET_FONT8,     "FONT" },
+    { "--font16-bmp",   ASSET_FONT16,    "FONT" },
+    { "--midi",         ASSET_MIDI,      "MIDI" },
+    { "--wav",          ASSET_WAV,       "SAMP" },
+    { "--flic",         ASSET_FLIC,      "FLIC" },
+    { "--data",         ASSET_DATA,      "DATA" },
+    { "--quantize-pal", ASSET_QUANT_PAL, "PAL " },  /* solo el job que anade --quantize auto */
+    { "--begin-group",  ASSET_GROUP,     "FILE" },
+    { "--begin-atlas",  ASSET_ATLAS,     "DATA" },
+    { "--tiles",        ASSET_TILES,     "DATA" },
+};
+
+int dat_asset_kind_from_option(const char *opt) {
+    size_t i;
+    for (i = 0; i < sizeof(asset_options) / sizeof(asset_options[0]); i++)
+        if (strcmp(opt, asset_options[i].opt) == 0 && asset_options[i].kind != ASSET_QUANT_PAL)
+            return (int)asset_options[i].kind;
+    return -1;
+}
+
+const char *dat_asset_option_name(AssetKind kind) {
+    size_t i;
+    for (i = 0; i < sizeof(asset_options) / sizeof(asset_options[0]); i++)
+        if (asset_options[i].kind == kind) return asset_options[i].opt;
+    return "?";
+}
+
+const char *dat_asset_object_type(AssetKind kind) {
+    size_t i;
+    for (i = 0; i < sizeof(asset_options) / sizeof(asset_options[0]); i++)
+        if (asset_options[i].kind == kind) return asset_options[i].type;
+    return "????";
+}
+
+int dat_is_container(AssetKind kind) {
+    return kind == ASSET_GROUP || kind == ASSET_ATLAS || kind == ASSET_TILES;
+}
+
+char *dat_dupstr(const char *s) {
+    size_t n = strlen(s);
+    char *d = (char*)malloc(n + 1);
+    if (!d) return NULL;
+    memcpy(d, s, n);
+    d[n] = '\0';
+    return d;
+}
+
+void dat_set_prop(Property *p, const char type4[4], const char *value) {
+    memcpy(p->magic, "prop", 4);
+    memcpy(p->type, type4, 4);
+    p->len_body = (u32)strlen(value);
+    p->body = dat_dupstr(value);
+}
+
+const char *dat_basename(const char *path) {
+    const char *s = strrchr(path, '/');
+    const char *s2 = strrchr(path, '\\');
+    if (!s || (s2 && s2 > s)) s = s2;
+    return s ? s + 1 : path;
+}
+
+/* Convierte "musica.mid" en "MUSICA_MID" para que Allegro lo encuentre */
+void dat_sanitize_name(char *dest, const char *path) {
+    const char *b = dat_basename(path);
+    int i = 0;
+    while (b[i] && i < 31) {
+        if (b[i] == '.') dest[i] = '_';
+        else dest[i] = (char)toupper((unsigned char)b[i]);
+        i++;
+    }
+    dest[i] = '\0';
+}
+
+/* DATE, NAME y ORIG como los escribe el grabber */
+static void set_std_props(DatObject *o, const AssetJob *job, const char *datestr) {
+    char clean_name[64];
+    o->num_properties = 3;
+    o->properties = (Property*)calloc(3, sizeof(Property));
+    dat_set_prop(&o->properties[0], "DATE", datestr);
+    if (!job->name[0]) dat_sanitize_name(clean_name, job->path);
+    dat_set_prop(&o->properties[1], "NAME", job->name[0] ? job->name : clean_name);
+    dat_set_prop(&o->properties[2], "ORIG", job->path);
+}
+
+#define GEN_NAME 96
+
+/* Nombre k de los que genera un contenedor llamado name: las paginas
+   NAME_PAGEk de un atlas o el tileset NAME_TILES */
+static void generated_name(char *dest, AssetKind kind, const char *name, size_t k) {
+    if (kind == ASSET_TILES) snprintf(dest, GEN_NAME, "%s_TILES", name);
+    else snprintf(dest, GEN_NAME, "%s_PAGE%u", name, (unsigned)k);
+}
+
+/* Cuantos nombres genera el job g: un atlas tiene como mucho una pagina
+   por sprite */
+static size_t generated_count(const AssetJob *jobs, size_t n, size_t g) {
+    size_t i, m = 0;
+    if (jobs[g].kind == ASSET_TILES) return 1;
+    if (jobs[g].kind != ASSET_ATLAS) return 0;
+    for (i = g + 1; i < n; i++)
+        if (jobs[i].group == (int)g) m++;
+    return m;
+}
+
+/* 1 si name y todos los que generaria el job g con el estan libres */
+static int generated_free(const DatNameSet *set, const AssetJob *jobs, size_t n, size_t g,
+                          const char *name) {
+    char gen[GEN_NAME];
+    size_t k, count = generated_count(jobs, n, g);
+    if (dat_names_find(set, name) != DAT_NAME_NONE) return 0;
+    for (k = 0; k < count; k++) {
+        generated_name(gen, jobs[g].kind, name, k);
+        if (dat_names_find(set, gen) != DAT_NAME_NONE) return 0;
+    }
+    return 1;
+}
+
+/* Registra los nombres que genera el job g (ya con nombre) en *next, que
+   vive tanto como set */
+static int reserve_generated(DatNameSet *set, const AssetJob *jobs, size_t n, size_t g,
+                             char (**next)[GEN_NAME]) {
+    size_t k, other, count = generated_count(jobs, n, g);
+    int ok = 1;
+    for (k = 0; k < count; k++) {
+        char *gen = **next;
+        generated_name(gen, jobs[g].kind, jobs[g].name, k);
+        (*next)++;
+        other = dat_names_add(set, gen, g);
+        if (other != DAT_NAME_NONE) {
+            fprintf(stderr, "Error: NAME '%s' of '%s' is already used by '%s'\n", gen,
+                    jobs[g].path, other < n ? jobs[other].path : "GrabberInfo");
+            ok = 0;
+        }
+    }
+    return ok;
+}
+
+/* Nombre derivado de un atlas o --tiles: el primero de NAME, NAME_2, ...
+   que deje libres tambien sus paginas o su tileset */
+static int name_container(DatNameSet *set, AssetJob *jobs, size_t n, size_t g,
+                          char (**next)[GEN_NAME]) {
+    char base[64];
+    unsigned k;
+    strcpy(base, jobs[g].name);
+    for (k = 2; !generated_free(set, jobs, n, g, jobs[g].name); k++) {
+        char suffix[16];
+        size_t slen = (size_t)snprintf(suffix, sizeof(suffix), "_%u", k), keep = strlen(base);
+        if (keep + slen + 1 > sizeof(jobs[g].name)) keep = sizeof(jobs[g].name) - slen - 1;
+        memcpy(jobs[g].name, base, keep);
+        memcpy(jobs[g].name + keep, suffix, slen + 1);
+    }
+    if (k > 2)
+        fprintf(stderr, "Warning: NAME '%s' of '%s' is already used, stored as '%s'\n",
+                base, jobs[g].path, jobs[g].name);
+    dat_names_add(set, jobs[g].name, g);
+    return reserve_generated(set, jobs, n, g, next);
+}
+
+/* Nombres de los jobs de un datafile: el DAT (group -1) o un grupo. Los
+   que generan los atlas y --tiles tambien cuentan */
+static int assign_scope(AssetJob *jobs, size_t n, int group, int strict) {
+    DatNameSet *set;
+    char (*gen)[GEN_NAME], (*next)[GEN_NAME];
+    size_t i, other, total = 0;
+    int ok = 1;
+
+    for (i = 0; i < n; i++)
+        if (jobs[i].group == group) total += generated_count(jobs, n, i);
+    set = dat_names_create(n + total + 1);
+    gen = (char(*)[GEN_NAME])malloc((total ? total : 1) * GEN_NAME);
+    if (!set || !gen) {
+        if (set) dat_names_free(set);
+        free(gen);
+        return 0;
+    }
+    next = gen;
+    /* GrabberInfo va siempre al final del fichero */
+    if (group < 0) dat_names_add(set, "GrabberInfo", n);
+
+    /* Primero los nombres explicitos: un nombre derivado nunca se los quita */
+    for (i = 0; i < n; i++) {
+        if (jobs[i].group != group || !jobs[i].want_name) continue;
+        if (strlen(jobs[i].want_name) >= sizeof(jobs[i].name)) {
+            fprintf(stderr, "Error: NAME '%s' is longer than %d characters\n",
+                    jobs[i].want_name, (int)sizeof(jobs[i].name) - 1);
+            ok = 0; continue;
+        }
+        strcpy(jobs[i].name, jobs[i].want_name);
+        other = dat_names_add(set, jobs[i].name, i);
+        if (other != DAT_NAME_NONE) {
+            fprintf(stderr, "Error: NAME '%s' of '%s' is already used by '%s'\n", jobs[i].name,
+                    jobs[i].path, other < n ? jobs[other].path : "GrabberInfo");
+            ok = 0;
+        }
+    }
+    for (i = 0; i < n && ok; i++)
+        if (jobs[i].group == group && jobs[i].want_name && !reserve_generated(set, jobs, n, i, &next))
+            ok = 0;
+    for (i = 0; i < n && ok; i++) {
+        char derived[64];
+        int r;
+        if (jobs[i].group != group || jobs[i].want_name) continue;
+        if (jobs[i].kind == ASSET_QUANT_PAL) {
+            /* La paleta de un BMP se llama como el: HERO -> HERO_PAL */
+            if (jobs[i].companion && i > 0) strcpy(derived, jobs[i - 1].name);
+            else dat_sanitize_name(derived, jobs[i].path);
+            snprintf(jobs[i].name, sizeof(jobs[i].name), "%.59s_PAL", derived);
+        } else {
+            dat_sanitize_name(jobs[i].name, jobs[i].path);
+        }
+        if (!strict && generated_count(jobs, n, i)) {
+            if (!name_container(set, jobs, n, i, &next)) ok = 0;
+            continue;
+        }
+        if (!strict) {
+            strcpy(derived, jobs[i].name);
+            r = dat_names_add_unique(set, jobs[i].name, sizeof(jobs[i].name), i);
+            if (r < 0) ok = 0;
+            else if (r > 0)
+                fprintf(stderr, "Warning: NAME '%s' of '%s' is already used, stored as '%s'\n",
+                        derived, jobs[i].path, jobs[i].name);
+            continue;
+        }
+        other = dat_names_add(set, jobs[i].name, i);
+        if (other != DAT_NAME_NONE) {
+            fprintf(stderr, "Error: NAME '%s' of '%s' is already used by '%s'\n", jobs[i].name,
+                    jobs[i].path, other < n ? jobs[other].path : "GrabberInfo");
+            ok = 0;
+        } else if (!reserve_generated(set, jobs, n, i, &next)) {
+            ok = 0;
+        }
+    }
+    dat_names_free(set);
+    free(gen);
+    return ok;
+}
+
+int dat_assign_names(AssetJob *jobs, size_t n, int strict) {
+    size_t g;
+    /* Cada sub-datafile es un espacio de nombres propio, y cada atlas
+       tambien: su tabla busca los sprites por nombre. El BMP de --tiles
+       no sale en el DAT, pero no debe quitarle el nombre a su mapa */
+    if (!assign_scope(jobs, n, -1, strict)) return 0;
+    for (g = 0; g < n; g++)
+        if (dat_is_container(jobs[g].kind) && !assign_scope(jobs, n, (int)g, strict))
+            return 0;
+    return 1;
+}
+
+static void set_rle(DatObject *o, DatRleSprite *r) {
+    memcpy(o->type, "RLE ", 4); o->body.rle = r;
+    o->len_uncompressed = o->len_compressed = (s32)dat_rle_body_size(r);
+}
+
+const char *dat_job_quantize(const AssetJob *job, const DatConvertOptions *opt) {
+    if (job->kind != ASSET_BMP) return NULL;
+    return job->quantize ? job->quantize : opt->quantize;
+}
+
+int dat_load_palettes(const AssetJob *jobs, size_t n, DatConvertOptions *opt) {
+    size_t i;
+    opt->palettes = dat_palettes_create();
+    if (!opt->palettes) return 0;
+    for (i = 0; i < n; i++) {
+        const char *q = dat_job_quantize(&jobs[i], opt);
+        if (q && strcmp(q, "auto") != 0 && !dat_palettes_get(opt->palettes, q)) return 0;
+    }
+    return 1;
+}
+
+/* --quantize: indices de 8 bits sobre una paleta fija o sobre la que
+   se calcula para la imagen, que se queda en job->quant_pal para el job
+   ASSET_QUANT_PAL siguiente */
+static int quantize_bitmap(AssetJob *job, const DatConvertOptions *opt, DatBitmap **bmp) {
+    const char *q = dat_job_quantize(job, opt);
+    u8 *src_pal = NULL, auto_pal[256 * 3];
+    DatBitmap *conv = NULL;
+    int ok;
+
+    if (!q) return 1;
+    if (strcmp(q, "auto") == 0) {
+        free(job->quant_pal);
+        job->quant_pal = NULL;
+        /* Un BMP de 8 bpp ya esta indexado: se queda como esta, con la suya
+           (si no se puede leer, su ASSET_QUANT_PAL lo vuelve a intentar) */
+        if ((*bmp)->bits_per_pixel == 8) {
+            load_bmp_to_pal63(job->path, &job->quant_pal);
+            return 1;
+        }
+        ok = dat_quantize_auto(*bmp, auto_pal, &conv);
+        if (ok && (job->quant_pal = (u8*)malloc(sizeof(auto_pal))) != NULL)
+            memcpy(job->quant_pal, auto_pal, sizeof(auto_pal));
+    } else {
+        const DatPalMap *map = dat_palettes_find(opt->palettes, q);
+        if (!map) return 0;
+        if ((*bmp)->bits_per_pixel == 8 && !load_bmp_to_pal63(job->path, &src_pal)) {
+            snprintf(job->error, sizeof(job->error), "Error: could not read the palette of '%s' for --quantize", job->path);
+            return 0;
+        }
+        ok = dat_quantize_to_palette(*bmp, src_pal, map, &conv);
+        free(src_pal);
+    }
+    if (!ok) {
+        snprintf(job->error, sizeof(job->error), "Error: could not quantize '%s'", job->path);
+        return 0;
+    }
+    free_dat_bitmap(*bmp);
+    *bmp = conv;
+    return 1;
+}
+
+/* --depth/--dither efectivos: los del asset o, si no, los globales */
+static int job_depth(const AssetJob *job, const DatConvertOptions *opt) {
+    return job->depth ? job->depth : opt->depth;
+}
+
+static int job_dither(const AssetJob *job, const DatConvertOptions *opt) {
+    int depth = job_depth(job, opt);
+    if (depth != 15 && depth != 16) return DAT_DITHER_NONE;
+    return job->dither >= 0 ? job->dither : opt->dither;
+}
+
+/* --depth: reescribe el BMP cargado en el formato de Allegro para esa
+   profundidad. Uno de 8 bpp necesita su paleta */
+static int convert_depth(AssetJob *job, const DatConvertOptions *opt, DatBitmap **bmp) {
+    int depth = job_depth(job, opt);
+    u8 *pal = NULL;
+    DatBitmap *conv;
+    int ok;
+
+    if (!depth) return 1;
+    if ((*bmp)->bits_per_pixel == 8 && !load_bmp_to_pal63(job->path, &pal)) {
+        snprintf(job->error, sizeof(job->error), "Error: could not read the palette of '%s' for --depth %d", job->path, depth);
+        return 0;
+    }
+    ok = dat_bitmap_convert(*bmp, pal, depth, (DatDither)job_dither(job, opt), &conv);
+    free(pal);
+    if (!ok) {
+        snprintf(job->error, sizeof(job->error), "Error: could not convert '%s' to %d bpp", job->path, depth);
+        return 0;
+    }
+    free_dat_bitmap(*bmp);
+    *bmp = conv;
+    return 1;
+}
+
+/* "MIDI 'x.mid': 4096 -> 3100 bytes (24.3% saved, ...)". in es el body
+   sin optimizar (las pistas copiadas tal cual), no el .mid: el formato
+   de Allegro lleva siempre la cabecera de 32 pistas. 0 = no se sabe */
+static void midi_note(AssetJob *job, u64 in, u64 out, const char *why) {
+    double pct = in ? 100.0 * ((double)in - (double)out) / (double)in : 0.0;
+    if (!in) {
+        snprintf(job->note, sizeof(job->note), "MIDI '%s': %llu bytes (%s)", job->path, (unsigned long long)out,
+                 why);
+        return;
+    }
+    snprintf(job->note, sizeof(job->note), "MIDI '%s': %llu -> %llu bytes (%.1f%% %s%s%s)", job->path,
+             (unsigned long long)in, (unsigned long long)out, pct < 0 ? -pct : pct,
+             pct < 0 ? "larger" : "saved", why ? ", " : "", why ? why : "");
+}
+
+/* Bytes del fichero fuente, solo para --stats/--trace */
+static u64 source_bytes(const AssetJob *job) {
+    struct stat sb;
+    if (job->hashed) return job->src_size;
+    return stat(job->path, &sb) == 0 ? (u64)sb.st_size : 0;
+}
+
+/* load_file_bytes medido como lectura */
+static int read_source(const AssetJob *job, u8 **buf, u32 *size) {
+    u64 t0 = dat_stats_begin();
+    int ok = load_file_bytes(job->path, buf, size);
+    dat_stats_end(DAT_STAGE_READ, t0, job->path, ok ? *size : 0, ok ? *size : 0);
+    return ok;
+}
+
+/* BMP decodificado, medido como lectura */
+static int read_bitmap(const AssetJob *job, DatBitmap **bmp) {
+    u64 t0 = dat_stats_begin();
+    int ok = load_bmp_to_dat_bitmap(job->path, bmp);
+    dat_stats_end(DAT_STAGE_READ, t0, job->path, t0 && ok ? source_bytes(job) : 0,
+                  ok ? dat_bmp_body_size(*bmp) : 0);
+    return ok;
+}
+
+static int convert_body(AssetJob *job, const DatConvertOptions *opt) {
+    DatObject *o = &job->obj;
+    const char *path = job->path;
+    u64 t0;
+
+    switch (job->kind) {
+    case ASSET_BMP: {
+        DatBitmap *bmp = NULL;
+        DatRleSprite *r = NULL;
+        u32 loaded;
+        if (!read_bitmap(job, &bmp)) return 0;
+        loaded = dat_bmp_body_size(bmp);
+        t0 = dat_stats_begin();
+        if (!convert_depth(job, opt, &bmp) || !quantize_bitmap(job, opt, &bmp)) { free_dat_bitmap(bmp); return 0; }
+        /* Sin --depth se queda en su profundidad, pero en el orden R,G,B
+           de Allegro (32 bpp como RGBA) como lo que sale de dat_bitmap_convert */
+        if (!job_depth(job, opt)) dat_bitmap_to_rgb(bmp);
+        /* --auto-rle: el sprite RLE solo gana si ocupa menos, es decir, si
+           tiene transparencia suficiente para que tambien se dibuje antes.
+           Un sprite de atlas tiene que quedar como bitmap */
+        if (opt->auto_rle && !job->atlas && dat_rle_encode(bmp, &r)) {
+            if (dat_rle_body_size(r) < dat_bmp_body_size(bmp)) {
+                free_dat_bitmap(bmp);
+                set_rle(o, r);
+                dat_stats_end(DAT_STAGE_BMP, t0, path, loaded, (u64)o->len_uncompressed);
+                return 1;
+            }
+            free_dat_rle(r);
+        }
+        memcpy(o->type, "BMP ", 4); o->body.bmp = bmp;
+        o->len_uncompressed = o->len_compressed = (s32)dat_bmp_body_size(bmp);
+        dat_stats_end(DAT_STAGE_BMP, t0, path, loaded, (u64)o->len_uncompressed);
+        return 1;
+    }
+    case ASSET_RLE_BMP: {
+        /* RLE codificado aqui mismo desde un BMP */
+        DatBitmap *bmp = NULL;
+        DatRleSprite *r = NULL;
+        u32 loaded;
+        int ok;
+        if (!read_bitmap(job, &bmp)) return 0;
+        loaded = dat_bmp_body_size(bmp);
+        t0 = dat_stats_begin();
+        dat_bitmap_to_rgb(bmp);
+        ok = dat_rle_encode(bmp, &r);
+        free_dat_bitmap(bmp);
+        if (!ok) return 0;
+        set_rle(o, r);
+        dat_stats_end(DAT_STAGE_BMP, t0, path, loaded, (u64)o->len_uncompressed);
+        return 1;
+    }
+    case ASSET_PAL:
+    case ASSET_PAL_BMP: {
+        /* PAL desde ACT/RIFF/JASC o desde BMP indexado (1/4/8 bpp) */
+        u8 *pal = NULL;
+        t0 = dat_stats_begin();
+        if (!(job->kind == ASSET_PAL ? load_act_to_pal63(path, &pal) : load_bmp_to_pal63(path, &pal))) return 0;
+        memcpy(o->type, "PAL ", 4); o->body.pal = pal;
+        o->len_uncompressed = o->len_compressed = 256 * 4; /* Spec: 256 x {R,G,B,pad} */
+        dat_stats_end(DAT_STAGE_CONVERT, t0, path, t0 ? source_bytes(job) : 0, 256 * 4);
+        return 1;
+    }
+    case ASSET_QUANT_PAL: {
+        /* La paleta que --quantize auto dio a este BMP (o la suya si es de
+           8 bpp). La deja su job; solo si el BMP salio de la cache o del DAT
+           anterior hay que volver a calcularla */
+        DatBitmap *bmp = NULL;
+        u8 *pal = job->quant_pal;
+        int ok = 1;
+        job->quant_pal = NULL;
+        if (!pal && !read_bitmap(job, &bmp)) return 0;
+        t0 = dat_stats_begin();
+        if (!pal && bmp->bits_per_pixel == 8) {
+            ok = load_bmp_to_pal63(path, &pal);
+        } else if (!pal) {
+            pal = (u8*)malloc(256 * 3);
+            ok = pal && dat_quantize_auto(bmp, pal, NULL);
+        }
+        if (bmp) free_dat_bitmap(bmp);
+        if (!ok) { free(pal); return 0; }
+        memcpy(o->type, "PAL ", 4); o->body.pal = pal;
+        o->len_uncompressed = o->len_compressed = 256 * 4;
+        dat_stats_end(DAT_STAGE_CONVERT, t0, path, 0, 256 * 4);
+        return 1;
+    }
+    case ASSET_RLE: {
+        u8 *buf; u32 sz;
+        DatRleSprite *r;
+        if (!read_source(job, &buf, &sz)) return 0;
+        r = (DatRleSprite*)calloc(1, sizeof(DatRleSprite));
+        if (!r) { free(buf); return 0; }
+        r->bits_per_pixel = 8; r->len_image = sz; r->image = buf;
+        memcpy(o->type, "RLE ", 4); o->body.rle = r;
+        o->len_uncompressed = o->len_compressed = (s32)(2+2+2+4) + (s32)sz;
+        return 1;
+    }
+    case ASSET_FONT8:
+    case ASSET_FONT16: {
+        /* FONT 8x8 y 8x16 */
+        DatFont *font = NULL;
+        int is16 = (job->kind == ASSET_FONT16);
+        t0 = dat_stats_begin();
+        if (!(is16 ? build_font16_from_bmp(path, 128, &font) : build_font8_from_bmp(path, 128, &font))) return 0;
+        memcpy(o->type, "FONT", 4); o->body.font = font;
+        o->len_uncompressed = o->len_compressed = (2 + 95 * (is16 ? 16 : 8));
+        dat_stats_end(DAT_STAGE_CONVERT, t0, path, t0 ? source_bytes(job) : 0, (u64)o->len_uncompressed);
+        return 1;
+    }
+    case ASSET_MIDI: {
+        /* MIDI: convierte SMF (.mid) al formato interno de Allegro 4 */
+        u8 *raw; u32 raw_sz;
+        u8 *alg_buf = NULL;
+        unsigned int alg_sz = 0;
+        MidiConvertOptions mopt;
+        MidiConvertStats st;
+        int ok;
+        if (!read_source(job, &raw, &raw_sz)) return 0;
+        mopt.keep_meta = job->keep_meta;
+        t0 = dat_stats_begin();
+        ok = mid_to_allegro_dat(raw, raw_sz, &mopt, &alg_buf, &alg_sz, &st);
+        dat_stats_end(DAT_STAGE_MIDI, t0, path, raw_sz, ok ? alg_sz : 0);
+        free(raw);
+        if (!ok) {
+            snprintf(job->error, sizeof(job->error), "Error: no se pudo convertir '%s' a formato MIDI de Allegro", path);
+            return 0;
+        }
+        /* Cuanto se ha ahorrado y por que */
+        if (st.verbatim) {
+            midi_note(job, st.plain_size, alg_sz, "malformed track, copied verbatim");
+            if (st.tracks > ALLEGRO_MIDI_TRACKS)
+                snprintf(job->warning, sizeof(job->warning), "Warning: MIDI '%s': %u tracks, only the first %d kept",
+                         path, st.tracks, ALLEGRO_MIDI_TRACKS);
+        } else {
+            char why[96];
+            int n = snprintf(why, sizeof(why), "%u meta events removed", st.meta_removed);
+            if (st.merged)
+                snprintf(why + n, sizeof(why) - (size_t)n, ", %u tracks merged into the last one",
+                         st.merged);
+            midi_note(job, st.plain_size, alg_sz, why);
+            /* Allegro no tiene mas de 32 pistas: las de mas suenan juntas en la ultima */
+            if (st.merged)
+                snprintf(job->warning, sizeof(job->warning),
+                         "Warning: MIDI '%s': more than %d tracks, %u merged into track %d", path,
+                         ALLEGRO_MIDI_TRACKS, st.merged, ALLEGRO_MIDI_TRACKS);
+        }
+        memcpy(o->type, "MIDI", 4);
+        o->body.any = alg_buf;
+        o->len_uncompressed = o->len_compressed = (s32)alg_sz;
+        return 1;
+    }
+    case ASSET_WAV: {
+        /* WAV: convierte RIFF/PCM al formato interno SAMP de Allegro 4,
+           leyendo el PCM por bloques directamente sobre el body */
+        u8 *alg_buf = NULL;
+        unsigned int alg_sz = 0;
+        t0 = dat_stats_begin();
+        if (!wav_to_allegro_samp_file(path, &job->wav, &alg_buf, &alg_sz)) return 0;
+        dat_stats_end(DAT_STAGE_WAV, t0, path, t0 ? source_bytes(job) : 0, alg_sz);
+        memcpy(o->type, "SAMP", 4);
+        o->body.any = alg_buf;
+        o->len_uncompressed = o->len_compressed = (s32)alg_sz;
+        return 1;
+    }
+    case ASSET_FLIC: {
+        /* FLIC: animacion FLI/FLC, almacenada verbatim (spec: "standard format") */
+        u8 *buf; u32 sz;
+        if (!read_source(job, &buf, &sz)) return 0;
+        /* Validar magic FLI (0xAF11) o FLC (0xAF12) en offset 4, little-endian */
+        if (!(sz >= 6 && ((buf[4] == 0x11 && buf[5] == 0xAF) ||
+                          (buf[4] == 0x12 && buf[5] == 0xAF)))) {
+            snprintf(job->error, sizeof(job->error), "Error: '%s' is not a valid FLI/FLC file", path);
+            free(buf);
+            return 0;
+        }
+        memcpy(o->type, "FLIC", 4); o->body.any = buf;
+        o->len_uncompressed = o->len_compressed = (s32)sz;
+        return 1;
+    }
+    case ASSET_GROUP:
+    case ASSET_ATLAS:
+    case ASSET_TILES:
+        /* Se construye con dat_build_groups, cuando sus assets ya estan */
+        return 0;
+    case ASSET_DATA: {
+        /* DATA: blob generico */
+        u8 *buf; u32 sz;
+        if (!read_source(job, &buf, &sz)) return 0;
+        memcpy(o->type, "DATA", 4); o->body.any = buf;
+        o->len_uncompressed = o->len_compressed = (s32)sz;
+        return 1;
+    }
+    }
+    return 0;
+}
+
+void dat_convert_tag(const AssetJob *job, const DatConvertOptions *opt, char *buf, size_t cap) {
+    char depth[32] = "", quant[32] = "", kind_opts[64] = "";
+    const char *q = dat_job_quantize(job, opt);
+    /* --depth 15 paso de 5.5.5 a 5.6.5: "+d15" ya no describe lo mismo */
+    if (job->kind == ASSET_BMP && job_depth(job, opt)) {
+        int dither = job_dither(job, opt);
+        int d = job_depth(job, opt);
+        snprintf(depth, sizeof(depth), "+d%d%s%s%s", d, d == 15 ? "+565" : "", dither ? "+" : "",
+                 dither ? dat_dither_name((DatDither)dither) : "");
+    }
+    if (q) {
+        /* Una paleta fija cuenta por su contenido, no por el nombre */
+        const DatPalMap *map = strcmp(q, "auto") == 0 ? NULL : dat_palettes_find(opt->palettes, q);
+        if (map) snprintf(quant, sizeof(quant), "+q%016llx", (unsigned long long)map->hash);
+        else snprintf(quant, sizeof(quant), "+qauto");
+    }
+    /* Los SAMP de 16 bits pasaron a unsigned: lo convertido antes (en la
+       cache o en el HASH de dat update) ya no vale */
+    if (job->kind == ASSET_WAV) {
+        const WavConvertOptions *w = &job->wav;
+        char rate[16] = "", trim[16] = "";
+        if (w->rate) snprintf(rate, sizeof(rate), "+r%u", w->rate);
+        if (w->trim_db) snprintf(trim, sizeof(trim), "+trim%d", w->trim_db);
+        snprintf(kind_opts, sizeof(kind_opts), "+u16%s%s%s%s", rate, w->mono ? "+mono" : "",
+                 w->bits == 8 ? "+b8" : (w->bits == 16 ? "+b16" : ""), trim);
+    }
+    /* Los MIDI se reescriben optimizados: distinto de la copia de antes */
+    if (job->kind == ASSET_MIDI)
+        snprintf(kind_opts, sizeof(kind_opts), "+opt%s", job->keep_meta ? "+keep-meta" : "");
+    /* Los BMP de 24/32 bpp pasaron de B,G,R a R,G,B, los de 32 bpp a RGBA
+       con alfa solo si la cabecera lo declara, y sus sprites RLE de 3 bytes
+       a una palabra de 32 bits por pixel */
+    if (job->kind == ASSET_BMP || job->kind == ASSET_RLE_BMP)
+        snprintf(kind_opts, sizeof(kind_opts), "+rgb%s", job->kind == ASSET_RLE_BMP ? "+rle32" : "+rgba");
+    snprintf(buf, cap, "%s%s%s%s%s", dat_asset_option_name(job->kind), depth, quant, kind_opts,
+             job->kind == ASSET_BMP && opt->auto_rle && !job->atlas ? "+auto-rle32" : "");
+}
+
+/* Los tipos que se guardan tal cual ya son una copia del fichero: no
+   compensa cachearlos */
+static int cacheable(AssetKind kind) {
+    return kind != ASSET_RLE && kind != ASSET_FLIC && kind != ASSET_DATA;
+}
+
+/* Un WAV que solo hay que reordenar no se lee aqui: el objeto queda con
+   su cabecera y su tamano, y dat_body_stream_* lo generan al escribirlo */
+static int stream_samp(AssetJob *job) {
+    WavStream ws;
+    FILE *f;
+    u64 t0;
+    int ok;
+
+    if (job->kind != ASSET_WAV || !job->stream_body || !(f = fopen(job->path, "rb"))) return 0;
+    t0 = dat_stats_begin();
+    ok = wav_stream_open(&ws, f) && wav_stream_is_plain(&ws, &job->wav) && wav_stream_body_size(&ws) <= 0x7FFFFFFFu;
+    fclose(f);
+    if (!ok) return 0; /* convert_body lo convierte o explica el error */
+    memcpy(job->obj.type, "SAMP", 4);
+    job->obj.len_uncompressed = job->obj.len_compressed = (s32)wav_stream_body_size(&ws);
+    dat_stats_end(DAT_STAGE_WAV, t0, job->path, 0, (u64)job->obj.len_uncompressed);
+    return 1;
+}
+
+int dat_convert_asset(AssetJob *job, const DatConvertOptions *opt) {
+    char tagbuf[64];
+    const char *tag = NULL;
+    u64 t_obj = dat_stats_begin(), t0;
+
+    memset(&job->obj, 0, sizeof(job->obj));
+    job->error[0] = '\0';
+    job->note[0] = '\0';
+    job->warning[0] = '\0';
+    /* Lo que se copia por bloques al escribir no pasa por la cache */
+    job->streamed = stream_samp(job);
+    if (opt->cache && cacheable(job->kind) && !job->streamed) {
+        dat_convert_tag(job, opt, tagbuf, sizeof(tagbuf));
+        tag = tagbuf + 2; /* sin "--" */
+    }
+    if (tag && !job->hashed) {
+        t0 = dat_stats_begin();
+        job->hashed = dat_hash_file(job->path, &job->src_hash, &job->src_size);
+        dat_stats_end(DAT_STAGE_HASH, t0, job->path, job->hashed ? job->src_size : 0, 0);
+    }
+    t0 = tag && job->hashed ? dat_stats_begin() : 0;
+    if (job->streamed) {
+        job->ok = 1;
+    } else if (tag && job->hashed && dat_cache_get(opt->cache, tag, job->src_hash, job->src_size, &job->obj)) {
+        job->ok = 1;
+        dat_stats_end(DAT_STAGE_CACHE, t0, job->path, 0, (u64)job->obj.len_uncompressed);
+        if (job->kind == ASSET_MIDI)
+            midi_note(job, 0, (u64)job->obj.len_uncompressed, "cached");
+    } else {
+        dat_stats_end(DAT_STAGE_CACHE, t0, job->path, 0, 0);
+        job->ok = convert_body(job, opt);
+        if (job->ok && tag && job->hashed) {
+            t0 = dat_stats_begin();
+            dat_cache_put(opt->cache, tag, job->src_hash, job->src_size, &job->obj);
+            dat_stats_end(DAT_STAGE_CACHE, t0, job->path, (u64)job->obj.len_uncompressed, 0);
+        }
+    }
+    if (job->ok) set_std_props(&job->obj, job, opt->datestr);
+    if (job->kind == ASSET_QUANT_PAL) {
+        /* Servida por la cache: la que dejo su BMP sobra */
+        free(job->quant_pal);
+        job->quant_pal = NULL;
+    }
+    dat_stats_end(DAT_STAGE_OBJECT, t_obj, job->path, t_obj ? source_bytes(job) : 0,
+                  job->ok ? (u64)job->obj.len_uncompressed : 0);
+    return job->ok;
+}
+
+int dat_convert_pass(const AssetJob *job) {
+    return job->kind == ASSET_QUANT_PAL && job->companion;
+}
+
+void dat_take_quant_pal(AssetJob *jobs, size_t i) {
+    if (i == 0 || !dat_convert_pass(&jobs[i])) return;
+    free(jobs[i].quant_pal);
+    jobs[i].quant_pal = jobs[i - 1].quant_pal;
+    jobs[i - 1].quant_pal = NULL;
+}
+
+typedef struct {
+    AssetJob                *jobs;
+    const DatConvertOptions *opt;
+    int                      pass;
+} ConvertRun;
+
+static void convert_task(void *ctx, size_t i) {
+    ConvertRun *run = (ConvertRun*)ctx;
+    if (dat_is_container(run->jobs[i].kind) || dat_convert_pass(&run->jobs[i]) != run->pass) return;
+    dat_take_quant_pal(run->jobs, i);
+    dat_convert_asset(&run->jobs[i], run->opt);
+}
+
+void dat_convert_assets(AssetJob *jobs, size_t n, const DatConvertOptions *opt, int threads) {
+    ConvertRun run;
+    size_t i;
+    run.jobs = jobs;
+    run.opt = opt;
+    /* Las paletas de --quantize auto despues de sus BMP */
+    for (run.pass = 0; run.pass < 2; run.pass++) {
+        for (i = 0; i < n && dat_convert_pass(&jobs[i]) != run.pass; i++) {}
+        if (i < n) dat_parallel_for(threads, n, convert_task, &run);
+    }
+}
+
+/* ------------------------------------------------------------------ */
+/* Sub-datafiles                                                       */
+/* ------------------------------------------------------------------ */
+
+typedef struct {
+    AssetJob                *jobs;
+    size_t                   n;
+    const DatConvertOptions *opt;
+    const size_t            *level;   /* grupos del nivel que se construye */
+} GroupRun;
+
+static int group_depth(const AssetJob *jobs, size_t i) {
+    int d = 0;
+    while (jobs[i].group >= 0) { i = (size_t)jobs[i].group; d++; }
+    return d;
+}
+
+/* Objetos que no vienen de un fichero: sin ORIG, que dat update tomaria
+   por el de un asset */
+static void set_built_props(DatObject *o, const char *datestr, const char *name) {
+    o->num_properties = 2;
+    o->properties = (Property*)calloc(2, sizeof(Property));
+    dat_set_prop(&o->properties[0], "DATE", datestr);
+    dat_set_prop(&o->properties[1], "NAME", name);
+}
+
+/* Los objetos del grupo (en orden de linea de comandos) pasan a ser el
+   cuerpo de su FILE; el NAME es el del grupo y no hay ORIG */
+static void group_task(GroupRun *run, size_t g) {
+    size_t i, m = 0;
+    AssetJob *job = &run->jobs[g];
+    DatObject *objs, *o = &job->obj;
+    u8 *buf = NULL;
+    u32 size = 0;
+    u64 t0 = dat_stats_begin();
+
+    memset(o, 0, sizeof(*o));
+    job->ok = 0;
+    objs = (DatObject*)calloc(run->n - g, sizeof(DatObject));
+    if (objs) {
+        /* Un grupo va siempre antes que sus assets; un atlas aporta
+           varios objetos, pero nunca mas que sus sprites */
+        for (i = g + 1; i < run->n; i++)
+            if (run->jobs[i].group == (int)g && run->jobs[i].ok) m += dat_take_job_objects(&run->jobs[i], objs + m);
+        job->ok = dat_serialize_objects(objs, (u32)m, &buf, &size);
+        for (i = 0; i < m; i++) free_dat_object(&objs[i]);
+        free(objs);
+    }
+    if (!job->ok) {
+        snprintf(job->error, sizeof(job->error), "Error: could not build group '%s'", job->path);
+        return;
+    }
+    memcpy(o->type, "FILE", 4);
+    o->body.any = buf;
+    o->len_uncompressed = o->len_compressed = (s32)size;
+    set_built_props(o, run->opt->datestr, job->name);
+    dat_stats_end(DAT_STAGE_GROUPS, t0, job->name, 0, size);
+}
+
+/* Pixeles de un sprite ya convertido: del bitmap o de su cuerpo guardado
+   (cache, dat update), descomprimido si hace falta. *owned se libera */
+static int sprite_view(const DatObject *o, DatBitmap *view, u8 **owned) {
+    const u8 *b;
+    u32 size;
+
+    *owned = NULL;
+    if (memcmp(o->type, "BMP ", 4) != 0) return 0;
+    if (!o->stored) {
+        *view = *o->body.bmp;
+        return 1;
+    }
+    if (o->len_uncompressed < 0) {
+        size = (u32)-o->len_uncompressed;
+        *owned = (u8*)malloc(size ? size : 1);
+        if (!*owned || !lzss_unpack_buffer(o->stored, (size_t)o->len_compressed, *owned, size)) return 0;
+        b = *owned;
+    } else {
+        size = (u32)o->len_compressed;
+        b = o->stored;
+    }
+    if (size < 6) return 0;
+    view->bits_per_pixel = (s16)((b[0] << 8) | b[1]);
+    view->width = (u16)((b[2] << 8) | b[3]);
+    view->height = (u16)((b[4] << 8) | b[5]);
+    view->image = (u8*)b + 6;
+    return (u64)size == 6 + (u64)view->width * view->height * dat_bitmap_pixel_size(view->bits_per_pixel);
+}
+
+/* Los sprites del atlas van a sus paginas (NAME_PAGE0, ...) y la tabla
+   de rectangulos queda como objeto del job, con el NAME del atlas */
+static void atlas_task(GroupRun *run, size_t g) {
+    AssetJob *job = &run->jobs[g];
+    size_t i;
+    u32 m = 0, k, p, pages = 0, table_size = 0;
+    DatBitmap *views = NULL;
+    const DatBitmap **sprites = NULL;
+    const char **names = NULL;
+    u8 **owned = NULL, *table = NULL;
+    u16 *w = NULL, *h = NULL, *page_w = NULL, *page_h = NULL;
+    DatAtlasRect *rects = NULL;
+    const char *bad = NULL, *first = NULL;
+    u64 t0 = dat_stats_begin(), bytes = 0;
+
+    memset(&job->obj, 0, sizeof(job->obj));
+    job->ok = 0;
+    for (i = g + 1; i < run->n; i++)
+        if (run->jobs[i].group == (int)g) m++;
+    if (!m) {
+        snprintf(job->error, sizeof(job->error), "Error: atlas '%s' has no sprites", job->path);
+        return;
+    }
+    if (m > DAT_ATLAS_MAX_SPRITES) {
+        snprintf(job->error, sizeof(job->error), "Error: atlas '%s' has more than %u sprites", job->path,
+                 DAT_ATLAS_MAX_SPRITES);
+        return;
+    }
+    views = (DatBitmap*)calloc(m, sizeof(DatBitmap));
+    sprites = (const DatBitmap**)calloc(m, sizeof(DatBitmap*));
+    names = (const char**)calloc(m, sizeof(char*));
+    owned = (u8**)calloc(m, sizeof(u8*));
+    w = (u16*)calloc(m, sizeof(u16));
+    h = (u16*)calloc(m, sizeof(u16));
+    page_w = (u16*)calloc(m, sizeof(u16));
+    page_h = (u16*)calloc(m, sizeof(u16));
+    rects = (DatAtlasRect*)calloc(m, sizeof(DatAtlasRect));
+    if (!views || !sprites || !names || !owned || !w || !h || !page_w || !page_h || !rects) {
+        snprintf(job->error, sizeof(job->error), "Error: out of memory building atlas '%s'", job->path);
+        goto done;
+    }
+
+    for (i = g + 1, k = 0; i < run->n; i++) {
+        AssetJob *s = &run->jobs[i];
+        if (s->group != (int)g) continue;
+        if (!s->ok || !sprite_view(&s->obj, &views[k], &owned[k])) {
+            snprintf(job->error, sizeof(job->error), "Error: atlas '%s': could not convert '%s'", job->path,
+                     s->path);
+            goto done;
+        }
+        if (views[k].bits_per_pixel != views[0].bits_per_pixel) {
+            snprintf(job->error, sizeof(job->error),
+                     "Error: atlas '%s': '%s' is %d bpp and '%s' %d bpp (give the atlas a --depth)", job->path,
+                     s->path, views[k].bits_per_pixel, first, views[0].bits_per_pixel);
+            goto done;
+        }
+        if (views[k].width > run->opt->atlas_w || views[k].height > run->opt->atlas_h) {
+            snprintf(job->error, sizeof(job->error), "Error: atlas '%s': '%s' (%ux%u) is larger than --atlas-size %ux%u",
+                     job->path, s->path, views[k].width, views[k].height, run->opt->atlas_w, run->opt->atlas_h);
+            goto done;
+        }
+        if (!k) first = s->path;
+        sprites[k] = &views[k];
+        names[k] = s->name;
+        w[k] = views[k].width;
+        h[k] = views[k].height;
+        k++;
+    }
+
+    pages = dat_atlas_pack(w, h, m, run->opt->atlas_w, run->opt->atlas_h, rects, page_w, page_h);
+    table = pages ? dat_atlas_table(rects, names, m, pages, &table_size) : NULL;
+    job->pages = table ? (DatObject*)calloc(pages, sizeof(DatObject)) : NULL;
+    if (!job->pages) {
+        bad = "out of memory";
+        goto done;
+    }
+    for (p = 0; p < pages; p++) {
+        DatObject *o = &job->pages[p];
+        char name[GEN_NAME];
+        DatBitmap *bmp = dat_atlas_page(sprites, rects, m, (u16)p, page_w[p], page_h[p]);
+        if (!bmp) {
+            bad = "out of memory";
+            goto done;
+        }
+        memcpy(o->type, "BMP ", 4);
+        o->body.bmp = bmp;
+        o->len_uncompressed = o->len_compressed = (s32)dat_bmp_body_size(bmp);
+        generated_name(name, ASSET_ATLAS, job->name, p);
+        set_built_props(o, run->opt->datestr, name);
+        job->num_pages++;
+        bytes += (u64)o->len_uncompressed;
+    }
+    memcpy(job->obj.type, "DATA", 4);
+    job->obj.body.any = table;
+    job->obj.len_uncompressed = job->obj.len_compressed = (s32)table_size;
+    set_built_props(&job->obj, run->opt->datestr, job->name);
+    table = NULL;
+    job->ok = 1;
+    snprintf(job->note, sizeof(job->note), "Atlas '%s': %u sprite%s on %u page%s (%.1f KB)", job->name, m,
+             m == 1 ? "" : "s", pages, pages == 1 ? "" : "s", (double)bytes / 1024.0);
+
+done:
+    if (bad) snprintf(job->error, sizeof(job->error), "Error: %s building atlas '%s'", bad, job->path);
+    if (!job->ok) dat_free_job_objects(job);
+    /* Los sprites ya estan en las paginas (o el atlas fallo) */
+    for (i = g + 1; i < run->n; i++) {
+        if (run->jobs[i].group != (int)g) continue;
+        free_dat_object(&run->jobs[i].obj);
+        memset(&run->jobs[i].obj, 0, sizeof(DatObject));
+    }
+    for (k = 0; owned && k < m; k++) free(owned[k]);
+    free(owned);
+    free(table);
+    free(views);
+    free(sprites);
+    free(names);
+    free(w);
+    free(h);
+    free(page_w);
+    free(page_h);
+    free(rects);
+    dat_stats_end(DAT_STAGE_ATLAS, t0, job->name, 0, bytes + table_size);
+}
+
+/* --tiles: el bitmap de su unico job pasa a tileset (NAME_TILES) y mapa */
+static void tiles_task(GroupRun *run, size_t g) {
+    AssetJob *job = &run->jobs[g], *src = &run->jobs[g + 1];
+    DatBitmap view;
+    DatTileset ts;
+    DatObject *o;
+    u8 *owned = NULL;
+    char name[GEN_NAME];
+    u64 t0 = dat_stats_begin(), in = 0;
+
+    memset(&job->obj, 0, sizeof(job->obj));
+    job->ok = 0;
+    if (!src->ok || !sprite_view(&src->obj, &view, &owned)) {
+        snprintf(job->error, sizeof(job->error), "Error: --tiles: could not convert '%s'", job->path);
+        goto done;
+    }
+    in = 6 + (u64)view.width * view.height * dat_bitmap_pixel_size(view.bits_per_pixel);
+    if (view.width % job->tile_w || view.height % job->tile_h) {
+        snprintf(job->error, sizeof(job->error), "Error: --tiles: '%s' is %ux%u, not a multiple of %ux%u tiles",
+                 job->path, view.width, view.height, job->tile_w, job->tile_h);
+        goto done;
+    }
+    if (!dat_tiles_build(&view, job->tile_w, job->tile_h, job->tile_flips, &ts)) {
+        if (ts.tiles > dat_tiles_limit(job->tile_h))
+            snprintf(job->error, sizeof(job->error),
+                     "Error: --tiles: '%s' has more than %u distinct %ux%u tiles (use larger tiles or --bmp)",
+                     job->path, dat_tiles_limit(job->tile_h), job->tile_w, job->tile_h);
+        else
+            snprintf(job->error, sizeof(job->error), "Error: out of memory cutting '%s' into tiles", job->path);
+        goto done;
+    }
+    job->pages = (DatObject*)calloc(1, sizeof(DatObject));
+    if (!job->pages) {
+        dat_tileset_free(&ts);
+        snprintf(job->error, sizeof(job->error), "Error: out of memory cutting '%s' into tiles", job->path);
+        goto done;
+    }
+    o = &job->pages[0];
+    job->num_pages = 1;
+    memcpy(o->type, "BMP ", 4);
+    o->body.bmp = ts.tileset;
+    o->len_uncompressed = o->len_compressed = (s32)dat_bmp_body_size(ts.tileset);
+    generated_name(name, ASSET_TILES, job->name, 0);
+    set_built_props(o, run->opt->datestr, name);
+    memcpy(job->obj.type, "DATA", 4);
+    job->obj.body.any = ts.map;
+    job->obj.len_uncompressed = job->obj.len_compressed = (s32)ts.map_size;
+    set_built_props(&job->obj, run->opt->datestr, job->name);
+    job->ok = 1;
+    snprintf(job->note, sizeof(job->note), "Tiles '%s': %u of %u %ux%u tiles unique, %.1f -> %.1f KB (%.1f:1)",
+             job->path, ts.tiles, ts.map_w * ts.map_h, job->tile_w, job->tile_h, (double)in / 1024.0,
+             (double)(o->len_uncompressed + ts.map_size) / 1024.0,
+             (double)in / (double)(o->len_uncompressed + ts.map_size));
+
+done:
+    free(owned);
+    free_dat_object(&src->obj);
+    memset(&src->obj, 0, sizeof(DatObject));
+    dat_stats_end(DAT_STAGE_TILES, t0, job->path, in,
+                  job->ok ? (u64)job->pages[0].len_uncompressed + (u64)job->obj.len_uncompressed : 0);
+}
+
+static void container_task(void *ctx, size_t k) {
+    GroupRun *run = (GroupRun*)ctx;
+    size_t g = run->level[k];
+    if (run->jobs[g].kind == ASSET_ATLAS) atlas_task(run, g);
+    else if (run->jobs[g].kind == ASSET_TILES) tiles_task(run, g);
+    else group_task(run, g);
+}
+
+void dat_build_groups(AssetJob *jobs, size_t first, size_t n, const DatConvertOptions *opt, int threads) {
+    GroupRun run;
+    size_t *level, i, count;
+    int depth, max_depth = -1;
+
+    for (i = first; i < n; i++)
+        if (dat_is_container(jobs[i].kind) && group_depth(jobs, i) > max_depth) max_depth = group_depth(jobs, i);
+    if (max_depth < 0) return;
+    level = (size_t*)malloc(sizeof(size_t) * (n - first));
+    if (!level) return;
+    run.jobs = jobs;
+    run.n = n;
+    run.opt = opt;
+    run.level = level;
+    /* Los grupos de dentro primero: su FILE es un objeto del de fuera */
+    for (depth = max_depth; depth >= 0; depth--) {
+        count = 0;
+        for (i = first; i < n; i++)
+            if (dat_is_container(jobs[i].kind) && group_depth(jobs, i) == depth) level[count++] = i;
+        dat_parallel_for(threads, count, container_task, &run);
+    }
+    free(level);
+}
+
+u32 dat_take_job_objects(AssetJob *job, DatObject *out) {
+    u32 k, n = 0;
+    for (k = 0; k < job->num_pages; k++) out[n++] = job->pages[k];
+    free(job->pages);
+    job->pages = NULL;
+    job->num_pages = 0;
+    out[n++] = job->obj;
+    memset(&job->obj, 0, sizeof(job->obj));
+    return n;
+}
+
+struct DatBodyStream {
+    FILE     *f;
+    WavStream ws;
+    u8        hdr[8];
+    u32       hdr_left;
+};
+
+DatBodyStream *dat_body_stream_open(const AssetJob *job, u32 size) {
+    DatBodyStream *s = (DatBodyStream*)calloc(1, sizeof(DatBodyStream));
+    if (!s) return NULL;
+    s->f = fopen(job->path, "rb");
+    /* El fichero puede haber cambiado desde que se miro */
+    if (!s->f || !wav_stream_open(&s->ws, s->f) || !wav_stream_is_plain(&s->ws, &job->wav) ||
+        wav_stream_body_size(&s->ws) != size) {
+        if (s->f) fclose(s->f);
+        free(s);
+        return NULL;
+    }
+    wav_stream_header(&s->ws, s->hdr);
+    s->hdr_left = 8;
+    return s;
+}
+
+u32 dat_body_stream_read(void *stream, u8 *dst, u32 cap) {
+    DatBodyStream *s = (DatBodyStream*)stream;
+    if (s->hdr_left) {
+        u32 n = cap < s->hdr_left ? cap : s->hdr_left;
+        memcpy(dst, s->hdr + 8 - s->hdr_left, n);
+        s->hdr_left -= n;
+        return n;
+    }
+    return wav_stream_read(&s->ws, dst, cap);
+}
+
+int dat_body_stream_close(DatBodyStream *s) {
+    int ok = !s->hdr_left && !s->ws.data_left;
+    fclose(s->f);
+    free(s);
+    return ok;
+}
+
+void dat_free_job_objects(AssetJob *job) {
+    u32 k;
+    for (k = 0; k < job->num_pages; k++) free_dat_object(&job->pages[k]);
+    free(job->pages);
+    job->pages = NULL;
+    job->num_pages = 0;
+    free_dat_object(&job->obj);
+    memset(&job->obj, 0, sizeof(job->obj));
+}
@@ -0,0 +1,168 @@
+/* src/dat_build.h
+ *
+ * Conversion of source assets (BMP, WAV, MIDI, ...) into DAT objects.
+ *
+ * Each AssetJob is converted independently, so a batch can run on several
+ * threads; results land in the job itself and are committed by the caller
+ * in its own (command-line) order, which keeps the output deterministic.
+ */
+#ifndef DAT_BUILD_H
+#define DAT_BUILD_H
+
+#include "allegro_dat_structs.h"
+#include "dat_cache.h"
+#include "dat_quantize.h"
+#include "wav_to_allegro.h"
+
+typedef enum {
+    ASSET_BMP,
+    ASSET_PAL,
+    ASSET_PAL_BMP,
+    ASSET_RLE,
+    ASSET_RLE_BMP,
+    ASSET_FONT8,
+    ASSET_FONT16,
+    ASSET_MIDI,
+    ASSET_WAV,
+    ASSET_FLIC,
+    ASSET_DATA,
+    ASSET_QUANT_PAL,      /* palette --quantize auto builds for a BMP */
+    ASSET_GROUP,          /* --begin-group: sub-datafile of the jobs whose group is it */
+    ASSET_ATLAS,          /* --begin-atlas: pages and table of the BMP jobs whose group is it */
+    ASSET_TILES           /* --tiles: tileset and map of the one BMP job whose group is it */
+} AssetKind;
+
+typedef struct {
+    AssetKind   kind;
+    const char *path;     /* source file, stored as ORIG (group: its name) */
+    const char *want_name; /* explicit NAME, NULL = derived from path */
+    char        name[64];   /* NAME actually used, set by dat_assign_names */
+    DatObject   obj;      /* converted object (valid when ok) */
+    int         ok;
+    char        error[256]; /* message for the user when !ok ("" = silent) */
+    u64         src_hash;   /* XXH64 and size of path, valid when hashed */
+    u64         src_size;
+    int         hashed;     /* set by the cache or by update, reused by the other */
+    int         depth;      /* --depth of this BMP, 0 = DatConvertOptions.depth */
+    int         dither;     /* --dither (DatDither), -1 = DatConvertOptions.dither */
+    const char *quantize;   /* --quantize: "auto" or a palette file, NULL = DatConvertOptions.quantize */
+    int         companion;  /* ASSET_QUANT_PAL added for the --bmp just before it */
+    u8         *quant_pal;  /* BMP: palette --quantize auto gave it, until its companion takes it */
+    WavConvertOptions wav;  /* --rate/--mono/--bits/--trim-silence of this WAV */
+    int         keep_meta;  /* --keep-meta: MIDI keeps text/lyric/... meta events */
+    char        note[192];  /* report for the user when ok ("" = none), e.g. MIDI bytes saved */
+    char        warning[192]; /* printed on stderr when ok ("" = none), e.g. MIDI tracks merged */
+    int         stream_body; /* WAV the caller can write with dat_body_stream_* (top level, not packed) */
+    int         streamed;   /* obj has its properties and lengths but no body: see dat_body_stream_open */
+    int         group;      /* index of the enclosing container job (dat_is_container), -1 = top level */
+    int         atlas;      /* BMP of an atlas or of --tiles: stays a bitmap, never --auto-rle */
+    DatObject  *pages;      /* written before obj: atlas bitmaps (obj is the table), tileset (obj is the map) */
+    u32         num_pages;
+    u16         tile_w;     /* ASSET_TILES: --tiles WxH */
+    u16         tile_h;
+    int         tile_flips; /* --tile-flips: mirrored tiles are the same tile */
+} AssetJob;
+
+/* Settings shared by every conversion of a build */
+typedef struct {
+    const char *datestr;      /* DATE property of new objects */
+    DatCache   *cache;        /* converted bodies, NULL = no cache */
+    int         reproducible; /* reused objects also get datestr as DATE */
+    int         auto_rle;     /* --bmp: store as RLE sprite when smaller */
+    int         depth;        /* --default-depth: 15/16/24/32, 0 = as loaded */
+    int         dither;       /* --default-dither (DatDither) */
+    const char *quantize;     /* --default-quantize, NULL = keep the depth */
+    DatPaletteSet *palettes;  /* fixed --quantize palettes, see dat_load_palettes */
+    u32         atlas_w;      /* --atlas-size: largest atlas page */
+    u32         atlas_h;
+} DatConvertOptions;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Maps a command-line option ("--bmp", "--wav", ...) to its kind; -1 if unknown. */
+int dat_asset_kind_from_option(const char *opt);
+
+/* Option name of a kind ("--bmp", ...) */
+const char *dat_asset_option_name(AssetKind kind);
+
+/* DAT object type a kind produces ("BMP ", "SAMP", ...) */
+const char *dat_asset_object_type(AssetKind kind);
+
+/* Groups, atlases and --tiles: jobs built by dat_build_groups from the
+   jobs inside them, never converted themselves */
+int dat_is_container(AssetKind kind);
+
+/* --quantize source of a job ("auto", a palette file, or NULL) */
+const char *dat_job_quantize(const AssetJob *job, const DatConvertOptions *opt);
+
+/* Loads every fixed --quantize palette the jobs use into opt->palettes
+   (created here, freed with dat_palettes_free), so the tables are built
+   once before converting in parallel. Returns 0 if one cannot be read. */
+int dat_load_palettes(const AssetJob *jobs, size_t n, DatConvertOptions *opt);
+
+/* Identifies the converter and the options that shape its output
+   ("--bmp", "--bmp+d16+ordered+rgb+auto-rle32", "--wav+u16+r22050+mono",
+   "--midi+opt"): part of the cache key and of the HASH
+   property, so changing an option reconverts. */
+void dat_convert_tag(const AssetJob *job, const DatConvertOptions *opt, char *buf, size_t cap);
+
+/* Gives every job a NAME that is unique in its datafile (the DAT or its
+   group; case-insensitively, as Allegro compares). Explicit names must not collide; derived ones get
+   a _2, _3... suffix, with a warning, unless strict. The NAME_PAGEk and
+   NAME_TILES objects of atlases and --tiles count as names too. Returns 0
+   on error. */
+int dat_assign_names(AssetJob *jobs, size_t n, int strict);
+
+/* Converts one asset (or fetches it from opt->cache); DATE/NAME/ORIG
+   properties are added to job->obj. */
+int dat_convert_asset(AssetJob *job, const DatConvertOptions *opt);
+
+/* A companion ASSET_QUANT_PAL takes the palette of the BMP just before
+   it, so it is converted in a second pass (1; everything else is pass 0).
+   dat_take_quant_pal hands the palette of jobs[i - 1] to jobs[i]. */
+int  dat_convert_pass(const AssetJob *job);
+void dat_take_quant_pal(AssetJob *jobs, size_t i);
+
+/* Converts jobs[0..n) on 'threads' workers. */
+void dat_convert_assets(AssetJob *jobs, size_t n, const DatConvertOptions *opt, int threads);
+
+/* Builds the "FILE" object of every ASSET_GROUP job in jobs[first..n)
+   from the converted jobs inside it, the pages and table of every
+   ASSET_ATLAS job (see dat_atlas.h) and the tileset and map of every
+   ASSET_TILES job (see dat_tiles.h), innermost first and those of one
+   nesting level in parallel. A group and everything in it must lie
+   inside the range. The objects of the grouped jobs are moved into the
+   group or atlas and freed; only top-level jobs go into the DAT. */
+void dat_build_groups(AssetJob *jobs, size_t first, size_t n, const DatConvertOptions *opt, int threads);
+
+/* Moves the objects of a converted job into out: the pages of an atlas
+   or the tileset of --tiles, then job->obj. Returns how many; never more than the jobs of the unit
+   (an atlas has a page at most per sprite). */
+u32 dat_take_job_objects(AssetJob *job, DatObject *out);
+
+/* Frees whatever dat_take_job_objects would have moved. */
+void dat_free_job_objects(AssetJob *job);
+
+/* Body of a streamed job (a stream_body WAV that only needs its samples
+   reordered), produced block by block from the file when it is written,
+   so a long sample never sits in memory: pass dat_body_stream_read to
+   dat_writer_add_streamed. open returns NULL if the file no longer gives
+   a body of size bytes; close returns 1 if all of it was read. */
+typedef struct DatBodyStream DatBodyStream;
+DatBodyStream *dat_body_stream_open(const AssetJob *job, u32 size);
+u32  dat_body_stream_read(void *stream, u8 *dst, u32 cap);
+int  dat_body_stream_close(DatBodyStream *s);
+
+/* Property helpers shared with the CLI */
+char *dat_dupstr(const char *s);
+void  dat_set_prop(Property *p, const char type4[4], const char *value);
+const char *dat_basename(const char *path);
+void  dat_sanitize_name(char *dest, const char *path);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DAT_BUILD_H */
@@ -0,0 +1,163 @@
+/* src/dat_cache.c */
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "dat_cache.h"
+#include "dat_writer.h"
+
+#define CACHE_MAGIC   0x44415443u  /* 'DATC' */
+#define CACHE_HEADER  32           /* magic, version, hash, size, type, len */
+
+struct DatCache {
+    char          *dir;
+    atomic_size_t  hits;
+    atomic_size_t  misses;
+    atomic_size_t  temps;
+};
+
+static void put_be32(u8 *p, u32 v) {
+    p[0] = (u8)(v >> 24); p[1] = (u8)(v >> 16); p[2] = (u8)(v >> 8); p[3] = (u8)v;
+}
+
+static u32 get_be32(const u8 *p) {
+    return ((u32)p[0] << 24) | ((u32)p[1] << 16) | ((u32)p[2] << 8) | (u32)p[3];
+}
+
+static void put_be64(u8 *p, u64 v) {
+    put_be32(p, (u32)(v >> 32));
+    put_be32(p + 4, (u32)v);
+}
+
+static u64 get_be64(const u8 *p) {
+    return ((u64)get_be32(p) << 32) | get_be32(p + 4);
+}
+
+DatCache *dat_cache_open(const char *dir) {
+    DatCache *cache;
+    struct stat st;
+    size_t n = strlen(dir);
+
+    if (mkdir(dir, 0777) != 0 && errno != EEXIST) return NULL;
+    if (stat(dir, &st) != 0 || !S_ISDIR(st.st_mode)) return NULL;
+    cache = (DatCache*)calloc(1, sizeof(DatCache));
+    if (!cache) return NULL;
+    cache->dir = (char*)malloc(n + 1);
+    if (!cache->dir) { free(cache); return NULL; }
+    memcpy(cache->dir, dir, n + 1);
+    atomic_init(&cache->hits, 0);
+    atomic_init(&cache->misses, 0);
+    atomic_init(&cache->temps, 0);
+    return cache;
+}
+
+void dat_cache_close(DatCache *cache) {
+    if (!cache) return;
+    free(cache->dir);
+    free(cache);
+}
+
+void dat_cache_counts(DatCache *cache, size_t *hits, size_t *misses) {
+    *hits = cache ? atomic_load(&cache->hits) : 0;
+    *misses = cache ? atomic_load(&cache->misses) : 0;
+}
+
+/* <dir>/ab/abcdef...-size-tag; shard != NULL recibe solo el directorio */
+static void entry_path(const DatCache *cache, const char *tag, u64 hash, u64 size,
+                       char *path, size_t cap, char *shard, size_t shard_cap) {
+    char hex[17];
+    snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)hash);
+    if (shard) snprintf(shard, shard_cap, "%s/%.2s", cache->dir, hex);
+    snprintf(path, cap, "%s/%.2s/%s-%llu-%s-v%d", cache->dir, hex, hex,
+             (unsigned long long)size, tag, DAT_CACHE_VERSION);
+}
+
+int dat_cache_get(DatCache *cache, const char *tag, u64 src_hash, u64 src_size, DatObject *o) {
+    char path[4096];
+    u8 hdr[CACHE_HEADER];
+    u8 *body = NULL;
+    u32 len;
+    struct stat st;
+    FILE *f;
+    int ok = 0;
+
+    if (!cache) return 0;
+    entry_path(cache, tag, src_hash, src_size, path, sizeof(path), NULL, 0);
+    f = fopen(path, "rb");
+    if (f) {
+        /* La cabecera repite la clave: un fichero ajeno o truncado no vale */
+        if (fstat(fileno(f), &st) == 0 && fread(hdr, 1, CACHE_HEADER, f) == CACHE_HEADER &&
+            get_be32(hdr) == CACHE_MAGIC && get_be32(hdr + 4) == DAT_CACHE_VERSION &&
+            get_be64(hdr + 8) == src_hash && get_be64(hdr + 16) == src_size) {
+            len = get_be32(hdr + 28);
+            if ((u64)st.st_size == CACHE_HEADER + (u64)len && len <= 0x7fffffffu) {
+                body = (u8*)malloc(len ? len : 1);
+                ok = body && fread(body, 1, len, f) == len;
+            }
+        }
+        fclose(f);
+    }
+    if (!ok) {
+        free(body);
+        atomic_fetch_add(&cache->misses, 1);
+        return 0;
+    }
+    memcpy(o->type, hdr + 24, 4);
+    o->stored = body;
+    o->stored_is_view = 0;
+    o->len_compressed = o->len_uncompressed = (s32)len;
+    atomic_fetch_add(&cache->hits, 1);
+    return 1;
+}
+
+int dat_cache_put(DatCache *cache, const char *tag, u64 src_hash, u64 src_size, const DatObject *o) {
+    char path[4096], shard[4096], tmp[4200];
+    u8 hdr[CACHE_HEADER];
+    u8 *body;
+    u32 len;
+    int fd, ok;
+    FILE *f;
+
+    if (!cache || o->len_uncompressed < 0) return 0;
+    len = (u32)o->len_uncompressed;
+    if (o->stored) {
+        body = o->stored;
+    } else {
+        body = (u8*)malloc(len ? len : 1);
+        if (!body) return 0;
+        dat_serialize_body(o, body);
+    }
+
+    entry_path(cache, tag, src_hash, src_size, path, sizeof(path), shard, sizeof(shard));
+    if (mkdir(shard, 0777) != 0 && errno != EEXIST) {
+        if (body != o->stored) free(body);
+        return 0;
+    }
+    /* Nombre temporal unico entre procesos (pid) e hilos (contador) */
+    snprintf(tmp, sizeof(tmp), "%s.tmp%ld_%zu", path, (long)getpid(),
+             atomic_fetch_add(&cache->temps, 1));
+    fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL, 0666);
+    f = fd >= 0 ? fdopen(fd, "wb") : NULL;
+    if (!f) {
+        if (fd >= 0) { close(fd); unlink(tmp); }
+        if (body != o->stored) free(body);
+        return 0;
+    }
+    put_be32(hdr, CACHE_MAGIC);
+    put_be32(hdr + 4, DAT_CACHE_VERSION);
+    put_be64(hdr + 8, src_hash);
+    put_be64(hdr + 16, src_size);
+    memcpy(hdr + 24, o->type, 4);
+    put_be32(hdr + 28, len);
+    ok = fwrite(hdr, 1, CACHE_HEADER, f) == CACHE_HEADER && fwrite(body, 1, len, f) == len;
+    ok = (fclose(f) == 0) && ok;
+    if (!ok || rename(tmp, path) != 0) { unlink(tmp); ok = 0; }
+    if (body != o->stored) free(body);
+    return ok;
+}
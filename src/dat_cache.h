@@ -0,0 +1,46 @@
+/* src/dat_cache.h
+ *
+ * On-disk cache of converted object bodies, keyed by content: the XXH64
+ * and size of the source file plus a converter tag (asset kind, converter
+ * version and any option that changes the output). The same BMP, WAV or
+ * MIDI converted by another build, or for another DAT, is read back
+ * instead of going through the converter again.
+ *
+ * Layout: <dir>/<first 2 hex digits>/<hash>-<size>-<tag>, each file a
+ * small header followed by the serialized body. Entries are written to a
+ * temporary name and renamed, so concurrent builds may share a directory.
+ * Nothing is ever evicted; delete the directory to reclaim the space.
+ */
+#ifndef DAT_CACHE_H
+#define DAT_CACHE_H
+
+#include "allegro_dat_structs.h"
+
+/* Bump when a converter changes its output for the same input */
+#define DAT_CACHE_VERSION 1
+
+typedef struct DatCache DatCache;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Opens (creating it if needed) a cache directory; NULL if unusable. */
+DatCache *dat_cache_open(const char *dir);
+void      dat_cache_close(DatCache *cache);
+
+/* On a hit, o gets its type and an owned serialized body in o->stored. */
+int dat_cache_get(DatCache *cache, const char *tag, u64 src_hash, u64 src_size, DatObject *o);
+
+/* Stores the body of a freshly converted object. Failures are ignored by
+   callers: the cache only ever saves work. */
+int dat_cache_put(DatCache *cache, const char *tag, u64 src_hash, u64 src_size, const DatObject *o);
+
+/* Lookups served / missed since open */
+void dat_cache_counts(DatCache *cache, size_t *hits, size_t *misses);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DAT_CACHE_H */
@@ -1,58 +1,32 @@
 /* src/dat_cli.c  (v3.3 - Full Compatibility) */
+#define _POSIX_C_SOURCE 200809L
+#include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
-#include <ctype.h>
+#include <sys/stat.h>
 
 #include "allegro_dat_structs.h"
-#include "dat_loader_bmp.h"
-#include "dat_loader_data.h"
-#include "dat_loader_font.h"
-#include "dat_loader_pal.h"
+#include "dat_atlas.h"
+#include "dat_build.h"
+#include "dat_cache.h"
+#include "dat_color.h"
+#include "dat_crc32c.h"
+#include "dat_edit.h"
+#include "dat_extract.h"
+#include "dat_manifest.h"
+#include "dat_pool.h"
+#include "dat_stats.h"
+#include "dat_update.h"
+#include "dat_verify.h"
 #include "dat_writer.h"
-#include "midi_to_allegro.h"
-#include "wav_to_allegro.h"
-
-static char* dupstr(const char* s) {
-    size_t n = strlen(s);
-    char* d = (char*)malloc(n + 1);
-    if (!d) return NULL;
-    memcpy(d, s, n);
-    d[n] = '\0';
-    return d;
-}
-
-static void set_prop(Property* p, const char type4[4], const char* value) {
-    memcpy(p->magic, "prop", 4);
-    memcpy(p->type, type4, 4);
-    p->len_body = (u32)strlen(value);
-    p->body = dupstr(value);
-}
-
-static const char* basename_portable(const char* path) {
-    const char* s = strrchr(path, '/');
-    const char* s2 = strrchr(path, '\\');
-    if (!s || (s2 && s2 > s)) s = s2;
-    return s ? s + 1 : path;
-}
-
-/* Convierte "musica.mid" en "MUSICA_MID" para que Allegro lo encuentre */
-static void sanitize_allegro_name(char* dest, const char* path) {
-    const char* b = basename_portable(path);
-    int i = 0;
-    while (b[i] && i < 31) {
-        if (b[i] == '.') dest[i] = '_';
-        else dest[i] = (char)toupper((unsigned char)b[i]);
-        i++;
-    }
-    dest[i] = '\0';
-}
+#include "lzss.h"
 
-/* Formato de fecha exacto de small.dat: "d-mm-yyyy, H:MM" */
-static void now_datestr(char* buf, size_t n) {
-    time_t t = time(NULL);
-    struct tm* tmv = localtime(&t);
+/* Formato de fecha exacto de small.dat: "d-mm-yyyy, H:MM".
+   Hora local, o UTC para que un build reproducible no dependa de TZ */
+static void format_datestr(char* buf, size_t n, time_t t, int utc) {
+    struct tm* tmv = utc ? gmtime(&t) : localtime(&t);
     if (!tmv) {
         if (n)
             buf[0] = '\0';
@@ -68,72 +42,134 @@ static void now_datestr(char* buf, size_t n) {
     }
 }
 
+/* DATE de los objetos nuevos. Con SOURCE_DATE_EPOCH (o --reproducible, que
+   sin ella usa el epoch 0) la salida solo depende de las entradas */
+static int build_datestr(char* buf, size_t n, int* reproducible) {
+    const char* sde = getenv("SOURCE_DATE_EPOCH");
+    if (sde && *sde) {
+        char* end;
+        long long v = strtoll(sde, &end, 10);
+        if (*end != '\0' || v < 0) {
+            fprintf(stderr, "Error: SOURCE_DATE_EPOCH must be a non-negative integer\n");
+            return 0;
+        }
+        format_datestr(buf, n, (time_t)v, 1);
+        *reproducible = 1;
+    } else if (*reproducible) {
+        format_datestr(buf, n, 0, 1);
+    } else {
+        format_datestr(buf, n, time(NULL), 0);
+    }
+    return 1;
+}
+
 static void usage(void) {
     printf("\nAllegro 4 DAT creator (ANSI C) - Full Support\n\n");
     printf("Usage:\n");
     printf("  dat create out.dat\n");
     printf("      [--bmp file.bmp]*\n");
-    printf("      [--rle file.rle]* [--midi file.mid]*\n");
+    printf("      [--depth 15|16|24|32] [--dither none|ordered|diffuse] (next asset)\n");
+    printf("      [--default-depth 15|16|24|32] [--default-dither mode] (every --bmp)\n");
+    printf("      [--quantize auto|palette] (next asset) [--default-quantize auto|palette]\n");
+    printf("      [--rle file.rle]* [--rle-bmp file.bmp]* [--auto-rle]\n");
+    printf("      [--midi file.mid]* [--keep-meta] (next asset)\n");
     printf("      [--font8-bmp f.bmp]* [--font16-bmp f.bmp]*\n");
     printf("      [--data file.bin]* [--wav file.wav]*\n");
+    printf("      [--rate HZ] [--mono] [--bits 8|16] [--trim-silence[=DB]] (next asset)\n");
     printf("      [--flic file.fli/flc]*\n");
-    printf("      [--pal file.act]* [--pal-bmp file.bmp]*\n\n");
+    printf("      [--pal file.act]* [--pal-bmp file.bmp]*\n");
+    printf("      [--pack | --compress [--min-gain pct]] [--pack-level 1-9]\n");
+    printf("      [--jobs N] [--cache dir] [--reproducible] [--checksum]\n");
+    printf("      [--name NAME] (NAME of the next asset) [--strict-names]\n");
+    printf("      [--begin-group NAME ... --end-group]* (sub-datafile, may nest)\n");
+    printf("      [--atlas NAME a.bmp b.bmp ...]* [--begin-atlas NAME --bmp ... --end-atlas]*\n");
+    printf("      [--atlas-size WxH] (largest atlas page, default %dx%d)\n", DAT_ATLAS_DEFAULT_SIZE,
+           DAT_ATLAS_DEFAULT_SIZE);
+    printf("      [--tiles WxH file.bmp]* [--tile-flips] (next --tiles: unique tiles + map)\n\n");
+    printf("  dat update out.dat [same options as create]\n");
+    printf("      (reconverts only inputs changed since out.dat was written)\n\n");
+    printf("  dat create|update @manifest [options for every DAT]\n");
+    printf("      (builds every DAT listed in the manifest)\n\n");
     printf("  dat list in.dat\n\n");
+    printf("  dat extract in.dat outdir [--only NAME]* [--jobs N]\n");
+    printf("      (BMP, WAV, MID and ACT files; groups become directories)\n\n");
+    printf("  dat verify in.dat [--jobs N]\n");
+    printf("      (structure of every object, and its CRC32C if built with --checksum)\n\n");
+    printf("  dat add in.dat [asset options as for create]\n");
+    printf("  dat replace in.dat NAME [options for one asset or group]\n");
+    printf("  dat remove in.dat NAME...\n");
+    printf("  dat set-prop in.dat NAME TYPE VALUE (empty VALUE removes it)\n");
+    printf("  dat merge a.dat b.dat -o out.dat\n");
+    printf("      (untouched objects are copied as they are, without decoding)\n\n");
+    printf("  Any command: [--stats] (time per stage) [--trace file.json] (Chrome trace)\n\n");
 }
 
 /* ------------------------------------------------------------------ */
 /* dat_list: lee y muestra el contenido de un fichero .dat            */
 /* ------------------------------------------------------------------ */
 
-/* Lee un u32 big-endian del buffer en la posicion *pos y avanza */
-static u32 read_be32_buf(const u8 *buf, u32 bufsz, u32 *pos) {
-    u32 v;
-    if (*pos + 4 > bufsz) return 0;
-    v = ((u32)buf[*pos] << 24) | ((u32)buf[*pos+1] << 16)
-      | ((u32)buf[*pos+2] <<  8) |  (u32)buf[*pos+3];
-    *pos += 4;
-    return v;
-}
-
-/* Devuelve el valor de una propiedad NAME de un objeto (NULL si no existe).
-   El puntero devuelto apunta dentro de 'buf', valido mientras buf este vivo. */
-static const char *find_prop(const u8 *buf, u32 obj_start, u32 bufsz,
-                              const char want[4]) {
-    u32 pos = obj_start;
-    while (pos + 12 <= bufsz && memcmp(buf + pos, "prop", 4) == 0) {
-        u32  plen;
-        pos += 4; /* skip "prop" */
-        if (memcmp(buf + pos, want, 4) == 0) {
-            pos += 4;
-            plen = read_be32_buf(buf, bufsz, &pos);
-            /* return pointer to property body (NOT null-terminated in file,
-               but we know its length) */
-            return (plen > 0 && pos + plen <= bufsz) ? (const char*)(buf + pos) : NULL;
-        }
-        pos += 4; /* skip type */
-        plen = read_be32_buf(buf, bufsz, &pos);
-        pos += plen; /* skip body */
-    }
-    return NULL;
-}
-
-/* Retorna la longitud de la prop NAME, o 0 */
-static u32 find_prop_len(const u8 *buf, u32 obj_start, u32 bufsz,
-                         const char want[4]) {
-    u32 pos = obj_start;
-    while (pos + 12 <= bufsz && memcmp(buf + pos, "prop", 4) == 0) {
-        u32 plen;
-        pos += 4;
-        if (memcmp(buf + pos, want, 4) == 0) {
-            pos += 4;
-            plen = read_be32_buf(buf, bufsz, &pos);
-            return plen;
-        }
-        pos += 4;
-        plen = read_be32_buf(buf, bufsz, &pos);
-        pos += plen;
+/* Lectura secuencial de un .dat: directa del fichero o a traves del
+   descompresor LZSS (ficheros "slh!"), sin cargarlo entero en memoria */
+typedef struct {
+    FILE         *f;
+    LzssUnpacker *unp;   /* NULL si el fichero no esta comprimido */
+} DatStream;
+
+static size_t file_source(void *ctx, u8 *buf, size_t n) {
+    return fread(buf, 1, n, (FILE*)ctx);
+}
+
+static int ds_read(DatStream *s, void *dst, size_t n) {
+    if (s->unp) return lzss_unpacker_read(s->unp, dst, n) == n;
+    return fread(dst, 1, n, s->f) == n;
+}
+
+static int ds_skip(DatStream *s, u64 n) {
+    u8 tmp[4096];
+    if (!s->unp) {
+        while (n > 0) {
+            long k = n > (1u << 30) ? (1L << 30) : (long)n;
+            if (fseek(s->f, k, SEEK_CUR) != 0) return 0;
+            n -= (u64)k;
+        }
+        return 1;
     }
-    return 0;
+    while (n > 0) {
+        size_t k = n < sizeof(tmp) ? (size_t)n : sizeof(tmp);
+        if (!ds_read(s, tmp, k)) return 0;
+        n -= k;
+    }
+    return 1;
+}
+
+static int ds_read_be32(DatStream *s, u32 *v) {
+    u8 b[4];
+    if (!ds_read(s, b, 4)) return 0;
+    *v = ((u32)b[0] << 24) | ((u32)b[1] << 16) | ((u32)b[2] << 8) | (u32)b[3];
+    return 1;
+}
+
+/* Objeto comprimido individualmente: el LZSS se alimenta solo de los
+   len_compressed bytes del chunk */
+typedef struct {
+    DatStream *s;
+    u64        left;
+} ChunkSource;
+
+static size_t chunk_source(void *ctx, u8 *buf, size_t n) {
+    ChunkSource *c = (ChunkSource*)ctx;
+    if (n > c->left) n = (size_t)c->left;
+    if (n == 0 || !ds_read(c->s, buf, n)) return 0;
+    c->left -= n;
+    return n;
+}
+
+/* Lee el valor de una propiedad en dst (truncado a cap-1) y salta el resto */
+static int read_prop_value(DatStream *s, u32 len, char *dst, size_t cap) {
+    u32 copy = len < cap - 1 ? len : (u32)(cap - 1);
+    if (!ds_read(s, dst, copy)) return 0;
+    dst[copy] = '\0';
+    return ds_skip(s, len - copy);
 }
 
 /* Descripcion legible del tipo de objeto */
@@ -164,7 +200,8 @@ static void print_type_detail(const char tag[4], const u8 *body, u32 body_sz) {
         s16 bits = (s16)(((u16)body[0] << 8) | body[1]);
         u16 w    = (u16)(((u16)body[2] << 8) | body[3]);
         u16 h    = (u16)(((u16)body[4] << 8) | body[5]);
-        printf("  %dx%d, %d bpp", w, h, (int)bits);
+        /* -32: RGBA de Allegro */
+        printf("  %dx%d, %d bpp%s", w, h, bits < 0 ? -(int)bits : (int)bits, bits < 0 ? " RGBA" : "");
         return;
     }
     if (memcmp(tag, "RLE ", 4) == 0 && body_sz >= 8) {
@@ -201,6 +238,11 @@ static void print_type_detail(const char tag[4], const u8 *body, u32 body_sz) {
         printf("  %d tracks, %d ticks/beat", tracks, (int)div);
         return;
     }
+    if (memcmp(tag, "FILE", 4) == 0 && body_sz >= 4) {
+        u32 n = ((u32)body[0] << 24) | ((u32)body[1] << 16) | ((u32)body[2] << 8) | (u32)body[3];
+        printf("  %u objects", n);
+        return;
+    }
     if (memcmp(tag, "FONT", 4) == 0 && body_sz >= 2) {
         s16 sz = (s16)(((u16)body[0] << 8) | body[1]);
         if (sz == 8)       printf("  8x8 bitmap");
@@ -224,39 +266,42 @@ static void print_type_detail(const char tag[4], const u8 *body, u32 body_sz) {
 }
 
 static int dat_list(const char *filename) {
-    u8   *buf;
-    u32   bufsz;
-    u32   pos;
-    u32   pack_magic, dat_magic, num_objects;
-    u32   idx;
-    int   name_w = 32; /* column width for name */
-
-    /* Load whole file */
-    if (!load_file_bytes(filename, &buf, &bufsz)) {
+    FILE     *f;
+    DatStream ds;
+    u32       pack_magic, dat_magic, num_objects;
+    u32       idx;
+    int       ok = 1;
+    int       name_w = 32; /* column width for name */
+
+    f = fopen(filename, "rb");
+    if (!f) {
         fprintf(stderr, "Error: cannot open '%s'\n", filename);
         return 1;
     }
+    ds.f = f;
+    ds.unp = NULL;
 
-    if (bufsz < 12) { free(buf); fprintf(stderr, "Error: file too small\n"); return 1; }
-
-    pos = 0;
-    pack_magic  = read_be32_buf(buf, bufsz, &pos);
-    dat_magic   = read_be32_buf(buf, bufsz, &pos);
-    num_objects = read_be32_buf(buf, bufsz, &pos);
-
-    /* Validate magic numbers */
-    if (pack_magic == 0x736C682Eu && dat_magic == 0x414C4C2Eu) {
-        /* F_NOPACK_MAGIC + DAT_MAGIC - uncompressed, OK */
-    } else if (pack_magic == 0x736C6821u) {
-        /* F_PACK_MAGIC - LZSS compressed, not supported */
-        fprintf(stderr, "Error: '%s' is compressed with LZSS (not supported)\n", filename);
-        free(buf); return 1;
-    } else {
+    if (!ds_read_be32(&ds, &pack_magic)) {
+        fclose(f); fprintf(stderr, "Error: file too small\n"); return 1;
+    }
+    if (pack_magic == DAT_F_PACK_MAGIC) {
+        /* F_PACK_MAGIC - todo lo que sigue es un stream LZSS */
+        ds.unp = lzss_unpacker_create(file_source, f);
+        if (!ds.unp) { fclose(f); return 1; }
+    } else if (pack_magic != DAT_F_NOPACK_MAGIC) {
         fprintf(stderr, "Error: '%s' is not a valid Allegro DAT file\n", filename);
-        free(buf); return 1;
+        fclose(f); return 1;
+    }
+    if (!ds_read_be32(&ds, &dat_magic) || !ds_read_be32(&ds, &num_objects)) {
+        fprintf(stderr, "Error: file too small\n");
+        lzss_unpacker_free(ds.unp); fclose(f); return 1;
+    }
+    if (dat_magic != DAT_MAGIC) {
+        fprintf(stderr, "Error: '%s' is not a valid Allegro DAT file\n", filename);
+        lzss_unpacker_free(ds.unp); fclose(f); return 1;
     }
 
-    printf("File: %s\n", filename);
+    printf("File: %s%s\n", filename, ds.unp ? " (LZSS packed)" : "");
     printf("Objects: %u\n\n", num_objects);
     printf("%-4s  %-*s  %-14s  %10s  %s\n",
            "#", name_w, "Name", "Type", "Size", "Details");
@@ -264,301 +309,1202 @@ static int dat_list(const char *filename) {
            "----", name_w, "--------------------------------",
            "--------------", "----------", "-------");
 
-    for (idx = 0; idx < num_objects; idx++) {
-        u32         obj_start = pos;
-        const char *name_ptr;
-        u32         name_len;
-        const char *date_ptr;
-        u32         date_len;
+    for (idx = 0; idx < num_objects && ok; idx++) {
         char        name_buf[64];
         char        date_buf[32];
         char        type_tag[5];
         u32         len_compressed;
-        u32         len_uncompressed;
-        const u8   *body;
-
-        /* Skip properties to find type tag, but remember obj_start for prop lookup */
-        {
-            u32 scan = pos;
-            while (scan + 12 <= bufsz && memcmp(buf + scan, "prop", 4) == 0) {
-                u32 plen;
-                scan += 8;
-                plen = read_be32_buf(buf, bufsz, &scan);
-                scan += plen;
-            }
-            pos = scan;
-        }
+        s32         len_uncompressed;
+        u32         body_sz;
+        u32         want;
+        u8          head[16];
+        u8         *body;
+        u64         t0 = dat_stats_begin();
 
-        if (pos + 12 > bufsz) break;
+        name_buf[0] = '\0';
+        date_buf[0] = '\0';
 
-        /* Read type tag */
-        memcpy(type_tag, buf + pos, 4);
+        /* Propiedades: solo nos interesan NAME y DATE */
+        for (;;) {
+            u8  ptype[4];
+            u32 plen;
+            if (!ds_read(&ds, type_tag, 4)) { ok = 0; break; }
+            if (memcmp(type_tag, "prop", 4) != 0) break;
+            if (!ds_read(&ds, ptype, 4) || !ds_read_be32(&ds, &plen)) { ok = 0; break; }
+            if (memcmp(ptype, "NAME", 4) == 0)
+                ok = read_prop_value(&ds, plen, name_buf, sizeof(name_buf));
+            else if (memcmp(ptype, "DATE", 4) == 0)
+                ok = read_prop_value(&ds, plen, date_buf, sizeof(date_buf));
+            else
+                ok = ds_skip(&ds, plen);
+            if (!ok) break;
+        }
+        if (!ok) break;
         type_tag[4] = '\0';
-        pos += 4;
+        if (!name_buf[0]) strcpy(name_buf, "(sin nombre)");
 
-        len_compressed   = read_be32_buf(buf, bufsz, &pos);
-        len_uncompressed = read_be32_buf(buf, bufsz, &pos);
+        if (!ds_read_be32(&ds, &len_compressed) ||
+            !ds_read_be32(&ds, (u32*)&len_uncompressed)) { ok = 0; break; }
 
-        body = buf + pos;
+        /* Negativo = cuerpo comprimido individualmente */
+        body_sz = len_uncompressed < 0 ? (u32)-len_uncompressed : (u32)len_uncompressed;
 
-        /* Resolve NAME property */
-        name_ptr = find_prop(buf, obj_start, bufsz, "NAME");
-        name_len = find_prop_len(buf, obj_start, bufsz, "NAME");
-        if (name_ptr && name_len > 0) {
-            u32 copy = name_len < 63 ? name_len : 63;
-            memcpy(name_buf, name_ptr, copy);
-            name_buf[copy] = '\0';
-        } else {
-            strcpy(name_buf, "(sin nombre)");
+        /* Solo hace falta el principio del cuerpo, salvo MIDI (recorre pistas) */
+        want = body_sz < sizeof(head) ? body_sz : (u32)sizeof(head);
+        body = head;
+        if (memcmp(type_tag, "MIDI", 4) == 0 && body_sz > sizeof(head)) {
+            body = (u8*)malloc(body_sz);
+            want = body ? body_sz : (u32)sizeof(head);
+            if (!body) body = head;
         }
 
-        /* Resolve DATE property */
-        date_ptr = find_prop(buf, obj_start, bufsz, "DATE");
-        date_len = find_prop_len(buf, obj_start, bufsz, "DATE");
-        if (date_ptr && date_len > 0) {
-            u32 copy = date_len < 31 ? date_len : 31;
-            memcpy(date_buf, date_ptr, copy);
-            date_buf[copy] = '\0';
+        if (len_uncompressed < 0) {
+            ChunkSource cs;
+            LzssUnpacker *up;
+            cs.s = &ds;
+            cs.left = len_compressed;
+            up = lzss_unpacker_create(chunk_source, &cs);
+            if (!up) { ok = 0; }
+            else {
+                want = (u32)lzss_unpacker_read(up, body, want);
+                lzss_unpacker_free(up);
+                ok = ds_skip(&ds, cs.left);
+            }
         } else {
-            date_buf[0] = '\0';
+            if (want > len_compressed) want = len_compressed;
+            ok = ds_read(&ds, body, want) && ds_skip(&ds, len_compressed - want);
         }
 
         /* Print row */
         printf("%-4u  %-*s  %-14s  %10u",
                idx + 1, name_w, name_buf,
                type_description(type_tag),
-               len_uncompressed);
+               body_sz);
 
         /* Extra detail from body */
-        {
-            u32 safe_body_sz = len_uncompressed;
-            if (pos + safe_body_sz > bufsz)
-                safe_body_sz = bufsz - pos;
-            print_type_detail(type_tag, body, safe_body_sz);
-        }
+        print_type_detail(type_tag, body, want);
+        if (len_uncompressed < 0) printf("  (LZSS %u)", len_compressed);
 
         if (date_buf[0]) printf("  [%s]", date_buf);
         printf("\n");
 
-        /* Advance past body (use compressed size for on-disk advance) */
-        pos += len_compressed;
-        (void)len_uncompressed;
+        if (body != head) free(body);
+        dat_stats_end(DAT_STAGE_LIST, t0, name_buf, len_compressed, body_sz);
     }
 
     printf("\n");
-    free(buf);
-    return 0;
+    if (!ok) fprintf(stderr, "Error: '%s' is truncated or corrupt\n", filename);
+    lzss_unpacker_free(ds.unp);
+    fclose(f);
+    return ok ? 0 : 1;
 }
 
-int main(int argc, char** argv) {
-    int i;
-    const char* out;
-    char datebuf[64];
-    AllegroDat* dat;
-    DatObject* objs;
+/* ------------------------------------------------------------------ */
+/* create / update                                                     */
+/* ------------------------------------------------------------------ */
 
-    /* dispatch commands */
-    if (argc >= 3 && strcmp(argv[1], "list") == 0) {
-        return dat_list(argv[2]);
+typedef struct {
+    u32             pack_magic;
+    int             individual;
+    int             min_gain;
+    int             jobs;
+    int             reproducible;
+    int             strict_names;
+    int             auto_rle;
+    int             checksum;    /* --checksum: propiedad CRC en cada objeto */
+    const char*     cache_dir;
+    int             default_depth;
+    int             default_dither;
+    const char*     default_quantize;
+    const char*     next_name;   /* --name: solo para el siguiente asset */
+    int             next_depth;  /* --depth, --dither: idem (0 / -1 = nada) */
+    int             next_dither;
+    const char*     next_quantize;
+    WavConvertOptions next_wav;  /* --rate, --mono, --bits, --trim-silence */
+    int             next_keep_meta;
+    u32             next_tile_w; /* --tile-size, --tile-flips: para el siguiente --tiles */
+    u32             next_tile_h;
+    int             next_tile_flips;
+    int             group;       /* --begin-group/--begin-atlas abierto (su job), -1 = ninguno */
+    size_t          num_groups;
+    u32             atlas_w;     /* --atlas-size */
+    u32             atlas_h;
+    DatWriteOptions wopt;
+    AssetJob*       assets;
+    size_t          num_assets;
+    size_t          cap_assets;
+} BuildArgs;
+
+static void init_build_args(BuildArgs* b) {
+    memset(b, 0, sizeof(*b));
+    b->pack_magic = DAT_F_NOPACK_MAGIC;
+    b->min_gain = 5;
+    b->jobs = dat_cpu_count();
+    b->wopt.pack_level = LZSS_LEVEL_DEFAULT;
+    b->cache_dir = getenv("DAT_CACHE_DIR");
+    b->next_dither = -1;
+    b->group = -1;
+    b->atlas_w = b->atlas_h = DAT_ATLAS_DEFAULT_SIZE;
+}
+
+/* --depth/--default-depth N y --dither/--default-dither MODO */
+static int parse_depth(const char* opt, const char* v, int* out) {
+    int d = atoi(v);
+    if (!dat_color_depth_valid(d)) {
+        fprintf(stderr, "Error: %s must be 15, 16, 24 or 32\n", opt);
+        return 0;
     }
-    if (argc < 3 || strcmp(argv[1], "create") != 0) { usage(); return 1; }
-    out = argv[2];
-    now_datestr(datebuf, sizeof(datebuf));
+    *out = d;
+    return 1;
+}
 
-    dat = (AllegroDat*)calloc(1, sizeof(AllegroDat));
-    dat->pack_magic = 0x736C682Eu; /* 'slh.' */
-    dat->dat_magic = 0x414C4C2Eu;  /* 'ALL.' */
-    objs = (DatObject*)calloc(1024, sizeof(DatObject));
-    dat->objects = objs;
+static int parse_rate(const char* opt, const char* v, unsigned int* out) {
+    long r = atol(v);
+    if (r < 1000 || r > 65535) {
+        fprintf(stderr, "Error: %s must be 1000..65535 Hz\n", opt);
+        return 0;
+    }
+    *out = (unsigned int)r;
+    return 1;
+}
 
-    for (i = 3; i < argc; i++) {
-        char clean_name[64];
-        
-        /* BMP */
-        if (strcmp(argv[i], "--bmp") == 0 && i + 1 < argc) {
-            DatBitmap* bmp = NULL;
-            if (load_bmp_to_dat_bitmap(argv[i+1], &bmp)) {
-                DatObject* o = &objs[dat->num_objects++];
-                memcpy(o->type, "BMP ", 4); o->body.bmp = bmp;
-                o->len_uncompressed = o->len_compressed = (s32)(2+2+2 + (bmp->width * bmp->height * ((u32)bmp->bits_per_pixel / 8u)));
-                o->num_properties = 3; o->properties = (Property*)calloc(3, sizeof(Property));
-                set_prop(&o->properties[0], "DATE", datebuf);
-                sanitize_allegro_name(clean_name, basename_portable(argv[i+1]));
-                set_prop(&o->properties[1], "NAME", clean_name);
-                set_prop(&o->properties[2], "ORIG", argv[i+1]);
+static int parse_bits(const char* opt, const char* v, int* out) {
+    int bits = atoi(v);
+    if (bits != 8 && bits != 16) {
+        fprintf(stderr, "Error: %s must be 8 or 16\n", opt);
+        return 0;
+    }
+    *out = bits;
+    return 1;
+}
+
+/* "16x16": --atlas-size (pagina) y --tiles/--tile-size (tile) */
+static int is_size(const char* v) {
+    size_t w = strspn(v, "0123456789"), h;
+    if (!w || (v[w] != 'x' && v[w] != 'X')) return 0;
+    h = strspn(v + w + 1, "0123456789");
+    return h && v[w + 1 + h] == '\0';
+}
+
+static int parse_size(const char* opt, const char* v, u32 max, u32* w, u32* h) {
+    unsigned long pw = 0, ph = 0;
+    char* end;
+    if (is_size(v)) {
+        pw = strtoul(v, &end, 10);
+        ph = strtoul(end + 1, NULL, 10);
+    }
+    if (pw < 1 || pw > max || ph < 1 || ph > max) {
+        fprintf(stderr, "Error: %s must be WxH, each 1..%u\n", opt, max);
+        return 0;
+    }
+    *w = (u32)pw;
+    *h = (u32)ph;
+    return 1;
+}
+
+/* "60" o "-60": dB por debajo del maximo */
+static int is_db(const char* v) {
+    if (*v == '-') v++;
+    if (!isdigit((unsigned char)*v)) return 0;
+    while (isdigit((unsigned char)*v)) v++;
+    return *v == '\0';
+}
+
+static int parse_trim(const char* v, int* out) {
+    int db = abs(atoi(v));
+    if (!is_db(v) || db < 1 || db > 120) {
+        fprintf(stderr, "Error: --trim-silence threshold must be 1..120 dB\n");
+        return 0;
+    }
+    *out = db;
+    return 1;
+}
+
+static int parse_dither(const char* opt, const char* v, int* out) {
+    int d = dat_dither_from_name(v);
+    if (d < 0) {
+        fprintf(stderr, "Error: %s must be none, ordered or diffuse\n", opt);
+        return 0;
+    }
+    *out = d;
+    return 1;
+}
+
+/* Sin limite de objetos: el vector crece al doble */
+static AssetJob* push_asset(BuildArgs* b) {
+    if (b->num_assets == b->cap_assets) {
+        size_t ncap = b->cap_assets ? b->cap_assets * 2 : 64;
+        AssetJob* na = (AssetJob*)realloc(b->assets, ncap * sizeof(AssetJob));
+        if (!na) return NULL;
+        b->assets = na;
+        b->cap_assets = ncap;
+    }
+    memset(&b->assets[b->num_assets], 0, sizeof(AssetJob));
+    b->assets[b->num_assets].group = b->group;
+    return &b->assets[b->num_assets++];
+}
+
+/* --begin-group y --begin-atlas: el job del contenedor va antes que sus
+   assets, que lo tienen como group hasta el --end */
+static int begin_container(BuildArgs* b, AssetKind kind, const char* name) {
+    AssetJob* job;
+    if (b->group >= 0 && b->assets[b->group].kind == ASSET_ATLAS) {
+        fprintf(stderr, "Error: '%s' cannot go inside atlas '%s'\n", name, b->assets[b->group].path);
+        return 0;
+    }
+    job = push_asset(b);
+    if (!job) return 0;
+    job->kind = kind;
+    job->path = job->want_name = name;
+    job->dither = -1;
+    if (kind != ASSET_GROUP) {
+        /* --depth, --dither y --quantize valen para todos sus bitmaps */
+        job->depth = b->next_depth;
+        job->dither = b->next_dither;
+        job->quantize = b->next_quantize;
+        b->next_depth = 0;
+        b->next_dither = -1;
+        b->next_quantize = NULL;
+    }
+    b->group = (int)(b->num_assets - 1);
+    b->num_groups++;
+    return 1;
+}
+
+static int end_container(BuildArgs* b, AssetKind kind) {
+    const char* opt = kind == ASSET_ATLAS ? "--end-atlas" : "--end-group";
+    if (b->group < 0 || b->assets[b->group].kind != kind) {
+        fprintf(stderr, "Error: %s without %s\n", opt, kind == ASSET_ATLAS ? "--begin-atlas" : "--begin-group");
+        return 0;
+    }
+    b->group = b->assets[b->group].group;
+    return 1;
+}
+
+/* --tiles: un contenedor con el BMP dentro, que nunca sale en el DAT; el
+   mapa lleva el NAME que habria tenido el BMP */
+static int add_tiles(BuildArgs* b, const char* path) {
+    AssetJob* job;
+    size_t t;
+    if (!b->next_tile_w) {
+        fprintf(stderr, "Error: --tiles '%s' needs a tile size (--tiles WxH file.bmp)\n", path);
+        return 0;
+    }
+    if (!begin_container(b, ASSET_TILES, path)) return 0;
+    t = b->num_assets - 1;
+    job = &b->assets[t];
+    job->want_name = b->next_name;
+    job->tile_w = (u16)b->next_tile_w;
+    job->tile_h = (u16)b->next_tile_h;
+    job->tile_flips = b->next_tile_flips;
+    b->next_name = NULL;
+    b->next_tile_w = b->next_tile_h = 0;
+    b->next_tile_flips = 0;
+    job = push_asset(b);
+    if (!job) return 0;
+    job->kind = ASSET_BMP;
+    job->path = path;
+    job->atlas = 1;
+    job->depth = b->assets[t].depth;
+    job->dither = b->assets[t].dither;
+    job->quantize = b->assets[t].quantize;
+    return end_container(b, ASSET_TILES);
+}
+
+/* Opciones comunes a create y update; los assets se convierten despues.
+   Se puede llamar varias veces (linea de comandos, manifiesto): la
+   ultima opcion gana */
+static int parse_build_args(int argc, char** argv, int first, BuildArgs* b) {
+    int i;
+
+    for (i = first; i < argc; i++) {
+        int kind;
+
+        /* Compresion LZSS de todo el fichero ("slh!") */
+        if (strcmp(argv[i], "--pack") == 0) {
+            b->pack_magic = DAT_F_PACK_MAGIC;
+            continue;
+        }
+        /* Compresion individual de cada objeto (chunks con longitud negativa) */
+        if (strcmp(argv[i], "--compress") == 0) {
+            b->individual = 1;
+            continue;
+        }
+        /* CRC32C de cada cuerpo, para dat verify */
+        if (strcmp(argv[i], "--checksum") == 0) {
+            b->checksum = 1;
+            continue;
+        }
+        if (strcmp(argv[i], "--min-gain") == 0 && i + 1 < argc) {
+            b->min_gain = atoi(argv[i+1]);
+            if (b->min_gain < 0 || b->min_gain > 100) {
+                fprintf(stderr, "Error: --min-gain must be 0..100\n");
+                return 0;
             }
             i++; continue;
         }
-
-        /* PAL */
-        if (strcmp(argv[i], "--pal") == 0 && i + 1 < argc) {
-            u8* pal = NULL;
-            if (load_act_to_pal63(argv[i+1], &pal)) {
-                DatObject* o = &objs[dat->num_objects++];
-                memcpy(o->type, "PAL ", 4); o->body.pal = pal;
-                o->len_uncompressed = o->len_compressed = 256 * 4; /* Spec: 256 x {R,G,B,pad} */
-                o->num_properties = 3; o->properties = (Property*)calloc(3, sizeof(Property));
-                set_prop(&o->properties[0], "DATE", datebuf);
-                sanitize_allegro_name(clean_name, basename_portable(argv[i+1]));
-                set_prop(&o->properties[1], "NAME", clean_name);
-                set_prop(&o->properties[2], "ORIG", argv[i+1]);
-            }
+        if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+            b->jobs = atoi(argv[i+1]);
+            if (b->jobs < 1) b->jobs = 1;
             i++; continue;
         }
-
-        /* PAL desde BMP indexado (1/4/8 bpp) */
-        if (strcmp(argv[i], "--pal-bmp") == 0 && i + 1 < argc) {
-            u8* pal = NULL;
-            if (load_bmp_to_pal63(argv[i+1], &pal)) {
-                DatObject* o = &objs[dat->num_objects++];
-                memcpy(o->type, "PAL ", 4); o->body.pal = pal;
-                o->len_uncompressed = o->len_compressed = 256 * 4;
-                o->num_properties = 3; o->properties = (Property*)calloc(3, sizeof(Property));
-                set_prop(&o->properties[0], "DATE", datebuf);
-                sanitize_allegro_name(clean_name, basename_portable(argv[i+1]));
-                set_prop(&o->properties[1], "NAME", clean_name);
-                set_prop(&o->properties[2], "ORIG", argv[i+1]);
-            }
+        /* Cache de conversiones compartida entre builds */
+        if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc) {
+            b->cache_dir = argv[i+1];
             i++; continue;
         }
-
-        /* RLE */
-        if (strcmp(argv[i], "--rle") == 0 && i + 1 < argc) {
-            u8* buf; u32 sz;
-            if (load_file_bytes(argv[i+1], &buf, &sz)) {
-                DatRleSprite* r = (DatRleSprite*)calloc(1, sizeof(DatRleSprite));
-                r->bits_per_pixel = 8; r->len_image = sz; r->image = buf;
-                DatObject* o = &objs[dat->num_objects++];
-                memcpy(o->type, "RLE ", 4); o->body.rle = r;
-                o->len_uncompressed = o->len_compressed = (s32)(2+2+2+4) + (s32)sz;
-                o->num_properties = 3; o->properties = (Property*)calloc(3, sizeof(Property));
-                set_prop(&o->properties[0], "DATE", datebuf);
-                sanitize_allegro_name(clean_name, basename_portable(argv[i+1]));
-                set_prop(&o->properties[1], "NAME", clean_name);
-                set_prop(&o->properties[2], "ORIG", argv[i+1]);
+        if (strcmp(argv[i], "--reproducible") == 0) {
+            b->reproducible = 1;
+            continue;
+        }
+        if (strcmp(argv[i], "--pack-level") == 0 && i + 1 < argc) {
+            b->wopt.pack_level = atoi(argv[i+1]);
+            if (b->wopt.pack_level < LZSS_LEVEL_MIN || b->wopt.pack_level > LZSS_LEVEL_MAX) {
+                fprintf(stderr, "Error: --pack-level must be %d..%d\n", LZSS_LEVEL_MIN, LZSS_LEVEL_MAX);
+                return 0;
             }
             i++; continue;
         }
-
-        /* FONT 8x8 y 8x16 */
-        if ((strcmp(argv[i], "--font8-bmp") == 0 || strcmp(argv[i], "--font16-bmp") == 0) && i + 1 < argc) {
-            DatFont* font = NULL;
-            int is16 = (argv[i][6] == '1');
-            int ok = is16 ? build_font16_from_bmp(argv[i+1], 128, &font) : build_font8_from_bmp(argv[i+1], 128, &font);
-            if (ok) {
-                DatObject* o = &objs[dat->num_objects++];
-                memcpy(o->type, "FONT", 4); o->body.font = font;
-                o->len_uncompressed = o->len_compressed = (2 + 95 * (is16 ? 16 : 8));
-                o->num_properties = 3; o->properties = (Property*)calloc(3, sizeof(Property));
-                set_prop(&o->properties[0], "DATE", datebuf);
-                sanitize_allegro_name(clean_name, basename_portable(argv[i+1]));
-                set_prop(&o->properties[1], "NAME", clean_name);
-                set_prop(&o->properties[2], "ORIG", argv[i+1]);
-            }
+        /* NAME del siguiente asset (en el manifiesto: name=...) */
+        if (strcmp(argv[i], "--name") == 0 && i + 1 < argc) {
+            b->next_name = argv[i+1];
             i++; continue;
         }
+        /* Profundidad de color de los BMP: del siguiente asset (en el
+           manifiesto: depth=16) o de todos */
+        if (strcmp(argv[i], "--depth") == 0 && i + 1 < argc) {
+            if (!parse_depth(argv[i], argv[i+1], &b->next_depth)) return 0;
+            i++; continue;
+        }
+        if (strcmp(argv[i], "--dither") == 0 && i + 1 < argc) {
+            if (!parse_dither(argv[i], argv[i+1], &b->next_dither)) return 0;
+            i++; continue;
+        }
+        if (strcmp(argv[i], "--default-depth") == 0 && i + 1 < argc) {
+            if (!parse_depth(argv[i], argv[i+1], &b->default_depth)) return 0;
+            i++; continue;
+        }
+        if (strcmp(argv[i], "--default-dither") == 0 && i + 1 < argc) {
+            if (!parse_dither(argv[i], argv[i+1], &b->default_dither)) return 0;
+            i++; continue;
+        }
+        /* A 8 bpp: "auto" o un fichero de paleta (ACT, PAL, BMP) */
+        if (strcmp(argv[i], "--quantize") == 0 && i + 1 < argc) {
+            b->next_quantize = argv[i+1];
+            i++; continue;
+        }
+        if (strcmp(argv[i], "--default-quantize") == 0 && i + 1 < argc) {
+            b->default_quantize = argv[i+1];
+            i++; continue;
+        }
+        /* WAV del siguiente asset: frecuencia, canales, bits y silencio */
+        if (strcmp(argv[i], "--rate") == 0 && i + 1 < argc) {
+            if (!parse_rate(argv[i], argv[i+1], &b->next_wav.rate)) return 0;
+            i++; continue;
+        }
+        if (strcmp(argv[i], "--mono") == 0) {
+            b->next_wav.mono = 1;
+            continue;
+        }
+        if (strcmp(argv[i], "--bits") == 0 && i + 1 < argc) {
+            if (!parse_bits(argv[i], argv[i+1], &b->next_wav.bits)) return 0;
+            i++; continue;
+        }
+        /* --trim-silence[=DB]; en el manifiesto trim-silence=DB llega
+           como "--trim-silence DB" */
+        if (strncmp(argv[i], "--trim-silence", 14) == 0 && (argv[i][14] == '\0' || argv[i][14] == '=')) {
+            b->next_wav.trim_db = WAV_TRIM_DEFAULT_DB;
+            if (argv[i][14] == '=') {
+                if (!parse_trim(argv[i] + 15, &b->next_wav.trim_db)) return 0;
+            } else if (i + 1 < argc && is_db(argv[i+1])) {
+                if (!parse_trim(argv[i+1], &b->next_wav.trim_db)) return 0;
+                i++;
+            }
+            continue;
+        }
+        /* MIDI del siguiente asset: conservar textos, letras, etc. */
+        if (strcmp(argv[i], "--keep-meta") == 0) {
+            b->next_keep_meta = 1;
+            continue;
+        }
+        if (strcmp(argv[i], "--strict-names") == 0) {
+            b->strict_names = 1;
+            continue;
+        }
+        /* --bmp como sprite RLE cuando ocupa menos */
+        if (strcmp(argv[i], "--auto-rle") == 0) {
+            b->auto_rle = 1;
+            continue;
+        }
 
-        /* MIDI: convierte SMF (.mid) al formato interno de Allegro 4 */
-        if (strcmp(argv[i], "--midi") == 0 && i + 1 < argc) {
-            u8* raw; u32 raw_sz;
-            if (load_file_bytes(argv[i+1], &raw, &raw_sz)) {
-                u8* alg_buf = NULL;
-                unsigned int alg_sz = 0;
-                if (mid_to_allegro_dat(raw, raw_sz, &alg_buf, &alg_sz)) {
-                    sanitize_allegro_name(clean_name, basename_portable(argv[i+1]));
-                    DatObject* o = &objs[dat->num_objects++];
-                    memcpy(o->type, "MIDI", 4);
-                    o->body.any = alg_buf;
-                    o->len_uncompressed = o->len_compressed = (s32)alg_sz;
-                    o->num_properties = 3;
-                    o->properties = (Property*)calloc(3, sizeof(Property));
-                    set_prop(&o->properties[0], "DATE", datebuf);
-                    set_prop(&o->properties[1], "NAME", clean_name);
-                    set_prop(&o->properties[2], "ORIG", argv[i+1]);
-                } else {
-                    fprintf(stderr, "Error: no se pudo convertir '%s' a formato MIDI de Allegro\n", argv[i+1]);
-                }
-                free(raw);
+        /* Sub-datafile: los assets hasta --end-group van en un FILE
+           propio, con sus propios nombres; se pueden anidar */
+        if (strcmp(argv[i], "--begin-group") == 0 && i + 1 < argc) {
+            if (!begin_container(b, ASSET_GROUP, argv[i+1])) return 0;
+            i++; continue;
+        }
+        if (strcmp(argv[i], "--end-group") == 0) {
+            if (!end_container(b, ASSET_GROUP)) return 0;
+            continue;
+        }
+        /* Atlas: los --bmp hasta --end-atlas se empaquetan en paginas BMP
+           con una tabla DATA; --atlas NAME a.bmp b.bmp ... es lo mismo */
+        if (strcmp(argv[i], "--begin-atlas") == 0 && i + 1 < argc) {
+            if (!begin_container(b, ASSET_ATLAS, argv[i+1])) return 0;
+            i++; continue;
+        }
+        if (strcmp(argv[i], "--end-atlas") == 0) {
+            if (!end_container(b, ASSET_ATLAS)) return 0;
+            continue;
+        }
+        if (strcmp(argv[i], "--atlas") == 0 && i + 1 < argc) {
+            size_t atlas;
+            if (!begin_container(b, ASSET_ATLAS, argv[i+1])) return 0;
+            atlas = b->num_assets - 1;
+            for (i += 2; i < argc && strncmp(argv[i], "--", 2) != 0; i++) {
+                AssetJob* job = push_asset(b);
+                if (!job) return 0;
+                job->kind = ASSET_BMP;
+                job->path = argv[i];
+                job->atlas = 1;
+                job->depth = b->assets[atlas].depth;
+                job->dither = b->assets[atlas].dither;
+                job->quantize = b->assets[atlas].quantize;
             }
+            i--;
+            if (!end_container(b, ASSET_ATLAS)) return 0;
+            continue;
+        }
+        if (strcmp(argv[i], "--atlas-size") == 0 && i + 1 < argc) {
+            if (!parse_size(argv[i], argv[i+1], 65535, &b->atlas_w, &b->atlas_h)) return 0;
             i++; continue;
         }
-
-        /* WAV: convierte RIFF/PCM al formato interno SAMP de Allegro 4 */
-        if (strcmp(argv[i], "--wav") == 0 && i + 1 < argc) {
-            u8* raw; u32 raw_sz;
-            if (load_file_bytes(argv[i+1], &raw, &raw_sz)) {
-                u8* alg_buf = NULL;
-                unsigned int alg_sz = 0;
-                if (wav_to_allegro_samp(raw, raw_sz, &alg_buf, &alg_sz)) {
-                    DatObject* o = &objs[dat->num_objects++];
-                    memcpy(o->type, "SAMP", 4);
-                    o->body.any = alg_buf;
-                    o->len_uncompressed = o->len_compressed = (s32)alg_sz;
-                    o->num_properties = 3;
-                    o->properties = (Property*)calloc(3, sizeof(Property));
-                    sanitize_allegro_name(clean_name, basename_portable(argv[i+1]));
-                    set_prop(&o->properties[0], "DATE", datebuf);
-                    set_prop(&o->properties[1], "NAME", clean_name);
-                    set_prop(&o->properties[2], "ORIG", argv[i+1]);
-                } else {
-                    fprintf(stderr, "Error: could not convert '%s' to Allegro SAMP format\n", argv[i+1]);
-                }
-                free(raw);
+        /* Tileset sin repetidos y mapa: --tiles WxH file.bmp (en el
+           manifiesto: tiles file.bmp tile-size=WxH [tile-flips]) */
+        if (strcmp(argv[i], "--tile-size") == 0 && i + 1 < argc) {
+            if (!parse_size(argv[i], argv[i+1], 1024, &b->next_tile_w, &b->next_tile_h)) return 0;
+            i++; continue;
+        }
+        if (strcmp(argv[i], "--tile-flips") == 0) {
+            b->next_tile_flips = 1;
+            continue;
+        }
+        if (strcmp(argv[i], "--tiles") == 0 && i + 1 < argc) {
+            if (i + 2 < argc && is_size(argv[i+1])) {
+                if (!parse_size(argv[i], argv[i+1], 1024, &b->next_tile_w, &b->next_tile_h)) return 0;
+                i++;
             }
+            if (!add_tiles(b, argv[i+1])) return 0;
             i++; continue;
         }
 
-        /* FLIC: animacion FLI/FLC, almacenada verbatim (spec: "standard format") */
-        if (strcmp(argv[i], "--flic") == 0 && i + 1 < argc) {
-            u8* buf; u32 sz;
-            if (load_file_bytes(argv[i+1], &buf, &sz)) {
-                /* Validar magic FLI (0xAF11) o FLC (0xAF12) en offset 4, little-endian */
-                if (sz >= 6 && ((buf[4] == 0x11 && buf[5] == 0xAF) ||
-                                (buf[4] == 0x12 && buf[5] == 0xAF))) {
-                    DatObject* o = &objs[dat->num_objects++];
-                    memcpy(o->type, "FLIC", 4); o->body.any = buf;
-                    o->len_uncompressed = o->len_compressed = (s32)sz;
-                    o->num_properties = 3; o->properties = (Property*)calloc(3, sizeof(Property));
-                    sanitize_allegro_name(clean_name, basename_portable(argv[i+1]));
-                    set_prop(&o->properties[0], "DATE", datebuf);
-                    set_prop(&o->properties[1], "NAME", clean_name);
-                    set_prop(&o->properties[2], "ORIG", argv[i+1]);
-                } else {
-                    fprintf(stderr, "Error: '%s' is not a valid FLI/FLC file\n", argv[i+1]);
-                    free(buf);
-                }
+        /* Assets: se convierten despues, en paralelo */
+        kind = dat_asset_kind_from_option(argv[i]);
+        if (kind >= 0 && i + 1 < argc) {
+            AssetJob* job;
+            if (b->group >= 0 && b->assets[b->group].kind == ASSET_ATLAS && kind != ASSET_BMP) {
+                fprintf(stderr, "Error: atlas '%s' only takes --bmp, not %s\n", b->assets[b->group].path, argv[i]);
+                return 0;
+            }
+            if (b->next_tile_w || b->next_tile_flips) {
+                fprintf(stderr, "Error: --tile-size and --tile-flips only apply to --tiles, not %s\n", argv[i]);
+                return 0;
+            }
+            job = push_asset(b);
+            if (!job) return 0;
+            job->kind = (AssetKind)kind;
+            job->path = argv[i+1];
+            job->want_name = b->next_name;
+            job->depth = b->next_depth;
+            job->dither = b->next_dither;
+            job->quantize = b->next_quantize;
+            job->wav = b->next_wav;
+            job->keep_meta = b->next_keep_meta;
+            b->next_name = NULL;
+            b->next_depth = 0;
+            b->next_dither = -1;
+            b->next_quantize = NULL;
+            memset(&b->next_wav, 0, sizeof(b->next_wav));
+            b->next_keep_meta = 0;
+            /* Un sprite sin opciones propias toma las del atlas */
+            if (job->group >= 0 && b->assets[job->group].kind == ASSET_ATLAS) {
+                const AssetJob* atlas = &b->assets[job->group];
+                job->atlas = 1;
+                if (!job->depth) job->depth = atlas->depth;
+                if (job->dither < 0) job->dither = atlas->dither;
+                if (!job->quantize) job->quantize = atlas->quantize;
             }
             i++; continue;
         }
+        fprintf(stderr, "Warning: ignoring unknown option '%s'\n", argv[i]);
+    }
+    return 1;
+}
+
+/* --quantize auto: cada BMP lleva detras un PAL con su paleta. Se
+   insertan al terminar el parseo porque --default-quantize puede venir
+   despues de los assets */
+static int add_quantize_palettes(BuildArgs* b) {
+    size_t a, extra = 0, k = 0;
+    AssetJob* na;
+    size_t* moved;
 
-        /* DATA: blob generico */
-        if (strcmp(argv[i], "--data") == 0 && i + 1 < argc) {
-            u8* buf; u32 sz;
-            if (load_file_bytes(argv[i+1], &buf, &sz)) {
-                DatObject* o = &objs[dat->num_objects++];
-                memcpy(o->type, "DATA", 4); o->body.any = buf;
-                o->len_uncompressed = o->len_compressed = (s32)sz;
-                o->num_properties = 3; o->properties = (Property*)calloc(3, sizeof(Property));
-                sanitize_allegro_name(clean_name, basename_portable(argv[i+1]));
-                set_prop(&o->properties[0], "DATE", datebuf);
-                set_prop(&o->properties[1], "NAME", clean_name);
-                set_prop(&o->properties[2], "ORIG", argv[i+1]);
+    for (a = 0; a < b->num_assets; a++) {
+        AssetJob* job = &b->assets[a];
+        const char* q = job->quantize ? job->quantize : b->default_quantize;
+        if (job->kind != ASSET_BMP || !q) continue;
+        if (job->depth || b->default_depth) {
+            fprintf(stderr, "Error: '%s': --quantize and --depth cannot be combined\n", job->path);
+            return 0;
+        }
+        /* Cada sprite tendria su paleta y la pagina solo puede tener una;
+           el PAL que anade tampoco tiene sitio junto al BMP de --tiles */
+        if (job->atlas && strcmp(q, "auto") == 0) {
+            fprintf(stderr, "Error: '%s': --quantize auto cannot be used in an atlas or with --tiles; "
+                    "give a palette file\n", job->path);
+            return 0;
+        }
+        if (strcmp(q, "auto") == 0) extra++;
+    }
+    if (!extra) return 1;
+    na = (AssetJob*)calloc(b->num_assets + extra, sizeof(AssetJob));
+    moved = (size_t*)malloc(sizeof(size_t) * b->num_assets);
+    if (!na || !moved) { free(na); free(moved); return 0; }
+    for (a = 0; a < b->num_assets; a++) {
+        AssetJob* job = &b->assets[a];
+        const char* q = job->quantize ? job->quantize : b->default_quantize;
+        moved[a] = k;
+        na[k] = *job;
+        /* El grupo va antes que sus assets: ya tiene su nuevo indice */
+        if (job->group >= 0) na[k].group = (int)moved[job->group];
+        k++;
+        if (job->kind == ASSET_BMP && q && strcmp(q, "auto") == 0) {
+            na[k].kind = ASSET_QUANT_PAL;
+            na[k].path = job->path;
+            na[k].dither = -1;
+            na[k].companion = 1;
+            na[k].group = na[k - 1].group;
+            k++;
+        }
+    }
+    free(moved);
+    free(b->assets);
+    b->assets = na;
+    b->num_assets = b->cap_assets = k;
+    return 1;
+}
+
+static int finish_build_args(BuildArgs* b) {
+    if (b->individual && b->pack_magic == DAT_F_PACK_MAGIC) {
+        fprintf(stderr, "Error: --pack and --compress are mutually exclusive\n");
+        return 0;
+    }
+    if (b->next_name) {
+        fprintf(stderr, "Error: --name '%s' is not followed by an asset\n", b->next_name);
+        return 0;
+    }
+    if (b->group >= 0) {
+        if (b->assets[b->group].kind == ASSET_ATLAS)
+            fprintf(stderr, "Error: --begin-atlas '%s' has no --end-atlas\n", b->assets[b->group].path);
+        else
+            fprintf(stderr, "Error: --begin-group '%s' has no --end-group\n", b->assets[b->group].path);
+        return 0;
+    }
+    if (b->next_depth || b->next_dither >= 0 || b->next_quantize || b->next_wav.rate ||
+        b->next_wav.mono || b->next_wav.bits || b->next_wav.trim_db || b->next_keep_meta || b->next_tile_w ||
+        b->next_tile_flips) {
+        fprintf(stderr, "Error: a per-asset option (--depth, --rate, ...) is not followed by an asset\n");
+        return 0;
+    }
+    return add_quantize_palettes(b);
+}
+
+/* Cada ventana se convierte, se escribe y se libera antes de la
+   siguiente: la memoria depende de este tamano (en bytes de los ficheros
+   fuente), no del tamano del DAT */
+#define BUILD_WINDOW_BYTES (64u << 20)
+
+/* Fin de la ventana que empieza en start: unidades completas (un asset
+   de primer nivel con su paleta de --quantize auto, o un grupo con todo
+   lo que lleva dentro) mientras
+   quepan en BUILD_WINDOW_BYTES, y al menos una */
+static size_t window_end(const BuildArgs* b, size_t start) {
+    u64 bytes = 0;
+    size_t i = start;
+    while (i < b->num_assets) {
+        u64 unit = 0;
+        size_t j = i;
+        do {
+            struct stat st;
+            if (!dat_is_container(b->assets[j].kind) && stat(b->assets[j].path, &st) == 0)
+                unit += (u64)st.st_size;
+            j++;
+        } while (j < b->num_assets && (b->assets[j].group >= 0 || b->assets[j].companion));
+        if (i > start && bytes + unit > BUILD_WINDOW_BYTES) break;
+        bytes += unit;
+        i = j;
+    }
+    return i;
+}
+
+/* Un objeto reutilizado puede venir comprimido individualmente; sin
+   --compress se guarda descomprimido, como el resto */
+static void unpack_reused(BuildArgs* b, size_t start, size_t end) {
+    size_t a;
+    for (a = start; a < end; a++) {
+        DatObject* o = &b->assets[a].obj;
+        u8* raw;
+        if (!b->assets[a].ok || !o->stored || o->len_uncompressed >= 0) continue;
+        raw = (u8*)malloc((size_t)-o->len_uncompressed);
+        if (!raw) continue;
+        if (!lzss_unpack_buffer(o->stored, (size_t)o->len_compressed, raw, (size_t)-o->len_uncompressed)) {
+            free(raw);
+            continue;
+        }
+        o->stored = raw;
+        o->stored_is_view = 0;
+        o->len_uncompressed = o->len_compressed = -o->len_uncompressed;
+    }
+}
+
+/* CRC32C del cuerpo de un objeto en flujo: una pasada mas por el fichero */
+static int stream_checksum(const AssetJob* job, DatObject* o) {
+    DatBodyStream* s = dat_body_stream_open(job, (u32)o->len_compressed);
+    u8* buf = (u8*)malloc(WAV_BLOCK_SIZE);
+    u32 crc = 0, n;
+    int ok;
+    if (!s || !buf) {
+        if (s) dat_body_stream_close(s);
+        free(buf);
+        return 0;
+    }
+    while ((n = dat_body_stream_read(s, buf, WAV_BLOCK_SIZE)) > 0) crc = dat_crc32c(crc, buf, n);
+    free(buf);
+    ok = dat_body_stream_close(s);
+    if (ok) dat_set_checksum(o, crc);
+    return ok;
+}
+
+/* Escribe objs[0..n) (comprimidos uno a uno con --compress) y cuenta los
+   que quedaron comprimidos. src[k] != NULL es el job de un objeto sin
+   cuerpo en memoria (AssetJob.streamed), que se lee de su fichero al
+   escribirlo */
+static int write_batch(DatWriter* w, BuildArgs* b, DatObject* objs, AssetJob* const* src, u32 n, u32* n_packed) {
+    AllegroDat batch;
+    u32 k;
+    int ok = 1;
+
+    memset(&batch, 0, sizeof(batch));
+    batch.objects = objs;
+    batch.num_objects = n;
+    if (b->individual) {
+        u64 t0 = dat_stats_begin();
+        dat_pack_objects(&batch, b->wopt.pack_level, b->min_gain, b->jobs);
+        dat_stats_end(DAT_STAGE_PACK, t0, NULL, 0, 0);
+    }
+    /* El CRC va sobre el cuerpo tal como queda escrito; sin --checksum
+       se quita el de un objeto reutilizado, que puede haber cambiado */
+    if (b->checksum) {
+        u64 t0 = dat_stats_begin();
+        dat_checksum_objects(&batch, b->jobs);
+        for (k = 0; src && k < n; k++)
+            if (src[k] && !stream_checksum(src[k], &objs[k])) {
+                fprintf(stderr, "Error: '%s' changed while the DAT was written\n", src[k]->path);
+                ok = 0;
+            }
+        dat_stats_end(DAT_STAGE_CHECKSUM, t0, NULL, 0, 0);
+    } else {
+        dat_drop_checksums(&batch);
+    }
+    for (k = 0; k < n; k++) {
+        DatBodyStream* s;
+        if (objs[k].len_uncompressed < 0) (*n_packed)++;
+        if (!src || !src[k]) {
+            if (!dat_writer_add_object(w, &objs[k])) ok = 0;
+        } else if (!ok || !(s = dat_body_stream_open(src[k], (u32)objs[k].len_compressed))) {
+            if (ok) fprintf(stderr, "Error: '%s' changed while the DAT was written\n", src[k]->path);
+            free_dat_object(&objs[k]);
+            ok = 0;
+        } else {
+            if (!dat_writer_add_streamed(w, &objs[k], dat_body_stream_read, s)) ok = 0;
+            if (!dat_body_stream_close(s) && ok) {
+                fprintf(stderr, "Error: '%s' changed while the DAT was written\n", src[k]->path);
+                ok = 0;
             }
-            i++; continue;
         }
     }
+    return ok;
+}
+
+/* Convierte los assets por ventanas (con reused != NULL, como dat
+   update: reutilizando los de prev) y los va escribiendo en orden, con
+   GrabberInfo al final */
+static int build_and_write(const char* out, BuildArgs* b, DatConvertOptions* copt, DatPrevious* prev,
+                           size_t* reused, const char* verb) {
+    DatWriter* w;
+    DatObject* objs;
+    AssetJob** src;
+    DatWriteStats wst;
+    size_t start, end, a;
+    u32 n, num_objects = 0, n_packed = 0;
+    u64 t;
+    int ok = 1;
+
+    objs = (DatObject*)calloc(b->num_assets + 1, sizeof(DatObject));
+    src = (AssetJob**)calloc(b->num_assets + 1, sizeof(AssetJob*));
+    w = objs && src ? dat_writer_open(out, b->pack_magic, &b->wopt) : NULL;
+    if (!w) {
+        fprintf(stderr, "Error: could not write '%s'\n", out);
+        free(objs);
+        free(src);
+        return 1;
+    }
+    /* Un WAV de primer nivel va del fichero al DAT por bloques; comprimido
+       o dentro de un grupo necesita el cuerpo entero en memoria */
+    for (a = 0; a < b->num_assets; a++)
+        b->assets[a].stream_body = b->assets[a].kind == ASSET_WAV && b->assets[a].group < 0 && !b->individual;
+
+    for (start = 0; start < b->num_assets && ok; start = end) {
+        end = window_end(b, start);
+        if (reused) {
+            *reused += dat_update_assets(prev, b->assets + start, end - start, copt, b->jobs);
+            if (!b->individual) unpack_reused(b, start, end);
+        } else {
+            dat_convert_assets(b->assets + start, end - start, copt, b->jobs);
+        }
+        dat_build_groups(b->assets, start, end, copt, b->jobs);
+
+        /* Los objetos se anaden en el orden de la linea de comandos, asi
+           el fichero es identico con cualquier --jobs */
+        n = 0;
+        for (a = start; a < end; a++) {
+            AssetJob* job = &b->assets[a];
+            if (job->ok) {
+                /* Los agrupados ya estan dentro del FILE de su grupo; un
+                   atlas aporta sus paginas y su tabla */
+                if (job->group < 0) {
+                    u32 m = dat_take_job_objects(job, objs + n);
+                    memset(src + n, 0, sizeof(*src) * m);
+                    if (job->streamed) src[n + m - 1] = job;
+                    n += m;
+                }
+                if (job->note[0]) printf("%s\n", job->note);
+                if (job->warning[0]) fprintf(stderr, "%s\n", job->warning);
+            } else if (job->error[0]) fprintf(stderr, "%s\n", job->error);
+        }
+        t = dat_stats_begin();
+        ok = write_batch(w, b, objs, src, n, &n_packed);
+        dat_stats_end(DAT_STAGE_WRITE, t, out, 0, 0);
+        num_objects += n;
+    }
 
     /* Objeto final GrabberInfo */
-    {
-        DatObject* o = &objs[dat->num_objects++];
+    if (ok) {
+        DatObject* o = &objs[0];
+        memset(o, 0, sizeof(*o));
         memcpy(o->type, "info", 4);
-        o->body.any = dupstr("For internal use by the grabber");
+        o->body.any = dat_dupstr("For internal use by the grabber");
         o->len_uncompressed = o->len_compressed = (s32)strlen((char*)o->body.any);
         o->num_properties = 1; o->properties = (Property*)calloc(1, sizeof(Property));
-        set_prop(&o->properties[0], "NAME", "GrabberInfo");
+        dat_set_prop(&o->properties[0], "NAME", "GrabberInfo");
+        ok = write_batch(w, b, objs, NULL, 1, &n_packed);
+        num_objects++;
     }
+    free(objs);
+    free(src);
 
-    if (dat_write(out, dat)) printf("DAT created: %s (%u objects)\n", out, dat->num_objects);
-    free_allegro_dat(dat);
+    if (!ok) {
+        dat_writer_abort(w);
+        fprintf(stderr, "Error: could not write '%s'\n", out);
+        return 1;
+    }
+    t = dat_stats_begin();
+    ok = dat_writer_close(w, &wst);
+    dat_stats_end(DAT_STAGE_WRITE, t, out, ok ? wst.raw_bytes : 0, ok ? wst.disk_bytes : 0);
+    if (!ok) {
+        fprintf(stderr, "Error: could not write '%s'\n", out);
+        return 1;
+    }
+    printf("DAT %s: %s (%u objects)\n", verb, out, num_objects);
+    if (b->individual) {
+        printf("Compressed %u of %u objects individually (min gain %d%%): %llu bytes\n",
+               n_packed, num_objects, b->min_gain, (unsigned long long)wst.disk_bytes);
+    }
+    if (b->pack_magic == DAT_F_PACK_MAGIC) {
+        printf("Packed (level %d): %llu -> %llu bytes (%.1f%%), %.1f MB/s\n",
+               b->wopt.pack_level,
+               (unsigned long long)wst.raw_bytes, (unsigned long long)wst.disk_bytes,
+               wst.raw_bytes ? 100.0 * (double)wst.disk_bytes / (double)wst.raw_bytes : 0.0,
+               wst.seconds > 0 ? (double)wst.raw_bytes / (1024.0 * 1024.0) / wst.seconds : 0.0);
+    }
     return 0;
 }
+
+/* Lo que hay que preparar antes de convertir: opciones, nombres,
+   paletas y cache. datebuf debe vivir mientras se use copt */
+static int begin_convert(BuildArgs* b, char* datebuf, size_t cap, DatConvertOptions* copt) {
+    u64 t0 = dat_stats_begin();
+
+    if (!finish_build_args(b) || !build_datestr(datebuf, cap, &b->reproducible))
+        return 0;
+    if (!dat_assign_names(b->assets, b->num_assets, b->strict_names)) return 0;
+    copt->datestr = datebuf;
+    copt->reproducible = b->reproducible;
+    copt->auto_rle = b->auto_rle;
+    copt->depth = b->default_depth;
+    copt->dither = b->default_dither;
+    copt->quantize = b->default_quantize;
+    copt->atlas_w = b->atlas_w;
+    copt->atlas_h = b->atlas_h;
+    if (!dat_load_palettes(b->assets, b->num_assets, copt)) {
+        dat_palettes_free(copt->palettes);
+        return 0;
+    }
+    copt->cache = NULL;
+    if (b->cache_dir && *b->cache_dir) {
+        copt->cache = dat_cache_open(b->cache_dir);
+        if (!copt->cache) fprintf(stderr, "Warning: cache '%s' is not usable, converting everything\n", b->cache_dir);
+    }
+    dat_stats_end(DAT_STAGE_SETUP, t0, "options, names, palettes", 0, 0);
+    return 1;
+}
+
+static void end_convert(DatConvertOptions* copt, int print_cache) {
+    if (copt->cache) {
+        size_t hits, misses;
+        dat_cache_counts(copt->cache, &hits, &misses);
+        if (print_cache) printf("Cache: %zu hits, %zu misses\n", hits, misses);
+        dat_cache_close(copt->cache);
+    }
+    dat_palettes_free(copt->palettes);
+}
+
+/* Un DAT completo: nombres, conversion (o reutilizacion) y escritura */
+static int run_build(const char* out, BuildArgs* b, int update) {
+    char datebuf[64];
+    DatConvertOptions copt;
+    int rc;
+    u64 t0;
+
+    if (!begin_convert(b, datebuf, sizeof(datebuf), &copt)) return 1;
+    if (update) {
+        /* Reutiliza los objetos cuyo fichero ORIG no ha cambiado */
+        DatPrevious* prev;
+        size_t reused = 0;
+        t0 = dat_stats_begin();
+        prev = dat_previous_open(out);
+        dat_stats_end(DAT_STAGE_SETUP, t0, "index of the previous DAT", 0, 0);
+        rc = build_and_write(out, b, &copt, prev, &reused, "updated");
+        if (rc == 0)
+            printf("Reused %zu of %zu objects, converted %zu\n", reused,
+                   b->num_assets - b->num_groups, b->num_assets - b->num_groups - reused);
+        dat_previous_close(prev);
+    } else {
+        rc = build_and_write(out, b, &copt, NULL, NULL, "created");
+    }
+    end_convert(&copt, rc == 0);
+    return rc;
+}
+
+/* dat create|update @manifest [opciones]: todos los DAT en un proceso.
+   Opciones de la linea de comandos, luego las comunes del manifiesto y
+   por ultimo las del propio DAT */
+static int run_manifest(const char* path, int argc, char** argv, int update) {
+    DatManifest m;
+    size_t t;
+    int rc = 0;
+
+    if (!dat_manifest_load(path, &m)) { dat_manifest_free(&m); return 1; }
+    for (t = 0; t < m.num_targets && rc == 0; t++) {
+        DatManifestTarget* tg = &m.targets[t];
+        BuildArgs b;
+        init_build_args(&b);
+        if (!parse_build_args(argc, argv, 3, &b) ||
+            !parse_build_args(m.common.argc, m.common.argv, 0, &b) ||
+            !parse_build_args(tg->args.argc, tg->args.argv, 0, &b)) {
+            fprintf(stderr, "%s:%d: Error: in the options of '%s'\n", path, tg->line, tg->out);
+            rc = 1;
+        } else {
+            rc = run_build(tg->out, &b, update);
+        }
+        free(b.assets);
+    }
+    dat_manifest_free(&m);
+    return rc;
+}
+
+/* ------------------------------------------------------------------ */
+/* add / replace / remove / set-prop / merge                           */
+/* ------------------------------------------------------------------ */
+
+/* Convierte todos los assets de una edicion (sin ventanas: son pocos) y
+   deja en *objs los de primer nivel. Si uno falla no se edita nada */
+static int convert_for_edit(const char* path, BuildArgs* b, DatObject** objs, u32* n) {
+    char datebuf[64];
+    DatConvertOptions copt;
+    size_t a;
+    int ok = 1;
+
+    *objs = NULL;
+    *n = 0;
+    if (b->pack_magic == DAT_F_PACK_MAGIC) {
+        fprintf(stderr, "Error: --pack does not apply to an edit; '%s' keeps its format\n", path);
+        return 0;
+    }
+    if (!b->num_assets) {
+        fprintf(stderr, "Error: no assets given\n");
+        return 0;
+    }
+    if (!begin_convert(b, datebuf, sizeof(datebuf), &copt)) return 0;
+    dat_convert_assets(b->assets, b->num_assets, &copt, b->jobs);
+    dat_build_groups(b->assets, 0, b->num_assets, &copt, b->jobs);
+    end_convert(&copt, 0);
+
+    *objs = (DatObject*)calloc(b->num_assets, sizeof(DatObject));
+    if (!*objs) {
+        fprintf(stderr, "Error: out of memory\n");
+        ok = 0;
+    }
+    for (a = 0; a < b->num_assets; a++) {
+        AssetJob* job = &b->assets[a];
+        if (!job->ok) {
+            if (job->error[0]) fprintf(stderr, "%s\n", job->error);
+            else fprintf(stderr, "Error: could not convert '%s'\n", job->path);
+            ok = 0;
+        } else {
+            if (job->note[0]) printf("%s\n", job->note);
+            if (job->warning[0]) fprintf(stderr, "%s\n", job->warning);
+        }
+        if (ok && job->ok && job->group < 0) *n += dat_take_job_objects(job, *objs + *n);
+    }
+    if (!ok) {
+        for (a = 0; a < b->num_assets; a++) dat_free_job_objects(&b->assets[a]);
+        if (*objs) {
+            u32 k;
+            for (k = 0; k < *n; k++) free_dat_object(&(*objs)[k]);
+        }
+        free(*objs);
+        *objs = NULL;
+        fprintf(stderr, "Error: '%s' was not changed\n", path);
+        return 0;
+    }
+    {
+        AllegroDat batch;
+        u64 t0 = dat_stats_begin();
+        memset(&batch, 0, sizeof(batch));
+        batch.objects = *objs;
+        batch.num_objects = *n;
+        if (b->individual) {
+            dat_pack_objects(&batch, b->wopt.pack_level, b->min_gain, b->jobs);
+            dat_stats_end(DAT_STAGE_PACK, t0, NULL, 0, 0);
+        }
+        if (b->checksum) {
+            t0 = dat_stats_begin();
+            dat_checksum_objects(&batch, b->jobs);
+            dat_stats_end(DAT_STAGE_CHECKSUM, t0, NULL, 0, 0);
+        }
+    }
+    return 1;
+}
+
+static int edit_done(int ok, const char* path, const DatEditStats* st) {
+    if (!ok) return 1;
+    printf("DAT edited: %s (%u objects): %.1f MB copied, %.1f KB written, %.2f s\n", path, st->objects,
+           (double)st->copied_bytes / (1024.0 * 1024.0), (double)st->new_bytes / 1024.0, st->seconds);
+    return 0;
+}
+
+/* dat add in.dat [opciones de create] */
+static int run_add(int argc, char** argv) {
+    BuildArgs b;
+    DatEditStats st;
+    DatObject* objs;
+    u32 n;
+    int ok;
+
+    init_build_args(&b);
+    ok = parse_build_args(argc, argv, 3, &b) && convert_for_edit(argv[2], &b, &objs, &n);
+    if (ok) {
+        ok = dat_edit_add(argv[2], objs, n, &st);
+        free(objs);
+    }
+    free(b.assets);
+    return edit_done(ok, argv[2], &st);
+}
+
+/* dat replace in.dat NAME [opciones de create para un asset o un grupo] */
+static int run_replace(int argc, char** argv) {
+    BuildArgs b;
+    DatEditStats st;
+    DatObject* objs = NULL;
+    u32 n = 0;
+    int ok;
+
+    if (argc < 5) {
+        usage();
+        return 1;
+    }
+    init_build_args(&b);
+    ok = parse_build_args(argc, argv, 4, &b) && convert_for_edit(argv[2], &b, &objs, &n);
+    if (ok && n != 1) {
+        fprintf(stderr, "Error: dat replace takes one asset or one group, not %u\n", n);
+        while (n) free_dat_object(&objs[--n]);
+        ok = 0;
+    }
+    if (ok) ok = dat_edit_replace(argv[2], argv[3], &objs[0], &st);
+    free(objs);
+    free(b.assets);
+    return edit_done(ok, argv[2], &st);
+}
+
+static int run_edit(int argc, char** argv) {
+    DatEditStats st;
+    const char* cmd = argv[1];
+
+    if (strcmp(cmd, "add") == 0) return run_add(argc, argv);
+    if (strcmp(cmd, "replace") == 0) return run_replace(argc, argv);
+    if (strcmp(cmd, "remove") == 0 && argc >= 4)
+        return edit_done(dat_edit_remove(argv[2], (const char* const*)argv + 3, (size_t)(argc - 3), &st), argv[2], &st);
+    if (strcmp(cmd, "set-prop") == 0 && argc == 6)
+        return edit_done(dat_edit_set_prop(argv[2], argv[3], argv[4], argv[5], &st), argv[2], &st);
+    if (strcmp(cmd, "merge") == 0 && argc == 6 && strcmp(argv[4], "-o") == 0)
+        return edit_done(dat_edit_merge(argv[2], argv[3], argv[5], &st), argv[5], &st);
+    usage();
+    return 1;
+}
+
+/* --stats y --trace FICHERO (o --trace=FICHERO) valen con cualquier
+   orden y en cualquier posicion: se quitan de argv antes de repartir */
+static int take_stats_args(int* argc, char** argv) {
+    const char* trace = NULL;
+    int i, k = 1, summary = 0;
+
+    for (i = 1; i < *argc; i++) {
+        if (strcmp(argv[i], "--stats") == 0) {
+            summary = 1;
+            continue;
+        }
+        if (strcmp(argv[i], "--trace") == 0 || strncmp(argv[i], "--trace=", 8) == 0) {
+            trace = argv[i][7] == '=' ? argv[i] + 8 : (i + 1 < *argc ? argv[++i] : "");
+            if (!*trace) {
+                fprintf(stderr, "Error: --trace needs a file name\n");
+                return 0;
+            }
+            continue;
+        }
+        argv[k++] = argv[i];
+    }
+    *argc = k;
+    argv[k] = NULL;
+    if ((summary || trace) && !dat_stats_enable(summary, trace)) {
+        fprintf(stderr, "Error: out of memory\n");
+        return 0;
+    }
+    return 1;
+}
+
+/* dat extract in.dat outdir [--only NAME]* [--jobs N] */
+static int run_extract(int argc, char** argv) {
+    DatExtractOptions opt;
+    DatExtractStats es;
+    const char** only;
+    int i;
+
+    if (argc < 4) {
+        usage();
+        return 1;
+    }
+    only = (const char**)malloc(sizeof(char*) * (size_t)argc);
+    if (!only) return 1;
+    memset(&opt, 0, sizeof(opt));
+    opt.jobs = dat_cpu_count();
+    for (i = 4; i < argc; i++) {
+        if (strcmp(argv[i], "--only") == 0 && i + 1 < argc) {
+            only[opt.num_only++] = argv[++i];
+        } else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+            opt.jobs = atoi(argv[++i]);
+            if (opt.jobs < 1) opt.jobs = 1;
+        } else {
+            fprintf(stderr, "Error: unknown option '%s' for extract\n", argv[i]);
+            free(only);
+            return 1;
+        }
+    }
+    opt.only = opt.num_only ? only : NULL;
+    if (!dat_extract(argv[2], argv[3], &opt, &es)) {
+        free(only);
+        return 1;
+    }
+    free(only);
+    printf("Extracted %u objects to %s: %.1f MB in %.2f s (%.1f MB/s)\n", es.files, argv[3],
+           (double)es.bytes / (1024.0 * 1024.0), es.seconds,
+           es.seconds > 0 ? (double)es.bytes / (1024.0 * 1024.0) / es.seconds : 0.0);
+    return 0;
+}
+
+static int run_verify(int argc, char** argv) {
+    DatVerifyStats vs;
+    int jobs = dat_cpu_count(), i, ok;
+
+    if (argc < 3) {
+        usage();
+        return 1;
+    }
+    for (i = 3; i < argc; i++) {
+        if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+            jobs = atoi(argv[++i]);
+            if (jobs < 1) jobs = 1;
+        } else {
+            fprintf(stderr, "Error: unknown option '%s' for verify\n", argv[i]);
+            return 1;
+        }
+    }
+    ok = dat_verify(argv[2], jobs, &vs);
+    if (!ok && !vs.errors) return 1; /* no se pudo leer */
+    printf("Verified %u objects in %s: %.1f MB in %.2f s (%.1f MB/s), %u with CRC32C%s\n", vs.objects, argv[2],
+           (double)vs.bytes / (1024.0 * 1024.0), vs.seconds,
+           vs.seconds > 0 ? (double)vs.bytes / (1024.0 * 1024.0) / vs.seconds : 0.0, vs.checksummed,
+           dat_crc32c_hw() ? " (SSE4.2)" : "");
+    if (!ok) {
+        fprintf(stderr, "Error: '%s' has %u problem%s\n", argv[2], vs.errors, vs.errors == 1 ? "" : "s");
+        return 1;
+    }
+    if (vs.objects && !vs.checksummed) printf("No CRC properties: build with --checksum to check the bodies too\n");
+    return 0;
+}
+
+static int run_command(int argc, char** argv) {
+    BuildArgs b;
+    int update, rc;
+
+    /* dispatch commands */
+    if (argc >= 3 && strcmp(argv[1], "list") == 0) {
+        return dat_list(argv[2]);
+    }
+    if (argc >= 2 && strcmp(argv[1], "extract") == 0) return run_extract(argc, argv);
+    if (argc >= 2 && strcmp(argv[1], "verify") == 0) return run_verify(argc, argv);
+    if (argc >= 3 && (strcmp(argv[1], "add") == 0 || strcmp(argv[1], "replace") == 0 ||
+                      strcmp(argv[1], "remove") == 0 || strcmp(argv[1], "set-prop") == 0 ||
+                      strcmp(argv[1], "merge") == 0))
+        return run_edit(argc, argv);
+    if (argc < 3 || (strcmp(argv[1], "create") != 0 && strcmp(argv[1], "update") != 0)) {
+        usage();
+        return 1;
+    }
+    update = strcmp(argv[1], "update") == 0;
+    if (argv[2][0] == '@') return run_manifest(argv[2] + 1, argc, argv, update);
+
+    init_build_args(&b);
+    rc = parse_build_args(argc, argv, 3, &b) ? run_build(argv[2], &b, update) : 1;
+    free(b.assets);
+    return rc;
+}
+
+int main(int argc, char** argv) {
+    int rc;
+
+    if (!take_stats_args(&argc, argv)) return 1;
+    rc = run_command(argc, argv);
+    if (!dat_stats_finish() && rc == 0) rc = 1;
+    return rc;
+}
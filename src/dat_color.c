@@ -0,0 +1,386 @@
+/* src/dat_color.c */
+#include <stdlib.h>
+#include <string.h>
+
+#include "dat_color.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define DAT_HAVE_AVX2 1
+#define AVX2_FN __attribute__((target("avx2")))
+#endif
+
+/* Kernels de una fila. Entrada siempre B,G,R,X (las de 8 y 24 bpp se
+   expanden antes); thr son los umbrales del dither ordenado para 4
+   pixeles consecutivos (todo ceros sin dither) */
+typedef struct {
+    void (*expand24)(const u8 *s, u8 *d, int n);
+    void (*to16)(const u8 *s, u8 *d, int n, const u8 *thr);
+    void (*to24)(const u8 *s, u8 *d, int n);
+    void (*to32)(const u8 *s, u8 *d, int n, u32 alpha);
+} ColorKernels;
+
+static const u8 bayer4[4][4] = {
+    {  0,  8,  2, 10 },
+    { 12,  4, 14,  6 },
+    {  3, 11,  1,  9 },
+    { 15,  7, 13,  5 },
+};
+
+/* ------------------------------------------------------------------ */
+/* Escalar (referencia: las demas rutas dan exactamente lo mismo)      */
+/* ------------------------------------------------------------------ */
+
+static void expand24_c(const u8 *s, u8 *d, int n) {
+    int x;
+    for (x = 0; x < n; x++, s += 3, d += 4) { d[0] = s[0]; d[1] = s[1]; d[2] = s[2]; d[3] = 0; }
+}
+
+static u32 sat_add(u32 v, u32 t) { v += t; return v > 255 ? 255 : v; }
+
+static void to16_c(const u8 *s, u8 *d, int n, const u8 *thr) {
+    int x;
+    for (x = 0; x < n; x++, s += 4, d += 2) {
+        const u8 *t = thr + 4 * (x & 3);
+        u32 b = sat_add(s[0], t[0]), g = sat_add(s[1], t[1]), r = sat_add(s[2], t[2]);
+        u32 c = ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3);
+        d[0] = (u8)c; d[1] = (u8)(c >> 8);
+    }
+}
+
+static void to24_c(const u8 *s, u8 *d, int n) {
+    int x;
+    for (x = 0; x < n; x++, s += 4, d += 3) { d[0] = s[2]; d[1] = s[1]; d[2] = s[0]; }
+}
+
+static void to32_c(const u8 *s, u8 *d, int n, u32 alpha) {
+    int x;
+    for (x = 0; x < n; x++, s += 4, d += 4) {
+        d[0] = s[2]; d[1] = s[1]; d[2] = s[0]; d[3] = (u8)(s[3] | (alpha >> 24));
+    }
+}
+
+static const ColorKernels kernels_c = { expand24_c, to16_c, to24_c, to32_c };
+
+/* ------------------------------------------------------------------ */
+/* SSE2                                                                */
+/* ------------------------------------------------------------------ */
+
+#ifdef __SSE2__
+/* 4 pixeles B,G,R,X -> 4 palabras 5.6.5 en los 16 bits bajos, con
+   signo extendido para que packs_epi32 no las sature */
+static __m128i pack_words_sse2(__m128i v) {
+    __m128i w = _mm_and_si128(_mm_srli_epi32(v, 3), _mm_set1_epi32(0x1F));
+    w = _mm_or_si128(w, _mm_and_si128(_mm_srli_epi32(v, 5), _mm_set1_epi32(0x7E0)));
+    w = _mm_or_si128(w, _mm_and_si128(_mm_srli_epi32(v, 8), _mm_set1_epi32(0xF800)));
+    return _mm_srai_epi32(_mm_slli_epi32(w, 16), 16);
+}
+
+static void to16_sse2(const u8 *s, u8 *d, int n, const u8 *thr) {
+    const __m128i t = _mm_loadu_si128((const __m128i*)thr);
+    int x = 0;
+    for (; x + 8 <= n; x += 8) {
+        __m128i a = _mm_adds_epu8(_mm_loadu_si128((const __m128i*)(s + 4 * x)), t);
+        __m128i b = _mm_adds_epu8(_mm_loadu_si128((const __m128i*)(s + 4 * x + 16)), t);
+        _mm_storeu_si128((__m128i*)(d + 2 * x), _mm_packs_epi32(pack_words_sse2(a), pack_words_sse2(b)));
+    }
+    /* x es multiplo de 4: la fase del patron se conserva */
+    to16_c(s + 4 * x, d + 2 * x, n - x, thr);
+}
+
+/* B,G,R,X -> R,G,B,A: R y B se cruzan con dos desplazamientos */
+static void to32_sse2(const u8 *s, u8 *d, int n, u32 alpha) {
+    const __m128i rb = _mm_set1_epi32(0x00FF00FF), ga = _mm_set1_epi32((int)0xFF00FF00u);
+    const __m128i a = _mm_set1_epi32((int)alpha);
+    int x = 0;
+    for (; x + 4 <= n; x += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(s + 4 * x));
+        __m128i c = _mm_and_si128(v, rb);
+        c = _mm_or_si128(_mm_slli_epi32(c, 16), _mm_srli_epi32(c, 16));
+        _mm_storeu_si128((__m128i*)(d + 4 * x), _mm_or_si128(_mm_or_si128(c, _mm_and_si128(v, ga)), a));
+    }
+    to32_c(s + 4 * x, d + 4 * x, n - x, alpha);
+}
+
+/* Empaquetar a 3 bytes pide un shuffle de bytes (SSSE3): escalar aqui */
+static const ColorKernels kernels_sse2 = { expand24_c, to16_sse2, to24_c, to32_sse2 };
+#endif
+
+/* ------------------------------------------------------------------ */
+/* AVX2 (se elige en tiempo de ejecucion)                              */
+/* ------------------------------------------------------------------ */
+
+#ifdef DAT_HAVE_AVX2
+AVX2_FN static void expand24_avx2(const u8 *s, u8 *d, int n) {
+    const __m256i sh = _mm256_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+                                        0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    int x = 0;
+    /* Cada mitad lee 16 bytes para usar 12: no pasar del final de la fila */
+    for (; x + 10 <= n; x += 8) {
+        __m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)(s + 3 * x))),
+                                            _mm_loadu_si128((const __m128i*)(s + 3 * x + 12)), 1);
+        _mm256_storeu_si256((__m256i*)(d + 4 * x), _mm256_shuffle_epi8(v, sh));
+    }
+    expand24_c(s + 3 * x, d + 4 * x, n - x);
+}
+
+AVX2_FN static __m256i pack_words_avx2(__m256i v) {
+    __m256i w = _mm256_and_si256(_mm256_srli_epi32(v, 3), _mm256_set1_epi32(0x1F));
+    w = _mm256_or_si256(w, _mm256_and_si256(_mm256_srli_epi32(v, 5), _mm256_set1_epi32(0x7E0)));
+    return _mm256_or_si256(w, _mm256_and_si256(_mm256_srli_epi32(v, 8), _mm256_set1_epi32(0xF800)));
+}
+
+AVX2_FN static void to16_avx2(const u8 *s, u8 *d, int n, const u8 *thr) {
+    const __m256i t = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)thr));
+    int x = 0;
+    for (; x + 16 <= n; x += 16) {
+        __m256i a = _mm256_adds_epu8(_mm256_loadu_si256((const __m256i*)(s + 4 * x)), t);
+        __m256i b = _mm256_adds_epu8(_mm256_loadu_si256((const __m256i*)(s + 4 * x + 32)), t);
+        /* packus trabaja por carriles de 128 bits: reordenar los cuartos */
+        __m256i p = _mm256_packus_epi32(pack_words_avx2(a), pack_words_avx2(b));
+        _mm256_storeu_si256((__m256i*)(d + 2 * x), _mm256_permute4x64_epi64(p, 0xD8));
+    }
+    to16_c(s + 4 * x, d + 2 * x, n - x, thr);
+}
+
+AVX2_FN static void to24_avx2(const u8 *s, u8 *d, int n) {
+    const __m256i sh = _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+                                        2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+    const __m256i idx = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
+    int x = 0;
+    for (; x + 8 <= n; x += 8) {
+        __m256i v = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)(s + 4 * x)), sh);
+        v = _mm256_permutevar8x32_epi32(v, idx); /* 24 bytes seguidos */
+        _mm_storeu_si128((__m128i*)(d + 3 * x), _mm256_castsi256_si128(v));
+        _mm_storel_epi64((__m128i*)(d + 3 * x + 16), _mm256_extracti128_si256(v, 1));
+    }
+    to24_c(s + 4 * x, d + 3 * x, n - x);
+}
+
+AVX2_FN static void to32_avx2(const u8 *s, u8 *d, int n, u32 alpha) {
+    const __m256i rb = _mm256_set1_epi32(0x00FF00FF), ga = _mm256_set1_epi32((int)0xFF00FF00u);
+    const __m256i a = _mm256_set1_epi32((int)alpha);
+    int x = 0;
+    for (; x + 8 <= n; x += 8) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(s + 4 * x));
+        __m256i c = _mm256_and_si256(v, rb);
+        c = _mm256_or_si256(_mm256_slli_epi32(c, 16), _mm256_srli_epi32(c, 16));
+        _mm256_storeu_si256((__m256i*)(d + 4 * x), _mm256_or_si256(_mm256_or_si256(c, _mm256_and_si256(v, ga)), a));
+    }
+    to32_c(s + 4 * x, d + 4 * x, n - x, alpha);
+}
+
+static const ColorKernels kernels_avx2 = { expand24_avx2, to16_avx2, to24_avx2, to32_avx2 };
+#endif
+
+static DatColorPath forced_path = DAT_COLOR_AUTO;
+
+static int path_supported(DatColorPath p) {
+    switch (p) {
+    case DAT_COLOR_AUTO:
+    case DAT_COLOR_SCALAR: return 1;
+#ifdef __SSE2__
+    case DAT_COLOR_SSE2: return 1;
+#endif
+#ifdef DAT_HAVE_AVX2
+    case DAT_COLOR_AVX2: return __builtin_cpu_supports("avx2");
+#endif
+    default: return 0;
+    }
+}
+
+static const ColorKernels *select_kernels(void) {
+    DatColorPath p = forced_path;
+    if (p == DAT_COLOR_AUTO)
+        p = path_supported(DAT_COLOR_AVX2) ? DAT_COLOR_AVX2 : (path_supported(DAT_COLOR_SSE2) ? DAT_COLOR_SSE2 : DAT_COLOR_SCALAR);
+#ifdef DAT_HAVE_AVX2
+    if (p == DAT_COLOR_AVX2) return &kernels_avx2;
+#endif
+#ifdef __SSE2__
+    if (p == DAT_COLOR_SSE2) return &kernels_sse2;
+#endif
+    return &kernels_c;
+}
+
+int dat_color_set_path(DatColorPath path) {
+    if (!path_supported(path)) return 0;
+    forced_path = path;
+    return 1;
+}
+
+const char *dat_color_path_name(DatColorPath path) {
+    switch (path) {
+    case DAT_COLOR_SCALAR: return "scalar";
+    case DAT_COLOR_SSE2:   return "sse2";
+    case DAT_COLOR_AVX2:   return "avx2";
+    default:               return "auto";
+    }
+}
+
+/* ------------------------------------------------------------------ */
+/* Dither                                                              */
+/* ------------------------------------------------------------------ */
+
+static const char *dither_names[] = { "none", "ordered", "diffuse" };
+
+int dat_dither_from_name(const char *name) {
+    int i;
+    for (i = 0; i < 3; i++)
+        if (strcmp(name, dither_names[i]) == 0) return i;
+    return -1;
+}
+
+const char *dat_dither_name(DatDither d) {
+    return (unsigned)d < 3 ? dither_names[d] : "?";
+}
+
+int dat_color_depth_valid(int depth) {
+    return depth == 15 || depth == 16 || depth == 24 || depth == 32;
+}
+
+/* Umbrales de la fila y: 0..7 para canales de 5 bits, 0..3 para 6 bits */
+static void ordered_thresholds(int y, u8 thr[16]) {
+    int k;
+    for (k = 0; k < 4; k++) {
+        u8 t = bayer4[y & 3][k];
+        thr[4 * k + 0] = (u8)(t >> 1);
+        thr[4 * k + 1] = (u8)(t >> 2);
+        thr[4 * k + 2] = (u8)(t >> 1);
+        thr[4 * k + 3] = 0;
+    }
+}
+
+/* Nivel mas cercano de 5 o 6 bits y el valor de 8 bits al que vuelve */
+typedef struct {
+    u8 q[256];
+    u8 back[256];
+} QuantTable;
+
+static void quant_table(QuantTable *t, int bits) {
+    int max = (1 << bits) - 1, v;
+    for (v = 0; v < 256; v++) {
+        t->q[v] = (u8)((v * max + 127) / 255);
+        t->back[v] = (u8)((t->q[v] * 255 + max / 2) / max);
+    }
+}
+
+/* Floyd-Steinberg: el error de cada pixel depende del anterior, asi que
+   va en escalar en todas las rutas. err tiene 2 filas de (w+2)*3 */
+static void diffuse_row(const u8 *s, u8 *d, int w, const QuantTable *tab[3], int *cur, int *nxt) {
+    int x, c;
+    memset(nxt, 0, (size_t)(w + 2) * 3 * sizeof(int));
+    for (x = 0; x < w; x++, s += 4, d += 2) {
+        u32 q[3];
+        for (c = 0; c < 3; c++) {
+            int v = s[c] + (cur[(x + 1) * 3 + c] >> 4), e;
+            if (v < 0) v = 0; else if (v > 255) v = 255;
+            q[c] = tab[c]->q[v];
+            e = v - tab[c]->back[v];
+            cur[(x + 2) * 3 + c] += e * 7;
+            nxt[(x + 0) * 3 + c] += e * 3;
+            nxt[(x + 1) * 3 + c] += e * 5;
+            nxt[(x + 2) * 3 + c] += e;
+        }
+        c = (int)((q[2] << 11) | (q[1] << 5) | q[0]);
+        d[0] = (u8)c; d[1] = (u8)(c >> 8);
+    }
+}
+
+/* ------------------------------------------------------------------ */
+/* Conversion                                                          */
+/* ------------------------------------------------------------------ */
+
+void dat_bitmap_to_rgb(DatBitmap *bmp) {
+    size_t i, n = (size_t)bmp->width * bmp->height, ps;
+    u8 *p = bmp->image, t;
+    if (bmp->bits_per_pixel != 24 && bmp->bits_per_pixel != 32) return;
+    ps = (size_t)bmp->bits_per_pixel / 8;
+    for (i = 0; i < n; i++, p += ps) { t = p[0]; p[0] = p[2]; p[2] = t; }
+    /* 4 bytes por pixel solo se leen como RGBA, igual que --depth 32 */
+    if (bmp->bits_per_pixel == 32) bmp->bits_per_pixel = -32;
+}
+
+int dat_bitmap_convert(const DatBitmap *src, const u8 *pal63, int depth, DatDither dither,
+                       DatBitmap **out) {
+    const ColorKernels *k = select_kernels();
+    int w = src->width, h = src->height, sbpp = src->bits_per_pixel, y;
+    s16 obpp = (s16)(depth == 32 ? -32 : depth);
+    size_t spb = (size_t)sbpp / 8, opb = dat_bitmap_pixel_size(obpp);
+    u32 alpha = sbpp == 32 ? 0 : 0xFF000000u; /* el cargador ya decidio el alfa de 32 bpp */
+    QuantTable t5, t6;
+    const QuantTable *tab[3];
+    u8 lut[256][4], *img, *tmp = NULL, zero_thr[16], thr[16];
+    int *err = NULL;
+    DatBitmap *db;
+
+    *out = NULL;
+    if (!dat_color_depth_valid(depth) || (sbpp != 8 && sbpp != 24 && sbpp != 32) || (sbpp == 8 && !pal63))
+        return 0;
+    if (depth != 15 && depth != 16) dither = DAT_DITHER_NONE; /* 8 bits por canal: nada que repartir */
+
+    img = (u8*)malloc((size_t)w * h * opb + 1);
+    if (sbpp != 32) tmp = (u8*)malloc((size_t)w * 4 + 1);
+    if (dither == DAT_DITHER_DIFFUSE) err = (int*)calloc((size_t)(w + 2) * 6, sizeof(int));
+    db = (DatBitmap*)calloc(1, sizeof(DatBitmap));
+    if (!img || (sbpp != 32 && !tmp) || (dither == DAT_DITHER_DIFFUSE && !err) || !db) {
+        free(img); free(tmp); free(err); free(db);
+        return 0;
+    }
+
+    if (sbpp == 8) {
+        /* Paleta 0..63 -> B,G,R,X de 8 bits, como hace Allegro */
+        int i;
+        for (i = 0; i < 256; i++) {
+            const u8 *p = pal63 + 3 * i;
+            int r = (p[0] << 2) | (p[0] >> 4), g = (p[1] << 2) | (p[1] >> 4), b = (p[2] << 2) | (p[2] >> 4);
+            lut[i][0] = (u8)b; lut[i][1] = (u8)g; lut[i][2] = (u8)r; lut[i][3] = 0;
+        }
+    }
+    memset(zero_thr, 0, sizeof(zero_thr));
+    if (dither == DAT_DITHER_DIFFUSE) {
+        quant_table(&t5, 5);
+        quant_table(&t6, 6);
+        tab[0] = &t5; tab[1] = &t6; tab[2] = &t5; /* B, G, R */
+    }
+
+    for (y = 0; y < h; y++) {
+        const u8 *s = src->image + (size_t)y * w * spb;
+        u8 *d = img + (size_t)y * w * opb;
+        if (sbpp == 24) {
+            k->expand24(s, tmp, w);
+            s = tmp;
+        } else if (sbpp == 8) {
+            int x;
+            for (x = 0; x < w; x++) memcpy(tmp + 4 * x, lut[s[x]], 4);
+            s = tmp;
+        }
+        switch (depth) {
+        case 15:
+        case 16:
+            if (dither == DAT_DITHER_DIFFUSE) {
+                int *cur = err + (size_t)(y & 1) * (w + 2) * 3, *nxt = err + (size_t)((y + 1) & 1) * (w + 2) * 3;
+                diffuse_row(s, d, w, tab, cur, nxt);
+            } else if (dither == DAT_DITHER_ORDERED) {
+                ordered_thresholds(y, thr);
+                k->to16(s, d, w, thr);
+            } else {
+                k->to16(s, d, w, zero_thr);
+            }
+            break;
+        case 24: k->to24(s, d, w); break;
+        default: k->to32(s, d, w, alpha); break;
+        }
+    }
+    free(tmp);
+    free(err);
+
+    db->bits_per_pixel = obpp;
+    db->width = (u16)w;
+    db->height = (u16)h;
+    db->image = img;
+    *out = db;
+    return 1;
+}
@@ -0,0 +1,78 @@
+/* src/dat_color.h
+ *
+ * Colour-depth conversion of BMP objects (--depth).
+ *
+ * load_bmp_to_dat_bitmap() keeps the pixel bytes of the file: palette
+ * indices, B,G,R or B,G,R,A, where A is 255 unless a V4/V5 header declares
+ * an alpha mask (the X byte of X8R8G8B8 files is often junk). The converter rewrites them in the layout
+ * Allegro 4's datafile reader expects for the target depth; a bitmap kept
+ * at its own depth goes through dat_bitmap_to_rgb() instead, so every
+ * truecolour object has the same byte order:
+ *
+ *   depth   bits   pixel
+ *   15      15     16-bit LE word rrrrrggggggbbbbb
+ *   16      16     16-bit LE word rrrrrggggggbbbbb
+ *   24      24     R,G,B
+ *   32      -32    R,G,B,A (A as loaded)
+ *
+ * Allegro reads 15 bpp datafile bitmaps as 5.6.5 words too and drops the
+ * low green bit when it builds the 15-bit surface.
+ *
+ * A 32 bpp object with 4 bytes per pixel is only readable as Allegro's
+ * "-32" (RGBA) bitmap, so that is what depth 32 produces, and what
+ * dat_bitmap_to_rgb() turns a 32 bpp bitmap into.
+ *
+ * Rows go through scalar, SSE2 or AVX2 kernels, picked at run time; all
+ * paths produce the same bytes. Reducing to 15/16 bpp can use a 4x4
+ * ordered dither (vectorised) or Floyd-Steinberg error diffusion
+ * (sequential, scalar on every path).
+ */
+#ifndef DAT_COLOR_H
+#define DAT_COLOR_H
+
+#include "allegro_dat_structs.h"
+
+typedef enum {
+    DAT_DITHER_NONE,
+    DAT_DITHER_ORDERED,
+    DAT_DITHER_DIFFUSE
+} DatDither;
+
+typedef enum {
+    DAT_COLOR_AUTO,      /* best path the CPU supports */
+    DAT_COLOR_SCALAR,
+    DAT_COLOR_SSE2,
+    DAT_COLOR_AVX2
+} DatColorPath;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* 1 if depth is a valid --depth value (15, 16, 24, 32) */
+int dat_color_depth_valid(int depth);
+
+/* "none", "ordered", "diffuse" -> mode; -1 if unknown */
+int dat_dither_from_name(const char *name);
+const char *dat_dither_name(DatDither d);
+
+/* Converts src (8, 24 or 32 bpp as loaded) to depth. pal63 (256 x R,G,B
+   in 0..63) is required for 8 bpp sources. Returns 0 on error. */
+int dat_bitmap_convert(const DatBitmap *src, const u8 *pal63, int depth, DatDither dither,
+                       DatBitmap **out);
+
+/* Puts a bitmap as loaded (24 bpp B,G,R or 32 bpp B,G,R,X) in Allegro's
+   R,G,B order in place, for objects stored at their own depth. Other
+   depths are left alone. */
+void dat_bitmap_to_rgb(DatBitmap *bmp);
+
+/* Forces a kernel path (benchmarks); 0 if the CPU lacks it. Not
+   thread-safe: call before converting. */
+int dat_color_set_path(DatColorPath path);
+const char *dat_color_path_name(DatColorPath path);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DAT_COLOR_H */
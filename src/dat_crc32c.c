@@ -0,0 +1,95 @@
+/* src/dat_crc32c.c */
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "dat_crc32c.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <nmmintrin.h>
+#define DAT_HAVE_SSE42 1
+#define SSE42_FN __attribute__((target("sse4.2")))
+#endif
+
+#define CRC32C_POLY 0x82F63B78u /* reflejado */
+
+static u32 table[8][256];
+static pthread_once_t table_once = PTHREAD_ONCE_INIT;
+
+static void build_table(void) {
+    u32 i, k, c;
+    for (i = 0; i < 256; i++) {
+        c = i;
+        for (k = 0; k < 8; k++) c = (c >> 1) ^ (CRC32C_POLY & (0u - (c & 1)));
+        table[0][i] = c;
+    }
+    for (i = 0; i < 256; i++)
+        for (k = 1; k < 8; k++) table[k][i] = (table[k - 1][i] >> 8) ^ table[0][table[k - 1][i] & 0xFF];
+}
+
+/* Slicing-by-8: ocho bytes por vuelta con ocho tablas */
+static u32 crc_table(u32 crc, const u8 *p, size_t n) {
+    pthread_once(&table_once, build_table);
+    crc = ~crc;
+    while (n && ((uintptr_t)p & 7)) {
+        crc = (crc >> 8) ^ table[0][(crc ^ *p++) & 0xFF];
+        n--;
+    }
+    while (n >= 8) {
+        u32 lo = crc ^ ((u32)p[0] | ((u32)p[1] << 8) | ((u32)p[2] << 16) | ((u32)p[3] << 24));
+        u32 hi = (u32)p[4] | ((u32)p[5] << 8) | ((u32)p[6] << 16) | ((u32)p[7] << 24);
+        crc = table[7][lo & 0xFF] ^ table[6][(lo >> 8) & 0xFF] ^ table[5][(lo >> 16) & 0xFF] ^ table[4][lo >> 24] ^
+              table[3][hi & 0xFF] ^ table[2][(hi >> 8) & 0xFF] ^ table[1][(hi >> 16) & 0xFF] ^ table[0][hi >> 24];
+        p += 8;
+        n -= 8;
+    }
+    while (n--) crc = (crc >> 8) ^ table[0][(crc ^ *p++) & 0xFF];
+    return ~crc;
+}
+
+#ifdef DAT_HAVE_SSE42
+SSE42_FN static u32 crc_sse42(u32 crc, const u8 *p, size_t n) {
+    crc = ~crc;
+    while (n && ((uintptr_t)p & 7)) {
+        crc = _mm_crc32_u8(crc, *p++);
+        n--;
+    }
+#ifdef __x86_64__
+    {
+        u64 c = crc;
+        while (n >= 8) {
+            u64 v;
+            memcpy(&v, p, 8);
+            c = _mm_crc32_u64(c, v);
+            p += 8;
+            n -= 8;
+        }
+        crc = (u32)c;
+    }
+#endif
+    while (n >= 4) {
+        u32 v;
+        memcpy(&v, p, 4);
+        crc = _mm_crc32_u32(crc, v);
+        p += 4;
+        n -= 4;
+    }
+    while (n--) crc = _mm_crc32_u8(crc, *p++);
+    return ~crc;
+}
+#endif
+
+int dat_crc32c_hw(void) {
+#ifdef DAT_HAVE_SSE42
+    return __builtin_cpu_supports("sse4.2") != 0;
+#else
+    return 0;
+#endif
+}
+
+u32 dat_crc32c(u32 crc, const void *p, size_t n) {
+#ifdef DAT_HAVE_SSE42
+    if (dat_crc32c_hw()) return crc_sse42(crc, (const u8*)p, n);
+#endif
+    return crc_table(crc, (const u8*)p, n);
+}
@@ -0,0 +1,31 @@
+/* src/dat_crc32c.h
+ *
+ * CRC32C (Castagnoli polynomial, as in iSCSI, ext4 and SSE4.2), used by
+ * --checksum and dat verify.
+ *
+ * The SSE4.2 crc32 instruction is used when the CPU has it (picked at run
+ * time, like the colour kernels), with tables of 8 x 256 entries
+ * (slicing-by-8) otherwise. Both give the same values.
+ */
+#ifndef DAT_CRC32C_H
+#define DAT_CRC32C_H
+
+#include <stddef.h>
+#include "allegro_dat_structs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* CRC of p[0..n) continuing crc (0 to start):
+   dat_crc32c(0, "123456789", 9) == 0xE3069283. Thread-safe. */
+u32 dat_crc32c(u32 crc, const void *p, size_t n);
+
+/* 1 if the SSE4.2 instruction is in use. */
+int dat_crc32c_hw(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DAT_CRC32C_H */
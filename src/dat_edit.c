@@ -0,0 +1,519 @@
+/* src/dat_edit.c */
+#define _POSIX_C_SOURCE 200809L
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dat_build.h"
+#include "dat_edit.h"
+#include "dat_names.h"
+#include "dat_reader.h"
+#include "dat_stats.h"
+#include "dat_writer.h"
+
+typedef struct {
+    const char *path;
+    DatFile    *df;
+    int         fd;
+} Source;
+
+/* Un objeto del resultado: copia de uno de src (con otras propiedades si
+   props no es NULL) o un objeto nuevo */
+typedef struct {
+    const Source   *src;
+    const DatEntry *e;
+    u8             *props;
+    u32             props_len;
+    DatObject      *obj;
+} Piece;
+
+typedef struct {
+    Piece  *p;
+    size_t  n, cap;
+} Plan;
+
+static int open_source(Source *s, const char *path) {
+    s->path = path;
+    s->df = dat_open(path);
+    s->fd = s->df ? open(path, O_RDONLY) : -1;
+    if (!s->df || s->fd < 0) {
+        fprintf(stderr, "Error: cannot read '%s' as an Allegro DAT file\n", path);
+        dat_close(s->df);
+        s->df = NULL;
+        return 0;
+    }
+    return 1;
+}
+
+static void close_source(Source *s) {
+    if (!s->df) return;
+    close(s->fd);
+    dat_close(s->df);
+    s->df = NULL;
+}
+
+static Piece *plan_add(Plan *pl) {
+    if (pl->n == pl->cap) {
+        size_t nc = pl->cap ? pl->cap * 2 : 64;
+        Piece *np = (Piece*)realloc(pl->p, nc * sizeof(Piece));
+        if (!np) {
+            fprintf(stderr, "Error: out of memory\n");
+            return NULL;
+        }
+        pl->p = np;
+        pl->cap = nc;
+    }
+    memset(&pl->p[pl->n], 0, sizeof(Piece));
+    return &pl->p[pl->n++];
+}
+
+/* Los objetos de src en [from, to) */
+static int plan_entries(Plan *pl, const Source *src, u32 from, u32 to) {
+    u32 i;
+    for (i = from; i < to; i++) {
+        Piece *p = plan_add(pl);
+        if (!p) return 0;
+        p->src = src;
+        p->e = dat_entry(src->df, i);
+    }
+    return 1;
+}
+
+static int plan_object(Plan *pl, DatObject *o) {
+    Piece *p = plan_add(pl);
+    if (!p) return 0;
+    p->obj = o;
+    return 1;
+}
+
+static void plan_free(Plan *pl) {
+    size_t i;
+    for (i = 0; i < pl->n; i++) {
+        free(pl->p[i].props);
+        if (!pl->p[i].obj) continue;
+        free_dat_object(pl->p[i].obj);
+        memset(pl->p[i].obj, 0, sizeof(DatObject));
+    }
+    free(pl->p);
+    pl->p = NULL;
+    pl->n = pl->cap = 0;
+}
+
+static void free_objects(DatObject *objs, u32 n) {
+    u32 i;
+    for (i = 0; i < n; i++) {
+        free_dat_object(&objs[i]);
+        memset(&objs[i], 0, sizeof(objs[i]));
+    }
+}
+
+/* Indice del primer objeto llamado name, o -1 */
+static long find_index(const Source *s, const char *name) {
+    const DatEntry *e = dat_find(s->df, name);
+    return e ? (long)(e - dat_entry(s->df, 0)) : -1;
+}
+
+/* NAME de e en buf ("" si no tiene) */
+static void entry_name(const DatEntry *e, char *buf, size_t cap) {
+    u32 len = 0;
+    const char *v = dat_prop(e, "NAME", &len);
+    if (!v) len = 0;
+    if (len >= cap) len = (u32)cap - 1;
+    memcpy(buf, v ? v : "", len);
+    buf[len] = '\0';
+}
+
+static const char *object_name(const DatObject *o) {
+    int i;
+    for (i = 0; i < o->num_properties; i++)
+        if (!memcmp(o->properties[i].type, "NAME", 4)) return o->properties[i].body;
+    return NULL;
+}
+
+static u64 object_bytes(const DatObject *o) {
+    u64 n = 12 + (u64)(u32)o->len_compressed;
+    int i;
+    for (i = 0; i < o->num_properties; i++) n += 12 + (u64)o->properties[i].len_body;
+    return n;
+}
+
+static u8 *put_prop(u8 *d, const char type4[4], const char *value, u32 len) {
+    memcpy(d, "prop", 4);
+    memcpy(d + 4, type4, 4);
+    d[8] = (u8)(len >> 24); d[9] = (u8)(len >> 16); d[10] = (u8)(len >> 8); d[11] = (u8)len;
+    memcpy(d + 12, value, len);
+    return d + 12 + len;
+}
+
+/* Las propiedades de e con type4 = value (en su sitio, o al final si no
+   estaba); value "" la quita. El orden de las demas no cambia */
+static int rewrite_props(Piece *p, const char type4[4], const char *value) {
+    const DatEntry *e = p->e;
+    u32 vlen = (u32)strlen(value), pos = 0;
+    u8 *buf = (u8*)malloc((size_t)e->props_len + 12 + vlen), *d = buf;
+    int placed = vlen == 0;
+
+    if (!buf) {
+        fprintf(stderr, "Error: out of memory\n");
+        return 0;
+    }
+    while (pos + 12 <= e->props_len) {
+        const u8 *c = e->props + pos;
+        u32 plen = ((u32)c[8] << 24) | ((u32)c[9] << 16) | ((u32)c[10] << 8) | (u32)c[11];
+        if (memcmp(c + 4, type4, 4) != 0) {
+            memcpy(d, c, 12 + (size_t)plen);
+            d += 12 + plen;
+        } else if (!placed) {
+            d = put_prop(d, type4, value, vlen);
+            placed = 1;
+        }
+        pos += 12 + plen;
+    }
+    if (!placed) d = put_prop(d, type4, value, vlen);
+    p->props = buf;
+    p->props_len = (u32)(d - buf);
+    return 1;
+}
+
+/* ------------------------------------------------------------------ */
+/* Escritura                                                           */
+/* ------------------------------------------------------------------ */
+
+/* Un tramo de objetos seguidos de una fuente, pendiente de copiar */
+typedef struct {
+    const Source *src;
+    const u8     *p;
+    u64           len;
+    u32           objects;
+} Run;
+
+static int flush_run(DatWriter *w, Run *r, DatEditStats *st) {
+    u64 off;
+    int ok;
+    if (!r->len) return 1;
+    if (dat_file_offset(r->src->df, r->p, &off))
+        ok = dat_writer_copy_range(w, r->src->fd, off, r->len, r->objects);
+    else
+        ok = dat_writer_add_bytes(w, r->p, r->len, r->objects); /* "slh!": desde memoria */
+    st->copied_bytes += r->len;
+    r->len = 0;
+    r->objects = 0;
+    return ok;
+}
+
+static int write_plan(const char *out, u32 pack_magic, Plan *pl, DatEditStats *st) {
+    DatWriter *w;
+    Run run;
+    size_t i;
+    int ok = 1;
+    u64 t0 = dat_stats_begin();
+
+    memset(&run, 0, sizeof(run));
+    w = dat_writer_open(out, pack_magic, NULL);
+    if (!w) {
+        fprintf(stderr, "Error: could not write '%s'\n", out);
+        return 0;
+    }
+    for (i = 0; i < pl->n && ok; i++) {
+        Piece *p = &pl->p[i];
+        const u8 *raw;
+        u64 size;
+
+        if (p->obj) {
+            st->new_bytes += object_bytes(p->obj);
+            ok = flush_run(w, &run, st) && dat_writer_add_object(w, p->obj);
+            continue;
+        }
+        raw = dat_entry_raw(p->e, &size);
+        if (p->props) {
+            /* Propiedades nuevas; cabecera y cuerpo siguen siendo copia */
+            st->new_bytes += p->props_len;
+            ok = flush_run(w, &run, st) && dat_writer_add_bytes(w, p->props, p->props_len, 0);
+            raw += p->e->props_len;
+            size -= p->e->props_len;
+        }
+        if (run.len && (run.src != p->src || run.p + run.len != raw)) ok = ok && flush_run(w, &run, st);
+        if (!run.len) {
+            run.src = p->src;
+            run.p = raw;
+        }
+        run.len += size;
+        run.objects++;
+    }
+    ok = ok && flush_run(w, &run, st);
+    if (!ok) {
+        dat_writer_abort(w);
+        fprintf(stderr, "Error: could not write '%s'\n", out);
+        return 0;
+    }
+    if (!dat_writer_close(w, NULL)) {
+        fprintf(stderr, "Error: could not write '%s'\n", out);
+        return 0;
+    }
+    st->objects = (u32)pl->n;
+    dat_stats_end(DAT_STAGE_WRITE, t0, out, st->copied_bytes + st->new_bytes, st->copied_bytes + st->new_bytes);
+    return 1;
+}
+
+static void start_stats(DatEditStats *st, u64 *t) {
+    memset(st, 0, sizeof(*st));
+    *t = dat_stats_now();
+}
+
+static void end_stats(DatEditStats *st, u64 t) {
+    st->seconds = (double)(dat_stats_now() - t) * 1e-9;
+}
+
+/* ------------------------------------------------------------------ */
+/* Operaciones                                                         */
+/* ------------------------------------------------------------------ */
+
+int dat_edit_add(const char *path, DatObject *objs, u32 n, DatEditStats *st) {
+    Source s;
+    Plan pl;
+    u32 i, count, at;
+    u64 t;
+    int ok = 0;
+
+    start_stats(st, &t);
+    memset(&pl, 0, sizeof(pl));
+    if (!open_source(&s, path)) {
+        free_objects(objs, n);
+        return 0;
+    }
+    for (i = 0; i < n; i++) {
+        const char *name = object_name(&objs[i]);
+        if (name && dat_find(s.df, name)) {
+            fprintf(stderr, "Error: NAME '%s' is already used in '%s' (dat replace changes an object)\n",
+                    name, path);
+            goto done;
+        }
+    }
+    /* GrabberInfo sigue siendo el ultimo */
+    count = dat_num_objects(s.df);
+    at = count && !memcmp(dat_entry(s.df, count - 1)->type, "info", 4) ? count - 1 : count;
+    if (!plan_entries(&pl, &s, 0, at)) goto done;
+    for (i = 0; i < n; i++)
+        if (!plan_object(&pl, &objs[i])) goto done;
+    if (!plan_entries(&pl, &s, at, count)) goto done;
+    ok = write_plan(path, dat_pack_magic(s.df), &pl, st);
+done:
+    plan_free(&pl);
+    free_objects(objs, n);
+    close_source(&s);
+    end_stats(st, t);
+    return ok;
+}
+
+int dat_edit_replace(const char *path, const char *name, DatObject *obj, DatEditStats *st) {
+    Source s;
+    Plan pl;
+    char old[256];
+    long at;
+    int i, ok = 0;
+    u64 t;
+
+    start_stats(st, &t);
+    memset(&pl, 0, sizeof(pl));
+    if (!open_source(&s, path)) {
+        free_objects(obj, 1);
+        return 0;
+    }
+    at = find_index(&s, name);
+    if (at < 0) {
+        fprintf(stderr, "Error: no object named '%s' in '%s'\n", name, path);
+        goto done;
+    }
+    /* El nuevo se llama exactamente como el que sustituye */
+    entry_name(dat_entry(s.df, (u32)at), old, sizeof(old));
+    for (i = 0; i < obj->num_properties; i++) {
+        if (memcmp(obj->properties[i].type, "NAME", 4) != 0) continue;
+        free_property(&obj->properties[i]);
+        dat_set_prop(&obj->properties[i], "NAME", old);
+        if (!obj->properties[i].body) {
+            fprintf(stderr, "Error: out of memory\n");
+            goto done;
+        }
+    }
+    if (!plan_entries(&pl, &s, 0, (u32)at) || !plan_object(&pl, obj) ||
+        !plan_entries(&pl, &s, (u32)at + 1, dat_num_objects(s.df)))
+        goto done;
+    ok = write_plan(path, dat_pack_magic(s.df), &pl, st);
+done:
+    plan_free(&pl);
+    free_objects(obj, 1);
+    close_source(&s);
+    end_stats(st, t);
+    return ok;
+}
+
+int dat_edit_remove(const char *path, const char *const *names, size_t n, DatEditStats *st) {
+    Source s;
+    Plan pl;
+    u8 *gone = NULL;
+    u32 i, count;
+    size_t k;
+    int ok = 0;
+    u64 t;
+
+    start_stats(st, &t);
+    memset(&pl, 0, sizeof(pl));
+    if (!open_source(&s, path)) return 0;
+    count = dat_num_objects(s.df);
+    gone = (u8*)calloc(count ? count : 1, 1);
+    if (!gone) {
+        fprintf(stderr, "Error: out of memory\n");
+        goto done;
+    }
+    for (k = 0; k < n; k++) {
+        long at = find_index(&s, names[k]);
+        if (at < 0) {
+            fprintf(stderr, "Error: no object named '%s' in '%s'\n", names[k], path);
+            goto done;
+        }
+        gone[at] = 1;
+    }
+    for (i = 0; i < count; i++)
+        if (!gone[i] && !plan_entries(&pl, &s, i, i + 1)) goto done;
+    ok = write_plan(path, dat_pack_magic(s.df), &pl, st);
+done:
+    free(gone);
+    plan_free(&pl);
+    close_source(&s);
+    end_stats(st, t);
+    return ok;
+}
+
+int dat_edit_set_prop(const char *path, const char *name, const char *type, const char *value,
+                      DatEditStats *st) {
+    Source s;
+    Plan pl;
+    char type4[4];
+    long at, other;
+    size_t k, tl = strlen(type);
+    int ok = 0;
+    u64 t;
+
+    start_stats(st, &t);
+    memset(&pl, 0, sizeof(pl));
+    if (tl == 0 || tl > 4) {
+        fprintf(stderr, "Error: a property type has 1 to 4 characters\n");
+        return 0;
+    }
+    /* Como el grabber: mayusculas, rellenado con espacios */
+    for (k = 0; k < 4; k++) type4[k] = k < tl ? (char)toupper((unsigned char)type[k]) : ' ';
+    if (!memcmp(type4, "NAME", 4) && !*value) {
+        fprintf(stderr, "Error: the NAME property cannot be removed\n");
+        return 0;
+    }
+    if (!open_source(&s, path)) return 0;
+    at = find_index(&s, name);
+    if (at < 0) {
+        fprintf(stderr, "Error: no object named '%s' in '%s'\n", name, path);
+        goto done;
+    }
+    if (!memcmp(type4, "NAME", 4) && (other = find_index(&s, value)) >= 0 && other != at) {
+        fprintf(stderr, "Error: NAME '%s' is already used in '%s'\n", value, path);
+        goto done;
+    }
+    if (!plan_entries(&pl, &s, 0, dat_num_objects(s.df)) || !rewrite_props(&pl.p[at], type4, value))
+        goto done;
+    ok = write_plan(path, dat_pack_magic(s.df), &pl, st);
+done:
+    plan_free(&pl);
+    close_source(&s);
+    end_stats(st, t);
+    return ok;
+}
+
+/* Todos los objetos de src menos GrabberInfo; los NAME ya usados se
+   renombran como en dat create. names guarda las copias de los nombres */
+static int plan_merged(Plan *pl, const Source *src, DatNameSet *set, char ***names, size_t *num_names) {
+    u32 i, count = dat_num_objects(src->df);
+    char **nn = (char**)realloc(*names, (*num_names + count + 1) * sizeof(char*));
+
+    if (!nn) {
+        fprintf(stderr, "Error: out of memory\n");
+        return 0;
+    }
+    *names = nn;
+    for (i = 0; i < count; i++) {
+        const DatEntry *e = dat_entry(src->df, i);
+        char name[256], *copy;
+        size_t cap;
+        int r;
+
+        if (!memcmp(e->type, "info", 4)) continue;
+        if (!plan_entries(pl, src, i, i + 1)) return 0;
+        entry_name(e, name, sizeof(name));
+        if (!name[0]) continue;
+        cap = strlen(name) + 16;
+        copy = (char*)malloc(cap);
+        if (!copy) {
+            fprintf(stderr, "Error: out of memory\n");
+            return 0;
+        }
+        memcpy(copy, name, strlen(name) + 1);
+        nn[(*num_names)++] = copy;
+        r = dat_names_add_unique(set, copy, cap, pl->n - 1);
+        if (r < 0) {
+            fprintf(stderr, "Error: out of memory\n");
+            return 0;
+        }
+        if (r == 1) {
+            fprintf(stderr, "Warning: NAME '%s' of '%s' is already used, stored as '%s'\n",
+                    name, src->path, copy);
+            if (!rewrite_props(&pl->p[pl->n - 1], "NAME", copy)) return 0;
+        }
+    }
+    return 1;
+}
+
+int dat_edit_merge(const char *a, const char *b, const char *out, DatEditStats *st) {
+    Source sa, sb;
+    Plan pl;
+    DatNameSet *set = NULL;
+    char **names = NULL;
+    size_t num_names = 0, k;
+    const Source *info_src = NULL;
+    u32 i, info = 0;
+    int ok = 0;
+    u64 t;
+
+    start_stats(st, &t);
+    memset(&pl, 0, sizeof(pl));
+    sb.df = NULL;
+    if (!open_source(&sa, a)) return 0;
+    if (!open_source(&sb, b)) goto done;
+    set = dat_names_create(dat_num_objects(sa.df) + dat_num_objects(sb.df));
+    if (!set) {
+        fprintf(stderr, "Error: out of memory\n");
+        goto done;
+    }
+    if (!plan_merged(&pl, &sa, set, &names, &num_names) || !plan_merged(&pl, &sb, set, &names, &num_names))
+        goto done;
+    /* Un solo GrabberInfo, el de a (o el de b), al final */
+    for (k = 0; k < 2 && !info_src; k++) {
+        const Source *s = k ? &sb : &sa;
+        for (i = 0; i < dat_num_objects(s->df); i++) {
+            if (memcmp(dat_entry(s->df, i)->type, "info", 4) != 0) continue;
+            info_src = s;
+            info = i;
+            break;
+        }
+    }
+    if (info_src && !plan_entries(&pl, info_src, info, info + 1)) goto done;
+    ok = write_plan(out, dat_pack_magic(sa.df), &pl, st);
+done:
+    plan_free(&pl);
+    dat_names_free(set);
+    for (k = 0; k < num_names; k++) free(names[k]);
+    free(names);
+    close_source(&sb);
+    close_source(&sa);
+    end_stats(st, t);
+    return ok;
+}
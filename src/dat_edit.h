@@ -0,0 +1,64 @@
+/* src/dat_edit.h
+ *
+ * Edits of an existing DAT without its source files: add, remove or
+ * replace objects, change a property, merge two DATs.
+ *
+ * Only what changes is serialized: the new objects and the property
+ * chunks of renamed or re-tagged ones. Every other object is moved as
+ * the bytes it already has, without being decoded, with runs of adjacent
+ * objects copied in one dat_writer_copy_range call. The result goes to a
+ * temporary that replaces the file at the end, as with dat create, so an
+ * edit that fails leaves the DAT as it was.
+ *
+ * A "slh!" file cannot be copied by ranges, since the LZSS stream covers
+ * the whole file: its objects come from memory and the result is packed
+ * again. The format of the DAT is always kept.
+ *
+ * Objects are looked up by NAME at the top level, without case, like
+ * Allegro does; when a name repeats, the first object is the one edited.
+ */
+#ifndef DAT_EDIT_H
+#define DAT_EDIT_H
+
+#include <stddef.h>
+#include "allegro_dat_structs.h"
+
+typedef struct {
+    u32    objects;       /* objects in the result */
+    u64    copied_bytes;  /* moved unchanged */
+    u64    new_bytes;     /* serialized: new objects and rewritten properties */
+    double seconds;
+} DatEditStats;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Every function returns 0 after printing the reason on stderr, and then
+   the DAT is left unchanged. The DatObjects passed in are written and
+   freed (zeroed) either way. */
+
+/* Appends objs, before a final GrabberInfo. Fails if a NAME is already used. */
+int dat_edit_add(const char *path, DatObject *objs, u32 n, DatEditStats *st);
+
+/* Puts obj in the place of the object called name; obj takes that NAME. */
+int dat_edit_replace(const char *path, const char *name, DatObject *obj, DatEditStats *st);
+
+/* Removes the objects called names[0..n). */
+int dat_edit_remove(const char *path, const char *const *names, size_t n, DatEditStats *st);
+
+/* Sets property type (up to 4 characters, e.g. NAME, XPOS) of the object
+   called name; an empty value removes it. Renaming to a NAME in use fails. */
+int dat_edit_set_prop(const char *path, const char *name, const char *type, const char *value,
+                      DatEditStats *st);
+
+/* out = the objects of a, then those of b, with a single GrabberInfo at
+   the end. NAMEs of b already in use become NAME_2, NAME_3... with a
+   warning, as in dat create. out may be a or b. */
+int dat_edit_merge(const char *a, const char *b, const char *out, DatEditStats *st);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DAT_EDIT_H */
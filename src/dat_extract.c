@@ -0,0 +1,689 @@
+/* src/dat_extract.c */
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "dat_extract.h"
+#include "dat_names.h"
+#include "dat_pool.h"
+#include "dat_reader.h"
+#include "dat_stats.h"
+#include "lzss.h"
+
+#define NAME_CAP   128  /* nombre de fichero sin extension */
+#define MAX_DEPTH  32
+#define OUT_BUF    (256 * 1024)
+
+typedef struct {
+    const DatEntry *e;
+    const DatEntry *pal;      /* paleta para un BMP de 8 bpp (NULL = gris) */
+    char           *path;
+    const char     *err;      /* NULL = bien; si no, motivo */
+    int             err_no;
+    u64             bytes;
+} ExtractTask;
+
+typedef struct Dir {
+    char       *path;
+    int         created;
+    struct Dir *parent;
+} Dir;
+
+typedef struct {
+    const DatExtractOptions *opt;
+    u8            *matched;    /* [num_only] */
+    const DatEntry *top_pal;   /* primera PAL del nivel superior */
+    ExtractTask   *tasks;
+    size_t         num_tasks, cap_tasks;
+    void         **keep;       /* listas y cuerpos de FILE, hasta el final */
+    size_t         num_keep, cap_keep;
+    Dir          **dirs;
+    size_t         num_dirs, cap_dirs;
+} Extractor;
+
+static u16 rd_be16(const u8 *p) { return (u16)((p[0] << 8) | p[1]); }
+static u32 rd_be32(const u8 *p) {
+    return ((u32)p[0] << 24) | ((u32)p[1] << 16) | ((u32)p[2] << 8) | (u32)p[3];
+}
+static void wr_le16(u8 *p, u32 v) { p[0] = (u8)v; p[1] = (u8)(v >> 8); }
+static void wr_le32(u8 *p, u32 v) { wr_le16(p, v); wr_le16(p + 2, v >> 16); }
+static void wr_be16(u8 *p, u32 v) { p[0] = (u8)(v >> 8); p[1] = (u8)v; }
+static void wr_be32(u8 *p, u32 v) { wr_be16(p, v >> 16); wr_be16(p + 2, v); }
+
+static int grow(void **arr, size_t *cap, size_t need, size_t elem) {
+    void *na;
+    size_t nc;
+    if (need <= *cap) return 1;
+    nc = *cap ? *cap * 2 : 64;
+    while (nc < need) nc *= 2;
+    na = realloc(*arr, nc * elem);
+    if (!na) return 0;
+    *arr = na;
+    *cap = nc;
+    return 1;
+}
+
+static int keep(Extractor *x, void *p) {
+    if (!grow((void**)&x->keep, &x->cap_keep, x->num_keep + 1, sizeof(void*))) return 0;
+    x->keep[x->num_keep++] = p;
+    return 1;
+}
+
+/* ------------------------------------------------------------------ */
+/* Salida con buffer sobre un descriptor                               */
+/* ------------------------------------------------------------------ */
+
+typedef struct {
+    int  fd;
+    int  ok;
+    u64  bytes;
+    size_t len;
+    u8   buf[OUT_BUF];
+} Out;
+
+static int write_all(Out *o, const u8 *p, size_t n) {
+    while (n && o->ok) {
+        ssize_t w = write(o->fd, p, n);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) { o->ok = 0; break; }
+        p += w; n -= (size_t)w;
+    }
+    return o->ok;
+}
+
+static int out_flush(Out *o) {
+    int ok = write_all(o, o->buf, o->len);
+    o->len = 0;
+    return ok;
+}
+
+/* Los bloques grandes (cuerpos en bruto) van directos desde el mapeo */
+static int out_put(Out *o, const void *p, size_t n) {
+    o->bytes += n;
+    if (o->len + n > sizeof(o->buf)) {
+        if (!out_flush(o)) return 0;
+        if (n >= sizeof(o->buf)) return write_all(o, (const u8*)p, n);
+    }
+    memcpy(o->buf + o->len, p, n);
+    o->len += n;
+    return o->ok;
+}
+
+/* ------------------------------------------------------------------ */
+/* Conversores                                                         */
+/* ------------------------------------------------------------------ */
+
+/* Cuerpo descomprimido; *owned hay que liberarlo. NULL si esta roto */
+static const u8 *entry_body(const DatEntry *e, u8 **owned, u32 *size) {
+    u32 raw;
+    *owned = NULL;
+    if (e->len_uncompressed >= 0) {
+        *size = (u32)e->len_compressed;
+        return e->stored;
+    }
+    raw = (u32)-e->len_uncompressed;
+    *owned = (u8*)malloc(raw ? raw : 1);
+    if (!*owned) return NULL;
+    if (!lzss_unpack_buffer(e->stored, (size_t)e->len_compressed, *owned, raw)) {
+        free(*owned);
+        *owned = NULL;
+        return NULL;
+    }
+    *size = raw;
+    return *owned;
+}
+
+static u8 expand6(u8 v) { v &= 63; return (u8)((v << 2) | (v >> 4)); }
+static u8 expand5(u32 v) { v &= 31; return (u8)((v << 3) | (v >> 2)); }
+
+/* Paleta de un BMP de 8 bpp como cuadruplas B,G,R,0 */
+static void bmp_palette(const DatEntry *pal, u8 quads[1024]) {
+    u8 *owned;
+    u32 size = 0, i;
+    const u8 *p = pal ? entry_body(pal, &owned, &size) : NULL;
+
+    for (i = 0; i < 256; i++) {
+        if (p && size >= 1024) {
+            quads[i * 4 + 0] = expand6(p[i * 4 + 2]);
+            quads[i * 4 + 1] = expand6(p[i * 4 + 1]);
+            quads[i * 4 + 2] = expand6(p[i * 4 + 0]);
+        } else {
+            quads[i * 4 + 0] = quads[i * 4 + 1] = quads[i * 4 + 2] = (u8)i;
+        }
+        quads[i * 4 + 3] = 0;
+    }
+    if (p) free(owned);
+}
+
+/* Inversa de load_bmp_to_dat_bitmap: las filas se guardan abajo-arriba.
+   Un RGBA lleva cabecera V4 con mascara de alfa, para que vuelva a cargarse
+   con su alfa */
+static const char *write_bmp(Out *o, const u8 *b, u32 size, const DatEntry *pal) {
+    s16 bpp;
+    u32 w, h, ps, obpp, row_out, stride, ih, off, y, x;
+    u8 hdr[14 + 108], *row;
+
+    if (size < 6) return "truncated bitmap";
+    bpp = (s16)rd_be16(b);
+    w = rd_be16(b + 2);
+    h = rd_be16(b + 4);
+    if (bpp != 8 && bpp != 15 && bpp != 16 && bpp != 24 && bpp != 32 && bpp != -32)
+        return "unsupported bitmap depth";
+    ps = dat_bitmap_pixel_size(bpp);
+    if ((u64)size < 6 + (u64)w * h * ps) return "truncated bitmap";
+    obpp = bpp == 8 ? 8 : (bpp == 15 || bpp == 16) ? 24 : (u32)(bpp < 0 ? -bpp : bpp);
+    row_out = w * (obpp / 8);
+    stride = (row_out + 3) & ~3u;
+    ih = bpp == -32 ? 108 : 40;
+    off = 14 + ih + (obpp == 8 ? 1024 : 0);
+
+    memset(hdr, 0, sizeof(hdr));
+    hdr[0] = 'B'; hdr[1] = 'M';
+    wr_le32(hdr + 2, off + stride * h);
+    wr_le32(hdr + 10, off);
+    wr_le32(hdr + 14, ih);
+    wr_le32(hdr + 18, w);
+    wr_le32(hdr + 22, h);
+    wr_le16(hdr + 26, 1);
+    wr_le16(hdr + 28, obpp);
+    wr_le32(hdr + 34, stride * h);
+    wr_le32(hdr + 38, 2835);
+    wr_le32(hdr + 42, 2835);
+    if (obpp == 8) wr_le32(hdr + 46, 256);
+    if (bpp == -32) {
+        wr_le32(hdr + 30, 3); /* BI_BITFIELDS */
+        wr_le32(hdr + 54, 0x00FF0000u);
+        wr_le32(hdr + 58, 0x0000FF00u);
+        wr_le32(hdr + 62, 0x000000FFu);
+        wr_le32(hdr + 66, 0xFF000000u);
+        wr_le32(hdr + 70, 0x73524742u); /* 'sRGB' */
+    }
+    out_put(o, hdr, 14 + ih);
+    if (obpp == 8) {
+        u8 quads[1024];
+        bmp_palette(pal, quads);
+        out_put(o, quads, sizeof(quads));
+    }
+
+    row = (u8*)calloc(1, stride ? stride : 1);
+    if (!row) return "out of memory";
+    for (y = h; y-- > 0 && o->ok;) {
+        const u8 *s = b + 6 + (size_t)y * w * ps;
+        if (bpp == 15 || bpp == 16) {
+            for (x = 0; x < w; x++) {
+                u32 c = (u32)s[2 * x] | ((u32)s[2 * x + 1] << 8);
+                u8 *d = row + 3 * x;
+                u32 g = (c >> 5) & 63;
+                d[0] = expand5(c);
+                d[1] = (u8)((g << 2) | (g >> 4));
+                d[2] = expand5(c >> 11);
+            }
+        } else if (bpp == 8) {
+            memcpy(row, s, row_out);
+        } else {
+            /* El DAT guarda R,G,B(,A/X); el BMP B,G,R(,A/X) */
+            for (x = 0; x < w; x++) {
+                row[ps * x + 0] = s[ps * x + 2];
+                row[ps * x + 1] = s[ps * x + 1];
+                row[ps * x + 2] = s[ps * x + 0];
+                if (ps == 4) row[4 * x + 3] = s[4 * x + 3];
+            }
+        }
+        out_put(o, row, stride);
+    }
+    free(row);
+    return NULL;
+}
+
+/* SAMP: s16 bits (negativo = estereo), u16 frecuencia, s32 frames y PCM
+   sin signo (16 bits en big-endian). WAV: PCM con signo en little-endian */
+static const char *write_wav(Out *o, const u8 *b, u32 size) {
+    s16 bits;
+    u32 freq, frames, ch, depth, data, i;
+    u8 hdr[44];
+
+    if (size < 8) return "truncated sample";
+    bits = (s16)rd_be16(b);
+    freq = rd_be16(b + 2);
+    frames = rd_be32(b + 4);
+    ch = bits < 0 ? 2 : 1;
+    depth = (u32)(bits < 0 ? -bits : bits);
+    if (depth != 8 && depth != 16) return "unsupported sample depth";
+    if ((u64)frames * ch * (depth / 8) > (u64)size - 8) return "truncated sample";
+    data = frames * ch * (depth / 8);
+
+    memcpy(hdr, "RIFF", 4);
+    wr_le32(hdr + 4, 36 + data + (data & 1));
+    memcpy(hdr + 8, "WAVEfmt ", 8);
+    wr_le32(hdr + 16, 16);
+    wr_le16(hdr + 20, 1);
+    wr_le16(hdr + 22, ch);
+    wr_le32(hdr + 24, freq);
+    wr_le32(hdr + 28, freq * ch * (depth / 8));
+    wr_le16(hdr + 32, ch * (depth / 8));
+    wr_le16(hdr + 34, depth);
+    memcpy(hdr + 36, "data", 4);
+    wr_le32(hdr + 40, data);
+    out_put(o, hdr, sizeof(hdr));
+
+    b += 8;
+    if (depth == 8) {
+        out_put(o, b, data);
+    } else {
+        u8 tmp[64 * 1024];
+        u32 done = 0;
+        while (done < data && o->ok) {
+            u32 n = data - done < sizeof(tmp) ? data - done : (u32)sizeof(tmp);
+            for (i = 0; i < n; i += 2) {
+                tmp[i] = b[done + i + 1];
+                tmp[i + 1] = (u8)(b[done + i] ^ 0x80);
+            }
+            out_put(o, tmp, n);
+            done += n;
+        }
+    }
+    if (data & 1) out_put(o, "", 1);
+    return NULL;
+}
+
+/* MIDI de Allegro: s16 divisiones y 32 pistas (be32 longitud + datos).
+   Sale un SMF de formato 1 con una MTrk por pista usada */
+static const char *write_midi(Out *o, const u8 *b, u32 size) {
+    static const u8 eot[3] = { 0xFF, 0x2F, 0x00 };
+    u32 pos = 2, t, len, used = 0;
+    u8 hdr[14];
+
+    if (size < 2) return "truncated MIDI";
+    for (t = 0; t < 32; t++) {
+        if (size - pos < 4) return "truncated MIDI";
+        len = rd_be32(b + pos);
+        if (len > size - pos - 4) return "truncated MIDI";
+        if (len) used++;
+        pos += 4 + len;
+    }
+
+    memcpy(hdr, "MThd", 4);
+    wr_be32(hdr + 4, 6);
+    wr_be16(hdr + 8, 1);
+    wr_be16(hdr + 10, used);
+    memcpy(hdr + 12, b, 2);
+    out_put(o, hdr, sizeof(hdr));
+
+    for (pos = 2, t = 0; t < 32; t++) {
+        const u8 *d = b + pos + 4;
+        int add_eot;
+        len = rd_be32(b + pos);
+        pos += 4 + len;
+        if (!len) continue;
+        add_eot = len < 3 || memcmp(d + len - 3, eot, 3) != 0;
+        memcpy(hdr, "MTrk", 4);
+        wr_be32(hdr + 4, len + (add_eot ? 4 : 0));
+        out_put(o, hdr, 8);
+        out_put(o, d, len);
+        if (add_eot) {
+            /* delta 0 + fin de pista */
+            static const u8 tail[4] = { 0x00, 0xFF, 0x2F, 0x00 };
+            out_put(o, tail, 4);
+        }
+    }
+    return NULL;
+}
+
+/* PAL: 256 x {R,G,B,pad} de 6 bits. ACT: 256 x R,G,B de 8 bits */
+static const char *write_act(Out *o, const u8 *b, u32 size) {
+    u8 act[768];
+    int i;
+    if (size < 1024) return "truncated palette";
+    for (i = 0; i < 256; i++) {
+        act[i * 3 + 0] = expand6(b[i * 4 + 0]);
+        act[i * 3 + 1] = expand6(b[i * 4 + 1]);
+        act[i * 3 + 2] = expand6(b[i * 4 + 2]);
+    }
+    out_put(o, act, sizeof(act));
+    return NULL;
+}
+
+static void extract_task(void *ctx, size_t index) {
+    ExtractTask *t = &((ExtractTask*)ctx)[index];
+    const DatEntry *e = t->e;
+    const char *err = NULL;
+    u8 *owned = NULL;
+    u32 size = 0;
+    const u8 *b;
+    Out *o;
+    u64 t0 = dat_stats_begin();
+
+    if (e->len_compressed > 0) {
+        /* El cuerpo se lee entero: pedirlo de una vez */
+        uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+        uintptr_t a = (uintptr_t)e->stored & ~(page - 1);
+        posix_madvise((void*)a, (size_t)((uintptr_t)e->stored + (u32)e->len_compressed - a), POSIX_MADV_WILLNEED);
+    }
+    b = entry_body(e, &owned, &size);
+    if (!b) { t->err = "cannot unpack the object"; return; }
+    o = (Out*)malloc(sizeof(Out));
+    if (!o) { free(owned); t->err = "out of memory"; return; }
+    o->ok = 1; o->bytes = 0; o->len = 0;
+    o->fd = open(t->path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (o->fd < 0) {
+        t->err = "cannot create";
+        t->err_no = errno;
+        free(o); free(owned);
+        return;
+    }
+
+    if (!memcmp(e->type, "BMP ", 4)) err = write_bmp(o, b, size, t->pal);
+    else if (!memcmp(e->type, "SAMP", 4)) err = write_wav(o, b, size);
+    else if (!memcmp(e->type, "MIDI", 4)) err = write_midi(o, b, size);
+    else if (!memcmp(e->type, "PAL ", 4)) err = write_act(o, b, size);
+    else out_put(o, b, size);
+
+    out_flush(o);
+    if (!err && !o->ok) { err = "cannot write"; t->err_no = errno; }
+    if (close(o->fd) != 0 && !err) { err = "cannot write"; t->err_no = errno; }
+    if (err) unlink(t->path);
+    t->err = err;
+    t->bytes = o->bytes;
+    dat_stats_end(DAT_STAGE_EXTRACT, t0, t->path, size, o->bytes);
+    free(o);
+    free(owned);
+}
+
+/* ------------------------------------------------------------------ */
+/* Recorrido de las cabeceras                                          */
+/* ------------------------------------------------------------------ */
+
+/* mkdir -p */
+static int make_dirs(const char *path) {
+    char *p = strdup(path), *s;
+    int ok = 1;
+    if (!p) return 0;
+    for (s = p + 1; ok; s++) {
+        if (*s != '/' && *s != '\0') continue;
+        {
+            char c = *s;
+            *s = '\0';
+            if (mkdir(p, 0755) != 0 && errno != EEXIST) ok = 0;
+            *s = c;
+            if (!c) break;
+        }
+    }
+    free(p);
+    return ok;
+}
+
+/* Los directorios se crean solo si algo va dentro */
+static int ensure_dir(Dir *d) {
+    if (d->created) return 1;
+    if (d->parent && !ensure_dir(d->parent)) return 0;
+    if (d->parent ? mkdir(d->path, 0755) != 0 && errno != EEXIST : !make_dirs(d->path)) {
+        fprintf(stderr, "Error: cannot create directory '%s': %s\n", d->path, strerror(errno));
+        return 0;
+    }
+    d->created = 1;
+    return 1;
+}
+
+static Dir *new_dir(Extractor *x, Dir *parent, const char *name) {
+    Dir *d = (Dir*)calloc(1, sizeof(Dir));
+    size_t n;
+    if (!d || !grow((void**)&x->dirs, &x->cap_dirs, x->num_dirs + 1, sizeof(Dir*))) { free(d); return NULL; }
+    n = strlen(parent->path) + strlen(name) + 2;
+    d->path = (char*)malloc(n);
+    if (!d->path) { free(d); return NULL; }
+    snprintf(d->path, n, "%s/%s", parent->path, name);
+    d->parent = parent;
+    x->dirs[x->num_dirs++] = d;
+    return d;
+}
+
+/* Copia terminada en '\0' de una propiedad ("" si falta) */
+static void prop_copy(const DatEntry *e, const char type[4], char *buf, size_t cap) {
+    u32 len = 0;
+    const char *v = dat_prop(e, type, &len);
+    if (!v) len = 0;
+    if (len >= cap) len = (u32)cap - 1;
+    memcpy(buf, v ? v : "", len);
+    buf[len] = '\0';
+}
+
+/* Solo [A-Za-z0-9_.-]; nada de ocultos ni "..". Sin NAME: tipo + indice */
+static void file_stem(const DatEntry *e, const char *name, u32 index, char *out) {
+    size_t i;
+    if (!*name) {
+        char type[5];
+        for (i = 0; i < 4; i++)
+            type[i] = (e->type[i] >= 'A' && e->type[i] <= 'Z') ? (char)(e->type[i] + 32) :
+                      (e->type[i] >= 'a' && e->type[i] <= 'z') ? e->type[i] : '\0';
+        type[4] = '\0';
+        snprintf(out, NAME_CAP, "%s_%u", type[0] ? type : "obj", index);
+        return;
+    }
+    if (name[0] == '.') *out++ = '_';
+    for (i = 0; name[i] && i < NAME_CAP - 8; i++) {
+        char c = name[i];
+        int okc = (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') ||
+                  c == '_' || c == '.' || c == '-';
+        out[i] = okc ? c : '_';
+    }
+    out[i] = '\0';
+}
+
+static void file_ext(const DatEntry *e, const char *orig, char *out, size_t cap) {
+    if (!memcmp(e->type, "BMP ", 4)) snprintf(out, cap, ".bmp");
+    else if (!memcmp(e->type, "SAMP", 4)) snprintf(out, cap, ".wav");
+    else if (!memcmp(e->type, "MIDI", 4)) snprintf(out, cap, ".mid");
+    else if (!memcmp(e->type, "PAL ", 4)) snprintf(out, cap, ".act");
+    else if (!memcmp(e->type, "RLE ", 4)) snprintf(out, cap, ".rle");
+    else if (!memcmp(e->type, "FONT", 4)) snprintf(out, cap, ".fnt");
+    else if (!memcmp(e->type, "FLIC", 4)) {
+        /* El numero magico (offset 4) dice si es FLI o FLC */
+        int flc = e->len_uncompressed >= 6 && e->stored[4] == 0x12 && e->stored[5] == 0xAF;
+        snprintf(out, cap, flc ? ".flc" : ".fli");
+    } else {
+        /* DATA y tipos desconocidos: la extension del ORIG, o .bin */
+        const char *dot = strrchr(orig, '.');
+        size_t i, n;
+        if (!dot || strchr(dot, '/') || strchr(dot, '\\') || !dot[1] || strlen(dot) > 10) {
+            snprintf(out, cap, ".bin");
+            return;
+        }
+        n = strlen(dot);
+        for (i = 0; i < n && i + 1 < cap; i++) {
+            char c = dot[i];
+            out[i] = ((c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '.') ? c : '_';
+        }
+        out[i] = '\0';
+    }
+}
+
+static int name_selected(Extractor *x, const char *name) {
+    size_t k;
+    int hit = 0;
+    for (k = 0; k < x->opt->num_only; k++) {
+        if (strcasecmp(name, x->opt->only[k]) == 0) {
+            x->matched[k] = 1;
+            hit = 1;
+        }
+    }
+    return hit;
+}
+
+static int add_task(Extractor *x, Dir *dir, const DatEntry *e, const DatEntry *pal,
+                    const char *stem, const char *ext) {
+    ExtractTask *t;
+    size_t n;
+    if (!ensure_dir(dir)) return 0;
+    if (!grow((void**)&x->tasks, &x->cap_tasks, x->num_tasks + 1, sizeof(ExtractTask))) {
+        fprintf(stderr, "Error: out of memory\n");
+        return 0;
+    }
+    t = &x->tasks[x->num_tasks];
+    memset(t, 0, sizeof(*t));
+    n = strlen(dir->path) + strlen(stem) + strlen(ext) + 2;
+    t->path = (char*)malloc(n);
+    if (!t->path) {
+        fprintf(stderr, "Error: out of memory\n");
+        return 0;
+    }
+    snprintf(t->path, n, "%s/%s%s", dir->path, stem, ext);
+    t->e = e;
+    t->pal = pal;
+    x->num_tasks++;
+    return 1;
+}
+
+/* Un nivel: names[i] es el NAME, stems[i] el nombre de fichero (unico en
+   el directorio, sin distinguir mayusculas). Los FILE bajan un nivel */
+static int walk(Extractor *x, const DatEntry *list, u32 n, Dir *dir, int selected, int depth) {
+    char (*names)[NAME_CAP] = NULL, (*stems)[NAME_CAP] = NULL;
+    DatNameSet *pals = NULL, *files = NULL;
+    const DatEntry *first_pal = NULL;
+    u32 i;
+    int ok = 0, oom = 1; /* oom: salir por done sin mensaje es falta de memoria */
+
+    if (depth > MAX_DEPTH) {
+        fprintf(stderr, "Error: sub-datafiles nested too deep\n");
+        return 0;
+    }
+    names = calloc(n ? n : 1, NAME_CAP);
+    stems = calloc(n ? n : 1, NAME_CAP);
+    pals = dat_names_create(16);
+    files = dat_names_create(n);
+    if (!names || !stems || !pals || !files) goto done;
+
+    for (i = 0; i < n; i++) {
+        prop_copy(&list[i], "NAME", names[i], NAME_CAP);
+        if (memcmp(list[i].type, "PAL ", 4) != 0) continue;
+        if (!first_pal) first_pal = &list[i];
+        if (names[i][0]) dat_names_add(pals, names[i], i);
+    }
+    if (depth == 0) x->top_pal = first_pal;
+
+    for (i = 0; i < n; i++) {
+        const DatEntry *e = &list[i];
+        int sel;
+        if (!memcmp(e->type, "info", 4)) continue;
+        /* Todos cuentan para los nombres: --only no cambia donde va cada uno */
+        file_stem(e, names[i], i, stems[i]);
+        if (dat_names_add_unique(files, stems[i], NAME_CAP, i) < 0) goto done;
+        sel = selected || name_selected(x, names[i]);
+
+        if (!memcmp(e->type, "FILE", 4)) {
+            u8 *owned = NULL;
+            u32 size = 0, count = 0;
+            const u8 *body = entry_body(e, &owned, &size);
+            DatEntry *sub = body ? dat_parse_objects(body, size, &count) : NULL;
+            Dir *d;
+            if (owned && !keep(x, owned)) { free(owned); free(sub); goto done; }
+            if (!sub) {
+                fprintf(stderr, "Error: group '%s' is not a valid sub-datafile\n", names[i]);
+                oom = 0;
+                goto done;
+            }
+            if (!keep(x, sub)) { free(sub); goto done; }
+            d = new_dir(x, dir, stems[i]);
+            if (!d) goto done;
+            if (!walk(x, sub, count, d, sel, depth + 1)) { oom = 0; goto done; }
+            continue;
+        }
+        if (!sel) continue;
+        {
+            const DatEntry *pal = NULL;
+            char ext[16], orig[256];
+            if (!memcmp(e->type, "BMP ", 4)) {
+                /* HERO -> HERO_PAL; si no, la primera PAL de aqui o de arriba */
+                char key[NAME_CAP + 8];
+                size_t k;
+                snprintf(key, sizeof(key), "%s_PAL", names[i]);
+                k = names[i][0] ? dat_names_find(pals, key) : DAT_NAME_NONE;
+                pal = k != DAT_NAME_NONE ? &list[k] : first_pal ? first_pal : x->top_pal;
+            }
+            prop_copy(e, "ORIG", orig, sizeof(orig));
+            file_ext(e, orig, ext, sizeof(ext));
+            if (!add_task(x, dir, e, pal, stems[i], ext)) { oom = 0; goto done; }
+        }
+    }
+    ok = 1;
+done:
+    if (!ok && oom) fprintf(stderr, "Error: out of memory\n");
+    dat_names_free(pals);
+    dat_names_free(files);
+    free(names);
+    free(stems);
+    return ok;
+}
+
+int dat_extract(const char *dat_path, const char *out_dir, const DatExtractOptions *opt,
+                DatExtractStats *st) {
+    Extractor x;
+    Dir root;
+    DatFile *df;
+    DatEntry *top;
+    u32 i, n;
+    size_t k;
+    u64 start = dat_stats_now(), t0 = dat_stats_begin();
+    int ok = 1;
+
+    memset(&x, 0, sizeof(x));
+    memset(st, 0, sizeof(*st));
+    x.opt = opt;
+    df = dat_open(dat_path);
+    if (!df) {
+        fprintf(stderr, "Error: cannot read '%s' as an Allegro DAT file\n", dat_path);
+        return 0;
+    }
+    n = dat_num_objects(df);
+    /* Copia de las entradas de arriba para tratarlas como cualquier lista */
+    top = (DatEntry*)malloc(sizeof(DatEntry) * (n ? n : 1));
+    x.matched = (u8*)calloc(opt->num_only ? opt->num_only : 1, 1);
+    if (!top || !x.matched) {
+        fprintf(stderr, "Error: out of memory\n");
+        free(top); free(x.matched); dat_close(df);
+        return 0;
+    }
+    for (i = 0; i < n; i++) top[i] = *dat_entry(df, i);
+
+    memset(&root, 0, sizeof(root));
+    root.path = (char*)out_dir;
+    ok = walk(&x, top, n, &root, opt->num_only == 0, 0);
+    for (k = 0; ok && k < opt->num_only; k++) {
+        if (x.matched[k]) continue;
+        fprintf(stderr, "Error: no object or group named '%s' in '%s'\n", opt->only[k], dat_path);
+        ok = 0;
+    }
+    /* Aunque no haya nada que escribir */
+    if (ok) ok = ensure_dir(&root);
+    dat_stats_end(DAT_STAGE_SETUP, t0, NULL, 0, 0);
+
+    if (ok) dat_parallel_for(opt->jobs, x.num_tasks, extract_task, x.tasks);
+
+    for (k = 0; k < x.num_tasks; k++) {
+        ExtractTask *t = &x.tasks[k];
+        if (ok && t->err) {
+            if (t->err_no) fprintf(stderr, "Error: %s '%s': %s\n", t->err, t->path, strerror(t->err_no));
+            else fprintf(stderr, "Error: '%s': %s\n", t->path, t->err);
+            ok = 0;
+        }
+        if (!t->err) { st->files++; st->bytes += t->bytes; }
+        free(t->path);
+    }
+    for (k = 0; k < x.num_dirs; k++) { free(x.dirs[k]->path); free(x.dirs[k]); }
+    for (k = 0; k < x.num_keep; k++) free(x.keep[k]);
+    free(x.dirs);
+    free(x.keep);
+    free(x.tasks);
+    free(x.matched);
+    free(top);
+    dat_close(df);
+    st->seconds = (double)(dat_stats_now() - start) * 1e-9;
+    return ok;
+}
@@ -0,0 +1,53 @@
+/* src/dat_extract.h
+ *
+ * dat extract: writes the objects of a DAT back out as ordinary files,
+ * one per object, named after its NAME property:
+ *
+ *   BMP   .bmp   8 bpp with the object's palette (NAME_PAL, else the first
+ *                PAL beside it or at the top level, else grey); 24 and 32
+ *                bpp back in the BMP's B,G,R / B,G,R,X order; RGBA -32 as
+ *                32 bpp; 15/16 bpp as 24.
+ *   SAMP  .wav   8 or 16 bit PCM, mono or stereo
+ *   MIDI  .mid   SMF format 1, one MTrk per used track slot
+ *   PAL   .act   256 x R,G,B, 8 bits per component
+ *   FILE  a directory with the objects of the sub-datafile
+ *   other        raw body (.fli/.flc, .rle, .fnt, or DATA with the
+ *                extension of its ORIG file, .bin without one)
+ *
+ * GrabberInfo objects are skipped. The walk over the object headers runs
+ * on the calling thread; the files are converted and written on a pool of
+ * threads, raw bodies straight from the mapped input.
+ */
+#ifndef DAT_EXTRACT_H
+#define DAT_EXTRACT_H
+
+#include <stddef.h>
+#include "allegro_dat_structs.h"
+
+typedef struct {
+    const char *const *only;     /* NAMEs to extract (an object or a whole group); NULL = all */
+    size_t             num_only;
+    int                jobs;     /* worker threads */
+} DatExtractOptions;
+
+typedef struct {
+    u32    files;      /* objects written */
+    u64    bytes;      /* bytes written */
+    double seconds;
+} DatExtractStats;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Extracts dat_path into out_dir (created if needed). Returns 0 if the DAT
+   cannot be read, a file cannot be written, or an --only name matched
+   nothing; the reason is printed on stderr. */
+int dat_extract(const char *dat_path, const char *out_dir, const DatExtractOptions *opt,
+                DatExtractStats *st);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DAT_EXTRACT_H */
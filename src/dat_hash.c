@@ -0,0 +1,147 @@
+/* dat_hash.c
+ *
+ * Streaming XXH64 (public domain algorithm by Yann Collet). Byte order of
+ * the input words is fixed to little-endian so hashes are portable.
+ */
+#include "dat_hash.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define P1 0x9E3779B185EBCA87ull
+#define P2 0xC2B2AE3D27D4EB4Full
+#define P3 0x165667B19E3779F9ull
+#define P4 0x85EBCA77C2B2AE63ull
+#define P5 0x27D4EB2F165667C5ull
+
+static u64 rotl(u64 x, int r) { return (x << r) | (x >> (64 - r)); }
+
+static u64 rd64(const u8 *p)
+{
+    return (u64)p[0] | ((u64)p[1] << 8) | ((u64)p[2] << 16) | ((u64)p[3] << 24)
+         | ((u64)p[4] << 32) | ((u64)p[5] << 40) | ((u64)p[6] << 48) | ((u64)p[7] << 56);
+}
+
+static u32 rd32(const u8 *p)
+{
+    return (u32)p[0] | ((u32)p[1] << 8) | ((u32)p[2] << 16) | ((u32)p[3] << 24);
+}
+
+static u64 round64(u64 acc, u64 in)
+{
+    acc += in * P2;
+    acc = rotl(acc, 31);
+    return acc * P1;
+}
+
+static u64 merge(u64 acc, u64 v)
+{
+    acc ^= round64(0, v);
+    return acc * P1 + P4;
+}
+
+void dat_hash_init(DatHash *h, u64 seed)
+{
+    memset(h, 0, sizeof(*h));
+    h->seed = seed;
+    h->v[0] = seed + P1 + P2;
+    h->v[1] = seed + P2;
+    h->v[2] = seed;
+    h->v[3] = seed - P1;
+}
+
+void dat_hash_update(DatHash *h, const void *data, size_t n)
+{
+    const u8 *p = (const u8 *)data;
+    h->total += n;
+
+    if (h->tail_len + n < 32) {
+        memcpy(h->tail + h->tail_len, p, n);
+        h->tail_len += n;
+        return;
+    }
+    if (h->tail_len) {
+        size_t take = 32 - h->tail_len;
+        memcpy(h->tail + h->tail_len, p, take);
+        h->v[0] = round64(h->v[0], rd64(h->tail));
+        h->v[1] = round64(h->v[1], rd64(h->tail + 8));
+        h->v[2] = round64(h->v[2], rd64(h->tail + 16));
+        h->v[3] = round64(h->v[3], rd64(h->tail + 24));
+        p += take; n -= take;
+        h->tail_len = 0;
+    }
+    while (n >= 32) {
+        h->v[0] = round64(h->v[0], rd64(p));
+        h->v[1] = round64(h->v[1], rd64(p + 8));
+        h->v[2] = round64(h->v[2], rd64(p + 16));
+        h->v[3] = round64(h->v[3], rd64(p + 24));
+        p += 32; n -= 32;
+    }
+    memcpy(h->tail, p, n);
+    h->tail_len = n;
+}
+
+u64 dat_hash_final(const DatHash *h)
+{
+    const u8 *p = h->tail;
+    size_t n = h->tail_len;
+    u64 acc;
+
+    if (h->total >= 32) {
+        acc = rotl(h->v[0], 1) + rotl(h->v[1], 7) + rotl(h->v[2], 12) + rotl(h->v[3], 18);
+        acc = merge(acc, h->v[0]);
+        acc = merge(acc, h->v[1]);
+        acc = merge(acc, h->v[2]);
+        acc = merge(acc, h->v[3]);
+    } else {
+        acc = h->seed + P5;
+    }
+    acc += h->total;
+
+    while (n >= 8) {
+        acc ^= round64(0, rd64(p));
+        acc = rotl(acc, 27) * P1 + P4;
+        p += 8; n -= 8;
+    }
+    if (n >= 4) {
+        acc ^= (u64)rd32(p) * P1;
+        acc = rotl(acc, 23) * P2 + P3;
+        p += 4; n -= 4;
+    }
+    while (n > 0) {
+        acc ^= (*p) * P5;
+        acc = rotl(acc, 11) * P1;
+        p++; n--;
+    }
+    acc ^= acc >> 33;
+    acc *= P2;
+    acc ^= acc >> 29;
+    acc *= P3;
+    acc ^= acc >> 32;
+    return acc;
+}
+
+u64 dat_hash64(const void *data, size_t n, u64 seed)
+{
+    DatHash h;
+    dat_hash_init(&h, seed);
+    dat_hash_update(&h, data, n);
+    return dat_hash_final(&h);
+}
+
+int dat_hash_file(const char *path, u64 *hash, u64 *size)
+{
+    u8 buf[1 << 16];
+    DatHash h;
+    size_t got;
+    FILE *f = fopen(path, "rb");
+    if (!f) return 0;
+    dat_hash_init(&h, 0);
+    while ((got = fread(buf, 1, sizeof(buf), f)) > 0)
+        dat_hash_update(&h, buf, got);
+    if (ferror(f)) { fclose(f); return 0; }
+    fclose(f);
+    *hash = dat_hash_final(&h);
+    if (size) *size = h.total;
+    return 1;
+}
@@ -0,0 +1,37 @@
+/* dat_hash.h
+ *
+ * 64-bit content hashing (XXH64 algorithm) used to fingerprint source
+ * files, so unchanged inputs can be detected without reconverting them.
+ */
+#ifndef DAT_HASH_H
+#define DAT_HASH_H
+
+#include <stddef.h>
+#include "allegro_dat_structs.h"
+
+typedef struct {
+    u64    v[4];
+    u64    total;
+    u8     tail[32];
+    size_t tail_len;
+    u64    seed;
+} DatHash;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void dat_hash_init(DatHash *h, u64 seed);
+void dat_hash_update(DatHash *h, const void *data, size_t n);
+u64  dat_hash_final(const DatHash *h);
+
+u64  dat_hash64(const void *data, size_t n, u64 seed);
+
+/* Hashes a whole file; *size receives its length. Returns 0 if unreadable. */
+int  dat_hash_file(const char *path, u64 *hash, u64 *size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DAT_HASH_H */
@@ -4,38 +4,98 @@
 #include <string.h>
 #include "dat_loader_bmp.h"
 
-#pragma pack(push,1)
-typedef struct { u16 bfType; u32 bfSize; u16 bfReserved1; u16 bfReserved2; u32 bfOffBits; } BMPFILEHDR;
-typedef struct { u32 biSize; s32 biWidth; s32 biHeight; u16 biPlanes; u16 biBitCount; u32 biCompression; u32 biSizeImage; s32 biXPelsPerMeter; s32 biYPelsPerMeter; u32 biClrUsed; u32 biClrImportant; } BMPINFOHDR;
-#pragma pack(pop)
+#define BI_RGB        0
+#define BI_BITFIELDS  3
 
-static size_t row_stride(int width, int bpp){ size_t raw = (size_t)width * (size_t)(bpp/8); size_t pad = (4 - (raw % 4)) & 3; return raw + pad; }
+static u16 rd16(const u8 *p){ return (u16)(p[0] | (p[1] << 8)); }
+static u32 rd32(const u8 *p){ return (u32)p[0] | ((u32)p[1] << 8) | ((u32)p[2] << 16) | ((u32)p[3] << 24); }
 
+/* Tamanos de cabecera conocidos: INFO, V2, V3 (Adobe), V4, V5 */
+static int known_header_size(u32 n){ return n == 40 || n == 52 || n == 56 || n == 108 || n == 124; }
+
+static int bmp_error(FILE *f, const char *filename, const char *what)
+{
+    fprintf(stderr, "Error: '%s': %s\n", filename, what);
+    if (f) fclose(f);
+    return 0;
+}
+
+// Lee las filas directamente en su posicion final (arriba-abajo, sin
+// relleno): una sola reserva del tamano de la salida, sin copia intermedia
 int load_bmp_to_dat_bitmap(const char *filename, DatBitmap **out)
 {
+    u8 fh[14], ih[124], masks[12], pad[4];
+    u32 ih_size, off, comp, hdr_end;
+    s32 w, h;
+    u16 bpp;
+    size_t H, row_out, stride, i;
+    int bottom_up, alpha;
+    u8 *flat;
+    DatBitmap *db;
+    FILE *f;
+
     *out = NULL;
-    FILE *f = fopen(filename, "rb"); if(!f) return 0;
-    BMPFILEHDR fh; BMPINFOHDR ih; if(fread(&fh, sizeof(fh),1,f)!=1){ fclose(f); return 0;} if(fread(&ih,sizeof(ih),1,f)!=1){ fclose(f); return 0;}
-    if(fh.bfType != 0x4D42){ fclose(f); return 0; }
-    if(ih.biCompression != 0){ fclose(f); return 0; }
-    if(!(ih.biBitCount==8 || ih.biBitCount==24 || ih.biBitCount==32)){ fclose(f); return 0; }
-    int w = ih.biWidth; int h = ih.biHeight; int H = (h<0)?-h:h; int bottom_up = (h>0);
-    size_t stride = row_stride(w, ih.biBitCount);
-    // Skip palette if present on 8-bit BMPs
-    fseek(f, fh.bfOffBits, SEEK_SET);
-    size_t datasz = stride * H; u8 *pix = (u8*)malloc(datasz); if(!pix){ fclose(f); return 0; }
-    if(fread(pix, 1, datasz, f)!=datasz){ free(pix); fclose(f); return 0; }
-    fclose(f);
+    f = fopen(filename, "rb");
+    if (!f) return 0;
+    if (fread(fh, 1, 14, f) != 14 || fh[0] != 'B' || fh[1] != 'M') return bmp_error(f, filename, "not a BMP file");
+    off = rd32(fh + 10);
 
-    // Flatten to DAT layout (top-down, tight)
-    int bppB = ih.biBitCount/8; size_t row_out = (size_t)w * bppB; size_t total = (size_t)H * row_out; u8 *flat = (u8*)malloc(total); if(!flat){ free(pix); return 0; }
-    for(int y=0;y<H;y++){
-        const u8 *src = bottom_up ? pix + (size_t)(H-1-y)*stride : pix + (size_t)y*stride; 
-        memcpy(flat + (size_t)y*row_out, src, row_out);
+    /* biSize manda: no asumir 40 bytes */
+    if (fread(ih, 1, 4, f) != 4) return bmp_error(f, filename, "truncated header");
+    ih_size = rd32(ih);
+    if (!known_header_size(ih_size)) {
+        fprintf(stderr, "Error: '%s': unsupported BMP header size %u (OS/2 or unknown)\n", filename, ih_size);
+        fclose(f); return 0;
     }
-    free(pix);
+    if (fread(ih + 4, 1, ih_size - 4, f) != ih_size - 4) return bmp_error(f, filename, "truncated header");
+    w = (s32)rd32(ih + 4); h = (s32)rd32(ih + 8);
+    bpp = rd16(ih + 14); comp = rd32(ih + 16);
+    hdr_end = 14 + ih_size;
+
+    if (rd16(ih + 12) != 1) return bmp_error(f, filename, "invalid number of planes");
+    if (bpp != 8 && bpp != 24 && bpp != 32) return bmp_error(f, filename, "only 8, 24 and 32 bpp BMPs are supported");
+    if (comp == BI_BITFIELDS && bpp == 32) {
+        /* V4/V5 de 32 bpp suelen declarar mascaras: se aceptan las que
+           equivalen a BI_RGB (B,G,R,x en memoria) */
+        if (ih_size >= 52) memcpy(masks, ih + 40, 12);
+        else if (fread(masks, 1, 12, f) == 12) hdr_end += 12;
+        else return bmp_error(f, filename, "truncated header");
+        if (rd32(masks) != 0x00FF0000u || rd32(masks + 4) != 0x0000FF00u || rd32(masks + 8) != 0x000000FFu)
+            return bmp_error(f, filename, "unsupported 32 bpp channel masks");
+    } else if (comp != BI_RGB) {
+        return bmp_error(f, filename, "compressed BMPs are not supported");
+    }
+    /* El cuarto byte solo es alfa si la cabecera V4/V5 lo dice */
+    alpha = bpp == 32 && ih_size >= 56 && rd32(ih + 52) == 0xFF000000u;
+    if (w <= 0 || w > 65535 || h == 0 || h < -65535 || h > 65535) return bmp_error(f, filename, "invalid dimensions");
+    if (off < hdr_end) return bmp_error(f, filename, "pixel data overlaps the header");
+
+    H = (size_t)(h < 0 ? -h : h);
+    bottom_up = h > 0;
+    row_out = (size_t)w * (bpp / 8);
+    stride = (row_out + 3) & ~(size_t)3;
+    flat = (u8*)malloc(row_out * H);
+    if (!flat) return bmp_error(f, filename, "out of memory");
+    if (fseek(f, (long)off, SEEK_SET) != 0) { free(flat); return bmp_error(f, filename, "truncated pixel data"); }
+
+    /* Lectura secuencial del fichero; cada fila va a su sitio */
+    for (i = 0; i < H; i++) {
+        u8 *dst = flat + (bottom_up ? H - 1 - i : i) * row_out;
+        if (fread(dst, 1, row_out, f) != row_out ||
+            (stride > row_out && i + 1 < H && fread(pad, 1, stride - row_out, f) != stride - row_out)) {
+            free(flat);
+            return bmp_error(f, filename, "truncated pixel data");
+        }
+        if (bpp == 32 && !alpha) {
+            size_t x;
+            for (x = 3; x < row_out; x += 4) dst[x] = 0xFF;
+        }
+    }
+    fclose(f);
 
-    DatBitmap *db = (DatBitmap*)calloc(1,sizeof(DatBitmap)); if(!db){ free(flat); return 0; }
-    db->bits_per_pixel = (s16)ih.biBitCount; db->width=(u16)w; db->height=(u16)H; db->image=flat;
-    *out = db; return 1;
+    db = (DatBitmap*)calloc(1, sizeof(DatBitmap));
+    if (!db) { free(flat); return 0; }
+    db->bits_per_pixel = (s16)bpp; db->width = (u16)w; db->height = (u16)H; db->image = flat;
+    *out = db;
+    return 1;
 }
@@ -4,6 +4,7 @@
 #include "allegro_dat_structs.h"
 
 // Loads a Windows BMP (8/24/32 bpp, uncompressed) and converts to DAT bitmap layout (top-down, tight)
+// 32 bpp pixels are B,G,R,A; A is 255 unless a V4/V5 header declares an alpha mask
 // Returns 0 on error
 int load_bmp_to_dat_bitmap(const char *filename, DatBitmap **out);
 
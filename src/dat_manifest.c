@@ -0,0 +1,176 @@
+/* src/dat_manifest.c */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dat_manifest.h"
+#include "dat_build.h"
+
+static int args_push(DatArgList *a, char *s) {
+    if (a->argc == a->cap) {
+        int ncap = a->cap ? a->cap * 2 : 16;
+        char **nv = (char**)realloc(a->argv, sizeof(char*) * (size_t)ncap);
+        if (!nv) return 0;
+        a->argv = nv;
+        a->cap = ncap;
+    }
+    a->argv[a->argc++] = s;
+    return 1;
+}
+
+static char *read_text(const char *path) {
+    FILE *f = fopen(path, "rb");
+    char *text = NULL;
+    size_t cap = 0, len = 0, got;
+    if (!f) return NULL;
+    do {
+        if (len + 1 >= cap) {
+            char *nt;
+            cap = cap ? cap * 2 : 65536;
+            nt = (char*)realloc(text, cap);
+            if (!nt) { free(text); fclose(f); return NULL; }
+            text = nt;
+        }
+        got = fread(text + len, 1, cap - len - 1, f);
+        len += got;
+    } while (got > 0);
+    fclose(f);
+    text[len] = '\0';
+    return text;
+}
+
+/* Corta la linea en tokens en su sitio; '#' al empezar un token es comentario */
+static int split_line(char *p, char **tok, int max) {
+    int n = 0;
+    for (;;) {
+        while (*p == ' ' || *p == '\t' || *p == '\r') p++;
+        if (!*p || *p == '#') return n;
+        if (n == max) return -1;
+        if (*p == '"') {
+            tok[n++] = ++p;
+            while (*p && *p != '"') p++;
+        } else {
+            tok[n++] = p;
+            while (*p && *p != ' ' && *p != '\t' && *p != '\r') p++;
+        }
+        if (*p) *p++ = '\0';
+    }
+}
+
+static int asset_line(DatManifest *m, DatArgList *dst, char **tok, int n, const char *path, int line) {
+    char opt[64];
+    int kind, k;
+
+    snprintf(opt, sizeof(opt), "%s%s", strncmp(tok[0], "--", 2) == 0 ? "" : "--", tok[0]);
+    kind = dat_asset_kind_from_option(opt);
+    if (kind < 0) return -1;
+    if (n < 2) {
+        fprintf(stderr, "%s:%d: Error: missing file after '%s'\n", path, line, tok[0]);
+        return 0;
+    }
+    if (kind == ASSET_GROUP && n > 2) {
+        fprintf(stderr, "%s:%d: Error: a group takes only a name\n", path, line);
+        return 0;
+    }
+    /* key=value -> "--key value" y key -> "--key" (mono, ...), delante
+       del asset al que afecta */
+    for (k = 2; k < n; k++) {
+        char *eq = strchr(tok[k], '='), *key;
+        if (eq == tok[k] || tok[k][0] == '-') {
+            fprintf(stderr, "%s:%d: Error: expected key=value or key, got '%s'\n", path, line, tok[k]);
+            return 0;
+        }
+        if (eq) *eq = '\0';
+        key = (char*)malloc(strlen(tok[k]) + 3);
+        if (!key || !args_push(&m->owned, key)) { free(key); return 0; }
+        sprintf(key, "--%s", tok[k]);
+        if (!args_push(dst, key) || (eq && !args_push(dst, eq + 1))) return 0;
+    }
+    return args_push(dst, (char*)dat_asset_option_name((AssetKind)kind)) && args_push(dst, tok[1]);
+}
+
+int dat_manifest_load(const char *path, DatManifest *m) {
+    char *line, *next, *tok[64];
+    int lineno = 0, n, r;
+    size_t cap_targets = 0;
+    DatArgList *cur;
+
+    memset(m, 0, sizeof(*m));
+    m->text = read_text(path);
+    if (!m->text) {
+        fprintf(stderr, "Error: cannot read manifest '%s'\n", path);
+        return 0;
+    }
+    cur = &m->common;
+    for (line = m->text; line; line = next) {
+        next = strchr(line, '\n');
+        if (next) *next++ = '\0';
+        lineno++;
+        n = split_line(line, tok, 64);
+        if (n == 0) continue;
+        if (n < 0) {
+            fprintf(stderr, "%s:%d: Error: too many fields\n", path, lineno);
+            return 0;
+        }
+
+        if (strcmp(tok[0], "dat") == 0) {
+            DatManifestTarget *t;
+            if (n < 2) {
+                fprintf(stderr, "%s:%d: Error: 'dat' needs an output file\n", path, lineno);
+                return 0;
+            }
+            if (m->num_targets == cap_targets) {
+                cap_targets = cap_targets ? cap_targets * 2 : 8;
+                t = (DatManifestTarget*)realloc(m->targets, sizeof(*t) * cap_targets);
+                if (!t) return 0;
+                m->targets = t;
+            }
+            t = &m->targets[m->num_targets++];
+            memset(t, 0, sizeof(*t));
+            t->out = tok[1];
+            t->line = lineno;
+            cur = &t->args;
+            for (r = 2; r < n; r++) if (!args_push(cur, tok[r])) return 0;
+            continue;
+        }
+
+        r = asset_line(m, cur, tok, n, path, lineno);
+        if (r == 0) return 0;
+        if (r > 0 && cur == &m->common) {
+            fprintf(stderr, "%s:%d: Error: asset before the first 'dat' line\n", path, lineno);
+            return 0;
+        }
+        if (r > 0) continue;
+        if (strcmp(tok[0], "end-group") == 0 && n == 1) {
+            if (!args_push(cur, (char*)"--end-group")) return 0;
+            continue;
+        }
+        if (strcmp(tok[0], "end-atlas") == 0 && n == 1) {
+            if (!args_push(cur, (char*)"--end-atlas")) return 0;
+            continue;
+        }
+        if (strncmp(tok[0], "--", 2) != 0) {
+            fprintf(stderr, "%s:%d: Error: unknown entry '%s'\n", path, lineno, tok[0]);
+            return 0;
+        }
+        /* Opciones sueltas, tal cual */
+        for (r = 0; r < n; r++) if (!args_push(cur, tok[r])) return 0;
+    }
+    if (m->num_targets == 0) {
+        fprintf(stderr, "Error: manifest '%s' has no 'dat' entries\n", path);
+        return 0;
+    }
+    return 1;
+}
+
+void dat_manifest_free(DatManifest *m) {
+    size_t i;
+    int k;
+    for (k = 0; k < m->owned.argc; k++) free(m->owned.argv[k]);
+    free(m->owned.argv);
+    for (i = 0; i < m->num_targets; i++) free(m->targets[i].args.argv);
+    free(m->targets);
+    free(m->common.argv);
+    free(m->text);
+    memset(m, 0, sizeof(*m));
+}
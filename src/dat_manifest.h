@@ -0,0 +1,62 @@
+/* src/dat_manifest.h
+ *
+ * Build manifests ("dat create @levels.txt"): one file describing several
+ * output DATs, built in a single process. Line oriented:
+ *
+ *   # comment
+ *   --jobs 8                    options before the first 'dat' line
+ *                               apply to every DAT
+ *   dat level1.dat --pack       starts a DAT, with its own options
+ *   bmp gfx/hero.bmp name=HERO  asset: type (or --type), path, key=value
+ *   wav "sfx/big jump.wav"      double quotes keep spaces
+ *   --compress                  option for the current DAT
+ *   begin-group LEVEL1          assets up to 'end-group' go into a
+ *   end-group                   sub-datafile ("FILE") called LEVEL1
+ *   begin-atlas HUD depth=16    the bmp entries up to 'end-atlas' are
+ *   end-atlas                   packed into pages HUD_PAGE0.. and a
+ *                               table HUD (see dat_atlas.h)
+ *   tiles bg.bmp tile-size=8x8  unique tiles BG_BMP_TILES and map BG_BMP
+ *                               (see dat_tiles.h)
+ *
+ * Each entry is turned into the same argument list the command line would
+ * use (key=value becomes "--key value" before the asset), so the manifest
+ * accepts exactly the options 'dat create' does.
+ */
+#ifndef DAT_MANIFEST_H
+#define DAT_MANIFEST_H
+
+#include <stddef.h>
+
+typedef struct {
+    char  **argv;
+    int     argc;
+    int     cap;
+} DatArgList;
+
+typedef struct {
+    const char *out;     /* output DAT */
+    DatArgList  args;    /* its options and assets */
+    int         line;    /* line of its 'dat' entry */
+} DatManifestTarget;
+
+typedef struct {
+    char              *text;      /* file contents; all strings point into it */
+    DatArgList         common;    /* options before the first 'dat' line */
+    DatManifestTarget *targets;
+    size_t             num_targets;
+    DatArgList         owned;     /* strings built while parsing ("--name") */
+} DatManifest;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Reads a manifest; errors are reported on stderr with their line. */
+int  dat_manifest_load(const char *path, DatManifest *m);
+void dat_manifest_free(DatManifest *m);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DAT_MANIFEST_H */
@@ -0,0 +1,127 @@
+/* src/dat_names.c */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "dat_names.h"
+
+typedef struct {
+    const char *name;      /* NULL = libre */
+    u64         hash;
+    size_t      owner;
+    u32         next_suffix;
+} NameSlot;
+
+struct DatNameSet {
+    NameSlot *slots;
+    size_t    cap;         /* potencia de 2 */
+    size_t    count;
+};
+
+/* FNV-1a sobre el nombre en mayusculas: Allegro compara sin distinguir */
+static u64 name_hash(const char *s) {
+    u64 h = 0xcbf29ce484222325ull;
+    while (*s) {
+        h ^= (u8)toupper((unsigned char)*s++);
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+static int name_equal(const char *a, const char *b) {
+    while (*a && toupper((unsigned char)*a) == toupper((unsigned char)*b)) { a++; b++; }
+    return toupper((unsigned char)*a) == toupper((unsigned char)*b);
+}
+
+static NameSlot *find_slot(const DatNameSet *set, const char *name, u64 h) {
+    size_t mask = set->cap - 1, i = (size_t)h & mask;
+    for (;;) {
+        NameSlot *sl = &set->slots[i];
+        if (!sl->name || (sl->hash == h && name_equal(sl->name, name))) return sl;
+        i = (i + 1) & mask;
+    }
+}
+
+static int grow(DatNameSet *set) {
+    NameSlot *old = set->slots;
+    size_t old_cap = set->cap, i;
+    NameSlot *ns = (NameSlot*)calloc(old_cap * 2, sizeof(NameSlot));
+    if (!ns) return 0;
+    set->slots = ns;
+    set->cap = old_cap * 2;
+    for (i = 0; i < old_cap; i++)
+        if (old[i].name) *find_slot(set, old[i].name, old[i].hash) = old[i];
+    free(old);
+    return 1;
+}
+
+DatNameSet *dat_names_create(size_t expected) {
+    DatNameSet *set = (DatNameSet*)calloc(1, sizeof(DatNameSet));
+    if (!set) return NULL;
+    set->cap = 64;
+    while (set->cap < expected * 2) set->cap *= 2;
+    set->slots = (NameSlot*)calloc(set->cap, sizeof(NameSlot));
+    if (!set->slots) { free(set); return NULL; }
+    return set;
+}
+
+void dat_names_free(DatNameSet *set) {
+    if (!set) return;
+    free(set->slots);
+    free(set);
+}
+
+/* Inserta si no existe; devuelve la casilla (nueva o la que ya lo tenia) */
+static NameSlot *insert(DatNameSet *set, const char *name, size_t owner, int *added) {
+    u64 h = name_hash(name);
+    NameSlot *sl;
+    /* Carga maxima 1/2: las cadenas de sondeo se quedan cortas */
+    if ((set->count + 1) * 2 > set->cap && !grow(set)) return NULL;
+    sl = find_slot(set, name, h);
+    *added = !sl->name;
+    if (*added) {
+        sl->name = name;
+        sl->hash = h;
+        sl->owner = owner;
+        sl->next_suffix = 2;
+        set->count++;
+    }
+    return sl;
+}
+
+size_t dat_names_add(DatNameSet *set, const char *name, size_t owner) {
+    int added;
+    NameSlot *sl = insert(set, name, owner, &added);
+    if (!sl) return owner; /* sin memoria: tratarlo como ocupado */
+    return added ? DAT_NAME_NONE : sl->owner;
+}
+
+size_t dat_names_find(const DatNameSet *set, const char *name) {
+    const NameSlot *sl = find_slot(set, name, name_hash(name));
+    return sl->name ? sl->owner : DAT_NAME_NONE;
+}
+
+int dat_names_add_unique(DatNameSet *set, char *name, size_t cap, size_t owner) {
+    char base[256];
+    int added;
+    NameSlot *sl = insert(set, name, owner, &added);
+    if (!sl) return -1;
+    if (added) return 0;
+
+    snprintf(base, sizeof(base), "%s", name);
+    for (;;) {
+        /* El contador vive en la casilla del nombre base: el siguiente
+           duplicado continua donde lo dejo este */
+        u32 n = find_slot(set, base, name_hash(base))->next_suffix++;
+        char suffix[16];
+        size_t slen, keep;
+        slen = (size_t)snprintf(suffix, sizeof(suffix), "_%u", n);
+        keep = strlen(base);
+        if (keep + slen + 1 > cap) keep = cap > slen + 1 ? cap - slen - 1 : 0;
+        memcpy(name, base, keep);
+        memcpy(name + keep, suffix, slen + 1);
+        if (!insert(set, name, owner, &added)) return -1;
+        if (added) return 1;
+    }
+}
@@ -0,0 +1,45 @@
+/* src/dat_names.h
+ *
+ * Registry of the NAME properties of one DAT. Allegro looks objects up by
+ * name, case-insensitively, so two objects called X_BMP (e.g. from
+ * a/x.bmp and b/x.bmp) make the second one unreachable.
+ *
+ * Open-addressing hash set, case-folded. Lookups and insertions are O(1)
+ * on average. Each name remembers the next free numeric suffix, so
+ * thousands of files with the same base name are still numbered in
+ * linear total time.
+ */
+#ifndef DAT_NAMES_H
+#define DAT_NAMES_H
+
+#include <stddef.h>
+#include "allegro_dat_structs.h"
+
+#define DAT_NAME_NONE ((size_t)-1)
+
+typedef struct DatNameSet DatNameSet;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+DatNameSet *dat_names_create(size_t expected);
+void        dat_names_free(DatNameSet *set);
+
+/* Adds name, kept by pointer (it must outlive the set). Returns
+   DAT_NAME_NONE if it was new, otherwise the owner that already holds it. */
+size_t dat_names_add(DatNameSet *set, const char *name, size_t owner);
+
+/* Owner of name, or DAT_NAME_NONE */
+size_t dat_names_find(const DatNameSet *set, const char *name);
+
+/* Like dat_names_add, but a taken name is first rewritten in place
+   (cap bytes) as NAME_2, NAME_3, ... Returns 1 if it had to be renamed,
+   -1 if out of memory. */
+int dat_names_add_unique(DatNameSet *set, char *name, size_t cap, size_t owner);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DAT_NAMES_H */
@@ -0,0 +1,67 @@
+/* dat_pool.c
+ *
+ * pthread implementation of dat_parallel_for(). Threads are created per
+ * call; every caller hands over enough work (whole objects or files) for
+ * the spawn cost to be negligible.
+ */
+#define _GNU_SOURCE
+#include "dat_pool.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+typedef struct {
+    dat_task_fn    fn;
+    void          *ctx;
+    size_t         count;
+    atomic_size_t  next;
+} PoolRun;
+
+static void *worker(void *arg)
+{
+    PoolRun *run = (PoolRun *)arg;
+    for (;;) {
+        size_t i = atomic_fetch_add(&run->next, 1);
+        if (i >= run->count) break;
+        run->fn(run->ctx, i);
+    }
+    return NULL;
+}
+
+int dat_cpu_count(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+}
+
+void dat_parallel_for(int jobs, size_t count, dat_task_fn fn, void *ctx)
+{
+    PoolRun run;
+    pthread_t *th;
+    int i, started = 0;
+
+    if (jobs > (int)count) jobs = (int)count;
+    if (jobs <= 1) {
+        size_t k;
+        for (k = 0; k < count; k++) fn(ctx, k);
+        return;
+    }
+
+    run.fn = fn;
+    run.ctx = ctx;
+    run.count = count;
+    atomic_init(&run.next, 0);
+
+    th = (pthread_t *)malloc(sizeof(pthread_t) * (size_t)(jobs - 1));
+    if (th) {
+        for (i = 0; i < jobs - 1; i++) {
+            if (pthread_create(&th[i], NULL, worker, &run) != 0) break;
+            started++;
+        }
+    }
+    worker(&run); /* the calling thread works too */
+    for (i = 0; i < started; i++) pthread_join(th[i], NULL);
+    free(th);
+}
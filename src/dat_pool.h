@@ -0,0 +1,29 @@
+/* dat_pool.h
+ *
+ * Minimal fork/join worker pool: runs fn(ctx, i) for every i in [0, count)
+ * on up to 'jobs' threads. Indices are handed out with an atomic counter,
+ * so each task must only write to its own slot; results are therefore
+ * independent of the thread count and scheduling.
+ */
+#ifndef DAT_POOL_H
+#define DAT_POOL_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef void (*dat_task_fn)(void *ctx, size_t index);
+
+/* Number of online CPUs (at least 1). */
+int dat_cpu_count(void);
+
+/* jobs <= 1 runs inline on the calling thread. */
+void dat_parallel_for(int jobs, size_t count, dat_task_fn fn, void *ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DAT_POOL_H */
@@ -0,0 +1,424 @@
+/* src/dat_quantize.c */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "dat_quantize.h"
+#include "dat_hash.h"
+#include "dat_loader_pal.h"
+
+#define MAGENTA 0xFF00FFu   /* R,G,B empaquetado como 0xRRGGBB */
+
+static int expand6(int v) { return (v << 2) | (v >> 4); }
+/* 0..255 -> 0..63 como load_act_to_pal63, para que exact[] case con ellos */
+static u8 to6(u32 v) { return (u8)(v >> 2); }
+
+/* 0xRRGGBB del pixel x de una fila de 24/32 bpp (B,G,R[,X]) */
+static u32 pixel_rgb(const u8 *p) { return ((u32)p[2] << 16) | ((u32)p[1] << 8) | p[0]; }
+
+static u32 idx15(u32 c) { return ((c >> 9) & 0x7C00) | ((c >> 6) & 0x3E0) | ((c >> 3) & 0x1F); }
+static u32 idx18(u32 c) { return ((c >> 6) & 0x3F000) | ((c >> 4) & 0xFC0) | ((c >> 2) & 0x3F); }
+
+static DatBitmap *new_bitmap8(int w, int h) {
+    DatBitmap *db = (DatBitmap*)calloc(1, sizeof(DatBitmap));
+    if (!db) return NULL;
+    db->image = (u8*)malloc((size_t)w * h + 1);
+    if (!db->image) { free(db); return NULL; }
+    db->bits_per_pixel = 8;
+    db->width = (u16)w;
+    db->height = (u16)h;
+    return db;
+}
+
+/* ------------------------------------------------------------------ */
+/* Paleta fija                                                         */
+/* ------------------------------------------------------------------ */
+
+DatPalMap *dat_palmap_create(const u8 *pal63) {
+    DatPalMap *m = (DatPalMap*)calloc(1, sizeof(DatPalMap));
+    int pr[256], pg[256], pb[256], i;
+    u32 cell;
+
+    if (!m) return NULL;
+    memcpy(m->pal, pal63, sizeof(m->pal));
+    m->hash = dat_hash64(m->pal, sizeof(m->pal), 0);
+    for (i = 0; i < 256; i++) {
+        pr[i] = expand6(pal63[3 * i]); pg[i] = expand6(pal63[3 * i + 1]); pb[i] = expand6(pal63[3 * i + 2]);
+    }
+    /* Exactas: gana la primera entrada con ese color */
+    for (i = 255; i >= 1; i--)
+        m->exact[(pal63[3 * i] << 12) | (pal63[3 * i + 1] << 6) | pal63[3 * i + 2]] = (u8)i;
+
+    /* rgb_map: la entrada mas cercana al centro de cada celda 5.5.5; la
+       0 es la mascara y nunca se elige, como en Allegro */
+    for (cell = 0; cell < 32768; cell++) {
+        int r = (int)((cell >> 10) << 3) | 4, g = (int)(((cell >> 5) & 31) << 3) | 4, b = (int)((cell & 31) << 3) | 4;
+        int best = 1, bestd = 0x7FFFFFFF;
+        for (i = 1; i < 256; i++) {
+            int dr = r - pr[i], dg = g - pg[i], db = b - pb[i];
+            /* pesos aproximados de luminancia (3,4,2) */
+            int d = 3 * dr * dr + 4 * dg * dg + 2 * db * db;
+            if (d < bestd) { bestd = d; best = i; }
+        }
+        m->rgb_map[cell] = (u8)best;
+    }
+    return m;
+}
+
+void dat_palmap_free(DatPalMap *m) {
+    free(m);
+}
+
+static u8 map_color(const DatPalMap *m, u32 c) {
+    u8 e;
+    if (c == MAGENTA) return 0;
+    e = m->exact[idx18(c)];
+    return e ? e : m->rgb_map[idx15(c)];
+}
+
+int dat_quantize_to_palette(const DatBitmap *src, const u8 *src_pal63, const DatPalMap *map,
+                            DatBitmap **out) {
+    int w = src->width, h = src->height, bpp = src->bits_per_pixel;
+    size_t i, n = (size_t)w * h;
+    DatBitmap *db;
+
+    *out = NULL;
+    if ((bpp != 8 && bpp != 24 && bpp != 32) || (bpp == 8 && !src_pal63)) return 0;
+    db = new_bitmap8(w, h);
+    if (!db) return 0;
+
+    if (bpp == 8) {
+        /* Reindexado: la mascara (indice 0) sigue siendo 0 */
+        u8 remap[256];
+        int k;
+        remap[0] = 0;
+        for (k = 1; k < 256; k++) {
+            const u8 *p = src_pal63 + 3 * k;
+            u32 c = ((u32)expand6(p[0]) << 16) | ((u32)expand6(p[1]) << 8) | (u32)expand6(p[2]);
+            u8 e = map->exact[(p[0] << 12) | (p[1] << 6) | p[2]];
+            remap[k] = e ? e : map->rgb_map[idx15(c)];
+        }
+        for (i = 0; i < n; i++) db->image[i] = remap[src->image[i]];
+    } else {
+        size_t pb = (size_t)bpp / 8;
+        const u8 *p = src->image;
+        u32 last = 0xFFFFFFFFu;
+        u8 last_idx = 0;
+        /* Las imagenes suelen repetir el color del pixel anterior */
+        for (i = 0; i < n; i++, p += pb) {
+            u32 c = pixel_rgb(p);
+            if (c != last) { last = c; last_idx = map_color(map, c); }
+            db->image[i] = last_idx;
+        }
+    }
+    *out = db;
+    return 1;
+}
+
+/* ------------------------------------------------------------------ */
+/* Conjunto de paletas por nombre de fichero                           */
+/* ------------------------------------------------------------------ */
+
+typedef struct {
+    char      *path;
+    DatPalMap *map;
+} PaletteSlot;
+
+struct DatPaletteSet {
+    PaletteSlot *slots;
+    size_t       num;
+    size_t       cap;
+};
+
+DatPaletteSet *dat_palettes_create(void) {
+    return (DatPaletteSet*)calloc(1, sizeof(DatPaletteSet));
+}
+
+void dat_palettes_free(DatPaletteSet *set) {
+    size_t i;
+    if (!set) return;
+    for (i = 0; i < set->num; i++) {
+        free(set->slots[i].path);
+        dat_palmap_free(set->slots[i].map);
+    }
+    free(set->slots);
+    free(set);
+}
+
+/* Casi siempre hay una o dos paletas: busqueda lineal */
+const DatPalMap *dat_palettes_find(const DatPaletteSet *set, const char *path) {
+    size_t i;
+    if (!set) return NULL;
+    for (i = 0; i < set->num; i++)
+        if (strcmp(set->slots[i].path, path) == 0) return set->slots[i].map;
+    return NULL;
+}
+
+static int has_bmp_extension(const char *path) {
+    size_t n = strlen(path);
+    return n >= 4 && path[n - 4] == '.' && tolower((unsigned char)path[n - 3]) == 'b' &&
+           tolower((unsigned char)path[n - 2]) == 'm' && tolower((unsigned char)path[n - 1]) == 'p';
+}
+
+const DatPalMap *dat_palettes_get(DatPaletteSet *set, const char *path) {
+    const DatPalMap *found = dat_palettes_find(set, path);
+    PaletteSlot *slot;
+    u8 *pal = NULL;
+    size_t len;
+
+    if (found) return found;
+    if (set->num == set->cap) {
+        size_t ncap = set->cap ? set->cap * 2 : 4;
+        PaletteSlot *ns = (PaletteSlot*)realloc(set->slots, ncap * sizeof(PaletteSlot));
+        if (!ns) return NULL;
+        set->slots = ns;
+        set->cap = ncap;
+    }
+    if (!(has_bmp_extension(path) ? load_bmp_to_pal63(path, &pal) : load_act_to_pal63(path, &pal))) {
+        fprintf(stderr, "Error: could not load palette '%s'\n", path);
+        return NULL;
+    }
+    slot = &set->slots[set->num];
+    len = strlen(path);
+    slot->path = (char*)malloc(len + 1);
+    slot->map = dat_palmap_create(pal);
+    free(pal);
+    if (!slot->path || !slot->map) {
+        free(slot->path);
+        dat_palmap_free(slot->map);
+        return NULL;
+    }
+    memcpy(slot->path, path, len + 1);
+    set->num++;
+    return slot->map;
+}
+
+/* ------------------------------------------------------------------ */
+/* Paleta automatica                                                   */
+/* ------------------------------------------------------------------ */
+
+/* Colores distintos (sin la mascara) en orden de aparicion, hasta 256.
+   Devuelve cuantos hay, o 257 si son mas */
+#define UNIQUE_SLOTS 1024
+
+static int unique_colors(const DatBitmap *src, u32 colors[256], int *has_mask) {
+    u32 table[UNIQUE_SLOTS];     /* color + 1; 0 = libre */
+    size_t i, n = (size_t)src->width * src->height, pb = (size_t)src->bits_per_pixel / 8;
+    const u8 *p = src->image;
+    u32 last = 0xFFFFFFFFu;
+    int count = 0;
+
+    memset(table, 0, sizeof(table));
+    *has_mask = 0;
+    for (i = 0; i < n; i++, p += pb) {
+        u32 c = pixel_rgb(p), s;
+        if (c == last) continue;
+        last = c;
+        if (c == MAGENTA) { *has_mask = 1; continue; }
+        s = (c * 2654435761u) >> 22; /* 10 bits */
+        while (table[s] && table[s] != c + 1) s = (s + 1) & (UNIQUE_SLOTS - 1);
+        if (table[s]) continue;
+        if (count == 256) return 257;
+        table[s] = c + 1;
+        colors[count++] = c;
+    }
+    return count;
+}
+
+typedef struct {
+    u8  lo[3], hi[3];   /* limites 5 bits inclusive: r, g, b */
+    u64 count;
+} CutBox;
+
+typedef struct {
+    u32 count[32768];
+    u64 sum[32768][3];
+} Histogram;
+
+static u32 hist_index(int r, int g, int b) { return ((u32)r << 10) | ((u32)g << 5) | (u32)b; }
+
+/* Ajusta la caja a las celdas ocupadas y recuenta */
+static void shrink_box(const Histogram *hg, CutBox *bx) {
+    int lo[3] = { 31, 31, 31 }, hi[3] = { 0, 0, 0 }, r, g, b;
+    u64 total = 0;
+    for (r = bx->lo[0]; r <= bx->hi[0]; r++)
+        for (g = bx->lo[1]; g <= bx->hi[1]; g++)
+            for (b = bx->lo[2]; b <= bx->hi[2]; b++) {
+                u32 c = hg->count[hist_index(r, g, b)];
+                if (!c) continue;
+                total += c;
+                if (r < lo[0]) lo[0] = r;
+                if (r > hi[0]) hi[0] = r;
+                if (g < lo[1]) lo[1] = g;
+                if (g > hi[1]) hi[1] = g;
+                if (b < lo[2]) lo[2] = b;
+                if (b > hi[2]) hi[2] = b;
+            }
+    bx->count = total;
+    if (!total) return;
+    for (r = 0; r < 3; r++) { bx->lo[r] = (u8)lo[r]; bx->hi[r] = (u8)hi[r]; }
+}
+
+/* Divide por la mediana del eje mas largo. 0 si la caja es una sola celda */
+static int split_box(const Histogram *hg, CutBox *bx, CutBox *nb) {
+    int axis = 0, k, v, cut;
+    u64 half, acc = 0;
+    u64 plane[32];
+
+    for (k = 1; k < 3; k++)
+        if (bx->hi[k] - bx->lo[k] > bx->hi[axis] - bx->lo[axis]) axis = k;
+    if (bx->hi[axis] == bx->lo[axis]) return 0;
+
+    memset(plane, 0, sizeof(plane));
+    {
+        int r, g, b;
+        for (r = bx->lo[0]; r <= bx->hi[0]; r++)
+            for (g = bx->lo[1]; g <= bx->hi[1]; g++)
+                for (b = bx->lo[2]; b <= bx->hi[2]; b++)
+                    plane[axis == 0 ? r : (axis == 1 ? g : b)] += hg->count[hist_index(r, g, b)];
+    }
+    half = bx->count / 2;
+    cut = bx->lo[axis];
+    for (v = bx->lo[axis]; v < bx->hi[axis]; v++) {
+        acc += plane[v];
+        cut = v;
+        if (acc >= half) break;
+    }
+    *nb = *bx;
+    bx->hi[axis] = (u8)cut;
+    nb->lo[axis] = (u8)(cut + 1);
+    shrink_box(hg, bx);
+    shrink_box(hg, nb);
+    return 1;
+}
+
+static int median_cut(const DatBitmap *src, u8 pal63[256 * 3], DatBitmap **out) {
+    Histogram *hg = (Histogram*)calloc(1, sizeof(Histogram));
+    CutBox boxes[255];
+    u8 *cell_map = (u8*)malloc(32768);
+    size_t i, n = (size_t)src->width * src->height, pb = (size_t)src->bits_per_pixel / 8;
+    const u8 *p;
+    int nboxes = 1, k;
+
+    if (!hg || !cell_map) { free(hg); free(cell_map); return 0; }
+    for (i = 0, p = src->image; i < n; i++, p += pb) {
+        u32 c = pixel_rgb(p), h;
+        if (c == MAGENTA) continue;
+        h = idx15(c);
+        hg->count[h]++;
+        hg->sum[h][0] += p[2]; hg->sum[h][1] += p[1]; hg->sum[h][2] += p[0];
+    }
+
+    memset(boxes[0].lo, 0, 3);
+    memset(boxes[0].hi, 31, 3);
+    shrink_box(hg, &boxes[0]);
+    /* Siempre se parte la caja con mas pixeles por longitud de lado */
+    while (nboxes < 255) {
+        int best = -1;
+        u64 bestv = 0;
+        for (k = 0; k < nboxes; k++) {
+            int side = 0, a;
+            u64 v;
+            for (a = 0; a < 3; a++)
+                if (boxes[k].hi[a] - boxes[k].lo[a] > side) side = boxes[k].hi[a] - boxes[k].lo[a];
+            v = boxes[k].count * (u64)side;
+            if (v > bestv) { bestv = v; best = k; }
+        }
+        if (best < 0 || !split_box(hg, &boxes[best], &boxes[nboxes])) break;
+        nboxes++;
+    }
+
+    memset(pal63, 0, 256 * 3);
+    pal63[0] = 63; pal63[1] = 0; pal63[2] = 63;
+    memset(cell_map, 1, 32768);
+    for (k = 0; k < nboxes; k++) {
+        u64 s[3] = { 0, 0, 0 }, cnt = 0;
+        int r, g, b;
+        for (r = boxes[k].lo[0]; r <= boxes[k].hi[0]; r++)
+            for (g = boxes[k].lo[1]; g <= boxes[k].hi[1]; g++)
+                for (b = boxes[k].lo[2]; b <= boxes[k].hi[2]; b++) {
+                    u32 h = hist_index(r, g, b);
+                    cell_map[h] = (u8)(k + 1);
+                    cnt += hg->count[h];
+                    s[0] += hg->sum[h][0]; s[1] += hg->sum[h][1]; s[2] += hg->sum[h][2];
+                }
+        if (cnt) {
+            pal63[3 * (k + 1) + 0] = to6((u32)((s[0] + cnt / 2) / cnt));
+            pal63[3 * (k + 1) + 1] = to6((u32)((s[1] + cnt / 2) / cnt));
+            pal63[3 * (k + 1) + 2] = to6((u32)((s[2] + cnt / 2) / cnt));
+        }
+    }
+    free(hg);
+
+    if (out) {
+        DatBitmap *db = new_bitmap8(src->width, src->height);
+        if (!db) { free(cell_map); return 0; }
+        for (i = 0, p = src->image; i < n; i++, p += pb) {
+            u32 c = pixel_rgb(p);
+            db->image[i] = c == MAGENTA ? 0 : cell_map[idx15(c)];
+        }
+        *out = db;
+    }
+    free(cell_map);
+    return 1;
+}
+
+int dat_quantize_auto(const DatBitmap *src, u8 pal63[256 * 3], DatBitmap **out) {
+    u32 colors[256];
+    int has_mask, count, first, k;
+    size_t i, n, pb;
+    const u8 *p;
+
+    if (out) *out = NULL;
+    if (src->bits_per_pixel != 24 && src->bits_per_pixel != 32) return 0;
+    count = unique_colors(src, colors, &has_mask);
+    if (count > 256 || (count == 256 && has_mask)) return median_cut(src, pal63, out);
+
+    /* Sin perdida: cada color tiene su entrada. La 0 queda para la
+       mascara salvo que hagan falta las 256 */
+    first = count == 256 ? 0 : 1;
+    memset(pal63, 0, 256 * 3);
+    if (first) { pal63[0] = 63; pal63[2] = 63; }
+    for (k = 0; k < count; k++) {
+        pal63[3 * (k + first) + 0] = to6(colors[k] >> 16);
+        pal63[3 * (k + first) + 1] = to6((colors[k] >> 8) & 0xFF);
+        pal63[3 * (k + first) + 2] = to6(colors[k] & 0xFF);
+    }
+    if (!out) return 1;
+
+    {
+        /* Color -> indice por la misma tabla de dispersion */
+        u32 keys[UNIQUE_SLOTS];
+        u8 vals[UNIQUE_SLOTS];
+        DatBitmap *db = new_bitmap8(src->width, src->height);
+        u32 last = 0xFFFFFFFFu;
+        u8 last_idx = 0;
+        if (!db) return 0;
+        memset(keys, 0, sizeof(keys));
+        for (k = 0; k < count; k++) {
+            u32 s = (colors[k] * 2654435761u) >> 22;
+            while (keys[s]) s = (s + 1) & (UNIQUE_SLOTS - 1);
+            keys[s] = colors[k] + 1;
+            vals[s] = (u8)(k + first);
+        }
+        n = (size_t)src->width * src->height;
+        pb = (size_t)src->bits_per_pixel / 8;
+        for (i = 0, p = src->image; i < n; i++, p += pb) {
+            u32 c = pixel_rgb(p);
+            if (c != last) {
+                last = c;
+                if (c == MAGENTA) {
+                    last_idx = 0;
+                } else {
+                    u32 s = (c * 2654435761u) >> 22;
+                    while (keys[s] != c + 1) s = (s + 1) & (UNIQUE_SLOTS - 1);
+                    last_idx = vals[s];
+                }
+            }
+            db->image[i] = last_idx;
+        }
+        *out = db;
+    }
+    return 1;
+}
@@ -0,0 +1,65 @@
+/* src/dat_quantize.h
+ *
+ * Truecolour to 8 bpp conversion of BMP objects (--quantize).
+ *
+ * Against a fixed palette (a game palette loaded with load_act_to_pal63 or
+ * load_bmp_to_pal63), every pixel is looked up in tables built once per
+ * palette and shared by all images:
+ *   - exact[]: 6-bit R,G,B -> entry, so art drawn with the palette maps
+ *     back to its own indices;
+ *   - rgb_map[]: 5-bit R,G,B -> nearest entry, like Allegro's rgb_map.
+ *
+ * Without a palette (auto), an image with at most 256 colours keeps every
+ * colour (lossless up to the 6-bit precision of a PAL object); otherwise
+ * a median cut on a 5.5.5 histogram picks 255 colours.
+ *
+ * Index 0 is the mask colour, as in Allegro: magenta (255,0,255) maps to 0
+ * and no other colour does. The one exception is an auto palette for an
+ * image with exactly 256 colours and no magenta, which needs all 256
+ * entries.
+ */
+#ifndef DAT_QUANTIZE_H
+#define DAT_QUANTIZE_H
+
+#include "allegro_dat_structs.h"
+
+typedef struct {
+    u8  pal[256 * 3];       /* 0..63, entry 0 is the mask colour */
+    u8  rgb_map[32768];     /* (r>>3)<<10 | (g>>3)<<5 | b>>3 -> 1..255 */
+    u8  exact[1 << 18];     /* (r>>2)<<12 | (g>>2)<<6 | b>>2 -> 1..255, 0 = none */
+    u64 hash;               /* XXH64 of pal: identifies it in cache keys */
+} DatPalMap;
+
+typedef struct DatPaletteSet DatPaletteSet;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Tables for a palette (256 x R,G,B in 0..63). NULL if out of memory. */
+DatPalMap *dat_palmap_create(const u8 *pal63);
+void       dat_palmap_free(DatPalMap *m);
+
+/* Palettes by file name, each loaded and tabulated once. dat_palettes_get
+   loads (ACT/RIFF/JASC, or the colour table of a .bmp) and may only be
+   called from one thread; dat_palettes_find only looks up. */
+DatPaletteSet   *dat_palettes_create(void);
+void             dat_palettes_free(DatPaletteSet *set);
+const DatPalMap *dat_palettes_get(DatPaletteSet *set, const char *path);
+const DatPalMap *dat_palettes_find(const DatPaletteSet *set, const char *path);
+
+/* Maps an 8, 24 or 32 bpp bitmap onto map. src_pal63 is the palette of an
+   8 bpp source. Returns 0 on error. */
+int dat_quantize_to_palette(const DatBitmap *src, const u8 *src_pal63, const DatPalMap *map,
+                            DatBitmap **out);
+
+/* Builds a palette for a 24 or 32 bpp bitmap into pal63 and, when out is
+   not NULL, the 8 bpp image. Deterministic: the same bitmap always gives
+   the same palette. Returns 0 on error. */
+int dat_quantize_auto(const DatBitmap *src, u8 pal63[256 * 3], DatBitmap **out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DAT_QUANTIZE_H */
@@ -0,0 +1,230 @@
+/* src/dat_reader.c */
+#define _POSIX_C_SOURCE 200809L
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "dat_reader.h"
+#include "dat_names.h"
+#include "lzss.h"
+
+struct DatFile {
+    void       *map;        /* mapping of the whole file, NULL for "slh!" */
+    size_t      map_len;
+    u8         *heap;       /* "slh!": payload unpacked in memory */
+    const u8   *data;       /* 'ALL.' ... */
+    u64         size;
+    u32         pack_magic;
+    DatEntry   *entries;
+    u32         num_entries;
+    u8        **unpacked;   /* [num_entries] cuerpos descomprimidos, lazy */
+    DatNameSet *names;      /* lazy */
+    char       *name_buf;   /* copias terminadas en '\0' para el indice */
+};
+
+static u32 be32(const u8 *p) {
+    return ((u32)p[0] << 24) | ((u32)p[1] << 16) | ((u32)p[2] << 8) | (u32)p[3];
+}
+
+/* Un solo recorrido de cabeceras; los cuerpos solo se saltan. d apunta a
+   num_objects: el fichero tras 'ALL.' o el cuerpo de un FILE */
+static DatEntry *parse_entries(const u8 *d, u64 size, u32 *num) {
+    DatEntry *entries;
+    u64 pos = 4;
+    u32 count, i;
+
+    if (size < 4) return NULL;
+    count = be32(d);
+    /* Cada objeto ocupa al menos 12 bytes: no fiarse de un count enorme */
+    if ((u64)count > (size - 4) / 12) return NULL;
+    entries = (DatEntry*)calloc(count ? count : 1, sizeof(DatEntry));
+    if (!entries) return NULL;
+
+    for (i = 0; i < count; i++) {
+        DatEntry *e = &entries[i];
+        u64 props = pos;
+        while (pos + 12 <= size && memcmp(d + pos, "prop", 4) == 0) {
+            u32 plen = be32(d + pos + 8);
+            if (pos + 12 + plen > size) goto bad;
+            pos += 12 + plen;
+        }
+        if (pos + 12 > size) goto bad;
+        memcpy(e->type, d + pos, 4);
+        e->len_compressed = (s32)be32(d + pos + 4);
+        e->len_uncompressed = (s32)be32(d + pos + 8);
+        e->props = d + props;
+        e->props_len = (u32)(pos - props);
+        pos += 12;
+        if (e->len_compressed < 0 || pos + (u64)e->len_compressed > size) goto bad;
+        e->stored = d + pos;
+        pos += (u64)e->len_compressed;
+    }
+    *num = count;
+    return entries;
+bad:
+    free(entries);
+    return NULL;
+}
+
+static int build_index(DatFile *df) {
+    if (df->size < 8 || be32(df->data) != DAT_MAGIC) return 0;
+    df->entries = parse_entries(df->data + 4, df->size - 4, &df->num_entries);
+    if (!df->entries) return 0;
+    df->unpacked = (u8**)calloc(df->num_entries ? df->num_entries : 1, sizeof(u8*));
+    return df->unpacked != NULL;
+}
+
+DatEntry *dat_parse_objects(const u8 *body, u32 size, u32 *count) {
+    return parse_entries(body, size, count);
+}
+
+DatFile *dat_open(const char *path) {
+    DatFile *df;
+    struct stat st;
+    const u8 *m;
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0) return NULL;
+    if (fstat(fd, &st) != 0 || st.st_size < 12) { close(fd); return NULL; }
+    df = (DatFile*)calloc(1, sizeof(DatFile));
+    if (!df) { close(fd); return NULL; }
+    df->map_len = (size_t)st.st_size;
+    df->map = mmap(NULL, df->map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (df->map == MAP_FAILED) { df->map = NULL; dat_close(df); return NULL; }
+    /* El indice solo toca cabeceras: sin lectura anticipada mientras tanto */
+    posix_madvise(df->map, df->map_len, POSIX_MADV_RANDOM);
+
+    m = (const u8*)df->map;
+    df->pack_magic = be32(m);
+    if (be32(m) == DAT_F_NOPACK_MAGIC) {
+        df->data = m + 4;
+        df->size = df->map_len - 4;
+    } else if (be32(m) == DAT_F_PACK_MAGIC) {
+        posix_madvise(df->map, df->map_len, POSIX_MADV_SEQUENTIAL);
+        /* no se puede entrar a mitad del flujo LZSS, se descomprime todo */
+        df->heap = lzss_unpack_alloc(m + 4, df->map_len - 4, &df->size);
+        munmap(df->map, df->map_len);
+        df->map = NULL;
+        df->data = df->heap;
+    }
+    if (!df->data || !build_index(df)) { dat_close(df); return NULL; }
+    if (df->map) posix_madvise(df->map, df->map_len, POSIX_MADV_NORMAL);
+    return df;
+}
+
+void dat_close(DatFile *df) {
+    u32 i;
+    if (!df) return;
+    if (df->unpacked)
+        for (i = 0; i < df->num_entries; i++) free(df->unpacked[i]);
+    free(df->unpacked);
+    free(df->entries);
+    dat_names_free(df->names);
+    free(df->name_buf);
+    free(df->heap);
+    if (df->map) munmap(df->map, df->map_len);
+    free(df);
+}
+
+u32 dat_num_objects(const DatFile *df) {
+    return df->num_entries;
+}
+
+const DatEntry *dat_entry(const DatFile *df, u32 index) {
+    return index < df->num_entries ? &df->entries[index] : NULL;
+}
+
+u32 dat_pack_magic(const DatFile *df) {
+    return df->pack_magic;
+}
+
+const u8 *dat_entry_raw(const DatEntry *e, u64 *size) {
+    /* Propiedades y cabecera van seguidas, justo antes del cuerpo */
+    if (size) *size = (u64)e->props_len + 12 + (u32)e->len_compressed;
+    return e->props;
+}
+
+int dat_file_offset(const DatFile *df, const void *p, u64 *offset) {
+    const u8 *b = (const u8*)p;
+    if (!df->map || b < (const u8*)df->map || b > (const u8*)df->map + df->map_len) return 0;
+    *offset = (u64)(b - (const u8*)df->map);
+    return 1;
+}
+
+const char *dat_prop(const DatEntry *e, const char type4[4], u32 *len) {
+    u32 pos = 0;
+    while (pos + 12 <= e->props_len) {
+        u32 plen = be32(e->props + pos + 8);
+        if (memcmp(e->props + pos + 4, type4, 4) == 0) {
+            if (len) *len = plen;
+            return (const char*)e->props + pos + 12;
+        }
+        pos += 12 + plen;
+    }
+    return NULL;
+}
+
+static int build_names(DatFile *df) {
+    size_t total = 0, off = 0;
+    u32 i, len;
+
+    for (i = 0; i < df->num_entries; i++)
+        if (dat_prop(&df->entries[i], "NAME", &len)) total += len + 1;
+    df->name_buf = (char*)malloc(total ? total : 1);
+    df->names = dat_names_create(df->num_entries);
+    if (!df->name_buf || !df->names) return 0;
+    for (i = 0; i < df->num_entries; i++) {
+        const char *n = dat_prop(&df->entries[i], "NAME", &len);
+        if (!n) continue;
+        memcpy(df->name_buf + off, n, len);
+        df->name_buf[off + len] = '\0';
+        dat_names_add(df->names, df->name_buf + off, i); /* repetido: gana el primero */
+        off += len + 1;
+    }
+    return 1;
+}
+
+const DatEntry *dat_find(DatFile *df, const char *name) {
+    size_t idx;
+    if (!df->names && !build_names(df)) {
+        dat_names_free(df->names);
+        df->names = NULL;
+        return NULL;
+    }
+    idx = dat_names_find(df->names, name);
+    return idx == DAT_NAME_NONE ? NULL : &df->entries[idx];
+}
+
+const u8 *dat_object_body(DatFile *df, const DatEntry *e, u32 *size) {
+    u32 i = (u32)(e - df->entries);
+    u32 raw;
+
+    if (df->map && (e->len_uncompressed >= 0 || !df->unpacked[i])) {
+        /* El cuerpo se va a leer entero: pedirlo de una vez */
+        uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+        uintptr_t a = (uintptr_t)e->stored & ~(page - 1);
+        posix_madvise((void*)a, (size_t)((uintptr_t)e->stored + (u32)e->len_compressed - a), POSIX_MADV_WILLNEED);
+    }
+    if (e->len_uncompressed >= 0) {
+        if (size) *size = (u32)e->len_compressed;
+        return e->stored;
+    }
+    raw = (u32)-e->len_uncompressed;
+    if (!df->unpacked[i]) {
+        u8 *buf = (u8*)malloc(raw ? raw : 1);
+        if (!buf) return NULL;
+        if (!lzss_unpack_buffer(e->stored, (size_t)e->len_compressed, buf, raw)) {
+            free(buf);
+            return NULL;
+        }
+        df->unpacked[i] = buf;
+    }
+    if (size) *size = raw;
+    return df->unpacked[i];
+}
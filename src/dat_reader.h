@@ -0,0 +1,72 @@
+/* src/dat_reader.h
+ *
+ * Random-access DAT reader. The file is mapped, not read: dat_open() walks
+ * the object headers once to build an offset index, and bodies are handed
+ * out as pointers into the mapping. Opening a large DAT to take a few
+ * objects costs one header page per object plus the bodies actually
+ * touched.
+ *
+ * Individually compressed objects are unpacked on first access and kept
+ * until dat_close(). A globally packed file ("slh!") has to be unpacked in
+ * full at open, since LZSS cannot be entered in the middle.
+ *
+ * A DatFile is not thread-safe for dat_find()/dat_object_body(); the
+ * entries and stored bodies are read-only and may be shared.
+ */
+#ifndef DAT_READER_H
+#define DAT_READER_H
+
+#include "allegro_dat_structs.h"
+
+typedef struct {
+    char      type[4];
+    s32       len_compressed;    /* bytes stored in the file */
+    s32       len_uncompressed;  /* negative: body is LZSS-compressed */
+    const u8 *props;             /* first "prop" chunk */
+    u32       props_len;         /* size of all the property chunks */
+    const u8 *stored;            /* body as stored, len_compressed bytes */
+} DatEntry;
+
+typedef struct DatFile DatFile;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* NULL if the file cannot be mapped or is not a DAT. */
+DatFile *dat_open(const char *path);
+void     dat_close(DatFile *df);
+
+u32             dat_num_objects(const DatFile *df);
+const DatEntry *dat_entry(const DatFile *df, u32 index);
+
+/* Value of a property (not NUL-terminated), NULL if absent. */
+const char *dat_prop(const DatEntry *e, const char type4[4], u32 *len);
+
+/* Object by NAME, compared without case like Allegro does; the first one
+   wins if a file repeats a name. The name index is built on first use. */
+const DatEntry *dat_find(DatFile *df, const char *name);
+
+/* Uncompressed body; points into the mapping unless it was compressed. */
+const u8 *dat_object_body(DatFile *df, const DatEntry *e, u32 *size);
+
+/* DAT_F_NOPACK_MAGIC or DAT_F_PACK_MAGIC ("slh!"). */
+u32 dat_pack_magic(const DatFile *df);
+
+/* The whole object as stored: property chunks, header and body. */
+const u8 *dat_entry_raw(const DatEntry *e, u64 *size);
+
+/* Offset in the file of p, a pointer into the bytes of the entries, so
+   they can be copied without being read (dat_writer_copy_range). Returns
+   0 for a "slh!" file, whose objects only exist unpacked in memory. */
+int dat_file_offset(const DatFile *df, const void *p, u64 *offset);
+
+/* Objects of a sub-datafile ("FILE") body, as an array the caller frees;
+   the entries point into body. NULL if it is not a valid object list. */
+DatEntry *dat_parse_objects(const u8 *body, u32 size, u32 *count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DAT_READER_H */
@@ -0,0 +1,255 @@
+/* src/dat_resample.c */
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dat_resample.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define DAT_HAVE_AVX2 1
+#define AVX2_FN __attribute__((target("avx2")))
+#endif
+
+#define MAX_PHASES  1024u
+#define ZERO_CROSS  12      /* cruces por cero de la sinc a cada lado */
+#define KAISER_BETA 8.0
+#define PASSBAND    0.90    /* corte, como fraccion del Nyquist menor */
+#define PI          3.14159265358979323846
+
+typedef float (*DotFn)(const float *x, const float *h, int n);
+
+struct DatResampler {
+    unsigned long long L, M;        /* out/in en minimos terminos */
+    unsigned long long P;           /* fases de la tabla (L o MAX_PHASES) */
+    int          half;              /* H: semiancho en muestras de entrada */
+    int          taps;              /* T: 2H redondeado a multiplo de 8 */
+    float       *table;             /* P fases x T coeficientes */
+    DotFn        dot;
+    int          channels;
+    float      **buf;               /* entrada pendiente, por canal */
+    size_t       len, cap;
+    long long    start;             /* indice absoluto de buf[c][0] */
+    unsigned long long k;           /* siguiente muestra de salida */
+    unsigned long long in_total;
+    unsigned long long out_total;   /* valido tras finish */
+    int          finished;
+};
+
+/* ------------------------------------------------------------------ */
+/* Producto escalar: 8 sumas parciales intercaladas, en el mismo orden */
+/* en todas las rutas                                                  */
+/* ------------------------------------------------------------------ */
+
+static float reduce8(const float *a) {
+    return ((a[0] + a[1]) + (a[2] + a[3])) + ((a[4] + a[5]) + (a[6] + a[7]));
+}
+
+#ifndef __SSE2__
+static float dot_c(const float *x, const float *h, int n) {
+    float a[8] = { 0 };
+    int i, l;
+    for (i = 0; i < n; i += 8)
+        for (l = 0; l < 8; l++) a[l] += x[i + l] * h[i + l];
+    return reduce8(a);
+}
+#endif
+
+#ifdef __SSE2__
+static float dot_sse2(const float *x, const float *h, int n) {
+    __m128 lo = _mm_setzero_ps(), hi = _mm_setzero_ps();
+    float a[8];
+    int i;
+    for (i = 0; i < n; i += 8) {
+        lo = _mm_add_ps(lo, _mm_mul_ps(_mm_loadu_ps(x + i), _mm_loadu_ps(h + i)));
+        hi = _mm_add_ps(hi, _mm_mul_ps(_mm_loadu_ps(x + i + 4), _mm_loadu_ps(h + i + 4)));
+    }
+    _mm_storeu_ps(a, lo);
+    _mm_storeu_ps(a + 4, hi);
+    return reduce8(a);
+}
+#endif
+
+#ifdef DAT_HAVE_AVX2
+AVX2_FN static float dot_avx2(const float *x, const float *h, int n) {
+    __m256 acc = _mm256_setzero_ps();
+    float a[8];
+    int i;
+    for (i = 0; i < n; i += 8)
+        acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_loadu_ps(x + i), _mm256_loadu_ps(h + i)));
+    _mm256_storeu_ps(a, acc);
+    return reduce8(a);
+}
+#endif
+
+static DotFn select_dot(void) {
+#ifdef DAT_HAVE_AVX2
+    if (__builtin_cpu_supports("avx2")) return dot_avx2;
+#endif
+#ifdef __SSE2__
+    return dot_sse2;
+#else
+    return dot_c;
+#endif
+}
+
+/* ------------------------------------------------------------------ */
+/* Filtro                                                              */
+/* ------------------------------------------------------------------ */
+
+static unsigned long long gcd(unsigned long long a, unsigned long long b) {
+    while (b) { unsigned long long t = a % b; a = b; b = t; }
+    return a;
+}
+
+/* Bessel modificada de primera especie, orden 0 (ventana de Kaiser) */
+static double bessel_i0(double x) {
+    double sum = 1.0, term = 1.0, q = x * x / 4.0;
+    int k;
+    for (k = 1; k < 64 && term > sum * 1e-14; k++) {
+        term *= q / ((double)k * k);
+        sum += term;
+    }
+    return sum;
+}
+
+/* Fase ph de T coeficientes: la muestra j esta a (j - H + 1) - ph/P
+   muestras de entrada de la posicion de salida */
+static void build_phase(float *dst, const DatResampler *r, unsigned long long ph, double fc) {
+    double tmp[4096], sum = 0.0, norm = bessel_i0(KAISER_BETA);
+    int j;
+    for (j = 0; j < r->taps; j++) {
+        double x = (double)(j - r->half + 1) - (double)ph / (double)r->P;
+        double u = x / r->half, v = 0.0;
+        if (j < 2 * r->half && u > -1.0 && u < 1.0) {
+            double s = fabs(x) < 1e-12 ? 1.0 : sin(PI * 2.0 * fc * x) / (PI * 2.0 * fc * x);
+            v = s * bessel_i0(KAISER_BETA * sqrt(1.0 - u * u)) / norm;
+        }
+        tmp[j] = v;
+        sum += v;
+    }
+    /* Ganancia 1 en continua en cada fase */
+    for (j = 0; j < r->taps; j++) dst[j] = (float)(tmp[j] / sum);
+}
+
+DatResampler *dat_resampler_create(unsigned int in_rate, unsigned int out_rate, int channels) {
+    DatResampler *r;
+    unsigned long long g, ph;
+    double fc;
+    int c;
+
+    if (!in_rate || !out_rate || channels < 1) return NULL;
+    r = (DatResampler*)calloc(1, sizeof(DatResampler));
+    if (!r) return NULL;
+    g = gcd(in_rate, out_rate);
+    r->L = out_rate / g;
+    r->M = in_rate / g;
+    r->P = r->L < MAX_PHASES ? r->L : MAX_PHASES;
+    /* Corte en ciclos por muestra de entrada */
+    fc = 0.5 * PASSBAND * (out_rate < in_rate ? (double)out_rate / in_rate : 1.0);
+    r->half = (int)ceil(ZERO_CROSS / (2.0 * fc));
+    r->taps = (2 * r->half + 7) & ~7;
+    r->dot = select_dot();
+    r->channels = channels;
+
+    r->table = (float*)malloc((size_t)r->P * r->taps * sizeof(float));
+    r->buf = (float**)calloc((size_t)channels, sizeof(float*));
+    if (!r->table || !r->buf || r->taps > 4096) { dat_resampler_free(r); return NULL; }
+    for (ph = 0; ph < r->P; ph++) build_phase(r->table + ph * r->taps, r, ph, fc);
+
+    /* Ceros a la izquierda: la primera salida tambien tiene ventana completa */
+    r->cap = 4096;
+    for (c = 0; c < channels; c++) {
+        r->buf[c] = (float*)calloc(r->cap, sizeof(float));
+        if (!r->buf[c]) { dat_resampler_free(r); return NULL; }
+    }
+    r->len = (size_t)r->half - 1;
+    r->start = -(long long)r->len;
+    return r;
+}
+
+void dat_resampler_free(DatResampler *r) {
+    int c;
+    if (!r) return;
+    if (r->buf)
+        for (c = 0; c < r->channels; c++) free(r->buf[c]);
+    free(r->buf);
+    free(r->table);
+    free(r);
+}
+
+size_t dat_resampler_out_frames(const DatResampler *r, size_t in_frames) {
+    return (size_t)(((unsigned long long)in_frames * r->L + r->M - 1) / r->M);
+}
+
+/* Posicion de la salida k en 1/P de muestra de entrada */
+static unsigned long long out_pos(const DatResampler *r, unsigned long long k) {
+    if (r->P == r->L) return k * r->M;
+    return (k * r->M * r->P + r->L / 2) / r->L;
+}
+
+/* Descarta la entrada que ya no necesita ninguna salida y hace sitio
+   para n muestras mas */
+static int make_room(DatResampler *r, size_t n) {
+    long long first = (long long)(out_pos(r, r->k) / r->P) - r->half + 1;
+    int c;
+    if (first > r->start) {
+        size_t drop = (size_t)(first - r->start);
+        if (drop > r->len) drop = r->len;
+        for (c = 0; c < r->channels; c++)
+            memmove(r->buf[c], r->buf[c] + drop, (r->len - drop) * sizeof(float));
+        r->len -= drop;
+        r->start += (long long)drop;
+    }
+    if (r->len + n > r->cap) {
+        size_t cap = r->cap;
+        while (cap < r->len + n) cap *= 2;
+        for (c = 0; c < r->channels; c++) {
+            float *nb = (float*)realloc(r->buf[c], cap * sizeof(float));
+            if (!nb) return 0;
+            r->buf[c] = nb;
+        }
+        r->cap = cap;
+    }
+    return 1;
+}
+
+int dat_resampler_push(DatResampler *r, const float *const *in, size_t n) {
+    int c;
+    if (r->finished || !make_room(r, n)) return 0;
+    for (c = 0; c < r->channels; c++) memcpy(r->buf[c] + r->len, in[c], n * sizeof(float));
+    r->len += n;
+    r->in_total += n;
+    return 1;
+}
+
+int dat_resampler_finish(DatResampler *r) {
+    int c;
+    if (r->finished) return 1;
+    if (!make_room(r, (size_t)r->taps)) return 0;
+    for (c = 0; c < r->channels; c++) memset(r->buf[c] + r->len, 0, (size_t)r->taps * sizeof(float));
+    r->len += (size_t)r->taps;
+    r->out_total = dat_resampler_out_frames(r, (size_t)r->in_total);
+    r->finished = 1;
+    return 1;
+}
+
+size_t dat_resampler_pull(DatResampler *r, float *const *out, size_t cap) {
+    size_t o = 0;
+    int c;
+    while (o < cap && !(r->finished && r->k >= r->out_total)) {
+        unsigned long long pos = out_pos(r, r->k);
+        long long first = (long long)(pos / r->P) - r->half + 1;
+        const float *h = r->table + (pos % r->P) * (unsigned long long)r->taps;
+        size_t off;
+        if (first + r->taps > r->start + (long long)r->len) break;
+        off = (size_t)(first - r->start);
+        for (c = 0; c < r->channels; c++) out[c][o] = r->dot(r->buf[c] + off, h, r->taps);
+        r->k++;
+        o++;
+    }
+    return o;
+}
@@ -0,0 +1,50 @@
+/* src/dat_resample.h
+ *
+ * Sample-rate conversion for SAMP objects (--rate).
+ *
+ * A polyphase FIR: every output sample is the dot product of the input
+ * around its position with one phase of a Kaiser-windowed sinc. The
+ * cut-off is just below the lower of the two Nyquist frequencies, so
+ * downsampling does not alias. For a ratio out/in = L/M in lowest terms
+ * the table holds L phases (at most 1024; beyond that positions are
+ * rounded to 1/1024 of an input sample).
+ *
+ * The dot products run on scalar, SSE2 or AVX2 code picked at run time.
+ * All paths add in the same order (8 interleaved partial sums), so the
+ * output is the same on every CPU.
+ *
+ * Input and output are planar floats, one array per channel.
+ */
+#ifndef DAT_RESAMPLE_H
+#define DAT_RESAMPLE_H
+
+#include <stddef.h>
+
+typedef struct DatResampler DatResampler;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* NULL if a rate is 0 or out of memory. */
+DatResampler *dat_resampler_create(unsigned int in_rate, unsigned int out_rate, int channels);
+void          dat_resampler_free(DatResampler *r);
+
+/* Output frames for in_frames input frames: ceil(in_frames * out / in). */
+size_t dat_resampler_out_frames(const DatResampler *r, size_t in_frames);
+
+/* Appends n input frames (in[c][0..n)). Returns 0 if out of memory. */
+int dat_resampler_push(DatResampler *r, const float *const *in, size_t n);
+
+/* Marks the end of the input: the last outputs see zeros past it. */
+int dat_resampler_finish(DatResampler *r);
+
+/* Writes up to cap output frames into out[c] and returns how many; 0 once
+   everything pushed so far has been used. Call it after every push. */
+size_t dat_resampler_pull(DatResampler *r, float *const *out, size_t cap);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DAT_RESAMPLE_H */
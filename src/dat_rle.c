@@ -0,0 +1,175 @@
+/* src/dat_rle.c */
+#include <stdlib.h>
+#include <string.h>
+
+#include "dat_rle.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define MASK16     0xF81Fu       /* magenta 5.6.5, tambien EOL de 15/16 bpp */
+#define EOL32      0x00FF00FFu
+
+/* ------------------------------------------------------------------ */
+/* Deteccion de pixeles transparentes: skip[x] = 1 si es color mascara */
+/* ------------------------------------------------------------------ */
+
+static void classify_row(const u8 *row, int w, int bpp, u8 *skip) {
+    int x = 0;
+#ifdef __SSE2__
+    const __m128i one = _mm_set1_epi8(1);
+    if (bpp == 8) {
+        const __m128i zero = _mm_setzero_si128();
+        for (; x + 16 <= w; x += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i*)(row + x));
+            _mm_storeu_si128((__m128i*)(skip + x), _mm_and_si128(_mm_cmpeq_epi8(v, zero), one));
+        }
+    } else if (bpp == 15 || bpp == 16) {
+        const __m128i mask = _mm_set1_epi16((short)MASK16);
+        for (; x + 16 <= w; x += 16) {
+            __m128i a = _mm_cmpeq_epi16(_mm_loadu_si128((const __m128i*)(row + 2 * x)), mask);
+            __m128i b = _mm_cmpeq_epi16(_mm_loadu_si128((const __m128i*)(row + 2 * x + 16)), mask);
+            _mm_storeu_si128((__m128i*)(skip + x), _mm_and_si128(_mm_packs_epi16(a, b), one));
+        }
+    } else if (bpp == 24) {
+        /* 16 pixeles = 48 bytes = 3 vectores, y el patron 255,0,255 vuelve
+           a empezar cada 48 bytes: un pixel es mascara si sus 3 bytes
+           coinciden, es decir, si sus 3 bits del movemask valen 1 */
+        const __m128i m0 = _mm_setr_epi8(-1,0,-1, -1,0,-1, -1,0,-1, -1,0,-1, -1,0,-1, -1);
+        const __m128i m1 = _mm_setr_epi8(0,-1, -1,0,-1, -1,0,-1, -1,0,-1, -1,0,-1, -1,0);
+        const __m128i m2 = _mm_setr_epi8(-1, -1,0,-1, -1,0,-1, -1,0,-1, -1,0,-1, -1,0,-1);
+        for (; x + 16 <= w; x += 16) {
+            const u8 *p = row + 3 * x;
+            u64 m = (u64)(u32)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)p), m0))
+                  | (u64)(u32)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(p + 16)), m1)) << 16
+                  | (u64)(u32)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(p + 32)), m2)) << 32;
+            int k;
+            m &= (m >> 1) & (m >> 2);
+            for (k = 0; k < 16; k++) skip[x + k] = (u8)((m >> (3 * k)) & 1);
+        }
+    } else if (bpp == 32) {
+        /* El cuarto byte no cuenta: (px & 0x00FFFFFF) == 0x00FF00FF */
+        const __m128i rgb = _mm_set1_epi32(0x00FFFFFF);
+        const __m128i mask = _mm_set1_epi32(0x00FF00FF);
+        for (; x + 16 <= w; x += 16) {
+            const u8 *p = row + 4 * x;
+            __m128i a = _mm_cmpeq_epi32(_mm_and_si128(_mm_loadu_si128((const __m128i*)p), rgb), mask);
+            __m128i b = _mm_cmpeq_epi32(_mm_and_si128(_mm_loadu_si128((const __m128i*)(p + 16)), rgb), mask);
+            __m128i c = _mm_cmpeq_epi32(_mm_and_si128(_mm_loadu_si128((const __m128i*)(p + 32)), rgb), mask);
+            __m128i d = _mm_cmpeq_epi32(_mm_and_si128(_mm_loadu_si128((const __m128i*)(p + 48)), rgb), mask);
+            __m128i ab = _mm_packs_epi32(a, b), cd = _mm_packs_epi32(c, d);
+            _mm_storeu_si128((__m128i*)(skip + x), _mm_and_si128(_mm_packs_epi16(ab, cd), one));
+        }
+    }
+#endif
+    for (; x < w; x++) {
+        switch (bpp) {
+        case 8:  skip[x] = row[x] == 0; break;
+        case 15:
+        case 16: skip[x] = (u16)(row[2 * x] | (row[2 * x + 1] << 8)) == MASK16; break;
+        case 24: skip[x] = row[3 * x] == 255 && row[3 * x + 1] == 0 && row[3 * x + 2] == 255; break;
+        default: skip[x] = row[4 * x] == 255 && row[4 * x + 1] == 0 && row[4 * x + 2] == 255; break;
+        }
+    }
+}
+
+/* Primer x >= i con skip[x] != skip[i] (o w) */
+static int run_end(const u8 *skip, int i, int w) {
+    u8 v = skip[i];
+    int x = i + 1;
+#ifdef __SSE2__
+    const __m128i cur = _mm_set1_epi8((char)v);
+    for (; x + 16 <= w; x += 16) {
+        int eq = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(skip + x)), cur));
+        if (eq != 0xFFFF) return x + __builtin_ctz(~eq & 0xFFFF);
+    }
+#endif
+    while (x < w && skip[x] == v) x++;
+    return x;
+}
+
+/* ------------------------------------------------------------------ */
+/* Codificacion                                                        */
+/* ------------------------------------------------------------------ */
+
+static u8 *put_count(u8 *p, int cb, s32 v) {
+    if (cb == 1) {
+        *p++ = (u8)v;
+    } else if (cb == 2) {
+        *p++ = (u8)v; *p++ = (u8)((u32)v >> 8);
+    } else {
+        *p++ = (u8)v; *p++ = (u8)((u32)v >> 8); *p++ = (u8)((u32)v >> 16); *p++ = (u8)((u32)v >> 24);
+    }
+    return p;
+}
+
+int dat_rle_encode(const DatBitmap *bmp, DatRleSprite **out) {
+    int bpp = bmp->bits_per_pixel == -32 ? 32 : bmp->bits_per_pixel, w = bmp->width, h = bmp->height, y;
+    int src_pb = (bpp + 7) / 8;                 /* bytes por pixel en el BMP */
+    int pb = bpp >= 24 ? 4 : src_pb;            /* ... y en el sprite */
+    int cb = bpp == 8 ? 1 : (bpp <= 16 ? 2 : 4); /* bytes de cada contador */
+    s32 max_run = bpp == 8 ? 127 : (bpp <= 16 ? 32767 : 0x7fffffff);
+    s32 max_skip = bpp == 8 ? 128 : (bpp <= 16 ? 32768 : 0x7fffffff);
+    size_t cap;
+    u8 *buf, *p, *skip;
+    DatRleSprite *r;
+
+    *out = NULL;
+    if (bpp != 8 && bpp != 15 && bpp != 16 && bpp != 24 && bpp != 32) return 0;
+    /* Peor caso: un contador por pixel, mas el EOL de cada fila */
+    cap = (size_t)h * ((size_t)w * (size_t)(pb + cb) + (size_t)cb) + 1;
+    buf = (u8*)malloc(cap);
+    skip = (u8*)malloc((size_t)w + 1);
+    r = (DatRleSprite*)calloc(1, sizeof(DatRleSprite));
+    if (!buf || !skip || !r) { free(buf); free(skip); free(r); return 0; }
+
+    p = buf;
+    for (y = 0; y < h; y++) {
+        const u8 *row = bmp->image + (size_t)y * w * src_pb;
+        int x = 0;
+        classify_row(row, w, bpp, skip);
+        while (x < w) {
+            int end = run_end(skip, x, w);
+            if (skip[x]) {
+                /* La fila se cubre entera, incluido el hueco final: los
+                   dibujantes con recorte de Allegro cuentan pixeles */
+                while (x < end) {
+                    s32 n = end - x > max_skip ? max_skip : end - x;
+                    /* -2017 seria 0xF81F, el marcador de fin de linea */
+                    if (cb == 2 && (u16)-n == MASK16) n--;
+                    p = put_count(p, cb, -n);
+                    x += n;
+                }
+            } else {
+                while (x < end) {
+                    s32 n = end - x > max_run ? max_run : end - x;
+                    p = put_count(p, cb, n);
+                    if (bpp >= 24) {
+                        /* Una palabra LE 0x00RRGGBB por pixel, como los
+                           contadores: asi las leen Allegro y el grabber */
+                        const u8 *s = row + (size_t)x * src_pb;
+                        int k;
+                        for (k = 0; k < n; k++, s += src_pb)
+                            p = put_count(p, 4, (s32)((u32)s[0] << 16 | (u32)s[1] << 8 | s[2]));
+                    } else {
+                        memcpy(p, row + (size_t)x * src_pb, (size_t)n * src_pb);
+                        p += (size_t)n * src_pb;
+                    }
+                    x += n;
+                }
+            }
+        }
+        p = put_count(p, cb, cb == 1 ? 0 : (cb == 2 ? (s32)MASK16 : (s32)EOL32));
+    }
+    free(skip);
+
+    r->bits_per_pixel = (s16)bpp;
+    r->width = (u16)w;
+    r->height = (u16)h;
+    r->len_image = (u32)(p - buf);
+    r->image = (u8*)realloc(buf, r->len_image ? r->len_image : 1);
+    if (!r->image) r->image = buf;
+    *out = r;
+    return 1;
+}
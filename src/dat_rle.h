@@ -0,0 +1,42 @@
+/* src/dat_rle.h
+ *
+ * Allegro 4 RLE sprite encoder (the "RLE " object of a datafile).
+ *
+ * Each row is a list of runs that together cover the full width, then an
+ * end-of-line marker:
+ *
+ *   depth   count      skip run   solid run            EOL
+ *   8       s8         -n         n, n indices         0
+ *   15/16   s16 (LE)   -n         n, n 5.6.5 words     0xF81F
+ *   24/32   s32 (LE)   -n         n, n s32 0x00RRGGBB  0x00FF00FF
+ *
+ * Transparent pixels are the mask colour: index 0 at 8 bpp, magenta
+ * (255,0,255) otherwise. At 8-16 bpp pixel bytes keep the layout of the
+ * BMP object (DatBitmap); at 24 and 32 bpp each pixel is one little-endian
+ * word like the counts (bytes B,G,R,0), read from the R,G,B bitmap the
+ * build stores, and the fourth byte of a 32 bpp pixel is dropped.
+ */
+#ifndef DAT_RLE_H
+#define DAT_RLE_H
+
+#include "allegro_dat_structs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Encodes a bitmap of 8, 15, 16, 24 or 32 bpp (-32 too: the sprite is
+   32 bpp without alpha). Returns 0 on error. */
+int dat_rle_encode(const DatBitmap *bmp, DatRleSprite **out);
+
+/* Body sizes, to choose between the two encodings */
+static inline u32 dat_rle_body_size(const DatRleSprite *r) { return 2 + 2 + 2 + 4 + r->len_image; }
+static inline u32 dat_bmp_body_size(const DatBitmap *b) {
+    return 2 + 2 + 2 + (u32)b->width * b->height * dat_bitmap_pixel_size(b->bits_per_pixel);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DAT_RLE_H */
@@ -0,0 +1,273 @@
+/* src/dat_stats.c */
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dat_stats.h"
+
+int dat_stats_on;
+
+static const char *stage_names[DAT_STAGE_COUNT] = {
+    "setup", "hash", "cache", "read", "bmp", "wav", "midi", "convert", "groups", "atlas",
+    "tiles", "pack", "checksum", "write", "list", "extract", "verify", "object"
+};
+
+typedef struct {
+    char *name;
+    int   stage;
+    int   tid;
+    u64   t0, t1;
+    u64   bytes_in, bytes_out;
+} Span;
+
+/* Memoria del proceso en un instante (contador "memory" de la traza) */
+typedef struct {
+    u64 t;
+    u64 rss;
+    u64 allocs;
+} Sample;
+
+static struct {
+    int              summary;
+    const char      *trace_path;
+    u64              start;
+    pthread_mutex_t  lock;
+    Span            *spans;
+    size_t           num_spans, cap_spans;
+    Sample          *samples;
+    size_t           num_samples, cap_samples;
+} st = { 0, NULL, 0, PTHREAD_MUTEX_INITIALIZER, NULL, 0, 0, NULL, 0, 0 };
+
+static atomic_ullong alloc_count, alloc_bytes;
+static atomic_int    next_tid;
+static _Thread_local int my_tid = -1;
+
+u64 dat_stats_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * 1000000000ull + (u64)ts.tv_nsec + 1;
+}
+
+/* Pista de la traza: 0 el hilo principal, los workers en orden de llegada */
+static int thread_id(void) {
+    if (my_tid < 0) my_tid = atomic_fetch_add(&next_tid, 1);
+    return my_tid;
+}
+
+/* RSS actual en bytes; 0 si /proc no esta */
+static u64 current_rss(void) {
+    unsigned long pages = 0, resident = 0;
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (!f) return 0;
+    if (fscanf(f, "%lu %lu", &pages, &resident) != 2) resident = 0;
+    fclose(f);
+    return (u64)resident * (u64)sysconf(_SC_PAGESIZE);
+}
+
+static u64 peak_rss(void) {
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) != 0) return 0;
+    return (u64)ru.ru_maxrss * 1024u; /* KB en Linux */
+}
+
+int dat_stats_enable(int summary, const char *trace_path) {
+    st.summary = summary;
+    st.trace_path = trace_path;
+    st.cap_spans = 1024;
+    st.spans = (Span*)malloc(sizeof(Span) * st.cap_spans);
+    st.cap_samples = 256;
+    st.samples = (Sample*)malloc(sizeof(Sample) * st.cap_samples);
+    if (!st.spans || !st.samples) {
+        free(st.spans);
+        free(st.samples);
+        st.spans = NULL;
+        st.samples = NULL;
+        return 0;
+    }
+    atomic_store(&next_tid, 0);
+    my_tid = -1;
+    thread_id();
+    st.start = dat_stats_now();
+    dat_stats_on = 1;
+    return 1;
+}
+
+void dat_stats_count_alloc(size_t n) {
+    atomic_fetch_add_explicit(&alloc_count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&alloc_bytes, n, memory_order_relaxed);
+}
+
+void dat_stats_record(DatStage stage, u64 t0, const char *name, u64 bytes_in, u64 bytes_out) {
+    u64 t1 = dat_stats_now();
+    int tid = thread_id();
+    char *copy = NULL;
+    Span *s;
+
+    if (name) {
+        size_t n = strlen(name);
+        copy = (char*)malloc(n + 1);
+        if (copy) memcpy(copy, name, n + 1);
+    }
+    pthread_mutex_lock(&st.lock);
+    if (st.num_spans == st.cap_spans) {
+        Span *ns = (Span*)realloc(st.spans, sizeof(Span) * st.cap_spans * 2);
+        if (!ns) { pthread_mutex_unlock(&st.lock); free(copy); return; }
+        st.spans = ns;
+        st.cap_spans *= 2;
+    }
+    s = &st.spans[st.num_spans++];
+    s->name = copy;
+    s->stage = (int)stage;
+    s->tid = tid;
+    s->t0 = t0;
+    s->t1 = t1;
+    s->bytes_in = bytes_in;
+    s->bytes_out = bytes_out;
+    /* El hilo principal tambien anota la memoria: basta para ver su forma */
+    if (tid == 0 && st.trace_path) {
+        if (st.num_samples == st.cap_samples) {
+            Sample *ns = (Sample*)realloc(st.samples, sizeof(Sample) * st.cap_samples * 2);
+            if (ns) { st.samples = ns; st.cap_samples *= 2; }
+        }
+        if (st.num_samples < st.cap_samples) {
+            Sample *m = &st.samples[st.num_samples++];
+            m->t = t1;
+            m->rss = current_rss();
+            m->allocs = atomic_load_explicit(&alloc_count, memory_order_relaxed);
+        }
+    }
+    pthread_mutex_unlock(&st.lock);
+}
+
+/* ------------------------------------------------------------------ */
+/* --stats                                                             */
+/* ------------------------------------------------------------------ */
+
+static double mb(u64 bytes) { return (double)bytes / (1024.0 * 1024.0); }
+
+static void print_summary(u64 end) {
+    u64 calls[DAT_STAGE_COUNT] = { 0 }, ns[DAT_STAGE_COUNT] = { 0 };
+    u64 in[DAT_STAGE_COUNT] = { 0 }, out[DAT_STAGE_COUNT] = { 0 };
+    const Span *slow[3] = { NULL, NULL, NULL };
+    size_t i;
+    int k, threads = atomic_load(&next_tid);
+
+    for (i = 0; i < st.num_spans; i++) {
+        const Span *s = &st.spans[i];
+        calls[s->stage]++;
+        ns[s->stage] += s->t1 - s->t0;
+        in[s->stage] += s->bytes_in;
+        out[s->stage] += s->bytes_out;
+        if (s->stage != DAT_STAGE_OBJECT) continue;
+        /* Los tres objetos mas lentos, de mas a menos */
+        for (k = 0; k < 3; k++) {
+            if (!slow[k] || s->t1 - s->t0 > slow[k]->t1 - slow[k]->t0) {
+                memmove(&slow[k + 1], &slow[k], sizeof(slow[0]) * (size_t)(2 - k));
+                slow[k] = s;
+                break;
+            }
+        }
+    }
+
+    printf("\nStats: %.3f s wall, %d thread%s (stage times are summed over threads)\n",
+           (double)(end - st.start) * 1e-9, threads, threads == 1 ? "" : "s");
+    printf("  %-8s %8s %11s %10s %10s %9s\n", "stage", "calls", "time ms", "MB in", "MB out", "MB/s");
+    for (k = 0; k < DAT_STAGE_COUNT; k++) {
+        double sec = (double)ns[k] * 1e-9;
+        u64 bytes = in[k] ? in[k] : out[k];
+        if (!calls[k]) continue;
+        printf("  %-8s %8llu %11.1f %10.1f %10.1f", stage_names[k], (unsigned long long)calls[k],
+               sec * 1e3, mb(in[k]), mb(out[k]));
+        /* Por debajo de 0.1 ms el cociente no dice nada */
+        if (bytes && sec >= 1e-4) printf(" %9.1f\n", mb(bytes) / sec);
+        else printf(" %9s\n", "-");
+    }
+    if (slow[0]) {
+        printf("  slowest objects:");
+        for (k = 0; k < 3 && slow[k]; k++)
+            printf("%s '%s' %.1f ms", k ? "," : "", slow[k]->name ? slow[k]->name : "?",
+                   (double)(slow[k]->t1 - slow[k]->t0) * 1e-6);
+        printf("\n");
+    }
+    printf("  allocations: %llu (%.1f MB)   peak RSS: %.1f MB\n",
+           (unsigned long long)atomic_load(&alloc_count), mb(atomic_load(&alloc_bytes)), mb(peak_rss()));
+}
+
+/* ------------------------------------------------------------------ */
+/* --trace                                                             */
+/* ------------------------------------------------------------------ */
+
+static void put_json_string(FILE *f, const char *s) {
+    fputc('"', f);
+    for (; s && *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') fprintf(f, "\\%c", c);
+        else if (c < 0x20) fprintf(f, "\\u%04x", c);
+        else fputc(c, f);
+    }
+    fputc('"', f);
+}
+
+/* Microsegundos desde dat_stats_enable, como los quiere el formato */
+static double trace_us(u64 t) { return (double)(t - st.start) * 1e-3; }
+
+static int write_trace(const char *path) {
+    FILE *f = fopen(path, "w");
+    size_t i;
+    int t, threads = atomic_load(&next_tid), ok;
+
+    if (!f) return 0;
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"dat\"}}");
+    for (t = 0; t < threads; t++) {
+        fprintf(f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":", t);
+        if (t == 0) fprintf(f, "\"main\"}}");
+        else fprintf(f, "\"worker %d\"}}", t);
+    }
+    for (i = 0; i < st.num_spans; i++) {
+        const Span *s = &st.spans[i];
+        fprintf(f, ",\n{\"name\":");
+        put_json_string(f, s->name ? s->name : stage_names[s->stage]);
+        fprintf(f, ",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%d,"
+                   "\"args\":{\"bytes_in\":%llu,\"bytes_out\":%llu}}",
+                stage_names[s->stage], trace_us(s->t0), (double)(s->t1 - s->t0) * 1e-3, s->tid,
+                (unsigned long long)s->bytes_in, (unsigned long long)s->bytes_out);
+    }
+    for (i = 0; i < st.num_samples; i++) {
+        const Sample *m = &st.samples[i];
+        fprintf(f, ",\n{\"name\":\"memory\",\"ph\":\"C\",\"ts\":%.3f,\"pid\":1,"
+                   "\"args\":{\"rss_mb\":%.2f,\"allocations\":%llu}}",
+                trace_us(m->t), mb(m->rss), (unsigned long long)m->allocs);
+    }
+    fprintf(f, "\n]}\n");
+    ok = !ferror(f);
+    return fclose(f) == 0 && ok;
+}
+
+int dat_stats_finish(void) {
+    u64 end;
+    size_t i;
+    int ok = 1;
+
+    if (!dat_stats_on) return 1;
+    end = dat_stats_now();
+    dat_stats_on = 0;
+    if (st.summary) print_summary(end);
+    if (st.trace_path) {
+        ok = write_trace(st.trace_path);
+        if (!ok) fprintf(stderr, "Error: could not write the trace '%s'\n", st.trace_path);
+    }
+    for (i = 0; i < st.num_spans; i++) free(st.spans[i].name);
+    free(st.spans);
+    free(st.samples);
+    st.spans = NULL;
+    st.samples = NULL;
+    st.num_spans = st.cap_spans = st.num_samples = st.cap_samples = 0;
+    return ok;
+}
@@ -0,0 +1,83 @@
+/* src/dat_stats.h
+ *
+ * Stage and object timers behind --stats (summary table) and --trace
+ * (Chrome trace-event JSON, for Perfetto or chrome://tracing).
+ *
+ * Measured work is bracketed as
+ *
+ *     u64 t0 = dat_stats_begin();
+ *     ...
+ *     dat_stats_end(DAT_STAGE_READ, t0, path, bytes_in, bytes_out);
+ *
+ * With both options off, dat_stats_begin() is a load and a branch that
+ * returns 0, and dat_stats_end() does nothing for t0 == 0, so the calls
+ * stay in every build. Spans of the stages never nest on one thread, so
+ * the per-stage sums do not count any time twice. DAT_STAGE_OBJECT spans
+ * are the exception: they cover all the stages of one asset and are
+ * reported apart.
+ *
+ * Spans may end on any thread; each thread gets its own track in the trace.
+ */
+#ifndef DAT_STATS_H
+#define DAT_STATS_H
+
+#include <stddef.h>
+#include "allegro_dat_structs.h"
+
+typedef enum {
+    DAT_STAGE_SETUP,    /* options, names, palettes, index of the old DAT */
+    DAT_STAGE_HASH,     /* fingerprinting source files */
+    DAT_STAGE_CACHE,    /* conversion cache lookups and stores */
+    DAT_STAGE_READ,     /* loading source files (BMP: decoded to a bitmap) */
+    DAT_STAGE_BMP,      /* --depth, --quantize and RLE encoding of bitmaps */
+    DAT_STAGE_WAV,      /* WAV to SAMP, reads included (they are streamed) */
+    DAT_STAGE_MIDI,     /* SMF to Allegro MIDI */
+    DAT_STAGE_CONVERT,  /* every other converter (PAL, FONT, RLE, ...) */
+    DAT_STAGE_GROUPS,   /* serializing sub-datafiles */
+    DAT_STAGE_ATLAS,    /* packing --atlas sprites into pages */
+    DAT_STAGE_TILES,    /* cutting --tiles bitmaps into unique tiles */
+    DAT_STAGE_PACK,     /* --compress */
+    DAT_STAGE_CHECKSUM, /* --checksum */
+    DAT_STAGE_WRITE,    /* DatWriter, --pack included */
+    DAT_STAGE_LIST,     /* dat list, one span per object */
+    DAT_STAGE_EXTRACT,  /* dat extract, one span per file written */
+    DAT_STAGE_VERIFY,   /* dat verify, one span per top-level object */
+    DAT_STAGE_OBJECT,   /* one asset from start to end (not a stage) */
+    DAT_STAGE_COUNT
+} DatStage;
+
+/* Non-zero while --stats or --trace is on; set once, before any thread starts. */
+extern int dat_stats_on;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Turns the timers on. summary: print the table in dat_stats_finish;
+   trace_path: write the trace there (NULL = no trace). Returns 0 if out of memory. */
+int  dat_stats_enable(int summary, const char *trace_path);
+
+/* Prints the table and writes the trace, then frees everything. Returns 0
+   if the trace could not be written. Does nothing when stats are off. */
+int  dat_stats_finish(void);
+
+/* Monotonic nanoseconds (never 0). */
+u64  dat_stats_now(void);
+
+/* Records a span started at t0; name is copied. */
+void dat_stats_record(DatStage stage, u64 t0, const char *name, u64 bytes_in, u64 bytes_out);
+
+/* One allocation of n bytes (called by the allocation counter, see dat_stats_alloc.c). */
+void dat_stats_count_alloc(size_t n);
+
+static inline u64 dat_stats_begin(void) { return dat_stats_on ? dat_stats_now() : 0; }
+
+static inline void dat_stats_end(DatStage stage, u64 t0, const char *name, u64 bytes_in, u64 bytes_out) {
+    if (t0) dat_stats_record(stage, t0, name, bytes_in, bytes_out);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DAT_STATS_H */
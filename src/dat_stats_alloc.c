@@ -0,0 +1,36 @@
+/* src/dat_stats_alloc.c
+ *
+ * Contador de reservas de memoria para --stats y --trace: sustituye
+ * malloc, calloc y realloc por envoltorios sobre los de glibc. Solo se
+ * enlaza en el ejecutable dat (no en bench ni en una biblioteca) y, con
+ * las estadisticas apagadas, cuesta una comparacion por llamada.
+ *
+ * Fuera de glibc, o con AddressSanitizer (que ya los sustituye), no hace
+ * nada y el resumen muestra 0 reservas.
+ */
+#include <stdlib.h>
+
+#include "dat_stats.h"
+
+#if defined(__GLIBC__) && !defined(__SANITIZE_ADDRESS__)
+
+extern void *__libc_malloc(size_t n);
+extern void *__libc_calloc(size_t count, size_t n);
+extern void *__libc_realloc(void *p, size_t n);
+
+void *malloc(size_t n) {
+    if (dat_stats_on) dat_stats_count_alloc(n);
+    return __libc_malloc(n);
+}
+
+void *calloc(size_t count, size_t n) {
+    if (dat_stats_on) dat_stats_count_alloc(count * n);
+    return __libc_calloc(count, n);
+}
+
+void *realloc(void *p, size_t n) {
+    if (dat_stats_on) dat_stats_count_alloc(n);
+    return __libc_realloc(p, n);
+}
+
+#endif
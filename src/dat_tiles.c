@@ -0,0 +1,186 @@
+/* src/dat_tiles.c */
+#include <stdlib.h>
+#include <string.h>
+
+#include "dat_tiles.h"
+#include "dat_atlas.h"
+#include "dat_hash.h"
+
+#define NO_TILE 0xFFFFFFFFu
+
+/* Tabla abierta hash -> tile unico; tile va +1 para que 0 sea hueco */
+typedef struct {
+    u64 hash;
+    u32 tile;
+} Slot;
+
+typedef struct {
+    Slot  *slots;
+    u32    mask;
+    const u8 *uniq;      /* tiles unicos, uno detras de otro */
+    size_t tile_bytes;
+} TileTable;
+
+u32 dat_tiles_limit(u16 tile_h) {
+    u32 lim = 65535u / (tile_h ? tile_h : 1) * DAT_TILES_COLUMNS;
+    return lim < DAT_TILES_MAX ? lim : DAT_TILES_MAX;
+}
+
+static u32 find(const TileTable *t, const u8 *tile, u64 h) {
+    u32 i;
+    for (i = (u32)h & t->mask; t->slots[i].tile; i = (i + 1) & t->mask)
+        if (t->slots[i].hash == h &&
+            memcmp(t->uniq + (size_t)(t->slots[i].tile - 1) * t->tile_bytes, tile, t->tile_bytes) == 0)
+            return t->slots[i].tile - 1;
+    return NO_TILE;
+}
+
+static void insert(TileTable *t, u64 h, u32 k) {
+    u32 i = (u32)h & t->mask;
+    while (t->slots[i].tile) i = (i + 1) & t->mask;
+    t->slots[i].hash = h;
+    t->slots[i].tile = k + 1;
+}
+
+static void flip_h(const u8 *src, u8 *dst, u32 w, u32 h, u32 ps) {
+    u32 x, y;
+    for (y = 0; y < h; y++, src += (size_t)w * ps, dst += (size_t)w * ps)
+        for (x = 0; x < w; x++) memcpy(dst + (size_t)x * ps, src + (size_t)(w - 1 - x) * ps, ps);
+}
+
+static void flip_v(const u8 *src, u8 *dst, u32 w, u32 h, u32 ps) {
+    size_t row = (size_t)w * ps;
+    u32 y;
+    for (y = 0; y < h; y++) memcpy(dst + (size_t)y * row, src + (size_t)(h - 1 - y) * row, row);
+}
+
+static u8 *put_be16(u8 *p, u32 v) {
+    p[0] = (u8)(v >> 8);
+    p[1] = (u8)v;
+    return p + 2;
+}
+
+/* El tile k de un candidato: k, o con flips la copia espejada que ya
+   este; *flags dice cual */
+static u32 match(const TileTable *t, u8 *scratch, u32 tw, u32 th, u32 ps, int flips, u32 *flags, u64 *h0) {
+    size_t n = t->tile_bytes;
+    u8 *fh = scratch + n, *fv = scratch + 2 * n, *fhv = scratch + 3 * n;
+    u32 k;
+
+    *flags = 0;
+    *h0 = dat_hash64(scratch, n, 0);
+    if ((k = find(t, scratch, *h0)) != NO_TILE || !flips) return k;
+    flip_h(scratch, fh, tw, th, ps);
+    if ((k = find(t, fh, dat_hash64(fh, n, 0))) != NO_TILE) {
+        *flags = DAT_TILE_FLIP_H;
+        return k;
+    }
+    flip_v(scratch, fv, tw, th, ps);
+    if ((k = find(t, fv, dat_hash64(fv, n, 0))) != NO_TILE) {
+        *flags = DAT_TILE_FLIP_V;
+        return k;
+    }
+    flip_v(fh, fhv, tw, th, ps);
+    if ((k = find(t, fhv, dat_hash64(fhv, n, 0))) != NO_TILE) *flags = DAT_TILE_FLIP_H | DAT_TILE_FLIP_V;
+    return k;
+}
+
+int dat_tiles_build(const DatBitmap *src, u16 tile_w, u16 tile_h, int flips, DatTileset *out) {
+    u32 ps = dat_bitmap_pixel_size(src->bits_per_pixel), limit = dat_tiles_limit(tile_h);
+    size_t row = (size_t)tile_w * ps, src_row = (size_t)src->width * ps;
+    u32 total, count = 0, cap, slots = 16, tx, ty, y, k, cols, rows;
+    TileTable t;
+    u8 *uniq = NULL, *scratch, *p;
+    DatBitmap *b;
+    int ok = 0;
+
+    memset(out, 0, sizeof(*out));
+    out->map_w = src->width / tile_w;
+    out->map_h = src->height / tile_h;
+    total = out->map_w * out->map_h;
+    if (total > 0x3FFFFFF0u) return 0;
+    cap = total < 256 ? (total ? total : 1) : 256;
+    while (slots < 2 * (total < limit + 1 ? total : limit + 1)) slots *= 2;
+
+    t.tile_bytes = row * tile_h;
+    t.mask = slots - 1;
+    t.slots = (Slot*)calloc(slots, sizeof(Slot));
+    scratch = (u8*)malloc(4 * t.tile_bytes);
+    uniq = (u8*)malloc(cap * t.tile_bytes);
+    out->map_size = 12 + 2 * total;
+    out->map = (u8*)malloc(out->map_size);
+    if (!t.slots || !scratch || !uniq || !out->map) goto done;
+
+    p = out->map + 12;
+    for (ty = 0; ty < out->map_h; ty++) {
+        for (tx = 0; tx < out->map_w; tx++) {
+            const u8 *at = src->image + (size_t)ty * tile_h * src_row + (size_t)tx * row;
+            u32 flags;
+            u64 h;
+            for (y = 0; y < tile_h; y++) memcpy(scratch + (size_t)y * row, at + (size_t)y * src_row, row);
+            t.uniq = uniq;
+            k = match(&t, scratch, tile_w, tile_h, ps, flips, &flags, &h);
+            if (k == NO_TILE) {
+                if (count == limit) {
+                    out->tiles = limit + 1;
+                    goto done;
+                }
+                if (count == cap) {
+                    u8 *nu = (u8*)realloc(uniq, (size_t)cap * 2 * t.tile_bytes);
+                    if (!nu) goto done;
+                    uniq = nu;
+                    cap *= 2;
+                    t.uniq = uniq;
+                }
+                memcpy(uniq + (size_t)count * t.tile_bytes, scratch, t.tile_bytes);
+                insert(&t, h, count);
+                k = count++;
+            }
+            p = put_be16(p, k | flags);
+        }
+    }
+
+    /* El tileset: los unicos en filas de hasta DAT_TILES_COLUMNS */
+    cols = count < DAT_TILES_COLUMNS ? (count ? count : 1) : DAT_TILES_COLUMNS;
+    rows = count ? (count + cols - 1) / cols : 1;
+    b = (DatBitmap*)calloc(1, sizeof(DatBitmap));
+    if (!b) goto done;
+    b->bits_per_pixel = src->bits_per_pixel;
+    b->width = (u16)(cols * tile_w);
+    b->height = (u16)(rows * tile_h);
+    b->image = (u8*)malloc((size_t)b->width * b->height * ps);
+    out->tileset = b;
+    if (!b->image) goto done;
+    if (count % cols || !count) dat_fill_mask(b->image, (size_t)b->width * b->height, b->bits_per_pixel);
+    for (k = 0; k < count; k++) {
+        u8 *dst = b->image + ((size_t)(k / cols) * tile_h * b->width + (size_t)(k % cols) * tile_w) * ps;
+        for (y = 0; y < tile_h; y++)
+            memcpy(dst + (size_t)y * b->width * ps, uniq + (size_t)k * t.tile_bytes + (size_t)y * row, row);
+    }
+
+    p = put_be16(out->map, tile_w);
+    p = put_be16(p, tile_h);
+    p = put_be16(p, out->map_w);
+    p = put_be16(p, out->map_h);
+    p = put_be16(p, count);
+    put_be16(p, cols);
+    out->tiles = count;
+    ok = 1;
+
+done:
+    free(t.slots);
+    free(scratch);
+    free(uniq);
+    if (!ok) {
+        u32 tiles = out->tiles;
+        dat_tileset_free(out);
+        out->tiles = tiles;
+    }
+    return ok;
+}
+
+void dat_tileset_free(DatTileset *t) {
+    if (t->tileset) free_dat_bitmap(t->tileset);
+    free(t->map);
+    memset(t, 0, sizeof(*t));
+}
@@ -0,0 +1,59 @@
+/* src/dat_tiles.h
+ *
+ * Tilesets (--tiles WxH file.bmp): a tilemap bitmap cut into WxH tiles,
+ * each distinct tile kept once. Tiles are matched by their XXH64 and then
+ * compared byte for byte; with flips, a tile that is another one mirrored
+ * horizontally, vertically or both also reuses it.
+ *
+ * The unique tiles go into one bitmap of the source depth, in order of
+ * first appearance, DAT_TILES_COLUMNS per row (fewer if there are not that
+ * many): tile k is at column k % columns, row k / columns. Unused slots of
+ * the last row are the mask colour. The map is a DATA body, big-endian
+ * like the rest of the datafile:
+ *
+ *   be16 tile_w, be16 tile_h, be16 map_w, be16 map_h (in tiles),
+ *   be16 unique tiles, be16 tileset columns
+ *   map_w * map_h be16 entries, row by row:
+ *     bits 0-13 tile index, bit 14 horizontal flip, bit 15 vertical flip
+ *
+ * The tileset is the BMP object NAME_TILES, where NAME is the map's; it
+ * is reserved with the other names of the DAT.
+ */
+#ifndef DAT_TILES_H
+#define DAT_TILES_H
+
+#include "allegro_dat_structs.h"
+
+#define DAT_TILES_COLUMNS 16
+#define DAT_TILES_MAX     16384  /* 14-bit index in the map */
+#define DAT_TILE_FLIP_H   0x4000
+#define DAT_TILE_FLIP_V   0x8000
+
+typedef struct {
+    DatBitmap *tileset;
+    u8        *map;      /* DATA body, map_size bytes */
+    u32        map_size;
+    u32        tiles;    /* unique tiles; > dat_tiles_limit() if there were too many */
+    u32        map_w, map_h;
+} DatTileset;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Most distinct tiles of tile_h rows: what the map index and the height
+   of the tileset (16 bits) can hold. */
+u32  dat_tiles_limit(u16 tile_h);
+
+/* Cuts src (whose width and height must be multiples of tile_w and
+   tile_h) into tiles and keeps the distinct ones. Returns 1 on success;
+   0 when out of memory or, with out->tiles > dat_tiles_limit(tile_h),
+   when there are too many distinct tiles. Free with dat_tileset_free. */
+int  dat_tiles_build(const DatBitmap *src, u16 tile_w, u16 tile_h, int flips, DatTileset *out);
+void dat_tileset_free(DatTileset *t);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DAT_TILES_H */
@@ -0,0 +1,305 @@
+/* src/dat_update.c */
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "dat_update.h"
+#include "dat_hash.h"
+#include "dat_pool.h"
+#include "dat_reader.h"
+#include "dat_stats.h"
+
+typedef struct {
+    const char     *orig;   /* ORIG value inside the mapping (not terminated) */
+    u32             orig_len;
+    const char     *hash;   /* HASH value, NULL if absent */
+    u32             hash_len;
+    const DatEntry *e;
+} PrevEntry;
+
+struct DatPrevious {
+    DatFile   *df;
+    time_t     mtime;
+    PrevEntry *entries;     /* objetos con ORIG, tambien los de dentro de un FILE */
+    u32        num_entries;
+    u32        cap_entries;
+    u32       *by_orig;     /* entry indices sorted by ORIG */
+    DatEntry **groups;      /* indices de los FILE, [num_groups] */
+    u32        num_groups;
+};
+
+static u32 be32(const u8 *p) {
+    return ((u32)p[0] << 24) | ((u32)p[1] << 16) | ((u32)p[2] << 8) | (u32)p[3];
+}
+
+/* ------------------------------------------------------------------ */
+/* Indice del DAT anterior                                             */
+/* ------------------------------------------------------------------ */
+
+static int cmp_orig(const PrevEntry *a, const PrevEntry *b) {
+    u32 n = a->orig_len < b->orig_len ? a->orig_len : b->orig_len;
+    int c = memcmp(a->orig, b->orig, n);
+    if (c) return c;
+    return a->orig_len < b->orig_len ? -1 : (a->orig_len > b->orig_len);
+}
+
+static const PrevEntry *sort_base;
+
+static int cmp_idx(const void *x, const void *y) {
+    return cmp_orig(&sort_base[*(const u32*)x], &sort_base[*(const u32*)y]);
+}
+
+static int add_entry(DatPrevious *prev, const DatEntry *e) {
+    PrevEntry *pe;
+    if (prev->num_entries == prev->cap_entries) {
+        u32 ncap = prev->cap_entries ? prev->cap_entries * 2 : 64;
+        PrevEntry *ne = (PrevEntry*)realloc(prev->entries, sizeof(PrevEntry) * ncap);
+        if (!ne) return 0;
+        prev->entries = ne;
+        prev->cap_entries = ncap;
+    }
+    pe = &prev->entries[prev->num_entries];
+    pe->e = e;
+    pe->orig = dat_prop(e, "ORIG", &pe->orig_len);
+    pe->hash = dat_prop(e, "HASH", &pe->hash_len);
+    if (pe->orig) prev->num_entries++;
+    return 1;
+}
+
+/* Los assets de un sub-datafile tambien se reutilizan: apuntan al cuerpo
+   del FILE, mapeado o descomprimido hasta dat_close */
+static int add_group(DatPrevious *prev, const u8 *body, u32 size, int depth) {
+    DatEntry *sub, **ng;
+    u32 count, i;
+
+    /* Un cuerpo que no es una lista de objetos no se reutiliza */
+    if (!body || depth > 32 || !(sub = dat_parse_objects(body, size, &count))) return 1;
+    ng = (DatEntry**)realloc(prev->groups, sizeof(DatEntry*) * (prev->num_groups + 1));
+    if (!ng) { free(sub); return 0; }
+    prev->groups = ng;
+    prev->groups[prev->num_groups++] = sub;
+    for (i = 0; i < count; i++) {
+        if (!add_entry(prev, &sub[i])) return 0;
+        /* Dentro de un FILE solo se entra en otro si no esta comprimido */
+        if (memcmp(sub[i].type, "FILE", 4) == 0 && sub[i].len_uncompressed >= 0 &&
+            !add_group(prev, sub[i].stored, (u32)sub[i].len_compressed, depth + 1))
+            return 0;
+    }
+    return 1;
+}
+
+DatPrevious *dat_previous_open(const char *path) {
+    DatPrevious *prev;
+    struct stat st;
+    u32 count, i, k;
+
+    if (stat(path, &st) != 0) return NULL;
+    prev = (DatPrevious*)calloc(1, sizeof(DatPrevious));
+    if (!prev) return NULL;
+    prev->mtime = st.st_mtime;
+    /* Mapeado: los cuerpos reutilizados se escriben desde el fichero viejo */
+    prev->df = dat_open(path);
+    if (!prev->df) { dat_previous_close(prev); return NULL; }
+    count = dat_num_objects(prev->df);
+
+    for (i = 0; i < count; i++) {
+        const DatEntry *e = dat_entry(prev->df, i);
+        const u8 *body;
+        u32 size = 0;
+        if (!add_entry(prev, e)) { dat_previous_close(prev); return NULL; }
+        if (memcmp(e->type, "FILE", 4) != 0) continue;
+        body = dat_object_body(prev->df, e, &size);
+        if (!add_group(prev, body, size, 1)) { dat_previous_close(prev); return NULL; }
+    }
+
+    prev->by_orig = (u32*)malloc(sizeof(u32) * (prev->num_entries ? prev->num_entries : 1));
+    if (!prev->by_orig) { dat_previous_close(prev); return NULL; }
+    for (k = 0; k < prev->num_entries; k++) prev->by_orig[k] = k;
+    sort_base = prev->entries;
+    qsort(prev->by_orig, prev->num_entries, sizeof(u32), cmp_idx);
+    return prev;
+}
+
+void dat_previous_close(DatPrevious *prev) {
+    u32 g;
+    if (!prev) return;
+    dat_close(prev->df);
+    for (g = 0; g < prev->num_groups; g++) free(prev->groups[g]);
+    free(prev->groups);
+    free(prev->entries);
+    free(prev->by_orig);
+    free(prev);
+}
+
+/* Varias entradas pueden compartir ORIG (un BMP y su paleta de
+   --quantize, o el mismo fichero con dos conversores): vale la que
+   registro este conversor, con estas opciones, en su HASH. Sin HASH no
+   se sabe con que opciones se convirtio: no vale ninguna */
+static const PrevEntry *find_orig(const DatPrevious *prev, const AssetJob *job, const char *tag) {
+    PrevEntry key;
+    u32 lo = 0, hi = prev->num_entries;
+    size_t tlen = strlen(tag);
+    key.orig = job->path;
+    key.orig_len = (u32)strlen(job->path);
+    while (lo < hi) {
+        u32 mid = (lo + hi) / 2;
+        if (cmp_orig(&prev->entries[prev->by_orig[mid]], &key) < 0) lo = mid + 1; else hi = mid;
+    }
+    for (; lo < prev->num_entries; lo++) {
+        const PrevEntry *e = &prev->entries[prev->by_orig[lo]];
+        if (cmp_orig(e, &key) != 0) break;
+        if (e->hash && e->hash_len > tlen && memcmp(e->hash, tag, tlen) == 0 && e->hash[tlen] == ':') return e;
+    }
+    return NULL;
+}
+
+/* ------------------------------------------------------------------ */
+/* Reutilizar o convertir                                              */
+/* ------------------------------------------------------------------ */
+
+static void format_hash(char *dst, size_t cap, const char *tag, u64 size, u64 hash) {
+    snprintf(dst, cap, "%s:%llu:%016llx", tag, (unsigned long long)size, (unsigned long long)hash);
+}
+
+/* Size recorded in a HASH value (copied to 'copy'), or ~0 if it was
+   recorded for another converter or options, or is not parseable */
+static u64 recorded_size(const PrevEntry *e, const char *opt, char *copy, size_t cap) {
+    size_t olen = strlen(opt);
+    u32 n = e->hash_len < cap - 1 ? e->hash_len : (u32)(cap - 1);
+    memcpy(copy, e->hash, n);
+    copy[n] = '\0';
+    if (strncmp(copy, opt, olen) != 0 || copy[olen] != ':') return ~(u64)0;
+    return strtoull(copy + olen + 1, NULL, 10);
+}
+
+static void append_prop(DatObject *o, const char type4[4], const char *value) {
+    Property *np = (Property*)realloc(o->properties, sizeof(Property) * (size_t)(o->num_properties + 1));
+    if (!np) return;
+    o->properties = np;
+    dat_set_prop(&o->properties[o->num_properties++], type4, value);
+}
+
+/* Objeto reutilizado: propiedades copiadas, cuerpo apuntando al fichero viejo */
+static void reuse_entry(const PrevEntry *pe, DatObject *o) {
+    const DatEntry *e = pe->e;
+    u32 pos = 0;
+    int n = 0;
+    memset(o, 0, sizeof(*o));
+    while (pos + 12 <= e->props_len) {
+        n++;
+        pos += 12 + be32(e->props + pos + 8);
+    }
+    o->properties = (Property*)calloc(n ? (size_t)n : 1, sizeof(Property));
+    pos = 0;
+    for (o->num_properties = 0; o->num_properties < n; o->num_properties++) {
+        Property *p = &o->properties[o->num_properties];
+        u32 plen = be32(e->props + pos + 8);
+        memcpy(p->magic, "prop", 4);
+        memcpy(p->type, e->props + pos + 4, 4);
+        p->len_body = plen;
+        p->body = (char*)malloc(plen ? plen : 1);
+        if (p->body) memcpy(p->body, e->props + pos + 12, plen);
+        pos += 12 + plen;
+    }
+    memcpy(o->type, e->type, 4);
+    o->len_compressed = e->len_compressed;
+    o->len_uncompressed = e->len_uncompressed;
+    o->stored = (u8*)e->stored;
+    o->stored_is_view = 1;
+}
+
+static void replace_prop(DatObject *o, const char type4[4], const char *value) {
+    int k;
+    for (k = 0; k < o->num_properties; k++) {
+        if (memcmp(o->properties[k].type, type4, 4) == 0) {
+            free(o->properties[k].body);
+            dat_set_prop(&o->properties[k], type4, value);
+        }
+    }
+}
+
+typedef struct {
+    DatPrevious             *prev;
+    AssetJob                *jobs;
+    const DatConvertOptions *opt;
+    u8                      *reused;    /* [n] */
+    int                      pass;      /* dat_convert_pass */
+} UpdateRun;
+
+static int hash_job(AssetJob *job) {
+    if (!job->hashed) {
+        u64 t0 = dat_stats_begin();
+        job->hashed = dat_hash_file(job->path, &job->src_hash, &job->src_size);
+        dat_stats_end(DAT_STAGE_HASH, t0, job->path, job->hashed ? job->src_size : 0, 0);
+    }
+    return job->hashed;
+}
+
+static void update_task(void *ctx, size_t i) {
+    UpdateRun *run = (UpdateRun*)ctx;
+    AssetJob *job = &run->jobs[i];
+    const PrevEntry *e;
+    char want[128], have[128], tag[64];
+    struct stat st;
+    u64 t_obj;
+
+    /* Los grupos los construye dat_build_groups con lo que hay dentro */
+    if (dat_is_container(job->kind) || dat_convert_pass(job) != run->pass) return;
+    dat_take_quant_pal(run->jobs, i);
+    t_obj = dat_stats_begin();
+    dat_convert_tag(job, run->opt, tag, sizeof(tag));
+    e = run->prev ? find_orig(run->prev, job, tag) : NULL;
+
+    if (e && stat(job->path, &st) == 0) {
+        int older = st.st_mtime < run->prev->mtime; /* mismo segundo: no fiarse */
+        u64 rec = recorded_size(e, tag, have, sizeof(have));
+        if (rec == (u64)st.st_size && older) {
+            reuse_entry(e, &job->obj);
+        } else if (rec == (u64)st.st_size && hash_job(job)) {
+            format_hash(want, sizeof(want), tag, job->src_size, job->src_hash);
+            if (strcmp(want, have) == 0) reuse_entry(e, &job->obj);
+            else e = NULL;
+        } else {
+            e = NULL;
+        }
+        if (e) {
+            /* El nombre puede cambiar (colisiones, name=); en modo
+               reproducible la fecha vieja no debe colarse en la salida */
+            if (job->name[0]) replace_prop(&job->obj, "NAME", job->name);
+            if (run->opt->reproducible) replace_prop(&job->obj, "DATE", run->opt->datestr);
+            job->ok = 1;
+            job->error[0] = '\0';
+            free(job->quant_pal);
+            job->quant_pal = NULL;
+            run->reused[i] = 1;
+            dat_stats_end(DAT_STAGE_OBJECT, t_obj, job->path, 0, (u64)job->obj.len_compressed);
+            return;
+        }
+    }
+
+    if (!dat_convert_asset(job, run->opt)) return;
+    if (!hash_job(job)) return;
+    format_hash(want, sizeof(want), tag, job->src_size, job->src_hash);
+    append_prop(&job->obj, "HASH", want);
+}
+
+size_t dat_update_assets(DatPrevious *prev, AssetJob *jobs, size_t n,
+                         const DatConvertOptions *opt, int threads) {
+    UpdateRun run;
+    size_t i, reused = 0;
+    run.prev = prev;
+    run.jobs = jobs;
+    run.opt = opt;
+    run.reused = (u8*)calloc(n ? n : 1, 1);
+    if (!run.reused) return 0;
+    for (run.pass = 0; run.pass < 2; run.pass++) {
+        for (i = 0; i < n && dat_convert_pass(&jobs[i]) != run.pass; i++) {}
+        if (i < n) dat_parallel_for(threads, n, update_task, &run);
+    }
+    for (i = 0; i < n; i++) reused += run.reused[i];
+    free(run.reused);
+    return reused;
+}
@@ -0,0 +1,44 @@
+/* src/dat_update.h
+ *
+ * Incremental rebuilds: objects of an existing DAT (also those inside its
+ * sub-datafiles) are matched to the new inputs by their ORIG property and
+ * reused byte for byte when the source did not change, so only modified
+ * inputs go through the converters.
+ *
+ * Change detection, cheapest first:
+ *   1. same size as recorded and not modified after the old DAT was written
+ *   2. otherwise the XXH64 of the file is compared with the recorded one
+ * The record is a "HASH" property ("<option>:<size>:<xxh64>") added to
+ * every object 'dat update' writes; Allegro ignores unknown properties.
+ * Objects without it (e.g. from 'dat create') are converted again: nothing
+ * says which options (--depth, --quantize, ...) they were made with.
+ */
+#ifndef DAT_UPDATE_H
+#define DAT_UPDATE_H
+
+#include "allegro_dat_structs.h"
+#include "dat_build.h"
+
+typedef struct DatPrevious DatPrevious;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Maps and indexes an existing DAT (plain or packed). NULL if it cannot be
+   read; the caller then falls back to a full build. */
+DatPrevious *dat_previous_open(const char *path);
+
+/* Reused objects point into the mapped file: close only after writing. */
+void dat_previous_close(DatPrevious *prev);
+
+/* Fills every job, reusing unchanged objects from prev (may be NULL) and
+   converting the rest on 'threads' workers. Returns how many were reused. */
+size_t dat_update_assets(DatPrevious *prev, AssetJob *jobs, size_t n,
+                         const DatConvertOptions *opt, int threads);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DAT_UPDATE_H */
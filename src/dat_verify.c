@@ -0,0 +1,351 @@
+/* src/dat_verify.c */
+#define _POSIX_C_SOURCE 200809L
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "dat_verify.h"
+#include "dat_crc32c.h"
+#include "dat_pool.h"
+#include "dat_reader.h"
+#include "dat_stats.h"
+#include "dat_writer.h"
+#include "lzss.h"
+
+#define PATH_CAP   512
+#define MAX_DEPTH  32
+
+/* Mensajes de un objeto de arriba, que se imprimen en orden al final */
+typedef struct {
+    char *buf;
+    size_t len, cap;
+    u32 errors;
+    u32 objects, checksummed;
+    int oom;
+} Report;
+
+typedef struct {
+    const DatEntry *e;
+    u32             index;
+    Report          r;
+} VerifyTask;
+
+static u16 rd_be16(const u8 *p) { return (u16)((p[0] << 8) | p[1]); }
+static u32 rd_be32(const u8 *p) {
+    return ((u32)p[0] << 24) | ((u32)p[1] << 16) | ((u32)p[2] << 8) | (u32)p[3];
+}
+
+static void report(Report *r, const char *who, const char *fmt, ...) {
+    char msg[512];
+    va_list ap;
+    int n;
+
+    r->errors++;
+    va_start(ap, fmt);
+    vsnprintf(msg, sizeof(msg), fmt, ap);
+    va_end(ap);
+    n = snprintf(NULL, 0, "Error: %s: %s\n", who, msg);
+    if (r->len + (size_t)n + 1 > r->cap) {
+        size_t cap = r->cap ? r->cap * 2 : 1024;
+        char *nb;
+        while (cap < r->len + (size_t)n + 1) cap *= 2;
+        nb = (char*)realloc(r->buf, cap);
+        if (!nb) { r->oom = 1; return; }
+        r->buf = nb;
+        r->cap = cap;
+    }
+    snprintf(r->buf + r->len, (size_t)n + 1, "Error: %s: %s\n", who, msg);
+    r->len += (size_t)n;
+}
+
+/* Tipo sin los espacios de relleno: "BMP " -> "BMP" */
+static void type_str(const char type[4], char out[5]) {
+    int n = 4;
+    memcpy(out, type, 4);
+    while (n > 0 && out[n - 1] == ' ') n--;
+    out[n] = '\0';
+}
+
+/* Lista de objetos (num_objects y los objetos): el fichero tras 'ALL.' o
+   el cuerpo de un FILE. A diferencia de dat_parse_objects, dice donde
+   falla y devuelve los objetos que si se pudieron recorrer */
+static DatEntry *walk_list(const u8 *d, u64 size, const char *who, Report *r, u32 *num) {
+    DatEntry *entries;
+    u64 pos = 4, fit;
+    u32 count, i;
+    char t[5];
+
+    *num = 0;
+    if (size < 4) {
+        report(r, who, "no room for num_objects");
+        return NULL;
+    }
+    count = rd_be32(d);
+    /* Cada objeto ocupa al menos 12 bytes: no fiarse de un count enorme */
+    fit = (size - 4) / 12;
+    if (fit > count) fit = count;
+    entries = (DatEntry*)calloc(fit ? (size_t)fit : 1, sizeof(DatEntry));
+    if (!entries) {
+        r->oom = 1;
+        return NULL;
+    }
+
+    for (i = 0; i < count; i++) {
+        DatEntry *e = &entries[i];
+        u64 props = pos;
+        while (pos + 12 <= size && memcmp(d + pos, "prop", 4) == 0) {
+            u32 plen = rd_be32(d + pos + 8);
+            if (12 + (u64)plen > size - pos) {
+                report(r, who, "object %u of %u: property '%.4s' of %u bytes runs past the end", i + 1, count,
+                       (const char*)d + pos + 4, plen);
+                goto done;
+            }
+            pos += 12 + plen;
+        }
+        if (pos == size && props == pos) {
+            report(r, who, "num_objects is %u but there are only %u objects", count, i);
+            goto done;
+        }
+        if (pos + 12 > size) {
+            report(r, who, "object %u of %u: header runs past the end", i + 1, count);
+            goto done;
+        }
+        memcpy(e->type, d + pos, 4);
+        e->len_compressed = (s32)rd_be32(d + pos + 4);
+        e->len_uncompressed = (s32)rd_be32(d + pos + 8);
+        e->props = d + props;
+        e->props_len = (u32)(pos - props);
+        pos += 12;
+        type_str(e->type, t);
+        if (e->len_compressed < 0 || (u64)e->len_compressed > size - pos) {
+            report(r, who, "object %u of %u (%s): body of %d bytes runs past the end (%llu left)", i + 1, count,
+                   t, e->len_compressed, (unsigned long long)(size - pos));
+            goto done;
+        }
+        if (e->len_uncompressed >= 0 && e->len_uncompressed != e->len_compressed)
+            report(r, who, "object %u of %u (%s): len_uncompressed is %d but the %d bytes are not packed", i + 1,
+                   count, t, e->len_uncompressed, e->len_compressed);
+        e->stored = d + pos;
+        pos += (u64)e->len_compressed;
+        (*num)++;
+    }
+    if (pos < size)
+        report(r, who, "%llu bytes after the last of %u objects", (unsigned long long)(size - pos), count);
+done:
+    return entries;
+}
+
+/* Tamanos que dan las cabeceras de cada tipo */
+static void check_body(Report *r, const char *who, const DatEntry *e, const u8 *b, u32 size) {
+    if (!memcmp(e->type, "BMP ", 4) || !memcmp(e->type, "RLE ", 4)) {
+        int rle = e->type[0] == 'R';
+        s16 bpp;
+        u64 need;
+        if (size < (rle ? 10u : 6u)) {
+            report(r, who, "%u bytes is too short for a %s header", size, rle ? "sprite" : "bitmap");
+            return;
+        }
+        bpp = (s16)rd_be16(b);
+        if (bpp != 8 && bpp != 15 && bpp != 16 && bpp != 24 && bpp != 32 && !(bpp == -32 && !rle)) {
+            report(r, who, "unknown depth %d", bpp);
+            return;
+        }
+        need = rle ? 10 + (u64)rd_be32(b + 6)
+                   : 6 + (u64)rd_be16(b + 2) * rd_be16(b + 4) * dat_bitmap_pixel_size(bpp);
+        if (need != size)
+            report(r, who, "body is %u bytes, %ux%u at %d bpp needs %llu", size, rd_be16(b + 2), rd_be16(b + 4), bpp,
+                   (unsigned long long)need);
+    } else if (!memcmp(e->type, "PAL ", 4)) {
+        if (size != 1024) report(r, who, "palette is %u bytes instead of 1024", size);
+    } else if (!memcmp(e->type, "SAMP", 4)) {
+        s16 bits;
+        u32 depth;
+        u64 need;
+        if (size < 8) {
+            report(r, who, "%u bytes is too short for a sample header", size);
+            return;
+        }
+        bits = (s16)rd_be16(b);
+        depth = (u32)(bits < 0 ? -bits : bits);
+        if (depth != 8 && depth != 16) {
+            report(r, who, "unknown sample depth %d", bits);
+            return;
+        }
+        need = 8 + (u64)rd_be32(b + 4) * (bits < 0 ? 2 : 1) * (depth / 8);
+        if (need != size)
+            report(r, who, "body is %u bytes, %u frames need %llu", size, rd_be32(b + 4), (unsigned long long)need);
+    } else if (!memcmp(e->type, "MIDI", 4)) {
+        u64 pos = 2;
+        u32 t;
+        for (t = 0; t < 32; t++) {
+            if (pos + 4 > size || rd_be32(b + pos) > size - pos - 4) {
+                report(r, who, "track %u runs past the end of the body", t);
+                return;
+            }
+            pos += 4 + (u64)rd_be32(b + pos);
+        }
+        if (pos != size) report(r, who, "%llu bytes after the 32 tracks", (unsigned long long)(size - pos));
+    }
+}
+
+static void check_object(Report *r, const DatEntry *e, const char *parent, u32 index, int depth) {
+    char path[PATH_CAP], who[PATH_CAP + 16], t[5];
+    const char *v;
+    const u8 *body;
+    u8 *owned = NULL;
+    u32 len = 0, size;
+
+    r->objects++;
+    type_str(e->type, t);
+    v = dat_prop(e, "NAME", &len);
+    if (v && len) snprintf(path, sizeof(path), "%s%s%.*s", parent, *parent ? "/" : "", (int)len, v);
+    else snprintf(path, sizeof(path), "%s%s#%u", parent, *parent ? "/" : "", index + 1);
+    snprintf(who, sizeof(who), "'%s' (%s)", path, t);
+
+    v = dat_prop(e, DAT_CRC_PROP, &len);
+    if (v) {
+        char hex[9];
+        u32 want, got;
+        r->checksummed++;
+        memcpy(hex, v, len == 8 ? 8 : 0);
+        hex[len == 8 ? 8 : 0] = '\0';
+        want = (u32)strtoul(hex, NULL, 16);
+        if (len != 8 || strspn(hex, "0123456789ABCDEFabcdef") != 8) {
+            report(r, who, "malformed CRC property");
+        } else {
+            got = dat_crc32c(0, e->stored, (size_t)e->len_compressed);
+            if (got != want) report(r, who, "CRC32C of the body is %08X, the CRC property says %s", got, hex);
+        }
+    }
+
+    if (e->len_uncompressed < 0) {
+        size = (u32)-e->len_uncompressed;
+        owned = (u8*)malloc(size ? size : 1);
+        if (!owned) {
+            r->oom = 1;
+            return;
+        }
+        if (!lzss_unpack_buffer(e->stored, (size_t)e->len_compressed, owned, size)) {
+            report(r, who, "packed body does not unpack to its %u bytes", size);
+            free(owned);
+            return;
+        }
+        body = owned;
+    } else {
+        size = (u32)e->len_compressed;
+        body = e->stored;
+    }
+
+    if (!memcmp(e->type, "FILE", 4)) {
+        DatEntry *sub;
+        u32 n, i;
+        if (depth >= MAX_DEPTH) {
+            report(r, who, "sub-datafiles nested too deep");
+        } else if ((sub = walk_list(body, size, who, r, &n)) != NULL) {
+            for (i = 0; i < n; i++) check_object(r, &sub[i], path, i, depth + 1);
+            free(sub);
+        }
+    } else {
+        check_body(r, who, e, body, size);
+    }
+    free(owned);
+}
+
+static void verify_task(void *ctx, size_t index) {
+    VerifyTask *t = &((VerifyTask*)ctx)[index];
+    u64 t0 = dat_stats_begin();
+    check_object(&t->r, t->e, "", t->index, 0);
+    dat_stats_end(DAT_STAGE_VERIFY, t0, NULL, (u64)(u32)t->e->len_compressed, 0);
+}
+
+int dat_verify(const char *path, int jobs, DatVerifyStats *st) {
+    Report top;
+    VerifyTask *tasks = NULL;
+    DatEntry *entries = NULL;
+    struct stat sb;
+    void *map = MAP_FAILED;
+    u8 *heap = NULL;
+    const u8 *data = NULL;
+    u64 size = 0, start = dat_stats_now(), t0 = dat_stats_begin();
+    u32 magic, n = 0, i;
+    int fd, oom = 0;
+    char who[PATH_CAP];
+
+    memset(st, 0, sizeof(*st));
+    memset(&top, 0, sizeof(top));
+    snprintf(who, sizeof(who), "'%s'", path);
+    fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &sb) != 0) {
+        fprintf(stderr, "Error: cannot open '%s'\n", path);
+        if (fd >= 0) close(fd);
+        return 0;
+    }
+    st->bytes = (u64)sb.st_size;
+    if (sb.st_size >= 8) map = mmap(NULL, (size_t)sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Error: '%s' is too short or cannot be mapped\n", path);
+        return 0;
+    }
+    /* Todo el fichero se va a leer, en orden aproximado */
+    posix_madvise(map, (size_t)sb.st_size, POSIX_MADV_SEQUENTIAL);
+
+    magic = rd_be32((const u8*)map);
+    if (magic == DAT_F_NOPACK_MAGIC) {
+        data = (const u8*)map + 4;
+        size = (u64)sb.st_size - 4;
+    } else if (magic == DAT_F_PACK_MAGIC) {
+        heap = lzss_unpack_alloc((const u8*)map + 4, (size_t)sb.st_size - 4, &size);
+        if (!heap) oom = 1;
+        data = heap;
+    } else {
+        report(&top, who, "not an Allegro DAT (no \"slh.\" or \"slh!\" magic)");
+    }
+    if (data && (size < 4 || rd_be32(data) != DAT_MAGIC)) {
+        report(&top, who, magic == DAT_F_PACK_MAGIC ? "the packed stream does not start with 'ALL.'"
+                                                       : "no 'ALL.' after the pack magic");
+        data = NULL;
+    }
+    if (data) entries = walk_list(data + 4, size - 4, who, &top, &n);
+    oom |= top.oom;
+    tasks = (VerifyTask*)calloc(n ? n : 1, sizeof(VerifyTask));
+    if (!tasks) oom = 1;
+    dat_stats_end(DAT_STAGE_SETUP, t0, NULL, 0, 0);
+
+    if (!oom) {
+        for (i = 0; i < n; i++) {
+            tasks[i].e = &entries[i];
+            tasks[i].index = i;
+        }
+        dat_parallel_for(jobs, n, verify_task, tasks);
+    }
+
+    /* Los errores de estructura de arriba van antes que los de cada objeto */
+    if (top.len) fputs(top.buf, stderr);
+    st->errors = top.errors;
+    for (i = 0; tasks && i < n; i++) {
+        Report *r = &tasks[i].r;
+        if (r->len) fputs(r->buf, stderr);
+        st->errors += r->errors;
+        st->objects += r->objects;
+        st->checksummed += r->checksummed;
+        oom |= r->oom;
+        free(r->buf);
+    }
+    if (oom) {
+        fprintf(stderr, "Error: out of memory\n");
+        st->errors++;
+    }
+    free(top.buf);
+    free(tasks);
+    free(entries);
+    free(heap);
+    munmap(map, (size_t)sb.st_size);
+    st->seconds = (double)(dat_stats_now() - start) * 1e-9;
+    return st->errors == 0;
+}
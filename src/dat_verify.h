@@ -0,0 +1,44 @@
+/* src/dat_verify.h
+ *
+ * dat verify: checks that a DAT is whole without converting anything.
+ *
+ *   structure  pack magic and 'ALL.', num_objects against the objects that
+ *              are really there (and no bytes after them), every property
+ *              chain and body inside the file, len_uncompressed equal to
+ *              len_compressed for bodies that are not packed
+ *   bodies     LZSS bodies unpack to exactly their size; BMP, RLE, PAL,
+ *              SAMP and MIDI bodies have the size their headers give;
+ *              FILE bodies are checked the same way, object by object
+ *   CRC        objects with a "CRC " property (dat create --checksum) are
+ *              compared against the CRC32C of their body as stored
+ *
+ * The header walk runs on the calling thread; every top-level object is
+ * then checked on a pool of threads, with the SSE4.2 crc32 instruction
+ * when the CPU has it. A "slh!" file is unpacked in memory first.
+ */
+#ifndef DAT_VERIFY_H
+#define DAT_VERIFY_H
+
+#include "allegro_dat_structs.h"
+
+typedef struct {
+    u32    objects;      /* objects checked, those in sub-datafiles included */
+    u32    checksummed;  /* objects with a "CRC " property */
+    u32    errors;
+    u64    bytes;        /* size of the file */
+    double seconds;
+} DatVerifyStats;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Prints every problem found on stderr. Returns 1 if there was none;
+   0 with st->errors == 0 if the file could not be read at all. */
+int dat_verify(const char *path, int jobs, DatVerifyStats *st);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DAT_VERIFY_H */
@@ -1,85 +1,479 @@
 /* src/dat_writer.c (v3.3) */
+#define _GNU_SOURCE
 #include "dat_writer.h"
+#include "dat_crc32c.h"
+#include "dat_pool.h"
+#include "lzss.h"
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 
-static void write_bmp(FILE* f, const DatBitmap* b) {
+/* Destino de escritura: memoria, compresor LZSS, fichero, CRC o solo contar */
+typedef struct {
+    LzssPacker* pk;
+    u64         raw;    /* bytes logicos escritos (antes de comprimir) */
+    int         ok;
+    u8*         mem;    /* si no es NULL, se escribe aqui */
+    FILE*       file;   /* escritura en flujo (DatWriter) */
+    u32*        crc;    /* --checksum: CRC32C de lo escrito, sin guardarlo */
+} DatOut;
+
+static void out_bytes(DatOut* o, const void* p, size_t n) {
+    o->raw += n;
+    if (o->crc) {
+        *o->crc = dat_crc32c(*o->crc, p, n);
+    } else if (o->mem) {
+        memcpy(o->mem, p, n);
+        o->mem += n;
+    } else if (o->pk) {
+        if (!lzss_packer_write(o->pk, p, n)) o->ok = 0;
+    } else if (o->file) {
+        if (n && fwrite(p, 1, n, o->file) != n) o->ok = 0;
+    }
+}
+
+static int file_sink(void* ctx, const u8* data, size_t n) {
+    return fwrite(data, 1, n, (FILE*)ctx) == n;
+}
+
+static void write_bmp(DatOut* f, const DatBitmap* b) {
     s16 bebpp = to_be16((u16)b->bits_per_pixel);
     u16 bew = to_be16(b->width), beh = to_be16(b->height);
-    fwrite(&bebpp, 2, 1, f);
-    fwrite(&bew, 2, 1, f);
-    fwrite(&beh, 2, 1, f);
-    fwrite(b->image, 1, (size_t)b->width * b->height * ((size_t)b->bits_per_pixel / 8), f);
+    out_bytes(f, &bebpp, 2);
+    out_bytes(f, &bew, 2);
+    out_bytes(f, &beh, 2);
+    out_bytes(f, b->image, (size_t)b->width * b->height * dat_bitmap_pixel_size(b->bits_per_pixel));
 }
 
-static void write_pal(FILE* f, const u8* pal) {
+static void write_pal(DatOut* f, const u8* pal) {
     /* Spec: 256 x { R, G, B, pad } = 256*4 bytes */
+    u8 quads[256 * 4];
     int i;
     for (i = 0; i < 256; i++) {
-        fwrite(pal + i * 3, 1, 3, f);
-        fputc(0, f); /* pad byte */
+        quads[i * 4 + 0] = pal[i * 3 + 0];
+        quads[i * 4 + 1] = pal[i * 3 + 1];
+        quads[i * 4 + 2] = pal[i * 3 + 2];
+        quads[i * 4 + 3] = 0; /* pad byte */
     }
+    out_bytes(f, quads, sizeof(quads));
 }
 
-static void write_rle(FILE* f, const DatRleSprite* r) {
+static void write_rle(DatOut* f, const DatRleSprite* r) {
     s16 bebpp = to_be16((u16)r->bits_per_pixel);
     u16 bew = to_be16(r->width), beh = to_be16(r->height);
     u32 belen = to_be32(r->len_image);
-    fwrite(&bebpp, 2, 1, f);
-    fwrite(&bew, 2, 1, f);
-    fwrite(&beh, 2, 1, f);
-    fwrite(&belen, 4, 1, f);
-    fwrite(r->image, 1, r->len_image, f);
+    out_bytes(f, &bebpp, 2);
+    out_bytes(f, &bew, 2);
+    out_bytes(f, &beh, 2);
+    out_bytes(f, &belen, 4);
+    out_bytes(f, r->image, r->len_image);
 }
 
-static void write_font(FILE* f, const DatFont* font) {
+static void write_font(DatOut* f, const DatFont* font) {
     s16 fs = to_be16((u16)font->font_size);
-    fwrite(&fs, 2, 1, f);
+    out_bytes(f, &fs, 2);
     if (font->font_size == 8) {
-        for (int i = 0; i < 95; i++) fwrite(font->u.f8->chars[i], 1, 8, f);
+        for (int i = 0; i < 95; i++) out_bytes(f, font->u.f8->chars[i], 8);
     } else if (font->font_size == 16) {
-        for (int i = 0; i < 95; i++) fwrite(font->u.f16->chars[i], 1, 16, f);
+        for (int i = 0; i < 95; i++) out_bytes(f, font->u.f16->chars[i], 16);
     }
 }
 
-int dat_write(const char* filename, AllegroDat* dat) {
-    FILE* f = fopen(filename, "wb");
-    if (!f) return 0;
+/* Cuerpo segun tipo, sin comprimir */
+static void write_body(DatOut* out, const DatObject* o) {
+    if (!memcmp(o->type, "BMP ", 4)) write_bmp(out, o->body.bmp);
+    else if (!memcmp(o->type, "PAL ", 4)) write_pal(out, o->body.pal);
+    else if (!memcmp(o->type, "RLE ", 4)) write_rle(out, o->body.rle);
+    else if (!memcmp(o->type, "FONT", 4)) write_font(out, o->body.font);
+    else if (o->body.any && o->len_uncompressed > 0) {
+        /* MIDI, FLIC, DATA, info y cualquier tipo verbatim */
+        out_bytes(out, o->body.any, (size_t)o->len_uncompressed);
+    }
+}
+
+void dat_serialize_body(const DatObject* o, u8* dst) {
+    DatOut out = { NULL, 0, 1, dst, NULL, NULL };
+    write_body(&out, o);
+}
+
+/* ------------------------------------------------------------------ */
+/* Compresion individual por objeto                                    */
+/* ------------------------------------------------------------------ */
+
+typedef struct {
+    AllegroDat* dat;
+    int         level;
+    int         min_gain;
+} PackJob;
+
+static void pack_one(void* ctx, size_t i) {
+    PackJob* job = (PackJob*)ctx;
+    DatObject* o = &job->dat->objects[i];
+    size_t raw_sz = (size_t)o->len_uncompressed;
+    u8 *raw, *packed = NULL;
+    size_t packed_sz = 0;
+    int own_raw;
+
+    if (o->len_uncompressed <= 0) return;
+    own_raw = !o->stored;
+    if (o->stored) {
+        raw = o->stored; /* cuerpo ya serializado (p.ej. reutilizado de otro .dat) */
+    } else {
+        raw = (u8*)malloc(raw_sz);
+        if (!raw) return;
+        dat_serialize_body(o, raw);
+    }
+    if (lzss_pack_buffer(raw, raw_sz, job->level, &packed, &packed_sz)) {
+        /* Solo compensa si ahorra al menos min_gain % del tamano original */
+        if ((u64)packed_sz * 100 <= (u64)raw_sz * (u64)(100 - job->min_gain) && packed_sz < raw_sz) {
+            if (o->stored && !o->stored_is_view) free(o->stored);
+            o->stored = packed;
+            o->stored_is_view = 0;
+            o->len_compressed = (s32)packed_sz;
+            o->len_uncompressed = -(s32)raw_sz;
+            packed = NULL;
+        }
+        free(packed);
+    }
+    if (own_raw) free(raw);
+}
+
+void dat_pack_objects(AllegroDat* dat, int level, int min_gain_pct, int jobs) {
+    PackJob job;
+    job.dat = dat;
+    job.level = level;
+    job.min_gain = min_gain_pct < 0 ? 0 : (min_gain_pct > 99 ? 99 : min_gain_pct);
+    dat_parallel_for(jobs, dat->num_objects, pack_one, &job);
+}
+
+/* ------------------------------------------------------------------ */
+/* --checksum                                                          */
+/* ------------------------------------------------------------------ */
 
-    u32 pm = to_be32(dat->pack_magic);
-    u32 dm = to_be32(dat->dat_magic);
-    u32 no = to_be32(dat->num_objects);
-    fwrite(&pm, 4, 1, f); fwrite(&dm, 4, 1, f); fwrite(&no, 4, 1, f);
+/* Quita la propiedad type de o; devuelve su hueco (o NULL si no estaba) */
+static Property* take_prop(DatObject* o, const char type4[4]) {
+    for (int i = 0; i < o->num_properties; i++) {
+        if (memcmp(o->properties[i].type, type4, 4) != 0) continue;
+        free_property(&o->properties[i]);
+        return &o->properties[i];
+    }
+    return NULL;
+}
+
+static void checksum_one(void* ctx, size_t i) {
+    DatObject* o = &((AllegroDat*)ctx)->objects[i];
+    u32 crc = 0;
+
+    if (o->stored) {
+        crc = dat_crc32c(0, o->stored, (size_t)(u32)o->len_compressed);
+    } else {
+        /* El cuerpo pasa por el CRC en vez de a un buffer */
+        DatOut out = { NULL, 0, 1, NULL, NULL, &crc };
+        write_body(&out, o);
+    }
+    dat_set_checksum(o, crc);
+}
+
+void dat_set_checksum(DatObject* o, u32 crc) {
+    char hex[9];
+    Property* p;
+
+    snprintf(hex, sizeof(hex), "%08X", crc);
+    p = take_prop(o, DAT_CRC_PROP);
+    if (!p) {
+        Property* np = (Property*)realloc(o->properties, sizeof(Property) * (size_t)(o->num_properties + 1));
+        if (!np) return;
+        o->properties = np;
+        p = &np[o->num_properties++];
+    }
+    memcpy(p->magic, "prop", 4);
+    memcpy(p->type, DAT_CRC_PROP, 4);
+    p->len_body = 8;
+    p->body = (char*)malloc(9);
+    if (p->body) memcpy(p->body, hex, 9);
+    else p->len_body = 0;
+}
+
+void dat_checksum_objects(AllegroDat* dat, int jobs) {
+    dat_parallel_for(jobs, dat->num_objects, checksum_one, dat);
+}
 
+void dat_drop_checksums(AllegroDat* dat) {
     for (u32 i = 0; i < dat->num_objects; i++) {
         DatObject* o = &dat->objects[i];
-        
-        /* Escribir propiedades */
-        for (int p = 0; p < o->num_properties; p++) {
-            Property* pr = &o->properties[p];
-            u32 bl = to_be32(pr->len_body);
-            fwrite(pr->magic, 1, 4, f);
-            fwrite(pr->type, 1, 4, f);
-            fwrite(&bl, 4, 1, f);
-            if (pr->len_body) fwrite(pr->body, 1, pr->len_body, f);
-        }
+        Property* p = take_prop(o, DAT_CRC_PROP);
+        if (!p) continue;
+        memmove(p, p + 1, sizeof(Property) * (size_t)(o->properties + o->num_properties - (p + 1)));
+        o->num_properties--;
+    }
+}
 
-        /* Encabezado del objeto */
-        fwrite(o->type, 1, 4, f);
-        u32 lc = to_be32((u32)o->len_compressed);
-        u32 lu = to_be32((u32)o->len_uncompressed);
-        fwrite(&lc, 4, 1, f); fwrite(&lu, 4, 1, f);
-
-        /* Cuerpo del objeto según tipo */
-        if (!memcmp(o->type, "BMP ", 4)) write_bmp(f, o->body.bmp);
-        else if (!memcmp(o->type, "PAL ", 4)) write_pal(f, o->body.pal);
-        else if (!memcmp(o->type, "RLE ", 4)) write_rle(f, o->body.rle);
-        else if (!memcmp(o->type, "FONT", 4)) write_font(f, o->body.font);
-        else if (o->body.any && o->len_uncompressed > 0) {
-            /* MIDI, FLIC, DATA, info y cualquier tipo verbatim */
-            fwrite(o->body.any, 1, (size_t)o->len_uncompressed, f);
-        }
+static double now_seconds(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/* Propiedades y encabezado de un objeto */
+static void write_object_head(DatOut* out, const DatObject* o) {
+    /* Escribir propiedades */
+    for (int p = 0; p < o->num_properties; p++) {
+        const Property* pr = &o->properties[p];
+        u32 bl = to_be32(pr->len_body);
+        out_bytes(out, pr->magic, 4);
+        out_bytes(out, pr->type, 4);
+        out_bytes(out, &bl, 4);
+        if (pr->len_body) out_bytes(out, pr->body, pr->len_body);
     }
 
-    fclose(f);
+    /* Encabezado del objeto */
+    out_bytes(out, o->type, 4);
+    u32 lc = to_be32((u32)o->len_compressed);
+    u32 lu = to_be32((u32)o->len_uncompressed);
+    out_bytes(out, &lc, 4); out_bytes(out, &lu, 4);
+}
+
+/* Propiedades, encabezado y cuerpo de un objeto */
+static void write_object(DatOut* out, const DatObject* o) {
+    write_object_head(out, o);
+
+    /* Cuerpo del objeto: ya serializado (p.ej. comprimido) o según tipo */
+    if (o->stored) out_bytes(out, o->stored, (size_t)o->len_compressed);
+    else write_body(out, o);
+}
+
+/* num_objects y los objetos: el fichero tras 'ALL.' o el cuerpo de un FILE */
+static void write_object_list(DatOut* out, const DatObject* objs, u32 num_objects) {
+    u32 no = to_be32(num_objects);
+    out_bytes(out, &no, 4);
+
+    for (u32 i = 0; i < num_objects; i++) write_object(out, &objs[i]);
+}
+
+int dat_serialize_objects(const DatObject* objs, u32 num_objects, u8** out_buf, u32* out_size) {
+    DatOut count = { NULL, 0, 1, NULL, NULL, NULL };
+    DatOut out = { NULL, 0, 1, NULL, NULL, NULL };
+    u8* buf;
+
+    write_object_list(&count, objs, num_objects);
+    if (count.raw > 0x7FFFFFFF) return 0; /* las longitudes son s32 */
+    buf = (u8*)malloc((size_t)count.raw);
+    if (!buf) return 0;
+    out.mem = buf;
+    write_object_list(&out, objs, num_objects);
+    *out_buf = buf;
+    *out_size = (u32)count.raw;
     return 1;
 }
+
+/* Fichero temporal junto al destino; se renombra al terminar, asi una
+   build interrumpida nunca deja un .dat truncado */
+static int open_temp(const char* filename, char* tmp, size_t cap) {
+    for (int k = 0; k < 100; k++) {
+        int fd;
+        snprintf(tmp, cap, "%s.tmp%ld_%d", filename, (long)getpid(), k);
+        fd = open(tmp, O_RDWR | O_CREAT | O_EXCL, 0666);
+        if (fd >= 0 || errno != EEXIST) return fd;
+    }
+    return -1;
+}
+
+/* ------------------------------------------------------------------ */
+/* Escritura incremental                                               */
+/* ------------------------------------------------------------------ */
+
+/* Cada objeto se escribe al anadirlo. El numero de objetos se parchea al
+   cerrar; con "slh!" va dentro del stream LZSS, asi que el fichero sin
+   comprimir se escribe primero en otro temporal y se comprime al cerrar,
+   por bloques */
+struct DatWriter {
+    char        filename[4096];
+    char        tmp[4096];      /* el .dat final (o, con pack, el comprimido) */
+    char        raw_tmp[4096];  /* pack: 'ALL.' + objetos sin comprimir */
+    FILE*       f;              /* tmp, o raw_tmp con pack */
+    int         packed;
+    int         level;
+    u32         num_objects;
+    long        count_off;      /* donde va num_objects en f */
+    DatOut      out;
+    double      seconds;
+};
+
+static FILE* open_temp_file(const char* filename, char* tmp, size_t cap) {
+    int fd = open_temp(filename, tmp, cap);
+    FILE* f;
+    if (fd < 0) return NULL;
+    f = fdopen(fd, "wb+");
+    if (!f) { close(fd); unlink(tmp); return NULL; }
+    setvbuf(f, NULL, _IOFBF, 1 << 20);
+    return f;
+}
+
+DatWriter* dat_writer_open(const char* filename, u32 pack_magic, const DatWriteOptions* opt) {
+    DatWriter* w = (DatWriter*)calloc(1, sizeof(DatWriter));
+    double t0 = now_seconds();
+    u32 pm = to_be32(pack_magic), dm = to_be32(DAT_MAGIC), zero = 0;
+
+    if (!w) return NULL;
+    snprintf(w->filename, sizeof(w->filename), "%s", filename);
+    w->packed = pack_magic == DAT_F_PACK_MAGIC;
+    w->level = opt ? opt->pack_level : LZSS_LEVEL_DEFAULT;
+    w->f = w->packed ? open_temp_file(filename, w->raw_tmp, sizeof(w->raw_tmp))
+                     : open_temp_file(filename, w->tmp, sizeof(w->tmp));
+    if (!w->f) { free(w); return NULL; }
+    w->out.ok = 1;
+    w->out.file = w->f;
+    if (!w->packed) out_bytes(&w->out, &pm, 4);
+    w->count_off = (long)w->out.raw + 4;
+    out_bytes(&w->out, &dm, 4);
+    out_bytes(&w->out, &zero, 4); /* num_objects: se parchea al cerrar */
+    w->seconds = now_seconds() - t0;
+    if (!w->out.ok) { dat_writer_abort(w); return NULL; }
+    return w;
+}
+
+int dat_writer_add_object(DatWriter* w, DatObject* o) {
+    double t0 = now_seconds();
+    if (w->out.ok) {
+        write_object(&w->out, o);
+        w->num_objects++;
+    }
+    free_dat_object(o);
+    memset(o, 0, sizeof(*o));
+    w->seconds += now_seconds() - t0;
+    return w->out.ok;
+}
+
+/* Bloque en el que se pide el cuerpo de un objeto en flujo */
+#define DAT_STREAM_BLOCK (1u << 16)
+
+int dat_writer_add_streamed(DatWriter* w, DatObject* o, DatBodyReader read, void* ctx) {
+    double t0 = now_seconds();
+    u32 left = (u32)o->len_compressed;
+    u8* buf = NULL;
+
+    if (w->out.ok) {
+        write_object_head(&w->out, o);
+        buf = (u8*)malloc(DAT_STREAM_BLOCK);
+        if (!buf) w->out.ok = 0;
+        while (w->out.ok && left > 0) {
+            u32 n = read(ctx, buf, left < DAT_STREAM_BLOCK ? left : DAT_STREAM_BLOCK);
+            if (n == 0 || n > left) { w->out.ok = 0; break; }
+            out_bytes(&w->out, buf, n);
+            left -= n;
+        }
+        free(buf);
+        if (w->out.ok) w->num_objects++;
+    }
+    free_dat_object(o);
+    memset(o, 0, sizeof(*o));
+    w->seconds += now_seconds() - t0;
+    return w->out.ok;
+}
+
+int dat_writer_add_bytes(DatWriter* w, const void* p, u64 size, u32 objects) {
+    double t0 = now_seconds();
+    const u8* b = (const u8*)p;
+    while (w->out.ok && size > 0) {
+        size_t n = size > (1u << 30) ? (size_t)1 << 30 : (size_t)size;
+        out_bytes(&w->out, b, n);
+        b += n; size -= n;
+    }
+    if (w->out.ok) w->num_objects += objects;
+    w->seconds += now_seconds() - t0;
+    return w->out.ok;
+}
+
+int dat_writer_copy_range(DatWriter* w, int fd, u64 off, u64 size, u32 objects) {
+    double t0 = now_seconds();
+    loff_t in = (loff_t)off;
+    u8* buf = NULL;
+
+    if (!w->out.ok) return 0;
+    if (fflush(w->f) != 0) { w->out.ok = 0; return 0; }
+    /* Se escribe en la posicion del descriptor, que es el final de f */
+    while (size > 0) {
+        ssize_t n = copy_file_range(fd, &in, fileno(w->f), NULL, size > (1u << 30) ? (size_t)1 << 30 : (size_t)size, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        w->out.raw += (u64)n;
+        size -= (u64)n;
+    }
+    if (fseeko(w->f, 0, SEEK_END) != 0) w->out.ok = 0;
+    /* ENOSYS, EXDEV en kernels viejos, ficheros especiales...: a mano */
+    if (size > 0 && w->out.ok) buf = (u8*)malloc(1 << 20);
+    if (size > 0 && !buf) w->out.ok = 0;
+    while (w->out.ok && size > 0) {
+        ssize_t n = pread(fd, buf, size > (1u << 20) ? (size_t)1 << 20 : (size_t)size, in);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) { w->out.ok = 0; break; }
+        out_bytes(&w->out, buf, (size_t)n);
+        in += n;
+        size -= (u64)n;
+    }
+    free(buf);
+    if (w->out.ok) w->num_objects += objects;
+    w->seconds += now_seconds() - t0;
+    return w->out.ok;
+}
+
+/* pack: el magic sin comprimir y raw_tmp entero como un stream LZSS */
+static int pack_raw(DatWriter* w, u64* disk) {
+    u32 pm = to_be32(DAT_F_PACK_MAGIC);
+    u64 packed_bytes = 0;
+    LzssPacker* pk;
+    FILE* f;
+    u8* buf;
+    size_t n;
+    int ok = 1;
+
+    if (fseek(w->f, 0, SEEK_SET) != 0) return 0;
+    f = open_temp_file(w->filename, w->tmp, sizeof(w->tmp));
+    if (!f) return 0;
+    buf = (u8*)malloc(1 << 20);
+    pk = buf ? lzss_packer_create(w->level, file_sink, f) : NULL;
+    if (!pk || fwrite(&pm, 4, 1, f) != 1) ok = 0;
+    while (ok && (n = fread(buf, 1, 1 << 20, w->f)) > 0)
+        if (!lzss_packer_write(pk, buf, n)) ok = 0;
+    if (ferror(w->f)) ok = 0;
+    if (pk && !lzss_packer_finish(pk, &packed_bytes)) ok = 0;
+    free(buf);
+    if (fclose(f) != 0) ok = 0;
+    if (!ok) { unlink(w->tmp); w->tmp[0] = '\0'; }
+    *disk = 4 + packed_bytes;
+    return ok;
+}
+
+int dat_writer_close(DatWriter* w, DatWriteStats* st) {
+    double t0 = now_seconds();
+    u32 no = to_be32(w->num_objects);
+    u64 raw = w->out.raw + (w->packed ? 4 : 0), disk = raw;
+    int ok = w->out.ok;
+
+    /* num_objects, ya con todo lo demas escrito */
+    if (ok && fflush(w->f) != 0) ok = 0;
+    if (ok && pwrite(fileno(w->f), &no, 4, (off_t)w->count_off) != 4) ok = 0;
+    if (ok && w->packed) ok = pack_raw(w, &disk);
+    if (fclose(w->f) != 0) ok = 0;
+    if (w->packed) unlink(w->raw_tmp);
+    if (ok && rename(w->tmp, w->filename) != 0) ok = 0;
+    if (!ok && w->tmp[0]) unlink(w->tmp);
+
+    if (st) {
+        st->raw_bytes  = raw;
+        st->disk_bytes = disk;
+        st->seconds    = w->seconds + (now_seconds() - t0);
+    }
+    free(w);
+    return ok;
+}
+
+void dat_writer_abort(DatWriter* w) {
+    if (!w) return;
+    fclose(w->f);
+    unlink(w->packed ? w->raw_tmp : w->tmp);
+    free(w);
+}
@@ -4,10 +4,80 @@
 #include <stdio.h>
 #include "allegro_dat_structs.h"
 
-int dat_write(const char *filename, AllegroDat *dat);
+// Options for dat_writer_open (NULL = defaults)
+typedef struct {
+    int pack_level;     // LZSS level 1..9, used with DAT_F_PACK_MAGIC
+} DatWriteOptions;
+
+// Filled by dat_writer_close (optional)
+typedef struct {
+    u64    raw_bytes;   // file size if it were not packed
+    u64    disk_bytes;  // bytes actually written
+    double seconds;     // wall time spent serializing/compressing
+} DatWriteStats;
+
+// Serializes the uncompressed body of o (len_uncompressed bytes) into dst
+void dat_serialize_body(const DatObject *o, u8 *dst);
+
+// Sub-datafile ("FILE") body: the object count and the objects, laid out
+// as in a DAT after 'ALL.'. Returns 0 if out of memory or over 2 GB.
+int dat_serialize_objects(const DatObject *objs, u32 num_objects, u8 **out_buf, u32 *out_size);
+
+// Incremental writer, for DATs that do not fit in memory. Each object is
+// serialized as soon as it is added and then freed; the object count is
+// patched in at close, which also renames the temporary into place, so an
+// unfinished file never replaces 'filename'. With DAT_F_PACK_MAGIC ("slh!")
+// the objects go to a second temporary first (the count is inside the LZSS
+// stream) and are packed into the final file at close, in constant memory.
+typedef struct DatWriter DatWriter;
+
+// NULL if the temporary cannot be created.
+DatWriter* dat_writer_open(const char* filename, u32 pack_magic, const DatWriteOptions* opt);
+// Writes o (its 'stored' bytes when set, e.g. after dat_pack_objects) and frees it
+// with free_dat_object, leaving it zeroed. Returns 0 once a write has failed.
+int dat_writer_add_object(DatWriter* w, DatObject* o);
+// Body produced while it is written: up to cap bytes into dst, 0 on error.
+typedef u32 (*DatBodyReader)(void* ctx, u8* dst, u32 cap);
+// Like dat_writer_add_object for an object without a body in memory: the
+// len_compressed bytes of its body are pulled from read in 64 KB blocks,
+// so a long sample is written in constant memory. Returns 0 once a write
+// has failed or read came up short.
+int dat_writer_add_streamed(DatWriter* w, DatObject* o, DatBodyReader read, void* ctx);
+// Appends 'objects' objects that are already serialized as in a DAT
+// (property chunks, header and body): size bytes of fd from offset off.
+// copy_file_range moves them inside the kernel, and filesystems with
+// reflinks or server-side copy (Btrfs, XFS, NFS 4.2) do not even read
+// them; pread/write where it is not available. 'objects' is 0 for part of
+// an object. Returns 0 once a write has failed.
+int dat_writer_copy_range(DatWriter* w, int fd, u64 off, u64 size, u32 objects);
+// Same, from memory.
+int dat_writer_add_bytes(DatWriter* w, const void* p, u64 size, u32 objects);
+// Patches the count, packs if needed and renames. Frees w. Returns 0 on
+// any error, in which case nothing is left on disk.
+int dat_writer_close(DatWriter* w, DatWriteStats* st);
+// Drops everything written so far and frees w.
+void dat_writer_abort(DatWriter* w);
+
+// Individual compression: LZSS-packs every object body on 'jobs' threads and
+// keeps it raw when the saving is below min_gain_pct percent (0..100). Packed objects
+// get o->stored, len_compressed = packed size, len_uncompressed = -raw size.
+// Output is identical for any thread count.
+void dat_pack_objects(AllegroDat *dat, int level, int min_gain_pct, int jobs);
+
+// --checksum: sets a "CRC " property on every object (replacing an old
+// one) to the CRC32C of its body as stored, after any individual
+// compression, in 8 upper-case hex digits. Allegro skips properties it does
+// not know. Runs on 'jobs' threads; call after dat_pack_objects.
+#define DAT_CRC_PROP "CRC "
+void dat_checksum_objects(AllegroDat *dat, int jobs);
+// Sets (or replaces) the "CRC " property of o to crc, for a body that was
+// checksummed outside dat_checksum_objects.
+void dat_set_checksum(DatObject* o, u32 crc);
+// Drops the "CRC " properties (a reused body may be stored differently).
+void dat_drop_checksums(AllegroDat *dat);
 
 // size helpers (host-endian to logical byte counts)
-static inline s32 dat_len_bmp(const DatBitmap *b){ return 2+2+2 + (s32)(b->width * b->height * (b->bits_per_pixel/8)); }
+static inline s32 dat_len_bmp(const DatBitmap *b){ return 2+2+2 + (s32)(b->width * b->height * dat_bitmap_pixel_size(b->bits_per_pixel)); }
 static inline s32 dat_len_pal(void){ return 256*4; } /* Spec: 256 x {R,G,B,pad} */
 static inline s32 dat_len_rle(const DatRleSprite *r){ return 2+2+2+4 + (s32)r->len_image; }
 // font: 8 -> 2 + 95*8, 16 -> 2 + 95*16
@@ -0,0 +1,472 @@
+/* lzss.c
+ *
+ * LZSS encoder producing streams readable by Allegro 4 pack_fopen().
+ *
+ * Instead of Okumura's binary tree (used by the original grabber) the
+ * encoder keeps a hash table of 3-byte prefixes with a chain of previous
+ * occurrences inside the 4 KB window. The compression level only bounds
+ * how many chain links are followed and enables one-step lazy matching,
+ * so every level emits a valid stream for the same decoder.
+ *
+ * Input is buffered in blocks; the last LZSS_N bytes are kept as history
+ * when the block slides, so memory use is constant whatever the size.
+ */
+
+#include "lzss.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_DIST    (LZSS_N - LZSS_F)   /* farthest match we emit */
+#define MIN_MATCH   (LZSS_THRESHOLD + 1)
+#define HASH_BITS   14
+#define HASH_SIZE   (1u << HASH_BITS)
+#define BLOCK_SIZE  (1u << 16)
+#define BUF_SIZE    (LZSS_N + BLOCK_SIZE + LZSS_F)
+#define OUT_SIZE    (1u << 16)
+
+struct LzssPacker {
+    lzss_sink_fn sink;
+    void        *ctx;
+    int          ok;
+    int          max_chain;
+    int          lazy;
+
+    u8     *buf;        /* [history][pending input] */
+    size_t  len;        /* valid bytes in buf */
+    size_t  cur;        /* next buf index to encode */
+    u64     base;       /* stream offset of buf[0] */
+
+    u64     head[HASH_SIZE];    /* stream pos + 1 of last occurrence, 0 = none */
+    u64     prev[LZSS_N];       /* stream pos + 1 of previous occurrence */
+
+    u8      out[OUT_SIZE];
+    size_t  out_len;
+    size_t  flag_pos;
+    int     items;      /* items in the current flag group */
+    u64     total_out;
+};
+
+static const int level_chain[LZSS_LEVEL_MAX + 1] = {
+    1, 1, 2, 4, 8, 16, 32, 64, 256, 4096
+};
+
+static unsigned hash3(const u8 *p)
+{
+    u32 v = ((u32)p[0] << 16) | ((u32)p[1] << 8) | p[2];
+    return (unsigned)((v * 2654435761u) >> (32 - HASH_BITS));
+}
+
+static void flush_out(LzssPacker *pk)
+{
+    if (pk->out_len && pk->ok && !pk->sink(pk->ctx, pk->out, pk->out_len))
+        pk->ok = 0;
+    pk->total_out += pk->out_len;
+    pk->out_len = 0;
+}
+
+static void begin_item(LzssPacker *pk)
+{
+    if (pk->items == 0) {
+        /* worst case group: 1 flags byte + 8 matches */
+        if (pk->out_len + 17 > OUT_SIZE) flush_out(pk);
+        pk->flag_pos = pk->out_len;
+        pk->out[pk->out_len++] = 0;
+    }
+}
+
+static void end_item(LzssPacker *pk)
+{
+    if (++pk->items == 8) pk->items = 0;
+}
+
+static void emit_literal(LzssPacker *pk, u8 c)
+{
+    begin_item(pk);
+    pk->out[pk->flag_pos] |= (u8)(1u << pk->items);
+    pk->out[pk->out_len++] = c;
+    end_item(pk);
+}
+
+static void emit_match(LzssPacker *pk, u64 src, int len)
+{
+    unsigned ring = (unsigned)((LZSS_N - LZSS_F + src) & (LZSS_N - 1));
+    begin_item(pk);
+    pk->out[pk->out_len++] = (u8)(ring & 0xFF);
+    pk->out[pk->out_len++] = (u8)(((ring >> 4) & 0xF0) | (unsigned)(len - MIN_MATCH));
+    end_item(pk);
+}
+
+static void insert(LzssPacker *pk, size_t i)
+{
+    u64 spos = pk->base + i;
+    unsigned h;
+    if (i + MIN_MATCH > pk->len) return;
+    h = hash3(pk->buf + i);
+    pk->prev[spos & (LZSS_N - 1)] = pk->head[h];
+    pk->head[h] = spos + 1;
+}
+
+/* Longest match for buf[i..i+maxlen) in the window; returns its length. */
+static int find_match(LzssPacker *pk, size_t i, int maxlen, u64 *src)
+{
+    u64 spos = pk->base + i;
+    u64 cand;
+    int best = 0, chain = pk->max_chain;
+    const u8 *p = pk->buf + i;
+
+    if (maxlen < MIN_MATCH) return 0;
+    cand = pk->head[hash3(p)];
+    while (cand && chain-- > 0) {
+        u64 c = cand - 1;
+        const u8 *q;
+        int l;
+        if (c >= spos || spos - c > MAX_DIST) break;
+        q = pk->buf + (size_t)(c - pk->base);
+        if (q[best] == p[best]) {
+            for (l = 0; l < maxlen && q[l] == p[l]; l++) ;
+            if (l > best) {
+                best = l; *src = c;
+                if (l == maxlen) break;
+            }
+        }
+        cand = pk->prev[c & (LZSS_N - 1)];
+        if (cand && cand - 1 >= c) break;  /* stale link */
+    }
+    return best >= MIN_MATCH ? best : 0;
+}
+
+static void encode(LzssPacker *pk, int final)
+{
+    size_t limit = final ? pk->len : (pk->len > LZSS_F ? pk->len - LZSS_F : 0);
+
+    while (pk->cur < limit) {
+        size_t i = pk->cur;
+        int maxlen = (int)((pk->len - i) < LZSS_F ? (pk->len - i) : LZSS_F);
+        u64 src = 0;
+        int len = find_match(pk, i, maxlen, &src);
+
+        if (len && pk->lazy && len < maxlen && i + 1 < limit) {
+            u64 src2 = 0;
+            int maxlen2 = (int)((pk->len - i - 1) < LZSS_F ? (pk->len - i - 1) : LZSS_F);
+            int len2;
+            insert(pk, i);
+            len2 = find_match(pk, i + 1, maxlen2, &src2);
+            if (len2 > len) {
+                emit_literal(pk, pk->buf[i]);
+                pk->cur = i + 1;
+                continue;
+            }
+            emit_match(pk, src, len);
+            for (size_t k = 1; k < (size_t)len; k++) insert(pk, i + k);
+            pk->cur = i + (size_t)len;
+            continue;
+        }
+
+        if (len) {
+            emit_match(pk, src, len);
+            for (size_t k = 0; k < (size_t)len; k++) insert(pk, i + k);
+            pk->cur = i + (size_t)len;
+        } else {
+            emit_literal(pk, pk->buf[i]);
+            insert(pk, i);
+            pk->cur = i + 1;
+        }
+    }
+}
+
+LzssPacker *lzss_packer_create(int level, lzss_sink_fn sink, void *ctx)
+{
+    LzssPacker *pk = (LzssPacker *)calloc(1, sizeof(LzssPacker));
+    if (!pk) return NULL;
+    pk->buf = (u8 *)malloc(BUF_SIZE);
+    if (!pk->buf) { free(pk); return NULL; }
+    if (level < LZSS_LEVEL_MIN) level = LZSS_LEVEL_MIN;
+    if (level > LZSS_LEVEL_MAX) level = LZSS_LEVEL_MAX;
+    pk->max_chain = level_chain[level];
+    pk->lazy = level >= 4;
+    pk->sink = sink;
+    pk->ctx = ctx;
+    pk->ok = 1;
+    return pk;
+}
+
+int lzss_packer_write(LzssPacker *pk, const void *data, size_t n)
+{
+    const u8 *p = (const u8 *)data;
+    while (n > 0) {
+        size_t room = BUF_SIZE - pk->len;
+        size_t take = n < room ? n : room;
+        memcpy(pk->buf + pk->len, p, take);
+        pk->len += take; p += take; n -= take;
+        if (pk->len == BUF_SIZE) {
+            /* encode the block and slide, keeping LZSS_N bytes of history */
+            size_t keep, drop;
+            encode(pk, 0);
+            keep = pk->cur < LZSS_N ? pk->cur : LZSS_N;
+            drop = pk->cur - keep;
+            memmove(pk->buf, pk->buf + drop, pk->len - drop);
+            pk->len -= drop;
+            pk->cur -= drop;
+            pk->base += drop;
+        }
+    }
+    return pk->ok;
+}
+
+int lzss_packer_finish(LzssPacker *pk, u64 *out_bytes)
+{
+    int ok;
+    encode(pk, 1);
+    flush_out(pk);
+    ok = pk->ok;
+    if (out_bytes) *out_bytes = pk->total_out;
+    free(pk->buf);
+    free(pk);
+    return ok;
+}
+
+/* ------------------------------------------------------------------ */
+/* One-shot buffer encoding                                            */
+/* ------------------------------------------------------------------ */
+
+typedef struct { u8 *data; size_t len, cap; } MemSink;
+
+static int mem_sink(void *ctx, const u8 *data, size_t n)
+{
+    MemSink *m = (MemSink *)ctx;
+    if (m->len + n > m->cap) {
+        size_t cap = m->cap ? m->cap : 4096;
+        u8 *nd;
+        while (cap < m->len + n) cap *= 2;
+        nd = (u8 *)realloc(m->data, cap);
+        if (!nd) return 0;
+        m->data = nd; m->cap = cap;
+    }
+    memcpy(m->data + m->len, data, n);
+    m->len += n;
+    return 1;
+}
+
+int lzss_pack_buffer(const u8 *in, size_t n, int level, u8 **out, size_t *out_sz)
+{
+    MemSink m = { NULL, 0, 0 };
+    LzssPacker *pk = lzss_packer_create(level, mem_sink, &m);
+    int ok;
+    if (!pk) return 0;
+    /* worst case is 9/8 of the input, reserve it up front */
+    m.cap = n + n / 8 + 16;
+    m.data = (u8 *)malloc(m.cap);
+    if (!m.data) { lzss_packer_finish(pk, NULL); return 0; }
+    ok = lzss_packer_write(pk, in, n);
+    ok = lzss_packer_finish(pk, NULL) && ok;
+    if (!ok) { free(m.data); return 0; }
+    *out = m.data;
+    *out_sz = m.len;
+    return 1;
+}
+
+/* ------------------------------------------------------------------ */
+/* Decoder                                                             */
+/* ------------------------------------------------------------------ */
+
+#define IN_SIZE (1u << 16)
+
+struct LzssUnpacker {
+    lzss_source_fn src;
+    void          *ctx;
+    u8             ring[LZSS_N];
+    unsigned       r;           /* ring write position */
+    unsigned       flags;       /* remaining flag bits, 0x100 marks exhausted */
+    unsigned       match_pos;   /* pending match (suspended mid-copy) */
+    unsigned       match_left;
+    int            eof;
+    u8             in[IN_SIZE];
+    size_t         in_pos, in_len;
+};
+
+static int next_in(LzssUnpacker *up)
+{
+    if (up->in_pos == up->in_len) {
+        if (up->eof) return -1;
+        up->in_len = up->src(up->ctx, up->in, IN_SIZE);
+        up->in_pos = 0;
+        if (up->in_len == 0) { up->eof = 1; return -1; }
+    }
+    return up->in[up->in_pos++];
+}
+
+LzssUnpacker *lzss_unpacker_create(lzss_source_fn src, void *ctx)
+{
+    LzssUnpacker *up = (LzssUnpacker *)calloc(1, sizeof(LzssUnpacker));
+    if (!up) return NULL;
+    up->src = src;
+    up->ctx = ctx;
+    up->r = LZSS_N - LZSS_F;
+    return up;
+}
+
+size_t lzss_unpacker_read(LzssUnpacker *up, void *dst, size_t n)
+{
+    u8 *out = (u8 *)dst;
+    u8 *ring = up->ring;
+    size_t done = 0;
+    unsigned r = up->r;
+    unsigned flags = up->flags;
+
+    while (done < n) {
+        int c, j;
+
+        if (up->match_left) {
+            /* copy from the ring, byte by byte (source may overlap r) */
+            unsigned mp = up->match_pos, left = up->match_left;
+            while (left && done < n) {
+                u8 b = ring[mp];
+                mp = (mp + 1) & (LZSS_N - 1);
+                ring[r] = b;
+                r = (r + 1) & (LZSS_N - 1);
+                out[done++] = b;
+                left--;
+            }
+            up->match_pos = mp;
+            up->match_left = left;
+            continue;
+        }
+
+        /* fast path: a whole flag group is buffered and fits in dst */
+        if (((flags >> 1) & 0x100) == 0 && up->in_len - up->in_pos >= 17 && n - done >= 8 * LZSS_F) {
+            const u8 *ip = up->in + up->in_pos;
+            unsigned f = *ip++, k;
+            for (k = 0; k < 8; k++, f >>= 1) {
+                if (f & 1) {
+                    u8 b = *ip++;
+                    ring[r] = b;
+                    r = (r + 1) & (LZSS_N - 1);
+                    out[done++] = b;
+                } else {
+                    unsigned mp = ip[0] | (((unsigned)ip[1] & 0xF0) << 4);
+                    unsigned len = ((unsigned)ip[1] & 0x0F) + LZSS_THRESHOLD + 1;
+                    ip += 2;
+                    while (len--) {
+                        u8 b = ring[mp];
+                        mp = (mp + 1) & (LZSS_N - 1);
+                        ring[r] = b;
+                        r = (r + 1) & (LZSS_N - 1);
+                        out[done++] = b;
+                    }
+                }
+            }
+            up->in_pos = (size_t)(ip - up->in);
+            flags = 0;
+            continue;
+        }
+
+        flags >>= 1;
+        if ((flags & 0x100) == 0) {
+            if ((c = next_in(up)) < 0) break;
+            flags = (unsigned)c | 0xFF00;
+        }
+        if (flags & 1) {
+            if ((c = next_in(up)) < 0) break;
+            ring[r] = (u8)c;
+            r = (r + 1) & (LZSS_N - 1);
+            out[done++] = (u8)c;
+        } else {
+            if ((c = next_in(up)) < 0) break;
+            if ((j = next_in(up)) < 0) break;
+            up->match_pos = ((unsigned)c | (((unsigned)j & 0xF0) << 4));
+            up->match_left = ((unsigned)j & 0x0F) + LZSS_THRESHOLD + 1;
+        }
+    }
+    up->r = r;
+    up->flags = flags;
+    return done;
+}
+
+void lzss_unpacker_free(LzssUnpacker *up)
+{
+    free(up);
+}
+
+int lzss_unpack_buffer(const u8 *in, size_t in_sz, u8 *out, size_t out_sz)
+{
+    /* The output buffer itself is the history: ring position p of a match
+       maps back to a distance from the current output position. Bytes
+       before the start of the stream are the zeroed ring. */
+    size_t ip = 0, op = 0;
+    unsigned flags = 0;
+
+    while (op < out_sz) {
+        flags >>= 1;
+        if ((flags & 0x100) == 0) {
+            if (ip >= in_sz) break;
+            flags = in[ip++] | 0xFF00u;
+        }
+        if (flags & 1) {
+            if (ip >= in_sz) break;
+            out[op++] = in[ip++];
+        } else {
+            unsigned pos, len, ring_r, dist;
+            if (ip + 2 > in_sz) break;
+            pos = in[ip] | (((unsigned)in[ip + 1] & 0xF0) << 4);
+            len = ((unsigned)in[ip + 1] & 0x0F) + LZSS_THRESHOLD + 1;
+            ip += 2;
+            ring_r = (unsigned)((LZSS_N - LZSS_F + op) & (LZSS_N - 1));
+            dist = (ring_r - pos) & (LZSS_N - 1);
+            if (dist == 0) dist = LZSS_N;
+            if (len > out_sz - op) len = (unsigned)(out_sz - op);
+            if (dist <= op && dist >= len) {
+                memcpy(out + op, out + op - dist, len);
+                op += len;
+            } else {
+                unsigned k;
+                for (k = 0; k < len; k++, op++)
+                    out[op] = (dist <= op) ? out[op - dist] : 0;
+            }
+        }
+    }
+    return op == out_sz;
+}
+
+typedef struct {
+    const u8 *p;
+    size_t    left;
+} MemSource;
+
+static size_t mem_source(void *ctx, u8 *buf, size_t n)
+{
+    MemSource *ms = (MemSource *)ctx;
+    if (n > ms->left) n = ms->left;
+    memcpy(buf, ms->p, n);
+    ms->p += n;
+    ms->left -= n;
+    return n;
+}
+
+u8 *lzss_unpack_alloc(const u8 *in, size_t in_sz, u64 *out_sz)
+{
+    MemSource ms;
+    LzssUnpacker *up;
+    u64 cap = (u64)in_sz * 2 + 4096, len = 0;
+    u8 *buf = (u8 *)malloc((size_t)cap);
+    size_t got;
+
+    ms.p = in;
+    ms.left = in_sz;
+    up = lzss_unpacker_create(mem_source, &ms);
+    if (!up) { free(buf); return NULL; }
+    while (buf) {
+        if (len == cap) {
+            u8 *nb = (u8 *)realloc(buf, (size_t)(cap * 2));
+            if (!nb) { free(buf); buf = NULL; break; }
+            buf = nb;
+            cap *= 2;
+        }
+        got = lzss_unpacker_read(up, buf + len, (size_t)(cap - len));
+        if (got == 0) break;
+        len += got;
+    }
+    lzss_unpacker_free(up);
+    *out_sz = len;
+    return buf;
+}
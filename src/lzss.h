@@ -0,0 +1,75 @@
+/* lzss.h
+ *
+ * LZSS codec compatible with Allegro 4 packfiles (F_PACK_MAGIC "slh!").
+ *
+ * Stream format (identical to allegro/src/lzss.c):
+ *
+ *   4096-byte ring buffer, first LZSS_N - LZSS_F bytes zeroed, write
+ *   position starting at LZSS_N - LZSS_F.
+ *   One flags byte precedes every group of 8 items, LSB first:
+ *     bit = 1  literal     u8 byte
+ *     bit = 0  match       u8 pos_lo, u8 (pos_hi << 4) | (len - 3)
+ *   pos is an absolute ring position (12 bits), len is 3..18.
+ *   The stream ends where the data ends (no terminator).
+ */
+#ifndef LZSS_H
+#define LZSS_H
+
+#include <stddef.h>
+#include "allegro_dat_structs.h"
+
+#define LZSS_N          4096   /* ring buffer size */
+#define LZSS_F          18     /* longest match */
+#define LZSS_THRESHOLD  2      /* matches must be longer than this */
+
+#define LZSS_LEVEL_MIN      1
+#define LZSS_LEVEL_MAX      9
+#define LZSS_LEVEL_DEFAULT  6
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Receives compressed output. Returns 0 on error (e.g. write failure). */
+typedef int (*lzss_sink_fn)(void *ctx, const u8 *data, size_t n);
+
+/* Streaming encoder: hash-chain match finder, chain depth set by level
+   (1 = fastest ... 9 = smallest). */
+typedef struct LzssPacker LzssPacker;
+
+LzssPacker *lzss_packer_create(int level, lzss_sink_fn sink, void *ctx);
+/* Returns 0 if the sink failed. */
+int lzss_packer_write(LzssPacker *pk, const void *data, size_t n);
+/* Flushes pending data, frees the packer. Returns 0 if the sink failed.
+   *out_bytes (optional) receives the total compressed size. */
+int lzss_packer_finish(LzssPacker *pk, u64 *out_bytes);
+
+/* One-shot helper. Returns 1 on success, caller must free(*out). */
+int lzss_pack_buffer(const u8 *in, size_t n, int level, u8 **out, size_t *out_sz);
+
+/* Supplies compressed input. Returns bytes stored in buf, 0 at end/error. */
+typedef size_t (*lzss_source_fn)(void *ctx, u8 *buf, size_t n);
+
+/* Streaming decoder: only the 4 KB ring and a small input buffer are kept,
+   so arbitrarily large streams can be walked in constant memory. */
+typedef struct LzssUnpacker LzssUnpacker;
+
+LzssUnpacker *lzss_unpacker_create(lzss_source_fn src, void *ctx);
+/* Returns bytes produced; less than n only when the stream ends. */
+size_t lzss_unpacker_read(LzssUnpacker *up, void *dst, size_t n);
+void lzss_unpacker_free(LzssUnpacker *up);
+
+/* One-shot decode of a complete stream into out[0..out_sz).
+   Returns 1 if exactly out_sz bytes were produced. */
+int lzss_unpack_buffer(const u8 *in, size_t in_sz, u8 *out, size_t out_sz);
+
+/* Decodes a whole stream of unknown output size (a "slh!" file) into a
+   malloc'd buffer; NULL if out of memory. A truncated stream just ends
+   early. */
+u8 *lzss_unpack_alloc(const u8 *in, size_t in_sz, u64 *out_sz);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LZSS_H */
@@ -16,6 +16,8 @@ void free_dat_object(DatObject *o){ if(!o) return; for(int i=0;i<o->num_properti
     else if(!memcmp(o->type,"PAL ",4)) { if(o->body.pal) free(o->body.pal);} 
     else if(!memcmp(o->type,"RLE ",4)) free_dat_rle(o->body.rle);
     else if(!memcmp(o->type,"FONT",4)) free_dat_font(o->body.font);
+    else if(o->body.any) free(o->body.any); /* MIDI, SAMP, FLIC, DATA, info... verbatim */
+    if(o->stored && !o->stored_is_view) free(o->stored);
 }
 
 void free_allegro_dat(AllegroDat *d){ if(!d) return; if(d->objects){ for(u32 i=0;i<d->num_objects;i++) free_dat_object(&d->objects[i]); free(d->objects);} free(d);} 
@@ -8,9 +8,14 @@
  *   s16  divisions                   (ticks per quarter-note)
  *   Then exactly ALLEGRO_MIDI_TRACKS (32) track slots:
  *     s32  track_len                 (0 = empty / unused track)
- *     u8   track_data[track_len]     (raw SMF track chunk payload,
+ *     u8   track_data[track_len]     (SMF track chunk payload,
  *                                     i.e. without the "MTrk" + length header)
  *
+ * Track payloads are decoded into absolute-time events and re-encoded:
+ * meta events the player ignores are dropped, running status is used
+ * wherever the status repeats, and tracks beyond the 32 slots are merged
+ * by time into the last one.
+ *
  * Reference: Allegro 4 source  allegro/src/midi.c  load_midi_datafile()
  *            and allegro/tools/grabber – MIDI import.
  */
@@ -52,116 +57,292 @@ static void write_be32(unsigned char *p, unsigned int v)
 }
 
 /* ------------------------------------------------------------------ */
-/* Main conversion                                                      */
+/* Event decoding                                                       */
 /* ------------------------------------------------------------------ */
 
-int mid_to_allegro_dat(const unsigned char *mid_data,
-                       unsigned int         mid_size,
-                       unsigned char      **out_buf,
-                       unsigned int        *out_size)
+typedef struct
 {
-    unsigned int   pos = 0;
-    unsigned short smf_format, smf_ntracks, smf_divisions;
-    unsigned int   i;
+    unsigned int         tick;      /* absolute time */
+    unsigned int         order;     /* position in its source track */
+    unsigned int         track;     /* source track, for stable merging */
+    unsigned char        status;    /* 0x80-0xEF channel, 0xF0/0xF7 sysex, 0xFF meta */
+    unsigned char        type;      /* meta type */
+    unsigned char        d[2];      /* channel message data bytes */
+    const unsigned char *payload;   /* sysex / meta data */
+    unsigned int         len;
+} MidiEvent;
 
-    /* Track payload pointers and lengths (up to ALLEGRO_MIDI_TRACKS) */
-    const unsigned char *track_data[ALLEGRO_MIDI_TRACKS];
-    unsigned int         track_len [ALLEGRO_MIDI_TRACKS];
+typedef struct
+{
+    MidiEvent   *ev;
+    unsigned int count;
+    unsigned int cap;
+    unsigned int end_tick;          /* End of Track time */
+} MidiTrack;
 
-    unsigned int total_track_bytes;
-    unsigned int body_size;
-    unsigned char *buf;
-    unsigned char *wp;
+typedef struct
+{
+    unsigned char *data;
+    unsigned int   len;
+    unsigned int   cap;
+} ByteBuf;
 
-    memset(track_data, 0, sizeof(track_data));
-    memset(track_len,  0, sizeof(track_len));
+static int read_varlen(const unsigned char *p, unsigned int len, unsigned int *pos, unsigned int *val)
+{
+    unsigned int v = 0;
+    int          i;
 
-    /* --- Parse MThd ------------------------------------------------ */
-    if (mid_size < 14)                           return 0;  /* too small */
-    if (memcmp(mid_data, "MThd", 4) != 0)        return 0;  /* not SMF   */
+    for (i = 0; i < 4; i++)
+    {
+        unsigned char b;
+        if (*pos >= len) return 0;
+        b = p[(*pos)++];
+        v = (v << 7) | (b & 0x7F);
+        if (!(b & 0x80)) { *val = v; return 1; }
+    }
+    return 0;
+}
 
+static MidiEvent *push_event(MidiTrack *t)
+{
+    if (t->count == t->cap)
     {
-        unsigned int mthd_len = read_be32(mid_data + 4);
-        if (mthd_len < 6 || 8 + mthd_len > mid_size) return 0;
+        unsigned int cap = t->cap ? t->cap * 2 : 256;
+        MidiEvent   *ev  = (MidiEvent *)realloc(t->ev, cap * sizeof(MidiEvent));
+        if (!ev) return NULL;
+        t->ev  = ev;
+        t->cap = cap;
+    }
+    memset(&t->ev[t->count], 0, sizeof(MidiEvent));
+    return &t->ev[t->count++];
+}
 
-        smf_format    = read_be16(mid_data + 8);
-        smf_ntracks   = read_be16(mid_data + 10);
-        smf_divisions = read_be16(mid_data + 12);
+/*
+ * Decodes one MTrk payload. Running status is accepted after sysex and
+ * meta events too, as Allegro's own player does. Returns 0 if the track
+ * is malformed (or out of memory).
+ */
+static int decode_track(const unsigned char *p, unsigned int len, unsigned int track,
+                        int keep_meta, MidiTrack *t, unsigned int *meta_removed)
+{
+    unsigned int  pos = 0, tick = 0, delta, n;
+    unsigned char running = 0;
 
-        /* SMPTE timecode (top bit set) is not supported by Allegro 4 */
-        if (smf_divisions & 0x8000) return 0;
-        /* SMF format 2 (multi-song) not supported */
-        if (smf_format == 2)        return 0;
+    while (pos < len)
+    {
+        MidiEvent    *e;
+        unsigned char b;
 
-        pos = 8 + mthd_len;   /* skip to first chunk after MThd */
+        if (!read_varlen(p, len, &pos, &delta) || pos >= len) return 0;
+        tick += delta;
+        b = p[pos];
+
+        if (b == 0xFF)
+        {
+            unsigned char type;
+            if (pos + 2 > len) return 0;
+            type = p[pos + 1];
+            pos += 2;
+            if (!read_varlen(p, len, &pos, &n) || n > len - pos) return 0;
+            if (type == 0x2F) break;                   /* End of Track */
+            if (!keep_meta && type != 0x51)            /* only Set Tempo matters */
+            {
+                (*meta_removed)++;
+                pos += n;
+                continue;
+            }
+            if (!(e = push_event(t))) return 0;
+            e->status  = 0xFF;
+            e->type    = type;
+        }
+        else if (b == 0xF0 || b == 0xF7)
+        {
+            pos++;
+            if (!read_varlen(p, len, &pos, &n) || n > len - pos) return 0;
+            if (!(e = push_event(t))) return 0;
+            e->status  = b;
+        }
+        else
+        {
+            unsigned char status = running;
+            unsigned int  k, nd;
+            if (b & 0x80)
+            {
+                if (b >= 0xF0) return 0;               /* system common: not in SMF */
+                status = running = b;
+                pos++;
+            }
+            if (!status) return 0;
+            nd = ((status & 0xF0) == 0xC0 || (status & 0xF0) == 0xD0) ? 1u : 2u;
+            if (nd > len - pos) return 0;
+            if (!(e = push_event(t))) return 0;
+            e->status = status;
+            for (k = 0; k < nd; k++)
+            {
+                if (p[pos + k] & 0x80) return 0;
+                e->d[k] = p[pos + k];
+            }
+            e->tick  = tick;
+            e->order = t->count - 1;
+            e->track = track;
+            pos += nd;
+            continue;
+        }
+
+        /* meta / sysex payload */
+        e->payload = p + pos;
+        e->len     = n;
+        e->tick    = tick;
+        e->order   = t->count - 1;
+        e->track   = track;
+        pos += n;
     }
+    t->end_tick = tick;
+    return 1;
+}
 
-    /* --- Parse MTrk chunks ----------------------------------------- */
+/* ------------------------------------------------------------------ */
+/* Event encoding                                                       */
+/* ------------------------------------------------------------------ */
+
+static int put_bytes(ByteBuf *b, const unsigned char *p, unsigned int n)
+{
+    if (b->len + n > b->cap)
     {
-        unsigned int stored = 0;
+        unsigned int   cap = b->cap ? b->cap : 4096;
+        unsigned char *d;
+        while (cap < b->len + n) cap *= 2;
+        d = (unsigned char *)realloc(b->data, cap);
+        if (!d) return 0;
+        b->data = d;
+        b->cap  = cap;
+    }
+    memcpy(b->data + b->len, p, n);
+    b->len += n;
+    return 1;
+}
 
-        while (pos + 8 <= mid_size && stored < (unsigned int)ALLEGRO_MIDI_TRACKS)
-        {
-            unsigned int chunk_len;
+static int put_varlen(ByteBuf *b, unsigned int v)
+{
+    unsigned char tmp[5];
+    int           n = 0, i;
+    unsigned char out[5];
 
-            /* Only process MTrk chunks; skip unknown chunk types */
-            chunk_len = read_be32(mid_data + pos + 4);
-            pos += 8;
+    do { tmp[n++] = (unsigned char)(v & 0x7F); v >>= 7; } while (v && n < 5);
+    for (i = 0; i < n; i++) out[i] = (unsigned char)(tmp[n - 1 - i] | (i < n - 1 ? 0x80 : 0));
+    return put_bytes(b, out, (unsigned int)n);
+}
 
-            if (memcmp(mid_data + pos - 8, "MTrk", 4) == 0)
-            {
-                if (pos + chunk_len > mid_size) return 0; /* truncated */
+/* Largest delta time a 4-byte varlen holds */
+#define MAX_DELTA 0x0FFFFFFFu
 
-                track_data[stored] = mid_data + pos;
-                track_len [stored] = chunk_len;
-                stored++;
-            }
+/*
+ * Writes a delta time. One longer than MAX_DELTA goes out in pieces, each
+ * followed by an empty text meta event (FF 01 00), which the player hands
+ * to midi_meta_callback and otherwise ignores; it clears running status.
+ */
+static int put_delta(ByteBuf *b, unsigned int delta, unsigned char *running)
+{
+    static const unsigned char filler[3] = { 0xFF, 0x01, 0x00 };
 
-            pos += chunk_len;
-        }
+    while (delta > MAX_DELTA)
+    {
+        if (!put_varlen(b, MAX_DELTA) || !put_bytes(b, filler, 3)) return 0;
+        delta -= MAX_DELTA;
+        *running = 0;
+    }
+    return put_varlen(b, delta);
+}
+
+/*
+ * Writes events (sorted by time) and an End of Track at end_tick. The
+ * status byte is only written when it changes; sysex and meta events
+ * clear running status, as the SMF spec says.
+ */
+static int encode_track(ByteBuf *b, const MidiEvent *ev, unsigned int count, unsigned int end_tick)
+{
+    static const unsigned char eot[3] = { 0xFF, 0x2F, 0x00 };
+    unsigned int  i, last = 0;
+    unsigned char running = 0;
+
+    for (i = 0; i < count; i++)
+    {
+        const MidiEvent *e = &ev[i];
+        unsigned char    msg[3];
+        unsigned int     n = 0;
+
+        if (!put_delta(b, e->tick - last, &running)) return 0;
+        last = e->tick;
 
-        /*
-         * For format 0 the single track contains data for all channels.
-         * Allegro 4 expects it in track slot 0 just as-is.
-         * No special splitting needed – Allegro handles it at runtime.
-         *
-         * If smf_ntracks says more tracks than we found, we just leave the
-         * remaining slots at 0 (empty).
-         */
-        (void)smf_ntracks; /* we use actual chunks found, not the header count */
+        if (e->status == 0xFF || e->status == 0xF0 || e->status == 0xF7)
+        {
+            msg[n++] = e->status;
+            if (e->status == 0xFF) msg[n++] = e->type;
+            if (!put_bytes(b, msg, n) || !put_varlen(b, e->len) || !put_bytes(b, e->payload, e->len))
+                return 0;
+            running = 0;
+            continue;
+        }
+        {
+            unsigned char status = e->status, d1 = e->d[1];
+            /* Note Off vel 64 == Note On vel 0: shares the Note On status */
+            if ((status & 0xF0) == 0x80 && d1 == 64)
+            {
+                status = (unsigned char)(0x90 | (status & 0x0F));
+                d1 = 0;
+            }
+            if (status != running) msg[n++] = running = status;
+            msg[n++] = e->d[0];
+            if ((status & 0xF0) != 0xC0 && (status & 0xF0) != 0xD0) msg[n++] = d1;
+            if (!put_bytes(b, msg, n)) return 0;
+        }
     }
+    if (end_tick < last) end_tick = last;
+    return put_delta(b, end_tick - last, &running) && put_bytes(b, eot, 3);
+}
 
-    /* --- Build Allegro body buffer ---------------------------------- */
-    /*
-     * Layout:
-     *   2  bytes  s16 divisions
-     *   ALLEGRO_MIDI_TRACKS * 4  bytes  (s32 len per track)
-     *   sum of all non-zero track_len values
-     */
-    total_track_bytes = 0;
-    for (i = 0; i < (unsigned int)ALLEGRO_MIDI_TRACKS; i++)
-        total_track_bytes += track_len[i];
+/* Merge order: time, then source track, then position in it */
+static int cmp_event(const void *a, const void *b)
+{
+    const MidiEvent *x = (const MidiEvent *)a, *y = (const MidiEvent *)b;
+    if (x->tick  != y->tick)  return x->tick  < y->tick  ? -1 : 1;
+    if (x->track != y->track) return x->track < y->track ? -1 : 1;
+    if (x->order != y->order) return x->order < y->order ? -1 : 1;
+    return 0;
+}
 
-    body_size = 2u + (unsigned int)(ALLEGRO_MIDI_TRACKS * 4) + total_track_bytes;
+/* ------------------------------------------------------------------ */
+/* Body layout                                                          */
+/* ------------------------------------------------------------------ */
+
+static int write_body(unsigned short divisions, unsigned char *const *slot_data,
+                      const unsigned int *slot_len, unsigned char **out_buf, unsigned int *out_size)
+{
+    unsigned int   i, total = 0, body_size;
+    unsigned char *buf, *wp;
+
+    for (i = 0; i < (unsigned int)ALLEGRO_MIDI_TRACKS; i++)
+        total += slot_len[i];
 
+    body_size = 2u + (unsigned int)(ALLEGRO_MIDI_TRACKS * 4) + total;
     buf = (unsigned char *)malloc(body_size);
     if (!buf) return 0;
 
     wp = buf;
 
     /* divisions */
-    write_be16(wp, smf_divisions);
+    write_be16(wp, divisions);
     wp += 2;
 
     /* 32 track slots */
     for (i = 0; i < (unsigned int)ALLEGRO_MIDI_TRACKS; i++)
     {
-        write_be32(wp, track_len[i]);
+        write_be32(wp, slot_len[i]);
         wp += 4;
-        if (track_len[i] > 0)
+        if (slot_len[i] > 0)
         {
-            memcpy(wp, track_data[i], track_len[i]);
-            wp += track_len[i];
+            memcpy(wp, slot_data[i], slot_len[i]);
+            wp += slot_len[i];
         }
     }
 
@@ -169,3 +350,197 @@ int mid_to_allegro_dat(const unsigned char *mid_data,
     *out_size = body_size;
     return 1;
 }
+
+/*
+ * Decodes every track and re-encodes it into the 32 slots. Returns 1 on
+ * success, 0 if out of memory and -1 if a track is malformed.
+ */
+static int optimise(const unsigned char *const *track_data, const unsigned int *track_len,
+                    unsigned int ntracks, unsigned short divisions, const MidiConvertOptions *opt,
+                    unsigned char **out_buf, unsigned int *out_size, MidiConvertStats *st)
+{
+    MidiTrack     *tracks;
+    unsigned int  *kept;
+    unsigned int   nkept = 0, i, ev_end = 0;
+    ByteBuf        slot[ALLEGRO_MIDI_TRACKS];
+    unsigned char *slot_data[ALLEGRO_MIDI_TRACKS];
+    unsigned int   slot_len[ALLEGRO_MIDI_TRACKS];
+    int            rc = 0;
+
+    memset(slot, 0, sizeof(slot));
+    tracks = (MidiTrack *)calloc(ntracks ? ntracks : 1, sizeof(MidiTrack));
+    kept   = (unsigned int *)calloc(ntracks ? ntracks : 1, sizeof(unsigned int));
+    if (!tracks || !kept) goto done;
+
+    for (i = 0; i < ntracks; i++)
+    {
+        if (!decode_track(track_data[i], track_len[i], i, opt->keep_meta, &tracks[i], &st->meta_removed))
+        {
+            rc = -1;
+            goto done;
+        }
+        if (tracks[i].count && tracks[i].end_tick > ev_end) ev_end = tracks[i].end_tick;
+    }
+
+    /* A track left without events only matters if it makes the song longer */
+    for (i = 0; i < ntracks; i++)
+        if (tracks[i].count || tracks[i].end_tick > ev_end) kept[nkept++] = i;
+
+    st->slots = nkept < (unsigned int)ALLEGRO_MIDI_TRACKS ? nkept : (unsigned int)ALLEGRO_MIDI_TRACKS;
+    for (i = 0; i < st->slots; i++)
+    {
+        MidiTrack *t = &tracks[kept[i]];
+        if (i == (unsigned int)ALLEGRO_MIDI_TRACKS - 1 && nkept > (unsigned int)ALLEGRO_MIDI_TRACKS)
+        {
+            /* Last slot: every remaining track, merged by time */
+            MidiTrack    merged;
+            unsigned int k;
+            memset(&merged, 0, sizeof(merged));
+            for (k = i; k < nkept; k++)
+            {
+                MidiTrack   *src = &tracks[kept[k]];
+                unsigned int e;
+                for (e = 0; e < src->count; e++)
+                {
+                    MidiEvent *d = push_event(&merged);
+                    if (!d) { free(merged.ev); goto done; }
+                    *d = src->ev[e];
+                }
+                if (src->end_tick > merged.end_tick) merged.end_tick = src->end_tick;
+            }
+            if (merged.count) qsort(merged.ev, merged.count, sizeof(MidiEvent), cmp_event);
+            st->merged = nkept - i;
+            if (!encode_track(&slot[i], merged.ev, merged.count, merged.end_tick)) { free(merged.ev); goto done; }
+            free(merged.ev);
+        }
+        else if (!encode_track(&slot[i], t->ev, t->count, t->end_tick))
+        {
+            goto done;
+        }
+    }
+
+    for (i = 0; i < (unsigned int)ALLEGRO_MIDI_TRACKS; i++)
+    {
+        slot_data[i] = slot[i].data;
+        slot_len[i]  = slot[i].len;
+    }
+    rc = write_body(divisions, slot_data, slot_len, out_buf, out_size);
+
+done:
+    for (i = 0; tracks && i < ntracks; i++) free(tracks[i].ev);
+    for (i = 0; i < (unsigned int)ALLEGRO_MIDI_TRACKS; i++) free(slot[i].data);
+    free(tracks);
+    free(kept);
+    return rc;
+}
+
+/* ------------------------------------------------------------------ */
+/* Main conversion                                                      */
+/* ------------------------------------------------------------------ */
+
+int mid_to_allegro_dat(const unsigned char      *mid_data,
+                       unsigned int              mid_size,
+                       const MidiConvertOptions *opt,
+                       unsigned char           **out_buf,
+                       unsigned int             *out_size,
+                       MidiConvertStats         *stats)
+{
+    static const MidiConvertOptions defaults = { 0 };
+    unsigned int   pos = 0;
+    unsigned short smf_format, smf_divisions;
+    unsigned int   i, ntracks = 0;
+    MidiConvertStats st;
+    int            rc;
+
+    /* Track payload pointers and lengths (every MTrk in the file) */
+    const unsigned char **track_data;
+    unsigned int         *track_len;
+
+    if (!opt) opt = &defaults;
+    memset(&st, 0, sizeof(st));
+
+    /* --- Parse MThd ------------------------------------------------ */
+    if (mid_size < 14)                           return 0;  /* too small */
+    if (memcmp(mid_data, "MThd", 4) != 0)        return 0;  /* not SMF   */
+
+    {
+        unsigned int mthd_len = read_be32(mid_data + 4);
+        if (mthd_len < 6 || 8 + mthd_len > mid_size) return 0;
+
+        smf_format    = read_be16(mid_data + 8);
+        smf_divisions = read_be16(mid_data + 12);
+
+        /* SMPTE timecode (top bit set) is not supported by Allegro 4 */
+        if (smf_divisions & 0x8000) return 0;
+        /* SMF format 2 (multi-song) not supported */
+        if (smf_format == 2)        return 0;
+
+        pos = 8 + mthd_len;   /* skip to first chunk after MThd */
+    }
+
+    /* --- Parse MTrk chunks ----------------------------------------- */
+    /* A chunk takes at least 8 bytes, which bounds the track count;
+       the header's track count is not trusted */
+    track_data = (const unsigned char **)calloc(mid_size / 8 + 1, sizeof(*track_data));
+    track_len  = (unsigned int *)calloc(mid_size / 8 + 1, sizeof(*track_len));
+    if (!track_data || !track_len) { free(track_data); free(track_len); return 0; }
+
+    while (pos + 8 <= mid_size)
+    {
+        unsigned int chunk_len;
+
+        /* Only process MTrk chunks; skip unknown chunk types */
+        chunk_len = read_be32(mid_data + pos + 4);
+        pos += 8;
+
+        if (memcmp(mid_data + pos - 8, "MTrk", 4) == 0)
+        {
+            if (chunk_len > mid_size - pos)               /* truncated */
+            {
+                free(track_data);
+                free(track_len);
+                return 0;
+            }
+
+            track_data[ntracks] = mid_data + pos;
+            track_len [ntracks] = chunk_len;
+            ntracks++;
+        }
+
+        if (chunk_len > mid_size - pos) break;
+        pos += chunk_len;
+    }
+    st.tracks = ntracks;
+    st.plain_size = 2u + (unsigned int)(ALLEGRO_MIDI_TRACKS * 4);
+    for (i = 0; i < ntracks && i < (unsigned int)ALLEGRO_MIDI_TRACKS; i++)
+        st.plain_size += track_len[i];
+
+    /*
+     * For format 0 the single track contains data for all channels.
+     * Allegro 4 expects it in track slot 0 just as-is.
+     */
+    rc = optimise(track_data, track_len, ntracks, smf_divisions, opt, out_buf, out_size, &st);
+    if (rc < 0)
+    {
+        /* Undecodable track: old behaviour, first 32 tracks verbatim */
+        unsigned char *slot_data[ALLEGRO_MIDI_TRACKS];
+        unsigned int   slot_len[ALLEGRO_MIDI_TRACKS];
+        unsigned int   plain = st.plain_size;
+
+        memset(&st, 0, sizeof(st));
+        st.tracks     = ntracks;
+        st.plain_size = plain;
+        st.verbatim   = 1;
+        for (i = 0; i < (unsigned int)ALLEGRO_MIDI_TRACKS; i++)
+        {
+            slot_data[i] = i < ntracks ? (unsigned char *)track_data[i] : NULL;
+            slot_len[i]  = i < ntracks ? track_len[i] : 0;
+        }
+        st.slots = ntracks < (unsigned int)ALLEGRO_MIDI_TRACKS ? ntracks : (unsigned int)ALLEGRO_MIDI_TRACKS;
+        rc = write_body(smf_divisions, slot_data, slot_len, out_buf, out_size);
+    }
+    free(track_data);
+    free(track_len);
+    if (rc && stats) *stats = st;
+    return rc > 0;
+}
@@ -17,6 +17,32 @@
 
 #include <stddef.h>
 
+#define ALLEGRO_MIDI_TRACKS 32
+
+/*
+ * MidiConvertOptions
+ *
+ * keep_meta: keep every meta event. By default only Set Tempo and End of
+ * Track survive; text, lyrics, markers, names, time/key signatures and
+ * sequencer-specific events are dropped, since the Allegro player only
+ * hands them to midi_meta_callback.
+ */
+typedef struct
+{
+    int keep_meta;
+} MidiConvertOptions;
+
+/* What the optimiser did, for the per-file report */
+typedef struct
+{
+    unsigned int tracks;        /* MTrk chunks in the file */
+    unsigned int slots;         /* Allegro track slots used */
+    unsigned int merged;        /* tracks merged into the last slot */
+    unsigned int meta_removed;  /* meta events dropped */
+    unsigned int plain_size;    /* body with the first 32 tracks copied as-is */
+    int          verbatim;      /* 1 = could not be decoded, copied as-is */
+} MidiConvertStats;
+
 /*
  * mid_to_allegro_dat
  *
@@ -26,16 +52,28 @@
  *
  * Supports SMF format 0 (single track) and format 1 (multi-track).
  * Format 2 is not supported (returns 0).
- * Up to ALLEGRO_MIDI_TRACKS (32) tracks are stored; extras are silently dropped.
+ *
+ * Every track is decoded and re-encoded with maximal running status (a
+ * Note Off with velocity 64 becomes the equivalent Note On with velocity
+ * 0, so note runs share one status byte). Tracks left with no events are
+ * dropped. When more than ALLEGRO_MIDI_TRACKS (32) remain, the extra ones
+ * are merged by time into the last slot instead of being lost. A delta
+ * time too long for a 4-byte varlen (2^28 ticks or more, possible once
+ * the dropped meta events' deltas are summed) is split with empty text
+ * meta events in between. A track
+ * that cannot be decoded makes the whole file fall back to a verbatim
+ * copy of its first 32 tracks.
+ *
+ * opt may be NULL (defaults); stats may be NULL.
  *
  * Returns 1 on success, 0 on error.
  * Caller must free(*out_buf).
  */
-int mid_to_allegro_dat(const unsigned char *mid_data,
-                       unsigned int         mid_size,
-                       unsigned char      **out_buf,
-                       unsigned int        *out_size);
-
-#define ALLEGRO_MIDI_TRACKS 32
+int mid_to_allegro_dat(const unsigned char      *mid_data,
+                       unsigned int              mid_size,
+                       const MidiConvertOptions *opt,
+                       unsigned char           **out_buf,
+                       unsigned int             *out_size,
+                       MidiConvertStats         *stats);
 
 #endif /* MIDI_TO_ALLEGRO_H */
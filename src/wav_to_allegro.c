@@ -14,7 +14,16 @@
  *   [4:8]  s32  len     número de frames (= muestras por canal)
  *   [8:..] u8[] pcm     datos PCM entrelazados
  *                       8-bit:  verbatim del chunk 'data' del WAV
- *                       16-bit: muestras convertidas de LE a BE (par de bytes invertido)
+ *                       16-bit: el WAV guarda signed LE; se invierte el par
+ *                               de bytes y el bit de signo (x ^ 0x8000)
+ *
+ * El PCM se convierte por bloques de WAV_BLOCK_SIZE bytes, en el sitio,
+ * con un kernel SSSE3 o AVX2 (pshufb + xor) cuando la CPU lo tiene.
+ *
+ * Con --rate, --mono, --bits, --trim-silence, o una entrada de 24/32 bits
+ * o float, cada bloque pasa a float: se mezcla, se remuestrea
+ * (dat_resample) y se cuantiza. A 8 bits con dither TPDF y realimentación
+ * del error de primer orden, que aleja el ruido de las frecuencias medias.
  *
  * Referencia: Allegro 4  allegro/src/sound/digi.c  load_sample_datafile()
  *             verificado byte a byte contra small2.dat de referencia.
@@ -22,9 +31,19 @@
 
 #include "wav_to_allegro.h"
 
+#include <math.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "dat_resample.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define WAV_HAVE_SIMD 1
+#define SSSE3_FN __attribute__((target("ssse3")))
+#define AVX2_FN  __attribute__((target("avx2")))
+#endif
+
 /* ------------------------------------------------------------------ */
 /* Helpers de lectura (no requieren alineación)                        */
 /* ------------------------------------------------------------------ */
@@ -64,75 +83,192 @@ static void write_be32_signed(unsigned char *p, int v)
 }
 
 /* ------------------------------------------------------------------ */
-/* Función principal                                                    */
+/* Kernels 16-bit: signed LE -> unsigned BE, n muestras en el sitio    */
 /* ------------------------------------------------------------------ */
 
-int wav_to_allegro_samp(const unsigned char *wav_data,
-                        unsigned int         wav_size,
-                        unsigned char      **out_buf,
-                        unsigned int        *out_size)
-{
-    unsigned int   pos;
-    unsigned short fmt_audio_format;
-    unsigned short fmt_channels;
-    unsigned int   fmt_sample_rate;
-    unsigned short fmt_bits;
-    unsigned int   pcm_offset;
-    unsigned int   pcm_size;
-
-    unsigned int   num_frames;
-    int            alg_bits;       /* campo 'bits' de Allegro, con signo */
-    unsigned int   body_size;
-    unsigned char *buf;
-    unsigned char *wp;
+static void pcm16_c(unsigned char *p, unsigned int n)
+{
+    unsigned int i;
+    for (i = 0; i < n; i++, p += 2)
+    {
+        unsigned char lo = p[0];
+        p[0] = (unsigned char)(p[1] ^ 0x80);
+        p[1] = lo;
+    }
+}
+
+#ifdef WAV_HAVE_SIMD
+/*
+ * pshufb invierte cada par de bytes; el xor con 0x0080 por palabra cambia
+ * el bit de signo, que tras el intercambio está en el primer byte.
+ */
+SSSE3_FN static void pcm16_ssse3(unsigned char *p, unsigned int n)
+{
+    const __m128i swap = _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+    const __m128i sign = _mm_set1_epi16(0x0080);
+    unsigned int i;
+    for (i = 0; i + 8 <= n; i += 8, p += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+        _mm_storeu_si128((__m128i *)p, _mm_xor_si128(_mm_shuffle_epi8(v, swap), sign));
+    }
+    pcm16_c(p, n - i);
+}
+
+AVX2_FN static void pcm16_avx2(unsigned char *p, unsigned int n)
+{
+    const __m256i swap = _mm256_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+                                          1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+    const __m256i sign = _mm256_set1_epi16(0x0080);
+    unsigned int i;
+    for (i = 0; i + 32 <= n; i += 32, p += 64)
+    {
+        __m256i a = _mm256_loadu_si256((const __m256i *)p);
+        __m256i b = _mm256_loadu_si256((const __m256i *)(p + 32));
+        _mm256_storeu_si256((__m256i *)p,        _mm256_xor_si256(_mm256_shuffle_epi8(a, swap), sign));
+        _mm256_storeu_si256((__m256i *)(p + 32), _mm256_xor_si256(_mm256_shuffle_epi8(b, swap), sign));
+    }
+    pcm16_c(p, n - i);
+}
+#endif
+
+static void convert_pcm16(unsigned char *p, unsigned int n)
+{
+#ifdef WAV_HAVE_SIMD
+    if (__builtin_cpu_supports("avx2"))  { pcm16_avx2(p, n);  return; }
+    if (__builtin_cpu_supports("ssse3")) { pcm16_ssse3(p, n); return; }
+#endif
+    pcm16_c(p, n);
+}
+
+/* ------------------------------------------------------------------ */
+/* Lectura por bloques                                                 */
+/* ------------------------------------------------------------------ */
+
+static int stream_fail(WavStream *ws, const char *why)
+{
+    ws->error = why;
+    return 0;
+}
+
+/* Resto del GUID SubFormat de WAVE_FORMAT_EXTENSIBLE (KSDATAFORMAT_SUBTYPE_*) */
+static const unsigned char ks_guid_tail[14] = {
+    0x00, 0x00, 0x00, 0x00, 0x10, 0x00, 0x80, 0x00, 0x00, 0xAA, 0x00, 0x38, 0x9B, 0x71
+};
+
+int wav_stream_open(WavStream *ws, FILE *f)
+{
+    unsigned char  hdr[40];
+    unsigned short fmt_audio_format = 0;
+    long           file_size;
+    long           pos;
+    long           data_pos = 0;
+
+    memset(ws, 0, sizeof(*ws));
+    ws->f = f;
+
+    if (fseek(f, 0, SEEK_END) != 0)   return stream_fail(ws, "cannot seek");
+    if ((file_size = ftell(f)) < 0)    return stream_fail(ws, "cannot seek");
+    if (fseek(f, 0, SEEK_SET) != 0)   return stream_fail(ws, "cannot seek");
 
     /* ---- Validar RIFF/WAVE ---------------------------------------- */
-    if (wav_size < 12)                          return 0;
-    if (memcmp(wav_data,     "RIFF", 4) != 0)  return 0;
-    if (memcmp(wav_data + 8, "WAVE", 4) != 0)  return 0;
-
-    fmt_audio_format = 0;
-    fmt_channels     = 0;
-    fmt_sample_rate  = 0;
-    fmt_bits         = 0;
-    pcm_offset       = 0;
-    pcm_size         = 0;
-
-    /* ---- Recorrer chunks ------------------------------------------ */
+    if (fread(hdr, 1, 12, f) != 12
+        || memcmp(hdr,     "RIFF", 4) != 0
+        || memcmp(hdr + 8, "WAVE", 4) != 0)
+        return stream_fail(ws, "not a RIFF/WAVE file");
+
+    /* ---- Recorrer chunks (solo sus cabeceras) --------------------- */
     pos = 12;
-    while (pos + 8 <= wav_size)
+    while (pos + 8 <= file_size)
     {
-        unsigned int chunk_size = read_le32(wav_data + pos + 4);
+        unsigned int chunk_size;
 
-        if (memcmp(wav_data + pos, "fmt ", 4) == 0)
+        if (fseek(f, pos, SEEK_SET) != 0 || fread(hdr, 1, 8, f) != 8) return stream_fail(ws, "read error");
+        chunk_size = read_le32(hdr + 4);
+
+        if (memcmp(hdr, "fmt ", 4) == 0)
         {
-            if (chunk_size < 16 || pos + 8 + chunk_size > wav_size) return 0;
-            fmt_audio_format = read_le16(wav_data + pos +  8);
-            fmt_channels     = read_le16(wav_data + pos + 10);
-            fmt_sample_rate  = read_le32(wav_data + pos + 12);
-            fmt_bits         = read_le16(wav_data + pos + 22);
+            unsigned int n = chunk_size < 40 ? chunk_size : 40;
+            if (chunk_size < 16 || pos + 8 + (long)chunk_size > file_size
+                || fread(hdr, 1, n, f) != n)
+                return stream_fail(ws, "truncated 'fmt ' chunk");
+            fmt_audio_format = read_le16(hdr);
+            ws->channels     = read_le16(hdr + 2);
+            ws->rate         = read_le32(hdr + 4);
+            ws->bits         = read_le16(hdr + 14);
+            /* WAVE_FORMAT_EXTENSIBLE: el formato real va en el GUID SubFormat */
+            if (fmt_audio_format == 0xFFFE)
+            {
+                if (n < 40 || memcmp(hdr + 26, ks_guid_tail, sizeof(ks_guid_tail)) != 0)
+                    return stream_fail(ws, "unsupported WAVE_FORMAT_EXTENSIBLE subformat");
+                fmt_audio_format = read_le16(hdr + 24);
+            }
         }
-        else if (memcmp(wav_data + pos, "data", 4) == 0)
+        else if (memcmp(hdr, "data", 4) == 0)
         {
-            pcm_offset = pos + 8;
-            pcm_size   = chunk_size;
+            data_pos      = pos + 8;
+            ws->data_size = chunk_size;
             /* Limitar al tamaño real del fichero */
-            if (pcm_offset + pcm_size > wav_size)
-                pcm_size = wav_size - pcm_offset;
+            if (data_pos + (long)chunk_size > file_size)
+                ws->data_size = (unsigned int)(file_size - data_pos);
         }
 
         /* Avanzar al siguiente chunk (tamaño par por especificación RIFF) */
-        pos += 8 + chunk_size + (chunk_size & 1u);
+        pos += 8 + (long)chunk_size + (long)(chunk_size & 1u);
     }
 
     /* ---- Validaciones -------------------------------------------- */
-    if (fmt_audio_format != 1)  return 0;  /* solo PCM */
-    if (pcm_offset == 0)        return 0;  /* no hay chunk data */
-    if (fmt_channels == 0)      return 0;
-    if (fmt_bits != 8 && fmt_bits != 16) return 0;
-    if (fmt_sample_rate == 0 || fmt_sample_rate > 65535u) return 0;
+    if (fmt_audio_format == 0)  return stream_fail(ws, "no 'fmt ' chunk");
+    if (data_pos == 0)          return stream_fail(ws, "no 'data' chunk");
+    if (ws->channels == 0)      return stream_fail(ws, "no channels");
+    if (ws->rate == 0)          return stream_fail(ws, "sample rate is 0");
+    if (fmt_audio_format == WAV_FORMAT_PCM)
+    {
+        if (ws->bits != 8 && ws->bits != 16 && ws->bits != 24 && ws->bits != 32)
+            return stream_fail(ws, "PCM must be 8, 16, 24 or 32 bits");
+    }
+    else if (fmt_audio_format == WAV_FORMAT_FLOAT)
+    {
+        if (ws->bits != 32 && ws->bits != 64)
+            return stream_fail(ws, "float samples must be 32 or 64 bits");
+    }
+    else
+    {
+        return stream_fail(ws, "only PCM and float WAV files are supported");
+    }
+    ws->format      = fmt_audio_format;
+    ws->block_align = (unsigned short)(ws->channels * (ws->bits / 8u));
 
-    /* ---- Calcular campos Allegro ---------------------------------- */
+    /*
+     * 'len' = número de frames (muestras por canal).
+     * frames = pcm_bytes / (channels * bytes_per_sample)
+     */
+    ws->frames    = ws->data_size / ws->block_align;
+    ws->data_left = ws->data_size;
+    if (fseek(f, data_pos, SEEK_SET) != 0) return stream_fail(ws, "cannot seek");
+    return 1;
+}
+
+int wav_stream_is_samp(const WavStream *ws)
+{
+    return ws->format == WAV_FORMAT_PCM
+        && (ws->bits == 8 || ws->bits == 16)
+        && ws->channels <= 2
+        && ws->rate <= 65535u;
+}
+
+int wav_stream_is_plain(const WavStream *ws, const WavConvertOptions *opt)
+{
+    if (!opt) return wav_stream_is_samp(ws);
+    return wav_stream_is_samp(ws)
+        && (!opt->rate || opt->rate == ws->rate)
+        && (!opt->mono || ws->channels == 1)
+        && (!opt->bits || opt->bits == ws->bits)
+        && !opt->trim_db;
+}
+
+void wav_stream_header(const WavStream *ws, unsigned char hdr[8])
+{
     /*
      * En Allegro 4 el campo 'bits' codifica tanto la profundidad como el
      * número de canales:
@@ -140,55 +276,379 @@ int wav_to_allegro_samp(const unsigned char *wav_data,
      *   negativo = estéreo
      * El valor absoluto es la profundidad en bits (8 ó 16).
      */
-    alg_bits = (fmt_channels >= 2) ? -(int)fmt_bits : (int)fmt_bits;
+    int alg_bits = (ws->channels >= 2) ? -(int)ws->bits : (int)ws->bits;
 
-    /*
-     * 'len' = número de frames (muestras por canal).
-     * frames = pcm_bytes / (channels * bytes_per_sample)
-     */
-    num_frames = pcm_size / (fmt_channels * (fmt_bits / 8u));
+    write_be16_signed(hdr, (short)alg_bits);
+    write_be16_unsigned(hdr + 2, (unsigned short)ws->rate);
+    write_be32_signed(hdr + 4, (int)ws->frames);
+}
 
-    /* ---- Reservar buffer body ------------------------------------ */
-    body_size = 8u + pcm_size;
-    buf = (unsigned char *)malloc(body_size);
-    if (!buf) return 0;
+unsigned int wav_stream_body_size(const WavStream *ws)
+{
+    return 8u + ws->data_size;
+}
 
-    wp = buf;
+unsigned int wav_stream_read(WavStream *ws, unsigned char *dst, unsigned int cap)
+{
+    unsigned int n = cap < ws->data_left ? cap : ws->data_left;
+    unsigned int got;
+
+    /* Sin partir una muestra entre dos bloques (salvo un byte suelto final) */
+    if (ws->bits == 16 && n < ws->data_left) n &= ~1u;
+    if (n == 0) return 0;
+
+    got = (unsigned int)fread(dst, 1, n, ws->f);
+    ws->data_left -= got;
 
-    /* bits (s16 BE) */
-    write_be16_signed(wp, (short)alg_bits);
-    wp += 2;
+    /* 8-bit: el WAV ya es unsigned, se queda tal cual */
+    if (ws->bits == 16) convert_pcm16(dst, got / 2u);
+    return got;
+}
 
-    /* freq (u16 BE) */
-    write_be16_unsigned(wp, (unsigned short)fmt_sample_rate);
-    wp += 2;
+/* ------------------------------------------------------------------ */
+/* Conversión en float (--rate, --mono, --bits, --trim-silence)        */
+/* ------------------------------------------------------------------ */
+
+/* n muestras entrelazadas del WAV a float en [-1, 1) */
+static void decode_samples(const WavStream *ws, const unsigned char *p, float *dst, size_t n)
+{
+    size_t i;
+
+    if (ws->format == WAV_FORMAT_FLOAT && ws->bits == 64)
+    {
+        for (i = 0; i < n; i++, p += 8)
+        {
+            unsigned long long u = read_le32(p) | ((unsigned long long)read_le32(p + 4) << 32);
+            double d;
+            memcpy(&d, &u, sizeof(d));
+            dst[i] = (float)d;
+        }
+    }
+    else if (ws->format == WAV_FORMAT_FLOAT)
+    {
+        for (i = 0; i < n; i++, p += 4)
+        {
+            unsigned int u = read_le32(p);
+            memcpy(&dst[i], &u, sizeof(float));
+        }
+    }
+    else if (ws->bits == 8)
+    {
+        for (i = 0; i < n; i++) dst[i] = (float)((int)p[i] - 128) * (1.0f / 128.0f);
+    }
+    else if (ws->bits == 16)
+    {
+        for (i = 0; i < n; i++, p += 2) dst[i] = (float)(short)read_le16(p) * (1.0f / 32768.0f);
+    }
+    else if (ws->bits == 24)
+    {
+        for (i = 0; i < n; i++, p += 3)
+        {
+            int s = (int)((unsigned int)p[0] << 8 | (unsigned int)p[1] << 16 | (unsigned int)p[2] << 24) >> 8;
+            dst[i] = (float)s * (1.0f / 8388608.0f);
+        }
+    }
+    else
+    {
+        for (i = 0; i < n; i++, p += 4) dst[i] = (float)(int)read_le32(p) * (1.0f / 2147483648.0f);
+    }
+}
 
-    /* len (s32 BE) */
-    write_be32_signed(wp, (int)num_frames);
-    wp += 4;
+/* Entrelazado -> un array por canal; con out_ch = 1, la media de todos */
+static void split_channels(const float *in, size_t frames, int in_ch, int out_ch, float *const *plane)
+{
+    size_t i;
+    int    c;
 
-    /* PCM data ---------------------------------------------------- */
-    if (fmt_bits == 8)
+    if (out_ch == in_ch)
     {
-        /* 8-bit PCM: verbatim */
-        memcpy(wp, wav_data + pcm_offset, pcm_size);
+        for (c = 0; c < out_ch; c++)
+            for (i = 0; i < frames; i++) plane[c][i] = in[i * in_ch + c];
     }
     else
     {
-        /*
-         * 16-bit PCM: WAV usa little-endian por muestra.
-         * Allegro almacena big-endian. Invertir cada par de bytes.
-         */
-        unsigned int i;
-        const unsigned char *src = wav_data + pcm_offset;
-        for (i = 0; i + 1 < pcm_size; i += 2)
+        float scale = 1.0f / (float)in_ch;
+        for (i = 0; i < frames; i++)
         {
-            wp[i]     = src[i + 1];
-            wp[i + 1] = src[i];
+            float sum = 0.0f;
+            for (c = 0; c < in_ch; c++) sum += in[i * in_ch + c];
+            plane[0][i] = sum * scale;
+        }
+    }
+}
+
+/* Destino de las muestras ya procesadas: el PCM del body SAMP */
+typedef struct
+{
+    unsigned char *wp;
+    int            channels;
+    int            bits;
+    int            dither;      /* 8 bits desde algo que no lo era */
+    float          err[2];      /* error de cuantización anterior, por canal */
+    unsigned int   seed;        /* fija: misma entrada, mismos bytes */
+    float          threshold;   /* amplitud de --trim-silence, 0 = sin recorte */
+    long long      frame;
+    long long      first_loud;
+    long long      last_loud;
+} SampSink;
+
+static float rand_unit(unsigned int *s)
+{
+    /* xorshift32 */
+    *s ^= *s << 13;
+    *s ^= *s >> 17;
+    *s ^= *s << 5;
+    return (float)(*s >> 8) * (1.0f / 16777216.0f);
+}
+
+static void sink_write(SampSink *s, const float *const *ch, size_t n)
+{
+    size_t i;
+    int    c;
+
+    for (i = 0; i < n; i++, s->frame++)
+    {
+        for (c = 0; c < s->channels; c++)
+        {
+            float v = ch[c][i];
+            float q;
+
+            if (v != v) v = 0.0f;   /* NaN en un WAV float */
+            if (s->threshold > 0.0f && fabsf(v) > s->threshold)
+            {
+                if (s->first_loud < 0) s->first_loud = s->frame;
+                s->last_loud = s->frame;
+            }
+
+            if (s->bits == 8)
+            {
+                float x = v * 128.0f;
+                if (s->dither)
+                {
+                    /* TPDF de +-1 LSB; el error vuelve con signo contrario
+                       en la muestra siguiente (ruido filtrado por 1 - z^-1) */
+                    float d = rand_unit(&s->seed);
+                    d -= rand_unit(&s->seed);
+                    x -= s->err[c];
+                    q = floorf(x + d + 0.5f);
+                    s->err[c] = q - x;
+                }
+                else
+                {
+                    q = floorf(x + 0.5f);
+                }
+                if (q < -128.0f) q = -128.0f;
+                if (q >  127.0f) q =  127.0f;
+                *s->wp++ = (unsigned char)((int)q + 128);
+            }
+            else
+            {
+                unsigned int u;
+                q = floorf(v * 32768.0f + 0.5f);
+                if (q < -32768.0f) q = -32768.0f;
+                if (q >  32767.0f) q =  32767.0f;
+                u = (unsigned int)((int)q + 32768);
+                *s->wp++ = (unsigned char)(u >> 8);
+                *s->wp++ = (unsigned char)(u & 0xFF);
+            }
         }
-        /* Si pcm_size es impar (no debería ocurrir en 16-bit) copia el byte suelto */
-        if (pcm_size & 1u) wp[pcm_size - 1] = src[pcm_size - 1];
     }
+}
+
+static int wav_error(const char *path, const char *what)
+{
+    fprintf(stderr, "Error: '%s': %s\n", path, what);
+    return 0;
+}
+
+static int convert_float(WavStream *ws, const WavConvertOptions *opt, const char *path,
+                         unsigned char **out_buf, unsigned int *out_size)
+{
+    int            out_ch   = opt->mono ? 1 : ws->channels;
+    int            out_bits = opt->bits ? opt->bits
+                            : (ws->format == WAV_FORMAT_PCM && ws->bits == 8 ? 8 : 16);
+    unsigned int   out_rate = opt->rate ? opt->rate : ws->rate;
+    size_t         block    = WAV_BLOCK_SIZE / ws->block_align + 1;
+    size_t         frame_bytes, out_frames, frames, k;
+    DatResampler  *rs = NULL;
+    SampSink       sink;
+    unsigned char *body = NULL, *raw = NULL;
+    float         *inter = NULL, *plane[2] = { NULL, NULL }, *rsout[2] = { NULL, NULL };
+    char           msg[96];
+    int            ok = 0, c;
+
+    if (out_ch > 2) return wav_error(path, "more than 2 channels: use --mono");
+    if (out_rate > 65535u)
+    {
+        snprintf(msg, sizeof(msg), "%u Hz does not fit a SAMP (at most 65535): use --rate", out_rate);
+        return wav_error(path, msg);
+    }
+
+    if (out_rate != ws->rate)
+    {
+        rs = dat_resampler_create(ws->rate, out_rate, out_ch);
+        if (!rs) return wav_error(path, "out of memory");
+    }
+    out_frames  = rs ? dat_resampler_out_frames(rs, ws->frames) : ws->frames;
+    frame_bytes = (size_t)out_ch * (size_t)(out_bits / 8);
+    if (out_frames > (0x7FFFFFFFu - 8u) / frame_bytes)
+    {
+        dat_resampler_free(rs);
+        return wav_error(path, "too long for a SAMP object");
+    }
+
+    body  = (unsigned char *)malloc(8 + out_frames * frame_bytes);
+    raw   = (unsigned char *)malloc(block * ws->block_align);
+    inter = (float *)malloc(block * ws->channels * sizeof(float));
+    ok = body && raw && inter;
+    for (c = 0; c < out_ch; c++)
+    {
+        plane[c] = (float *)malloc(block * sizeof(float));
+        rsout[c] = (float *)malloc(block * sizeof(float));
+        ok = ok && plane[c] && rsout[c];
+    }
+    if (!ok)
+    {
+        wav_error(path, "out of memory");
+        goto done;
+    }
+    ok = 0;
+
+    memset(&sink, 0, sizeof(sink));
+    sink.wp         = body + 8;
+    sink.channels   = out_ch;
+    sink.bits       = out_bits;
+    sink.dither     = out_bits == 8 && !(ws->format == WAV_FORMAT_PCM && ws->bits == 8
+                                         && !rs && out_ch == ws->channels);
+    sink.seed       = 0x9E3779B9u;
+    sink.threshold  = opt->trim_db ? powf(10.0f, -(float)opt->trim_db / 20.0f) : 0.0f;
+    sink.first_loud = -1;
+    sink.last_loud  = -1;
+
+    /* ---- Bloques: WAV -> float -> canales -> frecuencia -> SAMP --- */
+    for (frames = 0; frames < ws->frames; )
+    {
+        size_t n = ws->frames - frames < block ? ws->frames - frames : block;
+        if (fread(raw, ws->block_align, n, ws->f) != n)
+        {
+            wav_error(path, "read error");
+            goto done;
+        }
+        frames += n;
+        decode_samples(ws, raw, inter, n * ws->channels);
+        split_channels(inter, n, ws->channels, out_ch, plane);
+        if (!rs)
+        {
+            sink_write(&sink, (const float *const *)plane, n);
+            continue;
+        }
+        if (!dat_resampler_push(rs, (const float *const *)plane, n))
+        {
+            wav_error(path, "out of memory");
+            goto done;
+        }
+        while ((k = dat_resampler_pull(rs, rsout, block)) > 0)
+            sink_write(&sink, (const float *const *)rsout, k);
+    }
+    if (rs)
+    {
+        if (!dat_resampler_finish(rs))
+        {
+            wav_error(path, "out of memory");
+            goto done;
+        }
+        while ((k = dat_resampler_pull(rs, rsout, block)) > 0)
+            sink_write(&sink, (const float *const *)rsout, k);
+    }
+
+    /* ---- Recorte: del primer al último frame que supera el umbral -- */
+    frames = (size_t)sink.frame;
+    if (opt->trim_db && frames > 0)
+    {
+        size_t first = 0, last = 0;   /* todo silencio: queda un frame */
+        if (sink.first_loud >= 0)
+        {
+            first = (size_t)sink.first_loud;
+            last  = (size_t)sink.last_loud;
+        }
+        frames = last - first + 1;
+        memmove(body + 8, body + 8 + first * frame_bytes, frames * frame_bytes);
+    }
+
+    write_be16_signed(body, (short)(out_ch == 2 ? -out_bits : out_bits));
+    write_be16_unsigned(body + 2, (unsigned short)out_rate);
+    write_be32_signed(body + 4, (int)frames);
+
+    *out_size = (unsigned int)(8 + frames * frame_bytes);
+    *out_buf  = body;
+    body = NULL;
+    ok = 1;
+
+done:
+    dat_resampler_free(rs);
+    free(body);
+    free(raw);
+    free(inter);
+    for (c = 0; c < 2; c++)
+    {
+        free(plane[c]);
+        free(rsout[c]);
+    }
+    return ok;
+}
+
+/* ------------------------------------------------------------------ */
+/* Función principal                                                    */
+/* ------------------------------------------------------------------ */
+
+int wav_to_allegro_samp_file(const char              *path,
+                             const WavConvertOptions *opt,
+                             unsigned char          **out_buf,
+                             unsigned int            *out_size)
+{
+    static const WavConvertOptions none = { 0, 0, 0, 0 };
+    WavStream      ws;
+    FILE          *f;
+    unsigned char *buf;
+    unsigned char *wp;
+    unsigned int   body_size;
+    int            ok;
+
+    if (!opt) opt = &none;
+    f = fopen(path, "rb");
+    if (!f) return wav_error(path, "cannot open");
+    if (!wav_stream_open(&ws, f))
+    {
+        fclose(f);
+        return wav_error(path, ws.error);
+    }
+
+    /* Cualquier cosa que no sea copiar el PCM pasa por float */
+    if (!wav_stream_is_plain(&ws, opt))
+    {
+        ok = convert_float(&ws, opt, path, out_buf, out_size);
+        fclose(f);
+        return ok;
+    }
+
+    /* ---- Reservar buffer body ------------------------------------ */
+    body_size = wav_stream_body_size(&ws);
+    buf = (unsigned char *)malloc(body_size);
+    if (!buf) { fclose(f); return wav_error(path, "out of memory"); }
+
+    wav_stream_header(&ws, buf);
+    wp = buf + 8;
+
+    /* PCM data: cada bloque se lee ya en su sitio y se convierte ahí -- */
+    while (ws.data_left > 0)
+    {
+        unsigned int got = wav_stream_read(&ws, wp, WAV_BLOCK_SIZE);
+        if (got == 0) break;
+        wp += got;
+    }
+    fclose(f);
+
+    if (ws.data_left != 0) { free(buf); return wav_error(path, "read error"); }
 
     *out_buf  = buf;
     *out_size = body_size;
@@ -12,9 +12,16 @@
  *                      +16 = 16-bit unsigned mono
  *   [2:4]  u16  freq   frecuencia de muestreo (Hz)
  *   [4:8]  s32  len    número de frames (muestras por canal)
- *   [8:..] u8[] pcm    datos PCM entrelazados, verbatim del chunk 'data' del WAV
+ *   [8:..] u8[] pcm    datos PCM entrelazados del chunk 'data' del WAV
+ *                      8-bit:  verbatim (el WAV ya es unsigned)
+ *                      16-bit: signed LE del WAV -> unsigned BE
  *
- * Tamaño total del body = 8 + len * (|bits|/8) * (estéreo ? 2 : 1)
+ * Tamaño total del body = 8 + tamaño del chunk 'data'
+ *
+ * Entrada: PCM de 8, 16, 24 ó 32 bits, float de 32 ó 64 bits, también
+ * como WAVE_FORMAT_EXTENSIBLE. PCM de 8/16 bits mono o estéreo sin
+ * opciones se copia tal cual; el resto pasa por float (mezcla a mono,
+ * cambio de frecuencia, recorte de silencio) y se cuantiza a 8 ó 16 bits.
  *
  * Referencia: Allegro 4 src/sound/digi.c  load_sample_datafile()
  *             analizado sobre small2.dat de referencia.
@@ -22,22 +29,97 @@
 #ifndef WAV_TO_ALLEGRO_H
 #define WAV_TO_ALLEGRO_H
 
+#include <stdio.h>
+
+/* Bytes de PCM que se leen y convierten de una vez */
+#define WAV_BLOCK_SIZE 65536u
+
+/* Umbral de --trim-silence sin valor: -60 dBFS */
+#define WAV_TRIM_DEFAULT_DB 60
+
+#define WAV_FORMAT_PCM   1
+#define WAV_FORMAT_FLOAT 3
+
+/*
+ * WavConvertOptions
+ *
+ * Opciones de --wav; todo a cero deja el sonido como está.
+ */
+typedef struct
+{
+    unsigned int rate;      /* --rate: Hz de salida, 0 = los del WAV */
+    int          mono;      /* --mono: mezcla todos los canales */
+    int          bits;      /* --bits: 8 ó 16; 0 = 8 si el WAV es de 8 bits, si no 16 */
+    int          trim_db;   /* --trim-silence: quita el silencio (por debajo de
+                               -trim_db dBFS) del principio y del final; 0 = no */
+} WavConvertOptions;
+
 /*
- * wav_to_allegro_samp
+ * WavStream
  *
- * Lee un WAV PCM de los bytes [wav_data, wav_size) y genera el body
- * SAMP de Allegro 4 en un buffer recién reservado devuelto en
- * *out_buf / *out_size.
+ * Un WAV abierto para conversión por bloques: tras wav_stream_open el
+ * fichero queda posicionado al principio del PCM y cada wav_stream_read
+ * devuelve el siguiente trozo ya convertido, así que la memoria necesaria
+ * no depende de la duración del sonido.
+ */
+typedef struct
+{
+    FILE          *f;
+    unsigned short format;       /* WAV_FORMAT_PCM o WAV_FORMAT_FLOAT */
+    unsigned short channels;
+    unsigned short bits;         /* por muestra: 8/16/24/32 PCM, 32/64 float */
+    unsigned short block_align;  /* bytes por frame */
+    unsigned int   rate;
+    unsigned int   frames;       /* campo 'len' de Allegro */
+    unsigned int   data_size;    /* bytes de PCM (limitado al fichero) */
+    unsigned int   data_left;    /* bytes de PCM aún por leer */
+    const char    *error;        /* motivo si wav_stream_open falla */
+} WavStream;
+
+/*
+ * wav_stream_open
+ *
+ * Recorre los chunks RIFF de f (que debe admitir fseek) hasta 'fmt ' y
+ * 'data'. Otros formatos (ADPCM, etc.) devuelven 0 con ws->error. El
+ * llamador sigue siendo dueño de f.
+ */
+int wav_stream_open(WavStream *ws, FILE *f);
+
+/* 1 si el PCM ya es SAMP salvo el orden y el signo (8/16 bits, 1-2 canales):
+   solo entonces valen wav_stream_header, _body_size y _read */
+int wav_stream_is_samp(const WavStream *ws);
+
+/* 1 si con las opciones opt (NULL = ninguna) el body es ese PCM sin pasar
+   por float: entonces se puede generar entero con wav_stream_read */
+int wav_stream_is_plain(const WavStream *ws, const WavConvertOptions *opt);
+
+/* Cabecera SAMP de 8 bytes ([0:8] del body) y tamaño total del body */
+void         wav_stream_header(const WavStream *ws, unsigned char hdr[8]);
+unsigned int wav_stream_body_size(const WavStream *ws);
+
+/*
+ * wav_stream_read
+ *
+ * Lee hasta cap bytes de PCM en dst y los convierte al formato SAMP en el
+ * sitio. Devuelve los bytes escritos: 0 al terminar, o menos de los que
+ * quedaban si el fichero se acorta mientras se lee (data_left lo indica).
+ */
+unsigned int wav_stream_read(WavStream *ws, unsigned char *dst, unsigned int cap);
+
+/*
+ * wav_to_allegro_samp_file
  *
- * Soporta PCM 8-bit y 16-bit, mono y estéreo.
- * WAV de 16-bit se convierte de little-endian a big-endian muestra a muestra.
- * Otros formatos (float, ADPCM, etc.) devuelven 0.
+ * Convierte el WAV 'path' con las opciones opt (NULL = ninguna) y deja el
+ * body SAMP completo en un buffer recién reservado en *out_buf /
+ * *out_size. El PCM se lee por bloques; sin opciones, directamente sobre
+ * ese buffer, sin copia intermedia del fichero.
  *
- * Devuelve 1 si OK, 0 en error. El llamador debe free(*out_buf).
+ * Devuelve 1 si OK, 0 en error (con un mensaje en stderr). El llamador
+ * debe free(*out_buf).
  */
-int wav_to_allegro_samp(const unsigned char *wav_data,
-                        unsigned int         wav_size,
-                        unsigned char      **out_buf,
-                        unsigned int        *out_size);
+int wav_to_allegro_samp_file(const char              *path,
+                             const WavConvertOptions *opt,
+                             unsigned char          **out_buf,
+                             unsigned int            *out_size);
 
 #endif /* WAV_TO_ALLEGRO_H */